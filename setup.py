@@ -16,11 +16,11 @@ long_description = (this_directory / "README.rst").read_text()
 IS_WINDOWS = platform.system() == "Windows"
 
 if IS_WINDOWS:
-    extra_compile_args = ['/openmp', '/Ox']
+    extra_compile_args = ['/Ox']
     extra_link_args = []
 else:
-    extra_compile_args = ['-fopenmp', '-std=c++11', '-O3']
-    extra_link_args = ['-fopenmp', '-std=c++11']
+    extra_compile_args = ['-pthread', '-std=c++11', '-O3']
+    extra_link_args = ['-pthread', '-std=c++11']
 
 
 extensions = [
@@ -25,6 +25,41 @@ class RunConfig:
     :param bool use_multicore: Flag to indicate if multiprocessing shall be used.
     :param str kernel_engine: Use 'PY' or 'C' to select the Python or C++ engine
     :param int max_age: Max. age that is used when projecting (only C++)
+    :param bool model_point_compression: Project identical policies only once as weighted model point (only C++)
+    :param int dob_band_months: If positive, dates of birth within bands of this many months are merged into one
+                                model point as well (approximation, only C++)
+    :param str projection_engine: Use 'SCALAR' to project one policy at a time or 'BLOCK' to advance blocks of
+                                  policies together with vector instructions, the results are identical (only C++)
+    :param bool early_termination: Stop projecting a record once the probability of its in-force states falls
+                                   to the threshold (only C++)
+    :param float early_termination_threshold: In-force probability at or below which a record is no longer
+                                              projected, zero keeps the results exact (only C++)
+    :param bool payment_horizon: Project records only up to their last non-zero conditional payment, the state
+                                 probabilities are carried forward from there (only C++)
+    :param str time_step: Time step of the projection, 'MONTHLY', 'QUARTERLY' or 'YEARLY' (only C++)
+    :param list time_step_segments: Optional pairs of a time step and a number of years, the time step applies up to
+                                    the end of the year that many years after the portfolio date and `time_step`
+                                    afterwards, e.g. ``[["MONTHLY", 5], ["QUARTERLY", 20]]`` with ``time_step="YEARLY"``.
+                                    The product payments are per time step (only C++)
+    :param str rate_conversion: Conversion of the yearly rates to the time steps, 'SIMPLE' (linear), 'CONSTANT_FORCE'
+                                or 'MATRIX_EXPONENTIAL' (only C++)
+    :param list result_outputs: Optional list of the outputs to calculate, named by the prefix of their columns:
+                                'PROB_STATE', 'PROB_MVM', 'VOL_STATE', 'VOL_MVM' and 'PAYMENTS'. The columns of
+                                the other outputs are zero and their calculation is skipped, all of them are
+                                calculated by default. 'RESERVES' additionally runs the reserve recursion of the
+                                records, its result is not exported (only C++)
+    :param bool schedule_by_cost: With multiple cores the records with the highest estimated costs (remaining
+                                  projection steps times transitions) are started first (only C++)
+    :param int schedule_range_size: Number of consecutive records the workers take from the queues at once, zero
+                                    chooses about 16 ranges per worker, ignored with `reproducible_summation`
+                                    (only C++)
+    :param bool reproducible_summation: Sum the records in a fixed order such that the results are identical bit by
+                                        bit for any number of cores, the portfolio is cut into at most 64 ranges
+                                        with a result array each while its sum is pending (only C++)
+    :param int num_threads: Number of threads of the engine with ``use_multicore``, zero for the number of cpus.
+                            The sub-portfolios are then projected one after another (only C++)
+    :param bool pin_threads: Pin each thread of the engine to a cpu of its own, its buffers are then allocated on
+                             the NUMA node of that cpu (only C++ on Linux)
     """
     def __init__(self,
                  state_model_name: str,
@@ -40,7 +75,22 @@ class RunConfig:
                  portfolio_chunk_size: int = 20000,
                  use_multicore: bool = False,
                  kernel_engine: str = "PY",
-                 max_age: int = 119
+                 max_age: int = 119,
+                 model_point_compression: bool = True,
+                 dob_band_months: int = 0,
+                 projection_engine: str = "SCALAR",
+                 early_termination: bool = True,
+                 early_termination_threshold: float = 0.0,
+                 payment_horizon: bool = False,
+                 time_step: str = "MONTHLY",
+                 time_step_segments: Optional[list[tuple[str, int]]] = None,
+                 rate_conversion: str = "SIMPLE",
+                 result_outputs: Optional[list[str]] = None,
+                 schedule_by_cost: bool = True,
+                 schedule_range_size: int = 0,
+                 reproducible_summation: bool = False,
+                 num_threads: int = 0,
+                 pin_threads: bool = False
                  ) -> None:
         self.working_directory = working_directory
         self.model_name = model_name
@@ -55,6 +105,21 @@ class RunConfig:
         self.use_multicore = use_multicore
         self.kernel_engine = kernel_engine.upper()
         self.max_age = max_age
+        self.model_point_compression = model_point_compression
+        self.dob_band_months = dob_band_months
+        self.projection_engine = projection_engine.upper()
+        self.early_termination = early_termination
+        self.early_termination_threshold = early_termination_threshold
+        self.payment_horizon = payment_horizon
+        self.time_step = time_step.upper()
+        self.time_step_segments = [(str(ts).upper(), int(years)) for ts, years in (time_step_segments or [])]
+        self.rate_conversion = rate_conversion.upper()
+        self.result_outputs = None if result_outputs is None else [str(o).upper() for o in result_outputs]
+        self.schedule_by_cost = schedule_by_cost
+        self.schedule_range_size = schedule_range_size
+        self.reproducible_summation = reproducible_summation
+        self.num_threads = num_threads
+        self.pin_threads = pin_threads
 
         # make sure that relative paths are interpreted relative to the working directory
         if portfolio_cache and not os.path.isabs(portfolio_cache):
@@ -112,4 +177,19 @@ def get_config_from_file(config_file: str) -> RunConfig:
         config_raw["model"]["use_multicore"],
         config_raw["kernel"]["engine"],
         config_raw["kernel"]["max_age"],
+        config_raw["kernel"].get("model_point_compression", True),
+        config_raw["kernel"].get("dob_band_months", 0),
+        config_raw["kernel"].get("projection_engine", "SCALAR"),
+        config_raw["kernel"].get("early_termination", True),
+        config_raw["kernel"].get("early_termination_threshold", 0.0),
+        config_raw["kernel"].get("payment_horizon", False),
+        config_raw["kernel"].get("time_step", "MONTHLY"),
+        config_raw["kernel"].get("time_step_segments"),
+        config_raw["kernel"].get("rate_conversion", "SIMPLE"),
+        config_raw["kernel"].get("result_outputs"),
+        config_raw["kernel"].get("schedule_by_cost", True),
+        config_raw["kernel"].get("schedule_range_size", 0),
+        config_raw["kernel"].get("reproducible_summation", False),
+        config_raw["kernel"].get("num_threads", 0),
+        config_raw["kernel"].get("pin_threads", False),
     )
@@ -15,6 +15,10 @@
 #include <vector>
 #include <memory>
 #include <array>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <utility>
 #include <iostream>
 #include <string>
 
@@ -29,6 +33,11 @@ typedef shared_ptr<CBaseRateProvider> PtrCBaseRateProvider;
 /// "Matrix" of pointers to provider objects
 typedef vector<vector<PtrCBaseRateProvider>> MatPtrCBaseRateProvider;
 
+/// Default upper bound for the number of doubles in a compiled assumption set (32MB)
+const size_t MAX_COMPILED_ASSUMPTION_SIZE = 1 << 22;
+
+class CCompiledAssumptionSet;
+
 
 
 /**
@@ -126,9 +135,127 @@ public:
         providers[row][col] = prvdr;
     }
 
+    /// Return the provider in row r and column c (may be null).
+    const PtrCBaseRateProvider &get_provider(int row, int col) const
+    {
+        return providers.at(row).at(col);
+    }
+
+    /// Return the sparsity pattern of the rate matrices, element r * n + c is true if the transition r -> c
+    /// has a provider (transitions without provider have rate zero), the diagonal is always included.
+    /// With `transitive` the pattern also contains the states reachable by several transitions, as needed by
+    /// conversions which do not keep the zero rates (the matrix exponential).
+    vector<bool> get_transition_pattern(bool transitive = false) const
+    {
+        vector<bool> pattern(n * n, false);
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                pattern[r * n + c] = r == c || providers[r][c] != nullptr;
+            }
+        }
+
+        // transitive closure (Warshall)
+        if (transitive)
+        {
+            for (unsigned k = 0; k < n; k++)
+            {
+                for (unsigned r = 0; r < n; r++)
+                {
+                    if (!pattern[r * n + k])
+                    {
+                        continue;
+                    }
+                    for (unsigned c = 0; c < n; c++)
+                    {
+                        if (pattern[k * n + c])
+                        {
+                            pattern[r * n + c] = true;
+                        }
+                    }
+                }
+            }
+        }
+        return pattern;
+    }
+
+    /// Return for each state if it is absorbing, i.e. none of the transitions out of it has a provider.
+    vector<bool> get_absorbing_states() const
+    {
+        vector<bool> absorbing(n, true);
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                if (c != r && providers[r][c] != nullptr)
+                {
+                    absorbing[r] = false;
+                }
+            }
+        }
+        return absorbing;
+    }
+
+    /// Turn the set into a dense tensor of rate matrices, returns null if the providers
+    /// do not state their ranges, if one of them calculates its rates on demand (e.g. a trend
+    /// table over the calendar years) or if the tensor would exceed `max_size` doubles.
+    shared_ptr<CCompiledAssumptionSet> compile(size_t max_size = MAX_COMPILED_ASSUMPTION_SIZE) const;
+
+    /// Set the treatment of out-of-range indices for all providers in the set.
+    void set_edge_mode(CRateEdgeMode mode)
+    {
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                if (providers[r][c])
+                {
+                    providers[r][c]->set_edge_mode(mode);
+                }
+            }
+        }
+    }
+
+    /// Check once if all providers can serve every risk factor vector in the box [rf_lower, rf_upper]
+    /// so that the rates can subsequently be queried with `get_single_rateset_unchecked`.
+    bool covers(const vector<int> &rf_lower, const vector<int> &rf_upper) const
+    {
+        if (rf_lower.size() != NUMBER_OF_RISK_FACTORS || rf_upper.size() != NUMBER_OF_RISK_FACTORS)
+        {
+            throw domain_error("Unexpected length of risk factor vector!");
+        }
+
+        int lower[MAX_PROVIDER_DIMENSION];
+        int upper[MAX_PROVIDER_DIMENSION];
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                if (!providers[r][c])
+                {
+                    continue;
+                }
+
+                const vector<CRiskFactors> &rf_for_this_prvdr = providers[r][c]->get_risk_factors();
+                for (size_t l = 0; l < rf_for_this_prvdr.size(); l++)
+                {
+                    lower[l] = rf_lower[(int)rf_for_this_prvdr[l]];
+                    upper[l] = rf_upper[(int)rf_for_this_prvdr[l]];
+                }
+
+                if (!providers[r][c]->covers(lower, upper))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
     /// Return a bool vector of the length of the risk factors indicating 
     /// if the assumptions set depends on the risk factor or not
-    void get_relevant_risk_factor_indexes(vector<bool> &relevant_risk_factors) {
+    void get_relevant_risk_factor_indexes(vector<bool> &relevant_risk_factors) const {
         for (unsigned r = 0; r < n; r++)
         {
             for (unsigned c = 0; c < n; c++)
@@ -183,6 +310,469 @@ public:
             }
         }
     }
+
+    /**
+     * @brief Populate the rate matrices for a block of records in one call, each provider is queried once with
+     * a batched (vectorized) lookup rather than once per record.
+     *
+     * @param num_records Number of records in the block
+     * @param rf_index_vectors One pointer per risk factor (in the order of CRiskFactors) to an array of length `num_records`
+     *        with the values of the risk factor for each record, risk factors not used by any provider may be null
+     * @param rates_ext Output array of size n * n * num_records in "structure of arrays" layout, i.e. the rate
+     *        for the transition r -> c of record j is stored at rates_ext[(r * n + c) * num_records + j]
+     */
+    void get_rateset_block(size_t num_records, const vector<int *> &rf_index_vectors, double *rates_ext) const
+    {
+        if (rf_index_vectors.size() != NUMBER_OF_RISK_FACTORS)
+        {
+            throw domain_error("Unexpected length of risk factor vector!");
+        }
+
+        vector<int *> this_provider_indexes;
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                double *cell_rates = rates_ext + (r * n + c) * num_records;
+                if (!providers[r][c])
+                {
+                    std::fill(cell_rates, cell_rates + num_records, 0.0);
+                    continue;
+                }
+
+                const vector<CRiskFactors> &rf_for_this_prvdr = providers[r][c]->get_risk_factors();
+                this_provider_indexes.resize(rf_for_this_prvdr.size());
+                for (size_t l = 0; l < rf_for_this_prvdr.size(); l++)
+                {
+                    this_provider_indexes[l] = rf_index_vectors[(int)rf_for_this_prvdr[l]];
+                    if (!this_provider_indexes[l])
+                    {
+                        throw domain_error(string("Missing index vector for risk factor ") + CRiskFactors_names(rf_for_this_prvdr[l]));
+                    }
+                }
+
+                providers[r][c]->get_rates(cell_rates, num_records, this_provider_indexes);
+            }
+        }
+    }
+
+    /// Like `get_single_rateset` but without any range checks, only to be used for
+    /// risk factor vectors that have been validated with `covers`.
+    void get_single_rateset_unchecked(const vector<int> &rf_indexes, double *rates_ext) const
+    {
+        int this_provider_indexes[MAX_PROVIDER_DIMENSION];
+
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                const CBaseRateProvider *prvdr = providers[r][c].get();
+                if (!prvdr) {
+                    rates_ext[r * n + c] = 0;
+                    continue;
+                }
+
+                const vector<CRiskFactors> &rf_for_this_prvdr = prvdr->get_risk_factors();
+                for (size_t l = 0; l < rf_for_this_prvdr.size(); l++)
+                {
+                    this_provider_indexes[l] = rf_indexes[(int)rf_for_this_prvdr[l]];
+                }
+
+                rates_ext[r * n + c] = prvdr->get_rate_unchecked(this_provider_indexes);
+            }
+        }
+    }
+
+    /**
+     * @brief Populate the rate matrices along a diagonal of the risk factors, e.g. the trajectory of a cohort with
+     * age and calendar year increasing together, with one strided sweep per provider.
+     *
+     * @param rf_start Risk factor vector of the first matrix
+     * @param rf_step Increment of each risk factor from one matrix to the next
+     * @param length Number of matrices
+     * @param rates_ext Output array of size length * n * n, the matrix for rf_start + j * rf_step starts at rates_ext + j * n * n
+     */
+    void get_rateset_diagonal(const vector<int> &rf_start, const vector<int> &rf_step, size_t length, double *rates_ext) const
+    {
+        if (rf_start.size() != NUMBER_OF_RISK_FACTORS || rf_step.size() != NUMBER_OF_RISK_FACTORS)
+        {
+            throw domain_error("Unexpected length of risk factor vector!");
+        }
+        if (length == 0)
+        {
+            return;
+        }
+
+        vector<int> rf_lower(NUMBER_OF_RISK_FACTORS);
+        vector<int> rf_upper(NUMBER_OF_RISK_FACTORS);
+        for (size_t k = 0; k < NUMBER_OF_RISK_FACTORS; k++)
+        {
+            int rf_end = rf_start[k] + (int)(length - 1) * rf_step[k];
+            rf_lower[k] = min(rf_start[k], rf_end);
+            rf_upper[k] = max(rf_start[k], rf_end);
+        }
+
+        if (covers(rf_lower, rf_upper))
+        {
+            get_rateset_diagonal_unchecked(rf_start, rf_step, length, rates_ext);
+            return;
+        }
+
+        // the checked lookups reject (or clamp) the risk factors outside of the tables
+        vector<int> rf_current(rf_start);
+        for (size_t j = 0; j < length; j++)
+        {
+            get_single_rateset(rf_current, rates_ext + j * n * n);
+            for (size_t k = 0; k < NUMBER_OF_RISK_FACTORS; k++)
+            {
+                rf_current[k] += rf_step[k];
+            }
+        }
+    }
+
+    /// Like `get_rateset_diagonal` but without any range checks, only to be used for diagonals
+    /// whose ends have been validated with `covers`.
+    void get_rateset_diagonal_unchecked(const vector<int> &rf_start, const vector<int> &rf_step, size_t length, double *rates_ext) const
+    {
+        int start[MAX_PROVIDER_DIMENSION];
+        int step[MAX_PROVIDER_DIMENSION];
+        size_t n_squared = n * n;
+
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                double *cell_rates = rates_ext + r * n + c;
+                const CBaseRateProvider *prvdr = providers[r][c].get();
+                if (!prvdr)
+                {
+                    for (size_t j = 0; j < length; j++)
+                    {
+                        cell_rates[j * n_squared] = 0;
+                    }
+                    continue;
+                }
+
+                const vector<CRiskFactors> &rf_for_this_prvdr = prvdr->get_risk_factors();
+                for (size_t l = 0; l < rf_for_this_prvdr.size(); l++)
+                {
+                    start[l] = rf_start[(int)rf_for_this_prvdr[l]];
+                    step[l] = rf_step[(int)rf_for_this_prvdr[l]];
+                }
+
+                prvdr->get_diagonal_unchecked(cell_rates, n_squared, length, start, step);
+            }
+        }
+    }
+};
+
+
+/**
+ * @brief Dense representation of an assumption set: the n x n rate matrices for all combinations of the risk factors
+ * used by any of the providers are stored contiguously in one tensor. A lookup of a rate set is one offset
+ * calculation and a copy of n * n values instead of one virtual provider call per transition.
+ *
+ * The tensor spans for each risk factor the range all providers can serve. If all providers using a risk factor
+ * clamp out-of-range values the same applies to the compiled set, otherwise queries outside of the range are rejected.
+ */
+class CCompiledAssumptionSet
+{
+private:
+    unsigned n;          // the dimension of the state model
+    unsigned n_squared;  // size of one rate matrix
+
+    vector<int> used_rfs;    // the risk factors the tensor depends on (in the order of CRiskFactors)
+    vector<int> rf_lower;    // lowest index per used risk factor
+    vector<int> rf_size;     // number of indices per used risk factor
+    vector<int> rf_strides;  // strides in units of rate matrices
+    vector<bool> rf_clamped; // if out-of-range indices are clamped for this risk factor
+
+    vector<double> tensor;
+
+public:
+    /// Construct an empty set, use CAssumptionSet::compile to create a populated one.
+    CCompiledAssumptionSet(unsigned dim) : n(dim), n_squared(dim * dim) {}
+
+    /// Returns the number of dimensions of the state model.
+    unsigned get_dimension() const { return n; }
+
+    /// Returns the number of doubles stored in the tensor.
+    size_t size() const { return tensor.size(); }
+
+    /// Mark the risk factors the compiled set depends on
+    void get_relevant_risk_factor_indexes(vector<bool> &relevant_risk_factors) const
+    {
+        for (int rf : used_rfs)
+        {
+            relevant_risk_factors[rf] = true;
+        }
+    }
+
+    /// Check if every risk factor vector in the box [lower, upper] (full risk factor vectors) can be looked up.
+    bool covers(const vector<int> &lower, const vector<int> &upper) const
+    {
+        for (size_t k = 0; k < used_rfs.size(); k++)
+        {
+            if (rf_clamped[k])
+            {
+                continue;
+            }
+            if (lower[used_rfs[k]] < rf_lower[k] || upper[used_rfs[k]] >= rf_lower[k] + rf_size[k])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Copy the rate matrix for the given risk factors into the external array, only to be used
+    /// for risk factor vectors validated with `covers`.
+    void get_single_rateset_unchecked(const vector<int> &rf_indexes, double *rates_ext) const
+    {
+        size_t index = 0;
+        for (size_t k = 0; k < used_rfs.size(); k++)
+        {
+            int ind = rf_indexes[used_rfs[k]] - rf_lower[k];
+            if (rf_clamped[k])
+            {
+                ind = ind < 0 ? 0 : (ind >= rf_size[k] ? rf_size[k] - 1 : ind);
+            }
+            index += (size_t)rf_strides[k] * ind;
+        }
+        std::copy(tensor.begin() + index * n_squared, tensor.begin() + (index + 1) * n_squared, rates_ext);
+    }
+
+    /// Copy the rate matrices along the diagonal rf_start + j * rf_step (j < length) into the external array
+    /// (length * n * n values), only to be used for diagonals whose ends have been validated with `covers`.
+    void get_rateset_diagonal_unchecked(const vector<int> &rf_start, const vector<int> &rf_step, size_t length, double *rates_ext) const
+    {
+        bool any_clamped = std::find(rf_clamped.begin(), rf_clamped.end(), true) != rf_clamped.end();
+        if (any_clamped)
+        {
+            vector<int> rf_current(rf_start);
+            for (size_t j = 0; j < length; j++)
+            {
+                get_single_rateset_unchecked(rf_current, rates_ext + j * n_squared);
+                for (size_t k = 0; k < NUMBER_OF_RISK_FACTORS; k++)
+                {
+                    rf_current[k] += rf_step[k];
+                }
+            }
+            return;
+        }
+
+        // without clamping the matrices along a diagonal are equally spaced in the tensor
+        ptrdiff_t index = 0;
+        ptrdiff_t diagonal_stride = 0;
+        for (size_t k = 0; k < used_rfs.size(); k++)
+        {
+            index += (ptrdiff_t)rf_strides[k] * (rf_start[used_rfs[k]] - rf_lower[k]);
+            diagonal_stride += (ptrdiff_t)rf_strides[k] * rf_step[used_rfs[k]];
+        }
+        for (size_t j = 0; j < length; j++)
+        {
+            const double *matrix = tensor.data() + index * n_squared;
+            std::copy(matrix, matrix + n_squared, rates_ext + j * n_squared);
+            index += diagonal_stride;
+        }
+    }
+
+    /// Copy the rate matrix for the given risk factors into the external array.
+    void get_single_rateset(const vector<int> &rf_indexes, double *rates_ext) const
+    {
+        if (rf_indexes.size() != NUMBER_OF_RISK_FACTORS)
+        {
+            throw domain_error("Unexpected length of risk factor vector!");
+        }
+        if (!covers(rf_indexes, rf_indexes))
+        {
+            throw out_of_range("Risk factors out of the range of the compiled assumption set.");
+        }
+        get_single_rateset_unchecked(rf_indexes, rates_ext);
+    }
+
+    friend class CAssumptionSet;
+};
+
+shared_ptr<CCompiledAssumptionSet> CAssumptionSet::compile(size_t max_size) const
+{
+    auto compiled = make_shared<CCompiledAssumptionSet>(n);
+
+    // determine the range of each risk factor
+    vector<int> strict_lower(NUMBER_OF_RISK_FACTORS, std::numeric_limits<int>::min());
+    vector<int> strict_upper(NUMBER_OF_RISK_FACTORS, std::numeric_limits<int>::max());
+    vector<int> clamp_lower(NUMBER_OF_RISK_FACTORS, std::numeric_limits<int>::max());
+    vector<int> clamp_upper(NUMBER_OF_RISK_FACTORS, std::numeric_limits<int>::min());
+    vector<bool> used(NUMBER_OF_RISK_FACTORS, false);
+    vector<bool> strict_used(NUMBER_OF_RISK_FACTORS, false);
+
+    int lower[MAX_PROVIDER_DIMENSION];
+    int upper[MAX_PROVIDER_DIMENSION];
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            if (!providers[r][c])
+            {
+                continue;
+            }
+            if (providers[r][c]->is_lazy() || !providers[r][c]->get_index_range(lower, upper))
+            {
+                return nullptr;
+            }
+
+            bool clamps = providers[r][c]->resolves_out_of_range();
+            const vector<CRiskFactors> &rf_vec = providers[r][c]->get_risk_factors();
+            for (size_t l = 0; l < rf_vec.size(); l++)
+            {
+                int rf = (int)rf_vec[l];
+                used[rf] = true;
+                if (clamps)
+                {
+                    clamp_lower[rf] = min(clamp_lower[rf], lower[l]);
+                    clamp_upper[rf] = max(clamp_upper[rf], upper[l]);
+                }
+                else
+                {
+                    strict_used[rf] = true;
+                    strict_lower[rf] = max(strict_lower[rf], lower[l]);
+                    strict_upper[rf] = min(strict_upper[rf], upper[l]);
+                }
+            }
+        }
+    }
+
+    // layout of the tensor, the last risk factor varies fastest
+    size_t num_matrices = 1;
+    for (unsigned rf = 0; rf < NUMBER_OF_RISK_FACTORS; rf++)
+    {
+        if (!used[rf])
+        {
+            continue;
+        }
+        int lo = strict_used[rf] ? strict_lower[rf] : clamp_lower[rf];
+        int hi = strict_used[rf] ? strict_upper[rf] : clamp_upper[rf];
+        if (hi < lo)
+        {
+            return nullptr; // the providers have no common range
+        }
+        compiled->used_rfs.push_back(rf);
+        compiled->rf_lower.push_back(lo);
+        compiled->rf_size.push_back(hi - lo + 1);
+        compiled->rf_clamped.push_back(!strict_used[rf]);
+        num_matrices *= (size_t)(hi - lo + 1);
+        if (num_matrices * n * n > max_size)
+        {
+            return nullptr;
+        }
+    }
+
+    size_t num_used = compiled->used_rfs.size();
+    compiled->rf_strides.assign(num_used, 1);
+    for (int k = (int)num_used - 2; k >= 0; k--)
+    {
+        compiled->rf_strides[k] = compiled->rf_strides[k + 1] * compiled->rf_size[k + 1];
+    }
+
+    // populate the tensor by iterating over all risk factor combinations
+    compiled->tensor.resize(num_matrices * n * n);
+    vector<int> rf_indexes(NUMBER_OF_RISK_FACTORS, 0);
+    for (size_t k = 0; k < num_used; k++)
+    {
+        rf_indexes[compiled->used_rfs[k]] = compiled->rf_lower[k];
+    }
+
+    for (size_t m = 0; m < num_matrices; m++)
+    {
+        get_single_rateset_unchecked(rf_indexes, &compiled->tensor[m * n * n]);
+
+        // increment the last risk factor and carry over
+        for (int k = (int)num_used - 1; k >= 0; k--)
+        {
+            int rf = compiled->used_rfs[k];
+            if (++rf_indexes[rf] < compiled->rf_lower[k] + compiled->rf_size[k])
+            {
+                break;
+            }
+            rf_indexes[rf] = compiled->rf_lower[k];
+        }
+    }
+
+    return compiled;
+}
+
+
+/**
+ * @brief Assumption sets specialized (sliced) for Gender and SmokerStatus. A portfolio typically contains only
+ * a handful of distinct combinations so the slices are created once per run and then shared read-only by all
+ * projectors instead of slicing the assumptions again for every record.
+ */
+class CAssumptionSliceCache
+{
+private:
+    const CAssumptionSet &_be_assumptions;
+    const vector<shared_ptr<CAssumptionSet>> &_other_assumptions;
+
+    // slices per key (gender, smoker_status)
+    map<pair<int, int>, shared_ptr<CAssumptionSet>> _be_slices;
+    map<pair<int, int>, vector<shared_ptr<CAssumptionSet>>> _other_slices;
+
+    /// Create a copy of `assumptions` sliced for the given gender and smoker status.
+    static shared_ptr<CAssumptionSet> create_slice(const CAssumptionSet &assumptions, int gender, int smoker_status)
+    {
+        vector<int> slice_indexes(NUMBER_OF_RISK_FACTORS, -1);
+        slice_indexes[(int)CRiskFactors::Gender] = gender;
+        slice_indexes[(int)CRiskFactors::SmokerStatus] = smoker_status;
+
+        auto slice = make_shared<CAssumptionSet>(assumptions.get_dimension());
+        assumptions.clone_into(*slice);
+        assumptions.slice_into(slice_indexes, *slice);
+        return slice;
+    }
+
+public:
+    /**
+     * @brief Construct an empty cache, the assumption sets passed in must outlive the cache.
+     *
+     * @param be_assumptions The best estimate assumptions of the run.
+     * @param other_assumptions Further assumption sets of the run.
+     */
+    CAssumptionSliceCache(const CAssumptionSet &be_assumptions, const vector<shared_ptr<CAssumptionSet>> &other_assumptions) :
+        _be_assumptions(be_assumptions), _other_assumptions(other_assumptions) {}
+
+    /// Create the slices for the given key unless they exist already, not thread-safe.
+    void add(int gender, int smoker_status)
+    {
+        pair<int, int> key(gender, smoker_status);
+        if (_be_slices.count(key))
+        {
+            return;
+        }
+        _be_slices[key] = create_slice(_be_assumptions, gender, smoker_status);
+
+        vector<shared_ptr<CAssumptionSet>> &other_slices = _other_slices[key];
+        for (const shared_ptr<CAssumptionSet> &oa : _other_assumptions)
+        {
+            other_slices.push_back(create_slice(*oa, gender, smoker_status));
+        }
+    }
+
+    /// Return the number of cached keys.
+    size_t size() const { return _be_slices.size(); }
+
+    /// Return the sliced be assumptions for the key or null if they have not been added.
+    const CAssumptionSet *get_be_slice(int gender, int smoker_status) const
+    {
+        auto it = _be_slices.find(pair<int, int>(gender, smoker_status));
+        return it == _be_slices.end() ? nullptr : it->second.get();
+    }
+
+    /// Return the sliced other assumptions for the key or null if they have not been added.
+    const vector<shared_ptr<CAssumptionSet>> *get_other_slices(int gender, int smoker_status) const
+    {
+        auto it = _other_slices.find(pair<int, int>(gender, smoker_status));
+        return it == _other_slices.end() ? nullptr : &it->second;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,337 @@
+/**
+ * @file block_projector.h
+ * @author M. Seehafer
+ * @brief Projection engine that advances a block of records together.
+ * @version 0.2.0
+ * @date 2023-05-06
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Each record of a block occupies one lane. The state probabilities, the rate matrices of the current
+ * time step and the payments are stored in structure-of-arrays layout (lane index innermost) so that the
+ * state update of the whole block runs with vector instructions. The rates of each lane are still determined
+ * by a RecordProjector (slicing, diagonals, conversion to the length of the time step), the arithmetic is
+ * arranged such that the results are identical to the projection of the records one at a time. Only the
+ * probabilities are projected, the volumes are derived from them with the sum insured of each lane.
+ */
+#ifndef C_BLOCK_PROJECTOR_H
+#define C_BLOCK_PROJECTOR_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+
+#include "simd.h"
+#include "portfolio.h"
+#include "run_config.h"
+#include "time_axis.h"
+#include "run_result.h"
+#include "payments.h"
+#include "record_projector.h"
+
+using namespace std;
+
+/**
+ * @brief Projects blocks of up to `LANES` records at a time and adds their results to a run result.
+ *
+ */
+class BlockProjector
+{
+public:
+    /// Number of records advanced together (one AVX-512 or two AVX2 registers of doubles).
+    static const int LANES = 8;
+
+private:
+    /// Status of a lane within the current block
+    enum class LaneStatus : int
+    {
+        EMPTY,   // no record in this lane (last block of a portfolio)
+        ACTIVE,  // record is projected
+        STOPPED  // maximum age reached or no longer in force, the states are carried forward
+    };
+
+    const CRunConfig &_run_config;
+    const TimeAxis &_ta;
+
+    const unsigned _dimension;
+    const int _num_state_payment_cols;
+    const SimdLevel _simd_level;
+    const bool _store_payments;  // payments requested in the result spec of the run
+
+    // determine the rates of the lanes
+    vector<unique_ptr<RecordProjector>> _lane_projectors;
+
+    // storage in structure-of-arrays layout, the lane index is innermost
+    unique_ptr<double[]> _a;              // dependent assumptions of the current step, dimension x dimension x LANES
+    unique_ptr<double[]> _probs;          // state probabilities at the start of the step, dimension x LANES
+    unique_ptr<double[]> _probs_next;     // state probabilities at the end of the step
+    unique_ptr<double[]> _prob_mvms;      // probability movements of the step, dimension x dimension x LANES
+    unique_ptr<double[]> _probs_stopped;  // state probabilities kept by stopped lanes
+    unique_ptr<double[]> _payments;       // payments of the current step, payment columns x LANES
+
+    double _sum_insured[LANES];
+    LaneStatus _status[LANES];
+    bool _stops[LANES];       // maximum age reached in the current step, the states of the previous step are kept
+    bool _terminates[LANES];  // projection horizon reached or no longer in force after the current step, its states are kept
+
+    /// Add the values of one lane of an array in structure-of-arrays layout to the target row, scaled by `weight` unless null.
+    /// Nothing is added if the target is null (output not requested).
+    static void add_lane(double *target, const double *source, size_t len, int lane, const double *weight)
+    {
+        if (!target)
+        {
+            return;
+        }
+        for (size_t j = 0; j < len; j++)
+        {
+            target[j] += weight ? *weight * source[j * LANES + lane] : source[j * LANES + lane];
+        }
+    }
+
+    /// Add the results of all lanes for the given time step to the run result, lane by lane in the order of the records.
+    /// The volumes and volume movements are the probabilities and movements times the sum insured of the lane.
+    void add_results(RunResult &run_result, int time_index, const CPolicy *const *policies) const;
+
+public:
+    /**
+     * @brief Construct a new Block Projector object
+     *
+     * @param run_config Run configuration object.
+     * @param ta Time axis to be used for the simulation.
+     * @param num_state_payment_cols Number of payment types.
+     * @param compiled_be_assumptions Optional dense version of the be assumptions (shared read-only between projectors).
+     * @param slice_cache Optional cache of the assumptions sliced by gender and smoker status (shared read-only between projectors).
+     * @param conversion_cache Optional cache of the converted rates (shared between projectors).
+     */
+    BlockProjector(const CRunConfig &run_config, const TimeAxis &ta, int num_state_payment_cols,
+                   shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions = nullptr,
+                   shared_ptr<const CAssumptionSliceCache> slice_cache = nullptr,
+                   shared_ptr<CRateConversionCache> conversion_cache = nullptr) : _run_config(run_config),
+                                                                                  _ta(ta),
+                                                                                  _dimension(run_config.get_dimension()),
+                                                                                  _num_state_payment_cols(num_state_payment_cols),
+                                                                                  _simd_level(get_simd_level()),
+                                                                                  _store_payments(run_config.get_result_spec().payments)
+    {
+        // the lanes share one conversion cache
+        if (!conversion_cache && run_config.get_rate_conversion() != RateConversion::SIMPLE)
+        {
+            conversion_cache = make_shared<CRateConversionCache>(run_config.get_rate_conversion(), _dimension);
+        }
+        for (int l = 0; l < LANES; l++)
+        {
+            _lane_projectors.push_back(unique_ptr<RecordProjector>(new RecordProjector(run_config, ta, compiled_be_assumptions, slice_cache, conversion_cache)));
+        }
+
+        size_t states = (size_t)_dimension * LANES;
+        size_t transitions = (size_t)_dimension * _dimension * LANES;
+        _a = unique_ptr<double[]>(new double[transitions], std::default_delete<double[]>());
+        _probs = unique_ptr<double[]>(new double[states], std::default_delete<double[]>());
+        _probs_next = unique_ptr<double[]>(new double[states], std::default_delete<double[]>());
+        _prob_mvms = unique_ptr<double[]>(new double[transitions], std::default_delete<double[]>());
+        _probs_stopped = unique_ptr<double[]>(new double[states], std::default_delete<double[]>());
+        _payments = unique_ptr<double[]>(new double[(size_t)max(1, _num_state_payment_cols) * LANES], std::default_delete<double[]>());
+    }
+
+    // no copying intended
+    BlockProjector(const BlockProjector &) = delete;
+
+    /**
+     * @brief Project the block of records starting at `first` and add the results to `run_result`.
+     *
+     * @param policies The records of the portfolio.
+     * @param first Index of the first record of the block.
+     * @param end The block ends after `LANES` records or before this index.
+     * @param payments The payments of the records of the (sub-)portfolio.
+     * @param run_result Container the results are added to.
+     * @param portfolio_date portfolio date
+     */
+    void run(const vector<shared_ptr<CPolicy>> &policies, size_t first, size_t end, const AggregatePayments &payments,
+             RunResult &run_result, const PeriodDate &portfolio_date);
+};
+
+void BlockProjector::add_results(RunResult &run_result, int time_index, const CPolicy *const *policies) const
+{
+    size_t n = _dimension;
+    // the arrays of the outputs which are not requested are null
+    auto row = [](double *values, size_t len, int time_index) { return values ? values + time_index * len : nullptr; };
+    double *probs = row(run_result.get_be_state_probs_ptr(), n, time_index);
+    double *vols = row(run_result.get_be_state_vols_ptr(), n, time_index);
+    double *prob_mvms = row(run_result.get_be_prob_mvms_ptr(), n * n, time_index);
+    double *vol_mvms = row(run_result.get_be_vol_mvms_ptr(), n * n, time_index);
+    double *payments = run_result.get_state_cond_payments_ptr();
+
+    for (int l = 0; l < LANES; l++)
+    {
+        if (_status[l] == LaneStatus::EMPTY)
+        {
+            continue;
+        }
+        double weight = policies[l]->get_weight();
+        if (_status[l] == LaneStatus::STOPPED)
+        {
+            add_lane(probs, _probs_stopped.get(), n, l, &weight);
+            add_lane(vols, _probs_stopped.get(), n, l, &_sum_insured[l]);
+            continue;
+        }
+
+        // the initial states are stored at time index 0, after the step which reaches the maximum age
+        // the states of the previous step are kept
+        bool keep_states = time_index == 0 || _stops[l];
+        const double *lane_probs = keep_states ? _probs.get() : _probs_next.get();
+        add_lane(probs, lane_probs, n, l, &weight);
+        add_lane(vols, lane_probs, n, l, &_sum_insured[l]);
+        if (time_index > 0)
+        {
+            add_lane(prob_mvms, _prob_mvms.get(), n * n, l, &weight);
+            add_lane(vol_mvms, _prob_mvms.get(), n * n, l, &_sum_insured[l]);
+            if (payments && _num_state_payment_cols > 0)
+            {
+                add_lane(payments + time_index * _num_state_payment_cols, _payments.get(), _num_state_payment_cols, l, nullptr);
+            }
+        }
+    }
+}
+
+void BlockProjector::run(const vector<shared_ptr<CPolicy>> &policies, size_t first, size_t end, const AggregatePayments &payments,
+                         RunResult &run_result, const PeriodDate &portfolio_date)
+{
+    const size_t n = _dimension;
+    const int count = (int)min((size_t)LANES, min(end, policies.size()) - first);
+    const int max_time_step_index = (int)_ta.get_length() - 1;
+
+    const CPolicy *block_policies[LANES];
+    // the payments of the records in the block, owned by `payments`
+    const unordered_map<int, StateConditionalRecordPayout> *state_payments[LANES];
+    const unordered_map<pair<int, int>, TransitionConditionalRecordPayout> *transition_payments[LANES];
+
+    std::fill(_probs.get(), _probs.get() + n * LANES, 0.0);
+    std::fill(_a.get(), _a.get() + n * n * LANES, 0.0);
+    for (int l = 0; l < LANES; l++)
+    {
+        _stops[l] = false;
+        _terminates[l] = false;
+        _sum_insured[l] = 0.0;
+        block_policies[l] = nullptr;
+        _status[l] = l < count ? LaneStatus::ACTIVE : LaneStatus::EMPTY;
+        if (l >= count)
+        {
+            continue;
+        }
+
+        const CPolicy &policy = *policies[first + l];
+        int start_state = policy.get_initial_state();
+        if (start_state < 0 || start_state >= (int)n)
+        {
+            throw domain_error("Invalid state index: " + std::to_string(start_state));
+        }
+        block_policies[l] = &policy;
+        state_payments[l] = payments.get_single_record_payments(first + l).get();
+        transition_payments[l] = payments.get_single_record_transition_payments(first + l).get();
+        _sum_insured[l] = policy.get_sum_insured();
+        _probs[start_state * LANES + l] = 1;
+        _lane_projectors[l]->start_record(policy, portfolio_date);
+        _lane_projectors[l]->set_in_force_states(*state_payments[l]);
+        _lane_projectors[l]->set_projection_horizon(policy, *state_payments[l], *transition_payments[l]);
+    }
+
+    add_results(run_result, 0, block_policies);
+
+    for (int time_index = 1; time_index <= max_time_step_index; time_index++)
+    {
+        // Step 1: the assumptions of the active lanes
+        bool any_active = false;
+        for (int l = 0; l < count; l++)
+        {
+            _stops[l] = false;
+            if (_status[l] != LaneStatus::ACTIVE)
+            {
+                continue;
+            }
+            any_active = true;
+            const double *a = _lane_projectors[l]->step_assumptions(*block_policies[l], time_index);
+            for (size_t k = 0; k < n * n; k++)
+            {
+                _a[k * LANES + l] = a[k];
+            }
+            _stops[l] = _lane_projectors[l]->max_age_reached();
+        }
+
+        if (any_active)
+        {
+            // Step 2: payments at begin of period
+            std::fill(_payments.get(), _payments.get() + (size_t)_num_state_payment_cols * LANES, 0.0);
+            for (int l = 0; l < count; l++)
+            {
+                if (_status[l] != LaneStatus::ACTIVE || !_store_payments)
+                {
+                    continue;
+                }
+                for (auto &sp : *state_payments[l])
+                {
+                    for (const ConditionalPayout &payout : sp.second.payments)
+                    {
+                        _payments[payout.payment_index * LANES + l] = payout.cond_payments[time_index] * _probs[sp.first * LANES + l];
+                    }
+                }
+            }
+
+            // Step 3: update the states of all lanes
+            block_update_state(_simd_level, LANES, _dimension, _a.get(), _probs.get(), _probs_next.get(), _prob_mvms.get());
+
+            // Step 4: payments at end of period
+            for (int l = 0; l < count; l++)
+            {
+                if (_status[l] != LaneStatus::ACTIVE)
+                {
+                    continue;
+                }
+                _terminates[l] = !_stops[l] && (_lane_projectors[l]->projection_horizon_reached(time_index) ||
+                                                _lane_projectors[l]->in_force_negligible(_probs_next.get() + l, LANES));
+                if (!_store_payments)
+                {
+                    continue;
+                }
+                for (auto &tp : *transition_payments[l])
+                {
+                    size_t transition = tp.first.first * n + tp.first.second;
+                    for (const ConditionalPayout &payout : tp.second.payments)
+                    {
+                        _payments[payout.payment_index * LANES + l] = payout.cond_payments[time_index] * _prob_mvms[transition * LANES + l];
+                    }
+                }
+            }
+        }
+
+        add_results(run_result, time_index, block_policies);
+
+        // lanes reaching the maximum age, their projection horizon or leaving the in-force states keep their states until the end of the projection
+        for (int l = 0; l < count; l++)
+        {
+            if (!_stops[l] && !_terminates[l])
+            {
+                continue;
+            }
+            _status[l] = LaneStatus::STOPPED;
+            if (_terminates[l])
+            {
+                run_result.add_skipped_time_steps(max_time_step_index - time_index);
+                _terminates[l] = false;
+            }
+            const double *probs = _stops[l] ? _probs.get() : _probs_next.get();
+            for (size_t s = 0; s < n; s++)
+            {
+                _probs_stopped[s * LANES + l] = probs[s * LANES + l];
+            }
+            for (size_t k = 0; k < n * n; k++)
+            {
+                _a[k * LANES + l] = 0.0;
+            }
+        }
+
+        std::swap(_probs, _probs_next);
+    }
+}
+
+#endif
@@ -0,0 +1,333 @@
+/**
+ * @file model_points.h
+ * @author M. Seehafer
+ * @brief Compression of a portfolio into weighted model points.
+ * @version 0.2.0
+ * @date 2023-04-29
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Records which agree in everything the projection depends on (month of birth and the position of the
+ * day of birth relative to the days of the time axis, gender, smoker status, initial state, reserving
+ * rate, product and the structure of the payments) have the same state probabilities. They are projected
+ * once as a model point which carries the total insured amount and the sum of the payment streams, the
+ * probabilities are scaled by the number of records when the results are added up.
+ */
+#ifndef C_MODEL_POINTS_H
+#define C_MODEL_POINTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+#include "time_axis.h"
+#include "portfolio.h"
+#include "payments.h"
+
+using namespace std;
+
+/// Sorted payouts of a record: ((state, -1), payment type) for state conditional payments and
+/// ((from state, to state), payment type) for transition payments.
+typedef vector<pair<pair<int, int>, int>> CPaymentStructure;
+
+/// Attributes of a record the projection depends on, records with equal keys form one model point.
+struct CModelPointKey
+{
+    int birth_month;   // year * 12 + month - 1 (divided by the band width if dates of birth are banded)
+    int birth_day_class; // number of days of month used by the time axis before the day of birth
+    int gender;
+    int smoker_status;
+    int initial_state;
+    double reserving_rate;
+    int64_t disablement_date; // -1 if none
+    int64_t coverage_end_date; // -1 if none
+    CPaymentStructure payment_structure; // the state and transition keys and the payment types
+    string product;
+
+    bool operator==(const CModelPointKey &o) const
+    {
+        return birth_month == o.birth_month && birth_day_class == o.birth_day_class && gender == o.gender &&
+               smoker_status == o.smoker_status && initial_state == o.initial_state && reserving_rate == o.reserving_rate &&
+               disablement_date == o.disablement_date && coverage_end_date == o.coverage_end_date && payment_structure == o.payment_structure && product == o.product;
+    }
+};
+
+namespace std
+{
+    template <> struct hash<CModelPointKey>
+    {
+        inline size_t operator()(const CModelPointKey &k) const
+        {
+            size_t seed = 0;
+            ::hash_combine(seed, k.birth_month);
+            ::hash_combine(seed, k.birth_day_class);
+            ::hash_combine(seed, k.gender);
+            ::hash_combine(seed, k.smoker_status);
+            ::hash_combine(seed, k.initial_state);
+            ::hash_combine(seed, k.reserving_rate);
+            ::hash_combine(seed, k.disablement_date);
+            ::hash_combine(seed, k.coverage_end_date);
+            for (const auto &payout : k.payment_structure)
+            {
+                ::hash_combine(seed, payout);
+            }
+            ::hash_combine(seed, k.product);
+            return seed;
+        }
+    };
+}
+
+/**
+ * @brief Builds the model points of a portfolio and their payments.
+ *
+ */
+class CModelPointCompressor
+{
+private:
+    // sorted days of month of the portfolio date and the start dates of the time axis
+    vector<int> _relevant_days;
+
+    // width (in months) of the bands for the dates of birth, 0 for exact compression
+    int _dob_band_months;
+
+    static int month_index(const PeriodDate &d) { return 12 * d.get_year() + d.get_month() - 1; }
+
+    static CPaymentStructure payment_structure(const unordered_map<int, StateConditionalRecordPayout> &state_payments,
+                                               const unordered_map<pair<int, int>, TransitionConditionalRecordPayout> &transition_payments);
+
+    CModelPointKey make_key(const CPolicy &policy, CPaymentStructure payment_structure) const;
+
+    static shared_ptr<unordered_map<int, StateConditionalRecordPayout>> sum_state_payments(
+        const AggregatePayments &payments, const vector<size_t> &members);
+
+    static shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> sum_transition_payments(
+        const AggregatePayments &payments, const vector<size_t> &members);
+
+    static void add_payments(vector<ConditionalPayout> &target, const vector<ConditionalPayout> &source);
+
+public:
+    /**
+     * @brief Construct a new compressor.
+     *
+     * @param ta The time axis of the projection.
+     * @param dob_band_months If positive, dates of birth within bands of this many months are merged (approximation).
+     */
+    CModelPointCompressor(const TimeAxis &ta, int dob_band_months = 0) : _dob_band_months(dob_band_months)
+    {
+        if (dob_band_months < 0)
+        {
+            throw domain_error("The band width for the dates of birth must not be negative.");
+        }
+        std::set<int> days;
+        days.insert(ta.get_portfolio_day());
+        for (const PeriodDate &d : ta.get_start_dates())
+        {
+            days.insert(d.get_day());
+        }
+        _relevant_days.assign(days.begin(), days.end());
+    }
+
+    /**
+     * @brief Compress the portfolio into model points.
+     *
+     * @param portfolio The portfolio.
+     * @param payments The payments of the records of the portfolio.
+     * @param mp_payments Output, the payments of the model points.
+     * @return The portfolio of model points, the portfolio passed in (and the payments unchanged) if no records can be merged.
+     */
+    shared_ptr<CPolicyPortfolio> compress(const shared_ptr<CPolicyPortfolio> &portfolio, const AggregatePayments &payments,
+                                          shared_ptr<AggregatePayments> &mp_payments) const;
+};
+
+CPaymentStructure CModelPointCompressor::payment_structure(const unordered_map<int, StateConditionalRecordPayout> &state_payments,
+                                                           const unordered_map<pair<int, int>, TransitionConditionalRecordPayout> &transition_payments)
+{
+    CPaymentStructure structure;
+    for (const auto &sp : state_payments)
+    {
+        for (const ConditionalPayout &payout : sp.second.payments)
+        {
+            structure.push_back(make_pair(make_pair(sp.first, -1), payout.payment_index));
+        }
+    }
+    for (const auto &tp : transition_payments)
+    {
+        for (const ConditionalPayout &payout : tp.second.payments)
+        {
+            structure.push_back(make_pair(tp.first, payout.payment_index));
+        }
+    }
+
+    // independent of the iteration order of the maps
+    std::sort(structure.begin(), structure.end());
+    return structure;
+}
+
+CModelPointKey CModelPointCompressor::make_key(const CPolicy &policy, CPaymentStructure payment_structure) const
+{
+    CModelPointKey key;
+    const PeriodDate &dob = policy.get_dob();
+    if (_dob_band_months > 0)
+    {
+        key.birth_month = month_index(dob) / _dob_band_months;
+        key.birth_day_class = 0;
+    }
+    else
+    {
+        // the completed months of age at all dates of the projection agree for days of birth in the same class
+        key.birth_month = month_index(dob);
+        key.birth_day_class = (int)(std::lower_bound(_relevant_days.begin(), _relevant_days.end(), (int)dob.get_day()) - _relevant_days.begin());
+    }
+    key.gender = policy.get_gender();
+    key.smoker_status = policy.get_smoker_status();
+    key.initial_state = policy.get_initial_state();
+    key.reserving_rate = policy.get_reserving_rate();
+    const PeriodDate &dis = policy.get_date_dis();
+    key.disablement_date = policy.has_disablement_date() ? (int64_t)dis.get_year() * 10000 + dis.get_month() * 100 + dis.get_day() : -1;
+    const PeriodDate &cover_end = policy.get_coverage_end_date();
+    key.coverage_end_date = policy.has_coverage_end_date() ? (int64_t)cover_end.get_year() * 10000 + cover_end.get_month() * 100 + cover_end.get_day() : -1;
+    key.payment_structure = std::move(payment_structure);
+    key.product = policy.get_product();
+    return key;
+}
+
+void CModelPointCompressor::add_payments(vector<ConditionalPayout> &target, const vector<ConditionalPayout> &source)
+{
+    for (const ConditionalPayout &payout : source)
+    {
+        bool found = false;
+        for (ConditionalPayout &target_payout : target)
+        {
+            if (target_payout.payment_index == payout.payment_index)
+            {
+                for (size_t t = 0; t < target_payout.cond_payments.size(); t++)
+                {
+                    target_payout.cond_payments[t] += payout.cond_payments[t];
+                }
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            throw domain_error("Payment type " + std::to_string(payout.payment_index) + " is missing in the model point.");
+        }
+    }
+}
+
+shared_ptr<unordered_map<int, StateConditionalRecordPayout>> CModelPointCompressor::sum_state_payments(
+    const AggregatePayments &payments, const vector<size_t> &members)
+{
+    auto summed = make_shared<unordered_map<int, StateConditionalRecordPayout>>();
+    for (const auto &sp : *payments.get_single_record_payments(members[0]))
+    {
+        StateConditionalRecordPayout payout(sp.first);
+        payout.payments = sp.second.payments;
+        summed->insert(pair<int, StateConditionalRecordPayout>(sp.first, std::move(payout)));
+    }
+    for (size_t m = 1; m < members.size(); m++)
+    {
+        for (const auto &sp : *payments.get_single_record_payments(members[m]))
+        {
+            add_payments(summed->at(sp.first).payments, sp.second.payments);
+        }
+    }
+    return summed;
+}
+
+shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> CModelPointCompressor::sum_transition_payments(
+    const AggregatePayments &payments, const vector<size_t> &members)
+{
+    auto summed = make_shared<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>>();
+    for (const auto &tp : *payments.get_single_record_transition_payments(members[0]))
+    {
+        TransitionConditionalRecordPayout payout(tp.first.first, tp.first.second);
+        payout.payments = tp.second.payments;
+        summed->insert(pair<pair<int, int>, TransitionConditionalRecordPayout>(tp.first, std::move(payout)));
+    }
+    for (size_t m = 1; m < members.size(); m++)
+    {
+        for (const auto &tp : *payments.get_single_record_transition_payments(members[m]))
+        {
+            add_payments(summed->at(tp.first).payments, tp.second.payments);
+        }
+    }
+    return summed;
+}
+
+shared_ptr<CPolicyPortfolio> CModelPointCompressor::compress(const shared_ptr<CPolicyPortfolio> &portfolio, const AggregatePayments &payments,
+                                                             shared_ptr<AggregatePayments> &mp_payments) const
+{
+    // group the records by their keys (in the order of their first occurrence)
+    const vector<shared_ptr<CPolicy>> &policies = portfolio->get_policies();
+    unordered_map<CModelPointKey, size_t> group_index;
+    vector<vector<size_t>> groups;
+    for (size_t j = 0; j < policies.size(); j++)
+    {
+        auto it = group_index.insert(make_pair(make_key(*policies[j], payment_structure(*payments.get_single_record_payments(j), *payments.get_single_record_transition_payments(j))),
+                                               groups.size()));
+        if (it.second)
+        {
+            groups.push_back(vector<size_t>());
+        }
+        groups[it.first->second].push_back(j);
+    }
+
+    mp_payments = nullptr;
+    if (groups.size() == policies.size())
+    {
+        return portfolio;
+    }
+
+    shared_ptr<CPolicyPortfolio> mp_portfolio = make_shared<CPolicyPortfolio>(portfolio->get_portfolio_date());
+    mp_payments = shared_ptr<AggregatePayments>(new AggregatePayments(groups.size(), payments.get_payment_types_used()));
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        const vector<size_t> &members = groups[g];
+        if (members.size() == 1)
+        {
+            mp_portfolio->add(policies[members[0]]);
+            mp_payments->add_single_record_payments(payments.get_single_record_payments(members[0]), g);
+            mp_payments->add_single_record_transition_payments(payments.get_single_record_transition_payments(members[0]), g);
+            continue;
+        }
+
+        double weight = 0.0;
+        double sum_insured = 0.0;
+        double weighted_birth_month = 0.0;
+        for (size_t j : members)
+        {
+            weight += policies[j]->get_weight();
+            sum_insured += policies[j]->get_sum_insured();
+            weighted_birth_month += policies[j]->get_sum_insured() * month_index(policies[j]->get_dob());
+        }
+
+        // with banded dates of birth the record closest to the average (weighted by the insured amount) represents the band
+        size_t representative = members[0];
+        if (_dob_band_months > 0 && sum_insured != 0.0)
+        {
+            weighted_birth_month /= sum_insured;
+            for (size_t j : members)
+            {
+                if (fabs(month_index(policies[j]->get_dob()) - weighted_birth_month) <
+                    fabs(month_index(policies[representative]->get_dob()) - weighted_birth_month))
+                {
+                    representative = j;
+                }
+            }
+        }
+
+        mp_portfolio->add(policies[representative]->make_model_point(weight, sum_insured));
+        mp_payments->add_single_record_payments(sum_state_payments(payments, members), g);
+        mp_payments->add_single_record_transition_payments(sum_transition_payments(payments, members), g);
+    }
+    return mp_portfolio;
+}
+
+#endif
@@ -73,12 +73,17 @@ struct TransitionConditionalRecordPayout
 };
 
 
+class CModelPointCompressor;
+
 /**
  * @brief Represent the payment matrices of a subportfolio
  * 
  */
 class AggregatePayments
 {
+    // builds the payments of the model points with the private constructor
+    friend class CModelPointCompressor;
+
 private:
     // for each record maintain a pointer to a map. The map associates the state_index with
     // a StateConditionalRecordPayout structure
@@ -94,24 +99,10 @@ private:
     std::set<int> payment_types_used;
     size_t _size;
 
-public:
-    AggregatePayments(size_t size): _size(size) {
-        state_payouts.reserve(size);
-        transition_payouts.reserve(size);
-
-        // initialize
-        for(int j = 0; j < size; j++) {
-            state_payouts.push_back(make_shared<unordered_map<int, StateConditionalRecordPayout>>());
-            transition_payouts.push_back(make_shared<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>>());
-        }
-    }
-
-    // check and comment what this constructor is for
+    /// Payments of `size` records which must all be set with `add_single_record_payments` and
+    /// `add_single_record_transition_payments` before use, no maps are allocated here.
     AggregatePayments(size_t size, const std::set<int> &_payment_types_used): _size(size),
                                                                               payment_types_used(_payment_types_used) {
-        state_payouts.reserve(size);
-        transition_payouts.reserve(size);
-
         auto iter =  _payment_types_used.begin();
         while (iter !=  _payment_types_used.end()) {
             if(*iter > max_payment_type_index_used) {
@@ -120,6 +111,15 @@ public:
             ++iter;
         }
 
+        state_payouts.resize(size);
+        transition_payouts.resize(size);
+    }
+
+public:
+    AggregatePayments(size_t size): _size(size) {
+        state_payouts.reserve(size);
+        transition_payouts.reserve(size);
+
         // initialize
         for(int j = 0; j < size; j++) {
             state_payouts.push_back(make_shared<unordered_map<int, StateConditionalRecordPayout>>());
@@ -175,7 +175,7 @@ public:
         std::chrono::duration<double> duration_payment_copy;
         // iterate over the policies
         int row_count = 0;
-        for (auto p_map: state_payouts) {
+        for (auto &p_map: state_payouts) {
 
             auto state_cond_payout = p_map->find(state_index);
             if (state_cond_payout == p_map->end()) {
@@ -233,7 +233,7 @@ public:
 
         // iterate over the policies
         int row_count = 0;
-        for (auto p_map: transition_payouts) {
+        for (auto &p_map: transition_payouts) {
             pair<int, int> pair_index = pair<int, int>(state_index_from, state_index_to);
 
             auto transition_payout_it = p_map->find(pair_index);
@@ -256,21 +256,24 @@ public:
     }
 
 
-    /// use internally in C++ when splitting the payments into groups (for the parallelization)
-    void add_single_record_payments(shared_ptr<unordered_map<int, StateConditionalRecordPayout>> single_record_payments, size_t ind) {
+    /// use internally in C++ when building the payments of the model points (the maps may be shared)
+    void add_single_record_payments(const shared_ptr<unordered_map<int, StateConditionalRecordPayout>> &single_record_payments, size_t ind) {
         state_payouts[ind] = single_record_payments;
     }
 
-    /// use internally in C++ when splitting the payments into groups (for the parallelization)
-    void add_single_record_transition_payments(shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> single_record_payments, size_t ind) {
+    /// use internally in C++ when building the payments of the model points (the maps may be shared)
+    void add_single_record_transition_payments(const shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> &single_record_payments, size_t ind) {
         transition_payouts[ind] = single_record_payments;
     }
 
-    shared_ptr<unordered_map<int, StateConditionalRecordPayout>> get_single_record_payments(size_t index) const {
+    /// Return the state conditional payments of a record by reference, the workers of a run read them without
+    /// touching the reference counts.
+    const shared_ptr<unordered_map<int, StateConditionalRecordPayout>> &get_single_record_payments(size_t index) const {
         return state_payouts[index];
     }
 
-    shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> get_single_record_transition_payments(size_t index) const {
+    /// Return the transition payments of a record by reference.
+    const shared_ptr<unordered_map<pair<int, int>, TransitionConditionalRecordPayout>> &get_single_record_transition_payments(size_t index) const {
         return transition_payouts[index];
     }
 
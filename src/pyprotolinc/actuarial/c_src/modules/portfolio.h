@@ -37,6 +37,10 @@ protected:
     bool _has_disablement_date;
     PeriodDate date_dis = PeriodDate(0, 0, 0);
 
+    // end of the cover, nothing is projected beyond this date
+    bool _has_coverage_end_date = false;
+    PeriodDate coverage_end_date = PeriodDate(0, 0, 0);
+
     int gender;
     int smoker_status;
 
@@ -47,6 +51,9 @@ protected:
 
     int initial_state;
 
+    // number of records represented by this record (model points stand for several identical records)
+    double weight = 1.0;
+
 public:
     /// return the technical policy ID
     int64_t get_cession_id() const { return cession_id; }
@@ -71,6 +78,21 @@ public:
     // short get_date_dis_month() const { return date_dis.month; }
     // short get_date_dis_day() const { return date_dis.day; }
 
+    /// Return if the cover of the policy ends at a given date.
+    bool has_coverage_end_date() const { return _has_coverage_end_date; }
+
+    const PeriodDate &get_coverage_end_date() const {return coverage_end_date;}  ///< Return the end date of the cover.
+
+    /// Set the end date of the cover in the format YYYYMMDD, a negative value means that the cover does not end.
+    void set_coverage_end_date(int64_t coverage_end_date_long)
+    {
+        _has_coverage_end_date = coverage_end_date_long >= 0;
+        if (_has_coverage_end_date)
+        {
+            coverage_end_date.set_from_long(coverage_end_date_long);
+        }
+    }
+
     int get_gender() const { return gender; }                               ///< Return the Gender code.
     int get_smoker_status() const { return smoker_status; }                 ///< Return the SmokerStatus code.
 
@@ -82,6 +104,22 @@ public:
     
     int get_initial_state() const { return initial_state; }                 ///< Return the initial state
 
+    double get_weight() const { return weight; }                            ///< Return the number of records represented
+
+    /**
+     * @brief Create a model point from this record.
+     *
+     * @param weight Number of records represented by the model point.
+     * @param sum_insured Total insured amount of the records.
+     */
+    shared_ptr<CPolicy> make_model_point(double weight, double sum_insured) const
+    {
+        shared_ptr<CPolicy> model_point = make_shared<CPolicy>(*this);
+        model_point->weight = weight;
+        model_point->sum_insured = sum_insured;
+        return model_point;
+    }
+
     /**
      * @brief Construct a new CPolicy object
      *
@@ -143,6 +181,7 @@ public:
                ", BIRTH=" + std::to_string(dob.year) + "-" + std::to_string(dob.month) + "-" + std::to_string(dob.day) +
                ", ISSUE=" + std::to_string(issue_date.year) + "-" + std::to_string(issue_date.month) + "-" + std::to_string(issue_date.day) +
                ", DISABLED=" + std::to_string(date_dis.year) + "-" + std::to_string(date_dis.month) + "-" + std::to_string(date_dis.day) +
+               ", COVER_END=" + std::to_string(coverage_end_date.year) + "-" + std::to_string(coverage_end_date.month) + "-" + std::to_string(coverage_end_date.day) +
                "]>";
     }
 };
@@ -193,7 +232,7 @@ public:
     const PeriodDate &get_portfolio_date() { return _portfolio_date; }
 
     /// Return the vector of policies
-    const vector<shared_ptr<CPolicy>> &get_policies()
+    const vector<shared_ptr<CPolicy>> &get_policies() const
     {
         return _policies;
     }
@@ -207,7 +246,7 @@ public:
     /// Add a policy to the portfolio.
     void add(shared_ptr<CPolicy> record_ptr)
     {
-        _policies.push_back(record_ptr);
+        _policies.push_back(std::move(record_ptr));
         _num_policies++;
     }
 
@@ -250,6 +289,10 @@ private:
     bool has_dis_dates = false;
     int64_t *ptr_disablement_date;
 
+    // optional
+    bool has_coverage_end_dates = false;
+    int64_t *ptr_coverage_end_date;
+
     bool has_gender = false;
     int32_t *ptr_gender;
 
@@ -312,6 +355,13 @@ public:
         return *this;
     }
 
+    CPortfolioBuilder &set_coverage_end_date(int64_t *ptr_coverage_end_date)
+    {
+        this->ptr_coverage_end_date = ptr_coverage_end_date;
+        has_coverage_end_dates = true;
+        return *this;
+    }
+
     CPortfolioBuilder &set_gender(int32_t *ptr_gender)
     {
         this->ptr_gender = ptr_gender;
@@ -423,6 +473,10 @@ shared_ptr<CPolicyPortfolio> CPortfolioBuilder::build()
                                                           ptr_reserving_rate[k],
                                                           product,
                                                           ptr_initial_state[k]);
+        if (has_coverage_end_dates)
+        {
+            record->set_coverage_end_date(ptr_coverage_end_date[k]);
+        }
 
         portfolio.add(record);
     }
@@ -19,7 +19,11 @@
 #include <iostream>
 #include <memory>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include "risk_factors.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -35,6 +39,58 @@ void print_vec(vector<T> v, string name)
     cout << "\n";
 }
 
+/// Upper bound for the number of dimensions of a provider (each dimension corresponds to a risk factor).
+const unsigned MAX_PROVIDER_DIMENSION = NUMBER_OF_RISK_FACTORS;
+
+/// Treatment of indices which lie outside of the range of a rate table.
+enum class CRateEdgeMode : int
+{
+    STRICT, // 0 - throw an out_of_range exception
+    CLAMP   // 1 - use the value at the nearest edge of the table (constant extrapolation)
+};
+
+/**
+ * @brief Lookup kernel for a table of fixed rank, the compiler unrolls the loop over the dimensions.
+ * No range checks are performed, the caller must make sure that the indices are valid.
+ *
+ * @param values Pointer to the data array
+ * @param strides Step widths in the respective dimensions
+ * @param base_index Flat index that corresponds to the (possibly virtual) index vector of zeros, i.e. this accounts for the offsets
+ * @param indices The indices to look up
+ */
+template <unsigned RANK>
+inline double lookup_rate_unchecked(const double *values, const int *strides, int base_index, const int *indices)
+{
+    int index = base_index;
+    for (unsigned k = 0; k < RANK; k++)
+    {
+        index += strides[k] * indices[k];
+    }
+    return values[index];
+}
+
+/**
+ * @brief Lookup kernel for a table of fixed rank which maps indices outside of the table to the nearest edge.
+ *
+ * @param values Pointer to the data array
+ * @param strides Step widths in the respective dimensions
+ * @param offsets Offsets to be applied to the indices
+ * @param shape Shape of the table
+ * @param indices The indices to look up
+ */
+template <unsigned RANK>
+inline double lookup_rate_clamped(const double *values, const int *strides, const int *offsets, const int *shape, const int *indices)
+{
+    int index = 0;
+    for (unsigned k = 0; k < RANK; k++)
+    {
+        int ind_temp = indices[k] - offsets[k];
+        ind_temp = ind_temp < 0 ? 0 : (ind_temp >= shape[k] ? shape[k] - 1 : ind_temp);
+        index += strides[k] * ind_temp;
+    }
+    return values[index];
+}
+
 /**
  * @brief Abstract base class for the assumptions providers.
  * 
@@ -59,6 +115,60 @@ public:
         throw domain_error("Method not implemented in abstract class.");
     }
 
+    /// Return the rate for an array of indices (one per risk factor) without any checks,
+    /// only to be used after `covers` confirmed that the indices can be resolved.
+    virtual double get_rate_unchecked(const int *indices) const
+    {
+        return get_rate(vector<int>(indices, indices + risk_factors.size()));
+    }
+
+    /// Write the rates along the diagonal `start + j * step` (e.g. age and calendar year increasing together)
+    /// for j = 0, ..., length - 1 into out_array[j * out_stride], only to be used after `covers` confirmed
+    /// that the indices between both ends of the diagonal can be resolved.
+    virtual void get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const
+    {
+        int indices[MAX_PROVIDER_DIMENSION];
+        size_t dim = risk_factors.size();
+        std::copy(start, start + dim, indices);
+        for (size_t j = 0; j < length; j++)
+        {
+            out_array[j * out_stride] = get_rate_unchecked(indices);
+            for (size_t k = 0; k < dim; k++)
+            {
+                indices[k] += step[k];
+            }
+        }
+    }
+
+    /// Return true if all index vectors within the box [lower, upper] (inclusive, one entry per risk factor)
+    /// can be resolved by the provider without range errors.
+    virtual bool covers(const int *lower, const int *upper) const
+    {
+        return true;
+    }
+
+    /// Set the treatment of indices outside of the table range.
+    virtual void set_edge_mode(CRateEdgeMode mode) {} // do nothing
+
+    /// Write the range of valid indices (inclusive, one entry per risk factor) into lower/upper,
+    /// returns false if the provider cannot state its range.
+    virtual bool get_index_range(int *lower, int *upper) const
+    {
+        return risk_factors.empty();
+    }
+
+    /// Return true if indices outside of the range are resolved (clamped) rather than rejected.
+    virtual bool resolves_out_of_range() const
+    {
+        return false;
+    }
+
+    /// Return true if the rates are calculated on demand, such providers are not compiled into a dense tensor.
+    virtual bool is_lazy() const
+    {
+        return false;
+    }
+
     const vector<CRiskFactors> &get_risk_factors() const
     {
         return risk_factors;
@@ -93,6 +203,19 @@ public:
         return val;
     }
 
+    double get_rate_unchecked(const int *indices) const override
+    {
+        return val;
+    }
+
+    void get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const override
+    {
+        for (size_t j = 0; j < length; j++)
+        {
+            out_array[j * out_stride] = val;
+        }
+    }
+
     void get_rates(double *out_array, size_t length, const vector<int *> &indices) const override
     {
         for (size_t j = 0; j < length; j++)
@@ -121,22 +244,52 @@ public:
 
 };
 
+/// Callback that releases an externally owned buffer (e.g. a Python buffer view).
+typedef void (*CBufferRelease)(void *owner);
+
+/// Deleter for shared storage borrowed from an external owner, calls the release callback instead of freeing the data.
+struct CExternalBufferRelease
+{
+    void *owner;
+    CBufferRelease release;
+
+    void operator()(const double *) const
+    {
+        if (release)
+        {
+            release(owner);
+        }
+    }
+};
+
+/**
+ * @brief Provider backed by an N-dimensional table of rates.
+ *
+ * The table data is immutable once set and held in reference-counted storage: clones share the storage
+ * and slices are strided views into it, hence neither copies any rates.
+ */
 class CStandardRateProvider : public CBaseRateProvider
 {
 
 protected:
-    shared_ptr<double[]> values = nullptr;
+    shared_ptr<const double> values = nullptr; // first value of the view into the (shared, immutable) storage
     bool has_values = false; // flag if the data array is set
-    int number_values = 0;   // number of values used in the data
-    int capacity = 0;        // number of elements currently accolacted (can be bigger than number_values)
+    int number_values = 0;   // number of values in the view
+    int capacity = 0;        // number of elements of the underlying storage (can be bigger than number_values)
 
     vector<int> shape_vec;       // the dimensions/shape
     vector<int> strides;         // steps width in the respective dimension
     vector<int> offsets;         // offset to be applied when queried for rates
     unsigned int dimensions = 0; // number of dimensions of the data array
+    int base_index = 0;          // flat index belonging to the index vector of zeros (i.e. offsets already applied)
+
+    CRateEdgeMode edge_mode = CRateEdgeMode::STRICT; // treatment of out-of-range indices
 
     // private methods
+    void set_shape(vector<int> &shape_vec_in, vector<int> &offsets_in);
     void set_strides();
+    void set_base_index();
+    void view_into(const vector<int> &indices, CStandardRateProvider &other) const;
 
 public:
     CStandardRateProvider() {}
@@ -147,15 +300,38 @@ public:
     int get_dimension() const { return dimensions; }
     int get_capacity() const { return capacity; }
     int size() const { return number_values; }
+    const vector<int> &get_shape() const { return shape_vec; }
+    const vector<int> &get_offsets() const { return offsets; }
 
-    void get_values(double *ext_vals) const
+    CRateEdgeMode get_edge_mode() const { return edge_mode; }
+    void set_edge_mode(CRateEdgeMode mode) override { edge_mode = mode; }
+
+    /// Return true if the values of the view are stored contiguously in row-major order.
+    bool is_contiguous() const;
+
+    /// Return true if the table data is shared with the other provider.
+    bool shares_values_with(const CStandardRateProvider &other) const
     {
-        std::copy(values.get(), values.get() + number_values, ext_vals);
-        //std::copy_n(values.get(), number_values, ext_vals);
+        return has_values && other.has_values && values.owner_before(other.values) == other.values.owner_before(values);
     }
 
+    void get_values(double *ext_vals) const;
+
     void set_values(vector<int> &shape_vec_in, vector<int> &offsets_in, double *ext_vals);
 
+    /// Set the values without copying them, `storage` must contain the values in row-major (C-contiguous)
+    /// order and must not be modified while any provider (or slice) still refers to it.
+    void set_values(vector<int> &shape_vec_in, vector<int> &offsets_in, shared_ptr<const double> storage);
+
+    /// Borrow the external buffer `ext_vals` (C-contiguous) instead of copying it, `release(owner)` is
+    /// called once the last provider (or slice) referring to the buffer has been destroyed.
+    void set_values_borrowed(vector<int> &shape_vec_in, vector<int> &offsets_in, const double *ext_vals,
+                             void *owner, CBufferRelease release)
+    {
+        CExternalBufferRelease deleter = {owner, release};
+        set_values(shape_vec_in, offsets_in, shared_ptr<const double>(ext_vals, deleter));
+    }
+
     void add_risk_factor(CRiskFactors rf) override
     {
         // check if rf is already in the list and throw an exception in this case
@@ -184,58 +360,55 @@ public:
             throw domain_error("Dimension of indices does not match those of the data"); // TODO: testcase
         }
 
-        int index = 0;
-        for (unsigned k = 0; k < dimensions; k++)
+        if (edge_mode == CRateEdgeMode::STRICT)
         {
-            int ind_temp = indices[k] - offsets[k];
-            if (ind_temp < 0 || ind_temp >= shape_vec[k])
+            for (unsigned k = 0; k < dimensions; k++)
             {
-                throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max index allowed is "
-                                   + std::to_string(shape_vec[k] - 1) + ", tried with " +  std::to_string(ind_temp) + ".");
+                int ind_temp = indices[k] - offsets[k];
+                if (ind_temp < 0 || ind_temp >= shape_vec[k])
+                {
+                    throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max index allowed is "
+                                       + std::to_string(shape_vec[k] - 1) + ", tried with " +  std::to_string(ind_temp) + ".");
+                }
             }
-            index += strides[k] * ind_temp;
         }
 
-        return values.get()[index];
+        return get_rate_unchecked(indices.data());
     }
 
-    virtual void get_rates(double *out_array, size_t length, const vector<int *> &indices) const
-    {
+    double get_rate_unchecked(const int *indices) const override;
 
+    void get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const override;
+
+    bool covers(const int *lower, const int *upper) const override;
+
+    bool get_index_range(int *lower, int *upper) const override
+    {
         if (!has_values)
         {
-            throw logic_error("Not values have been set before querying."); // TODO: testcase
+            return false;
         }
-
-        if (indices.size() != dimensions)
+        for (unsigned k = 0; k < dimensions; k++)
         {
-            throw domain_error("Dimension of indices does not match those of the data"); // TODO: testcase
+            lower[k] = offsets[k];
+            upper[k] = offsets[k] + shape_vec[k] - 1;
         }
+        return true;
+    }
 
-        for (size_t j = 0; j < length; j++)
-        {
-
-            int index = 0;
-            for (unsigned k = 0; k < dimensions; k++)
-            {
-                int ind_temp = indices[k][j] - offsets[k];
-                if (ind_temp < 0 || ind_temp >= shape_vec[k])
-                {
-                    throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max length is " + std::to_string(shape_vec[k]) + ".");
-                }
-                index += strides[k] * ind_temp;
-            }
-
-            out_array[j] = values.get()[index];
-        }
+    bool resolves_out_of_range() const override
+    {
+        return edge_mode == CRateEdgeMode::CLAMP;
     }
 
+    void get_rates(double *out_array, size_t length, const vector<int *> &indices) const override;
+
     /// Given a vector of indexes take only the dimensions where the values is "-1" in full
     //  and otherwise restrict to the index provided
     virtual shared_ptr<CStandardRateProvider> slice(const vector<int> &indices) const;
 
-    // perform a slicing operation into another provider object, if possible
-    // using the already allocated memory of the other provider
+    // perform a slicing operation into another provider object which then
+    // becomes a view of this provider's values (no data is copied)
     void slice_into(const vector<int> &indices, CBaseRateProvider *other) const override;
 };
 
@@ -243,16 +416,8 @@ shared_ptr<CBaseRateProvider> CStandardRateProvider::clone() const
 {
     auto p_clone = make_shared<CStandardRateProvider>();
 
-    // deep copy of all attributes
-    if (this->values != nullptr)
-    {
-        p_clone->values = std::shared_ptr<double[]>(new double[capacity], std::default_delete<double[]>());
-        for (int j = 0; j < capacity; j++)
-        {
-            p_clone->values[j] = this->values[j];
-        }
-    }
-
+    // the values are immutable and can be shared, all other attributes are copied
+    p_clone->values = this->values;
     p_clone->has_values = this->has_values;
     p_clone->number_values = this->number_values;
     p_clone->capacity = this->capacity;
@@ -264,6 +429,8 @@ shared_ptr<CBaseRateProvider> CStandardRateProvider::clone() const
     copy(this->offsets.begin(), this->offsets.end(), back_inserter(p_clone->offsets));
 
     p_clone->dimensions = this->dimensions;
+    p_clone->base_index = this->base_index;
+    p_clone->edge_mode = this->edge_mode;
 
     return p_clone;
 }
@@ -272,6 +439,32 @@ void CStandardRateProvider::set_values(vector<int> &shape_vec_in, vector<int> &o
 {
     // this method allocates memory for the values, copies them and
     // sets the related member variables
+    set_shape(shape_vec_in, offsets_in);
+
+    // allocate a new array on the heap and copy the data over, the array is not modified afterwards
+    capacity = number_values;
+    shared_ptr<double> storage(new double[capacity], std::default_delete<double[]>());
+    std::copy(ext_vals, ext_vals + number_values, storage.get());
+    values = storage;
+    has_values = true;
+}
+
+void CStandardRateProvider::set_values(vector<int> &shape_vec_in, vector<int> &offsets_in, shared_ptr<const double> storage)
+{
+    if (!storage)
+    {
+        throw domain_error("Storage must not be null.");
+    }
+    set_shape(shape_vec_in, offsets_in);
+
+    capacity = number_values;
+    values = storage;
+    has_values = true;
+}
+
+void CStandardRateProvider::set_shape(vector<int> &shape_vec_in, vector<int> &offsets_in)
+{
+    // validates the shape and sets the related member variables
 
     if (has_values)
     {
@@ -338,17 +531,50 @@ void CStandardRateProvider::set_values(vector<int> &shape_vec_in, vector<int> &o
             number_values *= shape_vec_in[i];
         }
     }
+}
 
-    // allocate a new array on the heap
-    // values = new double[number_values];
-    capacity = number_values;
-    values = std::shared_ptr<double[]>(new double[capacity], std::default_delete<double[]>());
-    has_values = true;
+bool CStandardRateProvider::is_contiguous() const
+{
+    int acc_dims = 1;
+    for (int i = (int)dimensions - 1; i >= 0; i--)
+    {
+        if (shape_vec[i] > 1 && strides[i] != acc_dims)
+        {
+            return false;
+        }
+        acc_dims *= shape_vec[i];
+    }
+    return true;
+}
+
+void CStandardRateProvider::get_values(double *ext_vals) const
+{
+    if (is_contiguous())
+    {
+        std::copy(values.get(), values.get() + number_values, ext_vals);
+        return;
+    }
 
-    // copy the data over
+    // strided view: gather the values in row-major order
+    const double *vals = values.get();
+    vector<int> counters(dimensions, 0);
     for (int j = 0; j < number_values; j++)
     {
-        values.get()[j] = ext_vals[j];
+        int index = 0;
+        for (unsigned k = 0; k < dimensions; k++)
+        {
+            index += strides[k] * counters[k];
+        }
+        ext_vals[j] = vals[index];
+
+        for (int d = (int)dimensions - 1; d >= 0; d--)
+        {
+            if (++counters[d] < shape_vec[d])
+            {
+                break;
+            }
+            counters[d] = 0;
+        }
     }
 }
 
@@ -373,276 +599,1228 @@ shared_ptr<CStandardRateProvider> CStandardRateProvider::slice(const vector<int>
     /// Given a vector of indexes take only the dimensions where the values is "-1" in full
     //  and otherwise restrict to the index provided
 
+    auto slicedProviderPtr = make_shared<CStandardRateProvider>();
+    view_into(indices, *slicedProviderPtr);
+    return slicedProviderPtr;
+}
+
+// Perform a slicing operation into another provider object.
+// Slicing means given a vector of indexes (the first argument) take only the dimensions where the values is "-1" in full
+// and otherwise restrict to the index provided.
+void CStandardRateProvider::slice_into(const vector<int> &indices, CBaseRateProvider *other_in) const
+{
+    CStandardRateProvider *other = dynamic_cast<CStandardRateProvider *>(other_in);
+    if (!other)
+    {
+        throw domain_error("Slicing into a provider of a different type.");
+    }
+    view_into(indices, *other);
+}
+
+// Turn the other provider into a view of this provider's values with the fixed dimensions removed,
+// the data is shared rather than copied.
+void CStandardRateProvider::view_into(const vector<int> &indices, CStandardRateProvider &other) const
+{
     if (indices.size() != dimensions)
     {
         throw domain_error("Dimension of indices does not match those of the data"); // TODO: testcase
     }
 
-    auto slicedProviderPtr = make_shared<CStandardRateProvider>();
+    if (!has_values)
+    {
+        throw logic_error("No values have been set before slicing.");
+    }
 
+    vector<CRiskFactors> risk_factors_sliced;
     vector<int> shape_vec_sliced;
+    vector<int> strides_sliced;
     vector<int> offsets_sliced;
 
-    // find all fixed dimensions
-    vector<bool> dims_fixed(shape_vec.size(), false);
+    // the fixed dimensions determine the first value of the view, the free ones are taken over
+    int origin = 0;
     int required_size = 1;
     for (unsigned d = 0; d < dimensions; d++)
     {
         if (indices[d] != -1)
         {
-            dims_fixed[d] = true;
+            int ind_temp = indices[d] - offsets[d];
+            if (ind_temp < 0 || ind_temp >= shape_vec[d])
+            {
+                throw domain_error("Slicing indexes exceed dimensions"); // TODO: testcase
+            }
+            origin += strides[d] * ind_temp;
         }
         else
         {
             required_size *= shape_vec[d];
-            // cout << "Adding rf: " << CRiskFactors_names(risk_factors[d]);
-            slicedProviderPtr->add_risk_factor(risk_factors[d]);
+            risk_factors_sliced.push_back(risk_factors[d]);
             shape_vec_sliced.push_back(shape_vec[d]);
+            strides_sliced.push_back(strides[d]);
             offsets_sliced.push_back(offsets[d]);
         }
     }
 
-    // print_vec<int>(indices, "indices");
-    // print_vec<int>(offsets_sliced, "offsets_sliced");
-    // print_vec<int>(shape_vec_sliced, "shape_vec_sliced");
-
-    vector<int> bounds_lower(shape_vec.size(), 0);
-    vector<int> bounds_upper(shape_vec.size(), 0);
-
-    // cout << "Required sized: " << required_size << "\n";
-
-    // temporary storage space
-    double *new_vals = new double[required_size];
-
-    // determine the bounds
-    for (unsigned d = 0; d < dimensions; d++)
+    // special case: reduction to constant provider
+    if (risk_factors_sliced.size() == 0)
     {
-        if (dims_fixed[d])
-        {
-            bounds_lower[d] = indices[d] - offsets[d];
-            bounds_upper[d] = indices[d] - offsets[d] + 1; // exclusive
-            if (bounds_lower[d] < 0 || bounds_upper[d] > shape_vec[d])
-            {
-                throw domain_error("Slicing indexes exceed dimensions"); // TODO: testcase
-            }
-        }
-        else
-        {
-            bounds_lower[d] = 0;
-            bounds_upper[d] = shape_vec[d]; // exclusive
-        }
+        shape_vec_sliced.push_back(1);
+        strides_sliced.push_back(1);
+        offsets_sliced.push_back(0);
     }
 
-    // print_vec<int>(bounds_lower, "bounds_lower");
-    // print_vec<int>(bounds_upper, "bounds_upper");
+    // aliasing pointer: shares the ownership of the storage but points to the first value of the view
+    other.values = shared_ptr<const double>(values, values.get() + origin);
+    other.has_values = true;
+    other.number_values = required_size;
+    other.capacity = capacity;
+
+    other.risk_factors = risk_factors_sliced;
+    other.shape_vec = shape_vec_sliced;
+    other.strides = strides_sliced;
+    other.offsets = offsets_sliced;
+    other.dimensions = (unsigned)risk_factors_sliced.size();
+    other.set_base_index();
+    other.edge_mode = edge_mode;
+}
 
-    vector<int> counters = bounds_lower;
-    int new_val_counter = 0;
-    bool incremented;
-    do
+void CStandardRateProvider::set_strides()
+{
+    // calculate the strides
+    strides.assign(shape_vec.size(), 1);
+    int acc_dims = 1;
+    for (int i = (int)shape_vec.size() - 1; i >= 0; i--)
     {
-        // calculate the index belonging to our current counter
-        int index = 0;
-        for (unsigned k = 0; k < dimensions; k++)
-        {
-            index += strides[k] * counters[k];
-        }
-
-        // cout << "Adding ";
-        // print_vec(counters, "counters");
+        strides[i] = acc_dims;
+        acc_dims *= shape_vec[i];
+    }
+    set_base_index();
+}
 
-        new_vals[new_val_counter++] = values.get()[index];
+void CStandardRateProvider::set_base_index()
+{
+    // fold the offsets into one flat index so that the lookup does not need to subtract them
+    base_index = 0;
+    for (unsigned k = 0; k < dimensions; k++)
+    {
+        base_index -= strides[k] * offsets[k];
+    }
+}
 
-        // increment
-        incremented = false;
-        for (int d = dimensions - 1; d >= 0; d--)
-        {
-            if (counters[d] + 1 < bounds_upper[d])
-            {
-                counters[d] += 1;
-                for (int d2 = d + 1; d2 <= ((int)dimensions) - 1; d2++)
-                {
-                    counters[d2] = bounds_lower[d2];
-                }
-                incremented = true;
-                break;
-            }
-        }
-    } while (incremented);
+double CStandardRateProvider::get_rate_unchecked(const int *indices) const
+{
+    const double *vals = values.get();
 
-    // special case: reduction to constant provider
-    if (required_size == 1)
+    if (edge_mode == CRateEdgeMode::CLAMP)
     {
-        if (shape_vec_sliced.size() == 0)
-        {
-            shape_vec_sliced.push_back(1);
-        }
-        if (offsets_sliced.size() == 0)
+        switch (dimensions)
         {
-            offsets_sliced.push_back(0);
+        case 0:
+            return vals[0];
+        case 1:
+            return lookup_rate_clamped<1>(vals, strides.data(), offsets.data(), shape_vec.data(), indices);
+        case 2:
+            return lookup_rate_clamped<2>(vals, strides.data(), offsets.data(), shape_vec.data(), indices);
+        case 3:
+            return lookup_rate_clamped<3>(vals, strides.data(), offsets.data(), shape_vec.data(), indices);
+        case 4:
+            return lookup_rate_clamped<4>(vals, strides.data(), offsets.data(), shape_vec.data(), indices);
+        default:
+            return lookup_rate_clamped<MAX_PROVIDER_DIMENSION>(vals, strides.data(), offsets.data(), shape_vec.data(), indices);
         }
     }
 
-    // print_vec<int>(shape_vec_sliced, "shape_vec_sliced");
-    // print_vec<int>(offsets_sliced, "offsets_sliced");
-    // cout << "Dimension slice" << slicedProviderPtr->risk_factors.size() << "\n";
-    // cout << "new_vals: " ;
-    // for (auto i = 0; i < required_size; i++) {
-    //    std::cout << new_vals[i] << ' ';
-    // }
-    // cout << "\n";
-
-    slicedProviderPtr->set_values(shape_vec_sliced, offsets_sliced, new_vals);
-
-    delete[] new_vals;
-
-    return slicedProviderPtr;
+    switch (dimensions)
+    {
+    case 0:
+        return vals[0];
+    case 1:
+        return lookup_rate_unchecked<1>(vals, strides.data(), base_index, indices);
+    case 2:
+        return lookup_rate_unchecked<2>(vals, strides.data(), base_index, indices);
+    case 3:
+        return lookup_rate_unchecked<3>(vals, strides.data(), base_index, indices);
+    case 4:
+        return lookup_rate_unchecked<4>(vals, strides.data(), base_index, indices);
+    default:
+        return lookup_rate_unchecked<MAX_PROVIDER_DIMENSION>(vals, strides.data(), base_index, indices);
+    }
 }
 
-// Perform a slicing operation into another provider object, if possible
-// using the already allocated memory of the other provider.
-// Slicing means given a vector of indexes (the first argument) take only the dimensions where the values is "-1" in full
-// and otherwise restrict to the index provided.
-void CStandardRateProvider::slice_into(const vector<int> &indices, CBaseRateProvider *other_in) const
+void CStandardRateProvider::get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const
 {
+    if (edge_mode == CRateEdgeMode::CLAMP)
+    {
+        // the clamped indices do not advance linearly
+        CBaseRateProvider::get_diagonal_unchecked(out_array, out_stride, length, start, step);
+        return;
+    }
 
-    //cout << "CStandardRateProvider::slice_into (1)" << endl;    
-    
-    // CStandardRateProvider &other = *dynamic_pointer_cast<CStandardRateProvider>(other_in);
-
-    CStandardRateProvider *other = dynamic_cast<CStandardRateProvider *>(other_in);
+    // a diagonal of the table is a strided sequence in memory
+    const double *vals = values.get();
+    int index = base_index;
+    int diagonal_stride = 0;
+    for (unsigned k = 0; k < dimensions; k++)
+    {
+        index += strides[k] * start[k];
+        diagonal_stride += strides[k] * step[k];
+    }
+    for (size_t j = 0; j < length; j++)
+    {
+        out_array[j * out_stride] = vals[index];
+        index += diagonal_stride;
+    }
+}
 
-    //cout << "CStandardRateProvider::slice_into (2)" << endl;    
+void CStandardRateProvider::get_rates(double *out_array, size_t length, const vector<int *> &indices) const
+{
+    if (!has_values)
+    {
+        throw logic_error("Not values have been set before querying."); // TODO: testcase
+    }
 
     if (indices.size() != dimensions)
     {
-        cout << "Dimension of indices does not match those of the data: " <<  "indices.size()=" << indices.size() << ", dimensions=" << dimensions << endl;
         throw domain_error("Dimension of indices does not match those of the data"); // TODO: testcase
     }
 
-    if (!other->has_values)
+    // the bounds in terms of the external indices
+    int lower[MAX_PROVIDER_DIMENSION];
+    int upper[MAX_PROVIDER_DIMENSION];
+    for (unsigned k = 0; k < dimensions; k++)
     {
-        cout << "Memory needs to be allocated when slicing into" << endl;
-        throw domain_error("Memory needs to be allocated when slicing into");
+        lower[k] = offsets[k];
+        upper[k] = offsets[k] + shape_vec[k] - 1;
     }
 
-    // cout << "CStandardRateProvider::slice_into (3)" << endl;    
-
-    other->risk_factors.resize(0);
-    other->shape_vec.resize(0);
-    other->offsets.resize(0);
-    other->dimensions = 0;
-
-    // find all fixed dimensions
-    vector<bool> dims_fixed(shape_vec.size(), false);
-    int required_size = 1;
-    for (unsigned d = 0; d < dimensions; d++)
+    if (edge_mode == CRateEdgeMode::STRICT)
     {
-        if (indices[d] != -1)
-        {
-            dims_fixed[d] = true;
-        }
-        else
+        // validate all indices in one (branch free) pass per dimension before the lookup
+        for (unsigned k = 0; k < dimensions; k++)
         {
-            required_size *= shape_vec[d];
-            other->add_risk_factor(risk_factors[d]);
-            other->shape_vec.push_back(shape_vec[d]);
-            other->offsets.push_back(offsets[d]);
-            other->dimensions++;
+            const int *ind = indices[k];
+            const int off = offsets[k];
+            const unsigned lim = (unsigned)shape_vec[k];
+            unsigned invalid = 0;
+            for (size_t j = 0; j < length; j++)
+            {
+                invalid |= (unsigned)(ind[j] - off) >= lim;
+            }
+            if (invalid)
+            {
+                throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max length is " + std::to_string(shape_vec[k]) + ".");
+            }
         }
     }
 
-    vector<int> bounds_lower(shape_vec.size(), 0);
-    vector<int> bounds_upper(shape_vec.size(), 0);
+    gather_rates(out_array, length, values.get(), dimensions, strides.data(), base_index, indices.data(),
+                 edge_mode == CRateEdgeMode::CLAMP, lower, upper);
+}
 
-    if (other->capacity < required_size)
+bool CStandardRateProvider::covers(const int *lower, const int *upper) const
+{
+    if (!has_values)
     {
-        throw domain_error("Capacity too small for slicing."); // TODO: testcase
+        return false;
     }
 
-    other->number_values = required_size;
-    double *new_vals = other->values.get(); //  double[required_size];
-
-    // determine the bounds
-    for (unsigned d = 0; d < dimensions; d++)
+    if (edge_mode == CRateEdgeMode::CLAMP)
+    {
+        return true;
+    }
+
+    for (unsigned k = 0; k < dimensions; k++)
+    {
+        if (lower[k] - offsets[k] < 0 || upper[k] - offsets[k] >= shape_vec[k])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Cache of rate vectors, one per slot, which are computed on first use. Slots are published
+ * atomically so that the cache can be shared by concurrently running projections.
+ */
+class CLazyRateCache
+{
+private:
+    size_t num_slots;
+    unique_ptr<atomic<const double *>[]> slots;
+
+public:
+    CLazyRateCache(size_t num_slots) : num_slots(num_slots), slots(new atomic<const double *>[num_slots])
+    {
+        for (size_t j = 0; j < num_slots; j++)
+        {
+            slots[j].store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    ~CLazyRateCache()
+    {
+        for (size_t j = 0; j < num_slots; j++)
+        {
+            delete[] slots[j].load(memory_order_relaxed);
+        }
+    }
+
+    CLazyRateCache(const CLazyRateCache &) = delete;
+    CLazyRateCache &operator=(const CLazyRateCache &) = delete;
+
+    /// Return the vector stored in the slot or null if it has not been computed yet.
+    const double *get(size_t slot) const
+    {
+        return slots[slot].load(memory_order_acquire);
+    }
+
+    /// Store the vector (allocated with new[]) in the slot unless another thread was faster,
+    /// returns the vector held by the slot afterwards.
+    const double *publish(size_t slot, const double *vec)
+    {
+        const double *expected = nullptr;
+        if (slots[slot].compare_exchange_strong(expected, vec, memory_order_acq_rel, memory_order_acquire))
+        {
+            return vec;
+        }
+        delete[] vec;
+        return expected;
+    }
+
+    /// Return the number of slots which have been computed.
+    size_t count() const
     {
-        if (dims_fixed[d])
+        size_t cnt = 0;
+        for (size_t j = 0; j < num_slots; j++)
         {
-            bounds_lower[d] = indices[d] - offsets[d];
-            bounds_upper[d] = indices[d] - offsets[d] + 1; // exclusive
-            if (bounds_lower[d] < 0 || bounds_upper[d] > shape_vec[d])
+            cnt += slots[j].load(memory_order_relaxed) != nullptr;
+        }
+        return cnt;
+    }
+};
+
+/**
+ * @brief Provider for generational tables with a mortality trend. The rates
+ *
+ *     q(x, t) = q_base(x) * exp(-F(x, t) * (t - base_year)),  F(x, t) = F(x) + w(t) * (F_initial(x) - F(x))
+ *
+ * are calculated on demand rather than materialized over the calendar years (`F_initial` and `w` are optional,
+ * w(t) is the weight of the initial trend in year t). Besides Age and CalendarYear the base rates and trends may
+ * depend on further (segment) risk factors like Gender. The rates of a cohort (year of birth) are calculated once
+ * on first use for all ages, i.e. along the diagonal which a projection walks through.
+ */
+class CTrendRateProvider : public CBaseRateProvider
+{
+
+protected:
+    // base data over all risk factors except CalendarYear (immutable, shared by clones and slices)
+    shared_ptr<const double> base_rates = nullptr;
+    shared_ptr<const double> trend = nullptr;
+    shared_ptr<const double> initial_trend = nullptr; // may be null
+    shared_ptr<const double> trend_weights = nullptr; // one per calendar year, may be null
+    bool has_values = false;
+
+    vector<int> shape_vec;       // shape of the (virtual) table including the CalendarYear dimension
+    vector<int> offsets;         // offset to be applied when queried for rates
+    vector<int> base_strides;    // step widths in the base data (0 for CalendarYear)
+    vector<int> segment_strides; // step widths of the segment number (0 for Age and CalendarYear)
+    unsigned int dimensions = 0;
+    int age_dim = -1;
+    int year_dim = -1;
+    int base_year = 0;
+    int num_cohorts = 0;
+
+    CRateEdgeMode edge_mode = CRateEdgeMode::STRICT;
+
+    // rates per segment and cohort (shared by clones)
+    shared_ptr<CLazyRateCache> cohort_cache = nullptr;
+
+    // private methods
+    void set_layout();
+    const double *calculate_cohort_rates(int segment_base_index, int cohort_index) const;
+
+public:
+    CTrendRateProvider() {}
+    virtual ~CTrendRateProvider() {}
+
+    shared_ptr<CBaseRateProvider> clone() const override;
+
+    int get_dimension() const { return dimensions; }
+    const vector<int> &get_shape() const { return shape_vec; }
+    const vector<int> &get_offsets() const { return offsets; }
+    int get_base_year() const { return base_year; }
+
+    /// Return the number of cohort rate vectors calculated so far.
+    size_t get_cached_cohorts() const { return cohort_cache ? cohort_cache->count() : 0; }
+
+    CRateEdgeMode get_edge_mode() const { return edge_mode; }
+    void set_edge_mode(CRateEdgeMode mode) override { edge_mode = mode; }
+
+    void add_risk_factor(CRiskFactors rf) override
+    {
+        for (auto i_rf : risk_factors)
+        {
+            if (rf == i_rf)
             {
-                throw domain_error("Slicing indexes exceed dimensions"); // TODO: testcase
+                throw logic_error("Adding a risk factor for the second time.");
             }
         }
+        risk_factors.push_back(rf);
+    }
+
+    /**
+     * @brief Set the data of the provider, the arrays are copied.
+     *
+     * @param shape_vec_in Shape of the table, one entry per risk factor (including Age and CalendarYear)
+     * @param offsets_in Offsets, one entry per risk factor (the one of CalendarYear is the first year)
+     * @param base_year_in Year of the base rates
+     * @param base_rates_in Base rates in row-major order over all risk factors except CalendarYear
+     * @param trend_in Trend in the same layout as the base rates
+     * @param initial_trend_in Optional initial trend in the same layout as the base rates
+     * @param trend_weights_in Optional weights of the initial trend, one per calendar year
+     */
+    void set_values(vector<int> &shape_vec_in, vector<int> &offsets_in, int base_year_in,
+                    const double *base_rates_in, const double *trend_in,
+                    const double *initial_trend_in = nullptr, const double *trend_weights_in = nullptr);
+
+    string to_string() const override;
+
+    double get_rate(const vector<int> &indices) const override;
+
+    double get_rate_unchecked(const int *indices) const override;
+
+    void get_rates(double *out_array, size_t length, const vector<int *> &indices) const override;
+
+    bool covers(const int *lower, const int *upper) const override;
+
+    bool get_index_range(int *lower, int *upper) const override
+    {
+        if (!has_values)
+        {
+            return false;
+        }
+        for (unsigned k = 0; k < dimensions; k++)
+        {
+            lower[k] = offsets[k];
+            upper[k] = offsets[k] + shape_vec[k] - 1;
+        }
+        return true;
+    }
+
+    bool resolves_out_of_range() const override
+    {
+        return edge_mode == CRateEdgeMode::CLAMP;
+    }
+
+    bool is_lazy() const override
+    {
+        return true;
+    }
+
+    /// Given a vector of indexes take only the dimensions where the values is "-1" in full
+    //  and otherwise restrict to the index provided, only the segment risk factors can be fixed.
+    shared_ptr<CTrendRateProvider> slice(const vector<int> &indices) const;
+
+    // perform a slicing operation into another provider object (no data is copied)
+    void slice_into(const vector<int> &indices, CBaseRateProvider *other) const override;
+};
+
+shared_ptr<CBaseRateProvider> CTrendRateProvider::clone() const
+{
+    // the data is immutable and the cached rates do not depend on the edge mode, so both are shared
+    return static_pointer_cast<CBaseRateProvider>(make_shared<CTrendRateProvider>(*this));
+}
+
+void CTrendRateProvider::set_values(vector<int> &shape_vec_in, vector<int> &offsets_in, int base_year_in,
+                                    const double *base_rates_in, const double *trend_in,
+                                    const double *initial_trend_in, const double *trend_weights_in)
+{
+    if (has_values)
+    {
+        throw domain_error("Values already set.");
+    }
+
+    dimensions = (unsigned)risk_factors.size();
+    if (shape_vec_in.size() != dimensions || offsets_in.size() != dimensions)
+    {
+        throw domain_error("Shape_vec and offsets length must match number of risk_factors.");
+    }
+    if (!base_rates_in || !trend_in)
+    {
+        throw domain_error("Base rates and trend are required.");
+    }
+    if (initial_trend_in && !trend_weights_in)
+    {
+        throw domain_error("An initial trend requires trend weights.");
+    }
+    for (int d : shape_vec_in)
+    {
+        if (d < 1)
+        {
+            throw domain_error("Shape must be positive.");
+        }
+    }
+
+    shape_vec = shape_vec_in;
+    offsets = offsets_in;
+    base_year = base_year_in;
+
+    // row-major strides of the base data which does not have the CalendarYear dimension
+    base_strides.assign(dimensions, 0);
+    int base_size = 1;
+    for (int k = (int)dimensions - 1; k >= 0; k--)
+    {
+        if (risk_factors[k] != CRiskFactors::CalendarYear)
+        {
+            base_strides[k] = base_size;
+            base_size *= shape_vec[k];
+        }
+    }
+    set_layout();
+
+    auto copy_array = [](const double *src, size_t len) -> shared_ptr<const double> {
+        shared_ptr<double> storage(new double[len], std::default_delete<double[]>());
+        std::copy(src, src + len, storage.get());
+        return storage;
+    };
+    base_rates = copy_array(base_rates_in, base_size);
+    trend = copy_array(trend_in, base_size);
+    initial_trend = initial_trend_in ? copy_array(initial_trend_in, base_size) : nullptr;
+    trend_weights = initial_trend_in ? copy_array(trend_weights_in, shape_vec[year_dim]) : nullptr;
+    has_values = true;
+}
+
+void CTrendRateProvider::set_layout()
+{
+    // locate Age and CalendarYear, all other risk factors make up the segments
+    age_dim = -1;
+    year_dim = -1;
+    segment_strides.assign(dimensions, 0);
+    int num_segments = 1;
+    for (int k = (int)dimensions - 1; k >= 0; k--)
+    {
+        if (risk_factors[k] == CRiskFactors::Age)
+        {
+            age_dim = k;
+        }
+        else if (risk_factors[k] == CRiskFactors::CalendarYear)
+        {
+            year_dim = k;
+        }
         else
         {
-            bounds_lower[d] = 0;
-            bounds_upper[d] = shape_vec[d]; // exclusive
+            segment_strides[k] = num_segments;
+            num_segments *= shape_vec[k];
+        }
+    }
+    if (age_dim < 0 || year_dim < 0)
+    {
+        throw domain_error("A trend provider requires the risk factors Age and CalendarYear.");
+    }
+
+    // cohorts are identified by (year - age) relative to the youngest age in the first year
+    num_cohorts = shape_vec[year_dim] + shape_vec[age_dim] - 1;
+    cohort_cache = make_shared<CLazyRateCache>((size_t)num_segments * num_cohorts);
+}
+
+const double *CTrendRateProvider::calculate_cohort_rates(int segment_base_index, int cohort_index) const
+{
+    const int num_ages = shape_vec[age_dim];
+    const int num_years = shape_vec[year_dim];
+    const int age_stride = base_strides[age_dim];
+    const double *q = base_rates.get();
+    const double *f = trend.get();
+    const double *f_init = initial_trend.get();
+    const double *w = trend_weights.get();
+
+    double *rates = new double[num_ages];
+    for (int ia = 0; ia < num_ages; ia++)
+    {
+        int iy = cohort_index - (num_ages - 1) + ia;
+        if (iy < 0 || iy >= num_years)
+        {
+            rates[ia] = 0.0; // the cohort does not reach this age within the years of the table
+            continue;
         }
+        int b = segment_base_index + age_stride * ia;
+        double f_eff = f_init ? f[b] + w[iy] * (f_init[b] - f[b]) : f[b];
+        rates[ia] = q[b] * exp(-f_eff * (offsets[year_dim] + iy - base_year));
     }
+    return rates;
+}
 
-    vector<int> counters = bounds_lower;
-    int new_val_counter = 0;
-    bool incremented;
-    do
+string CTrendRateProvider::to_string() const
+{
+    string s = "<CTrendRateProvider with RF (";
+    bool first = true;
+    for (auto rf : risk_factors)
+    {
+        if (!first)
+        {
+            s += ", ";
+        }
+        s += CRiskFactors_names(rf);
+        first = false;
+    }
+    return s + ")>";
+}
+
+double CTrendRateProvider::get_rate(const vector<int> &indices) const
+{
+    if (!has_values)
+    {
+        throw logic_error("No values have been set before querying.");
+    }
+
+    if (indices.size() != dimensions)
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
+
+    if (edge_mode == CRateEdgeMode::STRICT)
     {
-        // calculate the index belonging to our current counter
-        int index = 0;
         for (unsigned k = 0; k < dimensions; k++)
         {
-            index += strides[k] * counters[k];
+            int ind_temp = indices[k] - offsets[k];
+            if (ind_temp < 0 || ind_temp >= shape_vec[k])
+            {
+                throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max index allowed is "
+                                   + std::to_string(shape_vec[k] - 1) + ", tried with " +  std::to_string(ind_temp) + ".");
+            }
+        }
+    }
+
+    return get_rate_unchecked(indices.data());
+}
+
+double CTrendRateProvider::get_rate_unchecked(const int *indices) const
+{
+    int segment = 0;
+    int segment_base_index = 0;
+    int ia = 0;
+    int iy = 0;
+    for (unsigned k = 0; k < dimensions; k++)
+    {
+        int ind = indices[k] - offsets[k];
+        if (edge_mode == CRateEdgeMode::CLAMP)
+        {
+            ind = ind < 0 ? 0 : (ind >= shape_vec[k] ? shape_vec[k] - 1 : ind);
+        }
+
+        if ((int)k == age_dim)
+        {
+            ia = ind;
+        }
+        else if ((int)k == year_dim)
+        {
+            iy = ind;
         }
+        else
+        {
+            segment += segment_strides[k] * ind;
+            segment_base_index += base_strides[k] * ind;
+        }
+    }
+
+    int cohort_index = iy - ia + shape_vec[age_dim] - 1;
+    size_t slot = (size_t)segment * num_cohorts + cohort_index;
+    const double *rates = cohort_cache->get(slot);
+    if (!rates)
+    {
+        rates = cohort_cache->publish(slot, calculate_cohort_rates(segment_base_index, cohort_index));
+    }
+    return rates[ia];
+}
 
-        // cout << "Adding ";
-        // print_vec(counters, "counters");
+void CTrendRateProvider::get_rates(double *out_array, size_t length, const vector<int *> &indices) const
+{
+    if (!has_values)
+    {
+        throw logic_error("No values have been set before querying.");
+    }
 
-        new_vals[new_val_counter++] = values.get()[index];
+    if (indices.size() != dimensions)
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
 
-        // increment
-        incremented = false;
-        for (int d = dimensions - 1; d >= 0; d--)
+    if (edge_mode == CRateEdgeMode::STRICT)
+    {
+        for (unsigned k = 0; k < dimensions; k++)
         {
-            if (counters[d] + 1 < bounds_upper[d])
+            const int *ind = indices[k];
+            const unsigned lim = (unsigned)shape_vec[k];
+            unsigned invalid = 0;
+            for (size_t j = 0; j < length; j++)
             {
-                counters[d] += 1;
-                for (int d2 = d + 1; d2 <= ((int)dimensions) - 1; d2++)
-                {
-                    counters[d2] = bounds_lower[d2];
-                }
-                incremented = true;
-                break;
+                invalid |= (unsigned)(ind[j] - offsets[k]) >= lim;
+            }
+            if (invalid)
+            {
+                throw out_of_range("Indices out of Range for dimension #" + std::to_string(k) + ", max length is " + std::to_string(shape_vec[k]) + ".");
             }
         }
-    } while (incremented);
+    }
 
-    // special case: reduction to constant provider
-    if (required_size == 1)
+    int this_indices[MAX_PROVIDER_DIMENSION];
+    for (size_t j = 0; j < length; j++)
     {
-        if (other->shape_vec.size() == 0)
+        for (unsigned k = 0; k < dimensions; k++)
         {
-            other->shape_vec.push_back(1);
+            this_indices[k] = indices[k][j];
         }
-        if (other->offsets.size() == 0)
+        out_array[j] = get_rate_unchecked(this_indices);
+    }
+}
+
+bool CTrendRateProvider::covers(const int *lower, const int *upper) const
+{
+    if (!has_values)
+    {
+        return false;
+    }
+
+    if (edge_mode == CRateEdgeMode::CLAMP)
+    {
+        return true;
+    }
+
+    for (unsigned k = 0; k < dimensions; k++)
+    {
+        if (lower[k] - offsets[k] < 0 || upper[k] - offsets[k] >= shape_vec[k])
         {
-            other->offsets.push_back(0);
+            return false;
         }
     }
+    return true;
+}
 
-    // calculate the strides
-    other->set_strides();
+shared_ptr<CTrendRateProvider> CTrendRateProvider::slice(const vector<int> &indices) const
+{
+    auto slicedProviderPtr = make_shared<CTrendRateProvider>();
+    slice_into(indices, slicedProviderPtr.get());
+    return slicedProviderPtr;
 }
 
-void CStandardRateProvider::set_strides()
+void CTrendRateProvider::slice_into(const vector<int> &indices, CBaseRateProvider *other_in) const
 {
-    // calculate the strides
-    strides.assign(shape_vec.size(), 1);
-    int acc_dims = 1;
-    for (int i = (int)shape_vec.size() - 1; i >= 0; i--)
+    CTrendRateProvider *other = dynamic_cast<CTrendRateProvider *>(other_in);
+    if (!other)
     {
-        strides[i] = acc_dims;
-        acc_dims *= shape_vec[i];
+        throw domain_error("Slicing into a provider of a different type.");
+    }
+
+    if (indices.size() != dimensions)
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
+
+    if (!has_values)
+    {
+        throw logic_error("No values have been set before slicing.");
+    }
+
+    vector<CRiskFactors> risk_factors_sliced;
+    vector<int> shape_vec_sliced;
+    vector<int> offsets_sliced;
+    vector<int> base_strides_sliced;
+
+    // fixing segment risk factors moves the origin of the base data
+    int origin = 0;
+    for (unsigned d = 0; d < dimensions; d++)
+    {
+        if (indices[d] != -1)
+        {
+            if ((int)d == age_dim || (int)d == year_dim)
+            {
+                throw domain_error("Age and CalendarYear cannot be sliced in a trend provider.");
+            }
+            int ind_temp = indices[d] - offsets[d];
+            if (ind_temp < 0 || ind_temp >= shape_vec[d])
+            {
+                throw domain_error("Slicing indexes exceed dimensions");
+            }
+            origin += base_strides[d] * ind_temp;
+        }
+        else
+        {
+            risk_factors_sliced.push_back(risk_factors[d]);
+            shape_vec_sliced.push_back(shape_vec[d]);
+            offsets_sliced.push_back(offsets[d]);
+            base_strides_sliced.push_back(base_strides[d]);
+        }
+    }
+
+    other->base_rates = shared_ptr<const double>(base_rates, base_rates.get() + origin);
+    other->trend = shared_ptr<const double>(trend, trend.get() + origin);
+    other->initial_trend = initial_trend ? shared_ptr<const double>(initial_trend, initial_trend.get() + origin) : nullptr;
+    other->trend_weights = trend_weights;
+    other->has_values = true;
+    other->base_year = base_year;
+
+    other->risk_factors = risk_factors_sliced;
+    other->shape_vec = shape_vec_sliced;
+    other->offsets = offsets_sliced;
+    other->base_strides = base_strides_sliced;
+    other->dimensions = (unsigned)risk_factors_sliced.size();
+    other->set_layout();
+    other->edge_mode = edge_mode;
+}
+
+/// Operation applied by a composite provider to the rates of its children
+enum class CCompositeOperation : int
+{
+    PRODUCT, // 0
+    SUM,     // 1
+    MIN,     // 2
+    MAX      // 3
+};
+
+/**
+ * @brief Provider which combines the rates of its child providers (which may be composite themselves) by a
+ * product, sum, minimum or maximum, e.g. base table x experience factor x smoker loading x trend. Children
+ * without risk factors (scalars) are folded into one value. Lookups evaluate the whole tree in one pass so that
+ * variants of an assumption can be expressed without materializing a table for each.
+ *
+ * The risk factors of the composite are the union of those of the children (in the order of appearance).
+ */
+class CCompositeRateProvider : public CBaseRateProvider
+{
+
+protected:
+    CCompositeOperation op;
+    vector<shared_ptr<CBaseRateProvider>> children; // children with risk factors
+    double scalar = 0.0;                            // the children without risk factors folded into one value
+    bool has_scalar = false;
+
+    // positions of the risk factors of each child in the risk factors of the composite
+    vector<vector<int>> child_rf_positions;
+
+    // private methods
+    void set_risk_factors();
+
+    double combine(double a, double b) const
+    {
+        switch (op)
+        {
+        case CCompositeOperation::PRODUCT:
+            return a * b;
+        case CCompositeOperation::SUM:
+            return a + b;
+        case CCompositeOperation::MIN:
+            return a < b ? a : b;
+        default:
+            return a > b ? a : b;
+        }
+    }
+
+    void combine_into(double *out, const double *other, size_t length) const;
+
+public:
+    /**
+     * @brief Construct a new composite provider.
+     *
+     * @param operation The operation applied to the rates of the children
+     * @param children_in The child providers (at least one)
+     */
+    CCompositeRateProvider(CCompositeOperation operation, const vector<shared_ptr<CBaseRateProvider>> &children_in);
+    virtual ~CCompositeRateProvider() {}
+
+    shared_ptr<CBaseRateProvider> clone() const override;
+
+    CCompositeOperation get_operation() const { return op; }
+    size_t get_number_of_children() const { return children.size(); }
+
+    void add_risk_factor(CRiskFactors rf) override
+    {
+        throw logic_error("The risk factors of a composite provider are determined by its children.");
     }
+
+    void set_edge_mode(CRateEdgeMode mode) override
+    {
+        for (auto &child : children)
+        {
+            child->set_edge_mode(mode);
+        }
+    }
+
+    string to_string() const override;
+
+    double get_rate(const vector<int> &indices) const override;
+
+    double get_rate_unchecked(const int *indices) const override;
+
+    void get_rates(double *out_array, size_t length, const vector<int *> &indices) const override;
+
+    void get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const override;
+
+    bool covers(const int *lower, const int *upper) const override;
+
+    bool get_index_range(int *lower, int *upper) const override;
+
+    bool resolves_out_of_range() const override
+    {
+        for (auto &child : children)
+        {
+            if (!child->resolves_out_of_range())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool is_lazy() const override
+    {
+        for (auto &child : children)
+        {
+            if (child->is_lazy())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Slice all children, the result has the same structure as this provider.
+    shared_ptr<CCompositeRateProvider> slice(const vector<int> &indices) const;
+
+    // perform a slicing operation into another composite provider of the same structure (e.g. a clone)
+    void slice_into(const vector<int> &indices, CBaseRateProvider *other) const override;
+};
+
+CCompositeRateProvider::CCompositeRateProvider(CCompositeOperation operation, const vector<shared_ptr<CBaseRateProvider>> &children_in) : op(operation)
+{
+    if (children_in.empty())
+    {
+        throw domain_error("A composite provider requires at least one child.");
+    }
+
+    vector<int> no_indices;
+    for (const shared_ptr<CBaseRateProvider> &child : children_in)
+    {
+        if (!child)
+        {
+            throw domain_error("Child providers must not be null.");
+        }
+        if (child->get_risk_factors().empty())
+        {
+            double val = child->get_rate(no_indices);
+            scalar = has_scalar ? combine(scalar, val) : val;
+            has_scalar = true;
+        }
+        else
+        {
+            children.push_back(child);
+        }
+    }
+    set_risk_factors();
+}
+
+void CCompositeRateProvider::set_risk_factors()
+{
+    risk_factors.clear();
+    child_rf_positions.assign(children.size(), vector<int>());
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        for (CRiskFactors rf : children[c]->get_risk_factors())
+        {
+            auto it = std::find(risk_factors.begin(), risk_factors.end(), rf);
+            if (it == risk_factors.end())
+            {
+                risk_factors.push_back(rf);
+                it = risk_factors.end() - 1;
+            }
+            child_rf_positions[c].push_back((int)(it - risk_factors.begin()));
+        }
+    }
+}
+
+shared_ptr<CBaseRateProvider> CCompositeRateProvider::clone() const
+{
+    auto p_clone = make_shared<CCompositeRateProvider>(*this);
+    for (auto &child : p_clone->children)
+    {
+        child = child->clone();
+    }
+    return static_pointer_cast<CBaseRateProvider>(p_clone);
+}
+
+string CCompositeRateProvider::to_string() const
+{
+    static const char *op_names[] = {"PRODUCT", "SUM", "MIN", "MAX"};
+    string s = string("<CCompositeRateProvider ") + op_names[(int)op] + "(";
+    bool first = true;
+    if (has_scalar)
+    {
+        s += std::to_string(scalar);
+        first = false;
+    }
+    for (auto &child : children)
+    {
+        if (!first)
+        {
+            s += ", ";
+        }
+        s += child->to_string();
+        first = false;
+    }
+    return s + ")>";
+}
+
+double CCompositeRateProvider::get_rate(const vector<int> &indices) const
+{
+    if (indices.size() != risk_factors.size())
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
+
+    // the children check the ranges
+    double result = scalar;
+    bool first = !has_scalar;
+    vector<int> child_indices;
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        child_indices.resize(child_rf_positions[c].size());
+        for (size_t l = 0; l < child_indices.size(); l++)
+        {
+            child_indices[l] = indices[child_rf_positions[c][l]];
+        }
+        double val = children[c]->get_rate(child_indices);
+        result = first ? val : combine(result, val);
+        first = false;
+    }
+    return result;
+}
+
+double CCompositeRateProvider::get_rate_unchecked(const int *indices) const
+{
+    int child_indices[MAX_PROVIDER_DIMENSION];
+    double result = scalar;
+    bool first = !has_scalar;
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        const vector<int> &positions = child_rf_positions[c];
+        for (size_t l = 0; l < positions.size(); l++)
+        {
+            child_indices[l] = indices[positions[l]];
+        }
+        double val = children[c]->get_rate_unchecked(child_indices);
+        result = first ? val : combine(result, val);
+        first = false;
+    }
+    return result;
+}
+
+void CCompositeRateProvider::combine_into(double *out, const double *other, size_t length) const
+{
+    // one loop per operation so that the compiler can vectorize it
+    switch (op)
+    {
+    case CCompositeOperation::PRODUCT:
+        for (size_t j = 0; j < length; j++)
+            out[j] *= other[j];
+        break;
+    case CCompositeOperation::SUM:
+        for (size_t j = 0; j < length; j++)
+            out[j] += other[j];
+        break;
+    case CCompositeOperation::MIN:
+        for (size_t j = 0; j < length; j++)
+            out[j] = other[j] < out[j] ? other[j] : out[j];
+        break;
+    case CCompositeOperation::MAX:
+        for (size_t j = 0; j < length; j++)
+            out[j] = other[j] > out[j] ? other[j] : out[j];
+        break;
+    }
+}
+
+void CCompositeRateProvider::get_rates(double *out_array, size_t length, const vector<int *> &indices) const
+{
+    if (indices.size() != risk_factors.size())
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
+
+    // the records are processed in blocks which stay in the cache while all children are combined
+    const size_t BLOCK_SIZE = 256;
+    double block[BLOCK_SIZE];
+    vector<int *> child_indices;
+    for (size_t start = 0; start < length; start += BLOCK_SIZE)
+    {
+        size_t block_length = length - start < BLOCK_SIZE ? length - start : BLOCK_SIZE;
+        double *out = out_array + start;
+        if (has_scalar)
+        {
+            std::fill(out, out + block_length, scalar);
+        }
+
+        for (size_t c = 0; c < children.size(); c++)
+        {
+            const vector<int> &positions = child_rf_positions[c];
+            child_indices.resize(positions.size());
+            for (size_t l = 0; l < positions.size(); l++)
+            {
+                child_indices[l] = indices[positions[l]] + start;
+            }
+
+            if (c == 0 && !has_scalar)
+            {
+                children[c]->get_rates(out, block_length, child_indices);
+            }
+            else
+            {
+                children[c]->get_rates(block, block_length, child_indices);
+                combine_into(out, block, block_length);
+            }
+        }
+    }
+}
+
+void CCompositeRateProvider::get_diagonal_unchecked(double *out_array, size_t out_stride, size_t length, const int *start, const int *step) const
+{
+    // combine the diagonals of the children contiguously, then write them out with the stride
+    vector<double> diagonal(length, scalar);
+    vector<double> child_diagonal(length);
+    int child_start[MAX_PROVIDER_DIMENSION];
+    int child_step[MAX_PROVIDER_DIMENSION];
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        const vector<int> &positions = child_rf_positions[c];
+        for (size_t l = 0; l < positions.size(); l++)
+        {
+            child_start[l] = start[positions[l]];
+            child_step[l] = step[positions[l]];
+        }
+
+        if (c == 0 && !has_scalar)
+        {
+            children[c]->get_diagonal_unchecked(diagonal.data(), 1, length, child_start, child_step);
+        }
+        else
+        {
+            children[c]->get_diagonal_unchecked(child_diagonal.data(), 1, length, child_start, child_step);
+            combine_into(diagonal.data(), child_diagonal.data(), length);
+        }
+    }
+
+    for (size_t j = 0; j < length; j++)
+    {
+        out_array[j * out_stride] = diagonal[j];
+    }
+}
+
+bool CCompositeRateProvider::covers(const int *lower, const int *upper) const
+{
+    int child_lower[MAX_PROVIDER_DIMENSION];
+    int child_upper[MAX_PROVIDER_DIMENSION];
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        const vector<int> &positions = child_rf_positions[c];
+        for (size_t l = 0; l < positions.size(); l++)
+        {
+            child_lower[l] = lower[positions[l]];
+            child_upper[l] = upper[positions[l]];
+        }
+        if (!children[c]->covers(child_lower, child_upper))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CCompositeRateProvider::get_index_range(int *lower, int *upper) const
+{
+    // intersection of the ranges of the children which reject out-of-range indices, for risk factors
+    // only used by clamping children the union of their ranges
+    size_t num_rfs = risk_factors.size();
+    vector<bool> strict_used(num_rfs, false);
+    vector<int> clamp_lower(num_rfs, std::numeric_limits<int>::max());
+    vector<int> clamp_upper(num_rfs, std::numeric_limits<int>::min());
+    for (size_t k = 0; k < num_rfs; k++)
+    {
+        lower[k] = std::numeric_limits<int>::min();
+        upper[k] = std::numeric_limits<int>::max();
+    }
+
+    int child_lower[MAX_PROVIDER_DIMENSION];
+    int child_upper[MAX_PROVIDER_DIMENSION];
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        if (!children[c]->get_index_range(child_lower, child_upper))
+        {
+            return false;
+        }
+        bool clamps = children[c]->resolves_out_of_range();
+        const vector<int> &positions = child_rf_positions[c];
+        for (size_t l = 0; l < positions.size(); l++)
+        {
+            int k = positions[l];
+            if (clamps)
+            {
+                clamp_lower[k] = min(clamp_lower[k], child_lower[l]);
+                clamp_upper[k] = max(clamp_upper[k], child_upper[l]);
+            }
+            else
+            {
+                strict_used[k] = true;
+                lower[k] = max(lower[k], child_lower[l]);
+                upper[k] = min(upper[k], child_upper[l]);
+            }
+        }
+    }
+
+    for (size_t k = 0; k < num_rfs; k++)
+    {
+        if (!strict_used[k])
+        {
+            lower[k] = clamp_lower[k];
+            upper[k] = clamp_upper[k];
+        }
+    }
+    return true;
+}
+
+shared_ptr<CCompositeRateProvider> CCompositeRateProvider::slice(const vector<int> &indices) const
+{
+    shared_ptr<CCompositeRateProvider> slicedProviderPtr = static_pointer_cast<CCompositeRateProvider>(clone());
+    slice_into(indices, slicedProviderPtr.get());
+    return slicedProviderPtr;
+}
+
+void CCompositeRateProvider::slice_into(const vector<int> &indices, CBaseRateProvider *other_in) const
+{
+    CCompositeRateProvider *other = dynamic_cast<CCompositeRateProvider *>(other_in);
+    if (!other || other->children.size() != children.size())
+    {
+        throw domain_error("Slicing into a provider of a different structure.");
+    }
+
+    if (indices.size() != risk_factors.size())
+    {
+        throw domain_error("Dimension of indices does not match those of the data");
+    }
+
+    // push the slicing down to the children (the results are not folded so that the structure is kept)
+    vector<vector<int>> child_slice_indices(children.size());
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        for (int pos : child_rf_positions[c])
+        {
+            child_slice_indices[c].push_back(indices[pos]);
+        }
+    }
+    for (size_t c = 0; c < children.size(); c++)
+    {
+        children[c]->slice_into(child_slice_indices[c], other->children[c].get());
+    }
+
+    other->op = op;
+    other->scalar = scalar;
+    other->has_scalar = has_scalar;
+    other->set_risk_factors();
 }
 
 #endif
\ No newline at end of file
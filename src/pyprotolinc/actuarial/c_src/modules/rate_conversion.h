@@ -0,0 +1,350 @@
+/**
+ * @file rate_conversion.h
+ * @author M. Seehafer
+ * @brief Conversion of yearly transition rates to the transition matrix of a time step.
+ * @version 0.2.0
+ * @date 2023-05-20
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The simple method scales the yearly rates linearly with the length of the step. The constant-force method
+ * treats the rates as yearly probabilities of leaving a state and distributes the decrement of the step
+ * proportionally, the matrix exponential treats the rates as intensities of a Markov chain which is
+ * homogeneous during the step. The latter two are memoized by rate set and step length in a cache which
+ * is shared between all projectors of a run.
+ */
+#ifndef C_RATE_CONVERSION_H
+#define C_RATE_CONVERSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+#include "utils.h"
+
+using namespace std;
+
+/// Method to convert yearly rates to the length of a time step
+enum class RateConversion : int
+{
+    SIMPLE,            // 0  a = days / 360 * rate
+    CONSTANT_FORCE,    // 1  constant force of decrement per state during the year
+    MATRIX_EXPONENTIAL // 2  P = exp(days / 360 * Q) with the rates as intensities of the generator Q
+};
+
+/// Returns if a transition with yearly rate zero has probability zero after the conversion, only the matrix
+/// exponential moves probability along chains of transitions within one step.
+inline bool keeps_zero_rates(RateConversion method)
+{
+    return method != RateConversion::MATRIX_EXPONENTIAL;
+}
+
+/// Linear scaling of the off-diagonal yearly rates, the diagonal completes the rows to one.
+inline void convert_rates_simple(unsigned n, const double *yearly, int days, double *out)
+{
+    double duration_factor = days / 360.0;
+    for (unsigned r = 0; r < n; r++)
+    {
+        double sum_row_nondiag = 0;
+        for (unsigned c = 0; c < n; c++)
+        {
+            if (c == r)
+            {
+                continue;
+            }
+            double this_scaled_val = duration_factor * yearly[r * n + c];
+            sum_row_nondiag += this_scaled_val;
+            out[r * n + c] = this_scaled_val;
+        }
+        out[r * n + r] = 1 - sum_row_nondiag;
+    }
+}
+
+/// The off-diagonal yearly rates of a row are probabilities of leaving the state within a year, their total
+/// decrement q is spread with constant force: the state is kept with probability (1 - q)^(days / 360).
+inline void convert_rates_constant_force(unsigned n, const double *yearly, int days, double *out)
+{
+    double duration_factor = days / 360.0;
+    for (unsigned r = 0; r < n; r++)
+    {
+        double q = 0;
+        for (unsigned c = 0; c < n; c++)
+        {
+            if (c != r)
+            {
+                q += yearly[r * n + c];
+            }
+        }
+
+        // probability to leave the state during the step
+        double leave;
+        if (q <= 0)
+        {
+            leave = 0;
+        }
+        else if (q >= 1)
+        {
+            leave = 1;
+        }
+        else
+        {
+            leave = -expm1(duration_factor * log1p(-q));
+        }
+
+        for (unsigned c = 0; c < n; c++)
+        {
+            out[r * n + c] = (c == r || q <= 0) ? 0.0 : yearly[r * n + c] / q * leave;
+        }
+        out[r * n + r] = 1 - leave;
+    }
+}
+
+/// The off-diagonal yearly rates are intensities, the transition matrix of the step is the exponential of the
+/// generator scaled to the step (scaling and squaring with a Taylor series).
+inline void convert_rates_matrix_exponential(unsigned n, const double *yearly, int days, double *out)
+{
+    double duration_factor = days / 360.0;
+    size_t nn = (size_t)n * n;
+    vector<double> a(nn), term(nn), next(nn);
+
+    // generator of the step and its norm
+    double norm = 0;
+    for (unsigned r = 0; r < n; r++)
+    {
+        double sum_row_nondiag = 0;
+        for (unsigned c = 0; c < n; c++)
+        {
+            if (c != r)
+            {
+                a[r * n + c] = duration_factor * yearly[r * n + c];
+                sum_row_nondiag += a[r * n + c];
+            }
+        }
+        a[r * n + r] = -sum_row_nondiag;
+        double row_norm = 0;
+        for (unsigned c = 0; c < n; c++)
+        {
+            row_norm += fabs(a[r * n + c]);
+        }
+        norm = max(norm, row_norm);
+    }
+
+    // scale such that the Taylor series converges quickly
+    int squarings = 0;
+    while (norm > 0.5 && squarings < 64)
+    {
+        norm /= 2;
+        squarings++;
+    }
+    double scale = ldexp(1.0, -squarings);
+    for (size_t k = 0; k < nn; k++)
+    {
+        a[k] *= scale;
+    }
+
+    // exp(A) = sum_k A^k / k!, with |A| <= 1/2 the terms beyond the 16th are negligible
+    for (size_t k = 0; k < nn; k++)
+    {
+        out[k] = 0;
+        term[k] = 0;
+    }
+    for (unsigned r = 0; r < n; r++)
+    {
+        out[r * n + r] = 1;
+        term[r * n + r] = 1;
+    }
+    for (int k = 1; k <= 16; k++)
+    {
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                double s = 0;
+                for (unsigned j = 0; j < n; j++)
+                {
+                    s += term[r * n + j] * a[j * n + c];
+                }
+                next[r * n + c] = s / k;
+            }
+        }
+        term.swap(next);
+        for (size_t i = 0; i < nn; i++)
+        {
+            out[i] += term[i];
+        }
+    }
+
+    // undo the scaling
+    for (int k = 0; k < squarings; k++)
+    {
+        for (unsigned r = 0; r < n; r++)
+        {
+            for (unsigned c = 0; c < n; c++)
+            {
+                double s = 0;
+                for (unsigned j = 0; j < n; j++)
+                {
+                    s += out[r * n + j] * out[j * n + c];
+                }
+                next[r * n + c] = s;
+            }
+        }
+        for (size_t i = 0; i < nn; i++)
+        {
+            out[i] = next[i];
+        }
+    }
+}
+
+/// Convert the yearly rates of an n x n matrix to a time step of `days` days (30/360) with the given method.
+inline void convert_rates(RateConversion method, unsigned n, const double *yearly, int days, double *out)
+{
+    switch (method)
+    {
+    case RateConversion::CONSTANT_FORCE:
+        convert_rates_constant_force(n, yearly, days, out);
+        break;
+    case RateConversion::MATRIX_EXPONENTIAL:
+        convert_rates_matrix_exponential(n, yearly, days, out);
+        break;
+    default:
+        convert_rates_simple(n, yearly, days, out);
+    }
+}
+
+/**
+ * @brief Converted transition matrices by yearly rate set and length of the time step. A portfolio passes
+ * through the same cells of the assumption tables again and again, so each conversion is done once per run.
+ * The cache is thread-safe: the entries are spread over shards with a lock each and the conversion runs without
+ * holding a lock. A shard is emptied once it holds its share of the capacity, e.g. for rates which change with
+ * the calendar year; the returned entries stay valid as long as they are referenced.
+ */
+class CRateConversionCache
+{
+public:
+    /// A converted matrix together with its key
+    struct Entry
+    {
+        int days;
+        vector<double> yearly;
+        vector<double> converted;
+    };
+
+    static const size_t NUM_SHARDS = 16;
+
+private:
+    RateConversion _method;
+    unsigned _dimension;
+    size_t _shard_capacity;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        unordered_multimap<size_t, shared_ptr<const Entry>> entries;
+    };
+    mutable Shard _shards[NUM_SHARDS];
+
+    Shard &shard(size_t hash) const { return _shards[(hash >> 7) % NUM_SHARDS]; }
+
+    /// Return the entry of the shard for the yearly rates and the length of the time step (null if not cached).
+    shared_ptr<const Entry> find(Shard &shard, const double *yearly, int days, size_t hash) const
+    {
+        auto range = shard.entries.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (matches(*it->second, yearly, days))
+            {
+                return it->second;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    /**
+     * @brief Construct an empty cache.
+     *
+     * @param method The conversion method.
+     * @param dimension Dimension of the state model.
+     * @param capacity Number of matrices kept at most.
+     */
+    CRateConversionCache(RateConversion method, unsigned dimension, size_t capacity = 1 << 16) : _method(method), _dimension(dimension),
+                                                                                                 _shard_capacity(max((size_t)1, capacity / NUM_SHARDS)) {}
+
+    RateConversion get_method() const { return _method; }   ///< Returns the conversion method
+    unsigned get_dimension() const { return _dimension; }  ///< Returns the dimension of the state model
+
+    /// Returns the number of cached matrices.
+    size_t size() const
+    {
+        size_t total = 0;
+        for (Shard &shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total += shard.entries.size();
+        }
+        return total;
+    }
+
+    /// Hash of a yearly rate set and the length of the time step.
+    size_t key_hash(const double *yearly, int days) const
+    {
+        size_t seed = 0;
+        ::hash_combine(seed, days);
+        for (size_t k = 0; k < (size_t)_dimension * _dimension; k++)
+        {
+            uint64_t bits;
+            memcpy(&bits, yearly + k, sizeof(bits));
+            ::hash_combine(seed, bits);
+        }
+        return seed;
+    }
+
+    /// True if the entry belongs to the given yearly rate set and length of the time step.
+    bool matches(const Entry &entry, const double *yearly, int days) const
+    {
+        return entry.days == days && memcmp(entry.yearly.data(), yearly, entry.yearly.size() * sizeof(double)) == 0;
+    }
+
+    /// Return the cached entry for the yearly rates and the length of the time step, converting them on first use.
+    shared_ptr<const Entry> get(const double *yearly, int days, size_t hash)
+    {
+        Shard &s = shard(hash);
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            shared_ptr<const Entry> cached = find(s, yearly, days, hash);
+            if (cached)
+            {
+                return cached;
+            }
+        }
+
+        // convert without holding the lock, another thread may have converted the same rates meanwhile
+        size_t nn = (size_t)_dimension * _dimension;
+        shared_ptr<Entry> entry = make_shared<Entry>();
+        entry->days = days;
+        entry->yearly.assign(yearly, yearly + nn);
+        entry->converted.resize(nn);
+        convert_rates(_method, _dimension, yearly, days, entry->converted.data());
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        shared_ptr<const Entry> cached = find(s, yearly, days, hash);
+        if (cached)
+        {
+            return cached;
+        }
+        if (s.entries.size() >= _shard_capacity)
+        {
+            s.entries.clear();
+        }
+        s.entries.emplace(hash, entry);
+        return entry;
+    }
+};
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * @file rate_table_file.h
+ * @author M. Seehafer
+ * @brief Binary file format for rate tables which can be memory mapped read-only.
+ * @version 0.2.0
+ * @date 2023-04-22
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * Layout of a file (native byte order):
+ *   - header (CRateTableFileHeader)
+ *   - risk factors (int32, `dimensions` entries)
+ *   - shape (int32, max(1, `dimensions`) entries)
+ *   - offsets (int32, max(1, `dimensions`) entries)
+ *   - padding up to `data_offset` (a multiple of RATE_TABLE_FILE_ALIGNMENT)
+ *   - the values in row-major order (`number_values` entries of type `dtype`)
+ *
+ * A table opened with `open_rate_table` refers directly to the mapped pages, so all processes and threads
+ * opening the same file share one copy in the page cache and no parsing is needed. Files are replaced
+ * atomically by `write_rate_table` so that existing mappings remain valid.
+ */
+#ifndef C_RATE_TABLE_FILE_H
+#define C_RATE_TABLE_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PYPROTOLINC_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "risk_factors.h"
+#include "providers.h"
+
+using namespace std;
+
+/// Magic bytes at the start of a rate table file
+const char RATE_TABLE_FILE_MAGIC[8] = {'P', 'P', 'L', 'C', 'R', 'T', 'B', 'L'};
+
+/// Current version of the file format
+const uint32_t RATE_TABLE_FILE_VERSION = 1;
+
+/// Alignment of the values in the file (in bytes)
+const uint64_t RATE_TABLE_FILE_ALIGNMENT = 64;
+
+/// Data type of the values stored in a rate table file
+enum class CRateTableDType : uint32_t
+{
+    FLOAT64 = 1
+};
+
+/// Fixed size header of a rate table file
+struct CRateTableFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t dimensions;
+    int32_t edge_mode;
+    uint64_t data_offset;
+    uint64_t number_values;
+};
+
+/**
+ * @brief Write the table of the provider (including its risk factors, shape, offsets and edge mode) to a file.
+ * The data is written to a temporary file first which then replaces the target.
+ *
+ * @param path Path of the file to be written
+ * @param provider The provider with values set
+ */
+void write_rate_table(const string &path, const CStandardRateProvider &provider)
+{
+    unsigned dimensions = provider.get_dimension();
+    const vector<int> &shape_vec = provider.get_shape();
+    const vector<int> &offsets = provider.get_offsets();
+    if (shape_vec.empty())
+    {
+        throw logic_error("No values have been set before writing the table.");
+    }
+
+    vector<int32_t> meta;
+    for (CRiskFactors rf : provider.get_risk_factors())
+    {
+        meta.push_back((int32_t)rf);
+    }
+    meta.insert(meta.end(), shape_vec.begin(), shape_vec.end());
+    meta.insert(meta.end(), offsets.begin(), offsets.end());
+
+    CRateTableFileHeader header;
+    memcpy(header.magic, RATE_TABLE_FILE_MAGIC, sizeof(header.magic));
+    header.version = RATE_TABLE_FILE_VERSION;
+    header.dtype = (uint32_t)CRateTableDType::FLOAT64;
+    header.dimensions = dimensions;
+    header.edge_mode = (int32_t)provider.get_edge_mode();
+    uint64_t meta_end = sizeof(CRateTableFileHeader) + meta.size() * sizeof(int32_t);
+    header.data_offset = (meta_end + RATE_TABLE_FILE_ALIGNMENT - 1) / RATE_TABLE_FILE_ALIGNMENT * RATE_TABLE_FILE_ALIGNMENT;
+    header.number_values = (uint64_t)provider.size();
+
+    vector<double> vals(provider.size());
+    provider.get_values(vals.data());
+
+    string tmp_path = path + ".tmp";
+    {
+        ofstream out(tmp_path, ios::binary | ios::trunc);
+        if (!out)
+        {
+            throw runtime_error("Cannot open rate table file for writing: " + tmp_path);
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(meta.data()), meta.size() * sizeof(int32_t));
+        vector<char> padding(header.data_offset - meta_end, 0);
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char *>(vals.data()), vals.size() * sizeof(double));
+        out.close();
+        if (!out)
+        {
+            std::remove(tmp_path.c_str());
+            throw runtime_error("Error writing rate table file: " + tmp_path);
+        }
+    }
+
+#ifndef PYPROTOLINC_HAS_MMAP
+    std::remove(path.c_str()); // rename does not replace existing files on all platforms
+#endif
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        throw runtime_error("Cannot replace rate table file: " + path);
+    }
+}
+
+/// Validate the header and the metadata of a rate table file of `file_size` bytes starting at `base` and set up the provider.
+void init_rate_table_provider(const char *base, size_t file_size, shared_ptr<const char> storage, CStandardRateProvider &provider)
+{
+    CRateTableFileHeader header;
+    if (file_size < sizeof(header))
+    {
+        throw domain_error("Rate table file too small.");
+    }
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, RATE_TABLE_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        throw domain_error("Not a rate table file.");
+    }
+    if (header.version != RATE_TABLE_FILE_VERSION)
+    {
+        throw domain_error("Unsupported rate table file version " + std::to_string(header.version) + ".");
+    }
+    if (header.dtype != (uint32_t)CRateTableDType::FLOAT64)
+    {
+        throw domain_error("Unsupported data type in rate table file.");
+    }
+    if (header.dimensions > MAX_PROVIDER_DIMENSION)
+    {
+        throw domain_error("Too many dimensions in rate table file.");
+    }
+
+    size_t num_shape = header.dimensions == 0 ? 1 : header.dimensions;
+    size_t meta_end = sizeof(header) + (header.dimensions + 2 * num_shape) * sizeof(int32_t);
+    if (header.data_offset < meta_end || header.data_offset % sizeof(double) != 0 ||
+        header.data_offset + header.number_values * sizeof(double) > file_size)
+    {
+        throw domain_error("Corrupt rate table file.");
+    }
+
+    vector<int32_t> meta(header.dimensions + 2 * num_shape);
+    memcpy(meta.data(), base + sizeof(header), meta.size() * sizeof(int32_t));
+
+    for (unsigned k = 0; k < header.dimensions; k++)
+    {
+        if (meta[k] < 0 || meta[k] >= (int32_t)NUMBER_OF_RISK_FACTORS)
+        {
+            throw domain_error("Unknown risk factor in rate table file.");
+        }
+        provider.add_risk_factor((CRiskFactors)meta[k]);
+    }
+    vector<int> shape_vec(meta.begin() + header.dimensions, meta.begin() + header.dimensions + num_shape);
+    vector<int> offsets(meta.begin() + header.dimensions + num_shape, meta.end());
+
+    uint64_t number_values = 1;
+    for (int d : shape_vec)
+    {
+        number_values *= (uint64_t)(d < 0 ? 0 : d);
+    }
+    if (number_values != header.number_values)
+    {
+        throw domain_error("Corrupt rate table file.");
+    }
+
+    // the values are used in place, the provider shares the ownership of the whole file
+    provider.set_values(shape_vec, offsets,
+                        shared_ptr<const double>(storage, reinterpret_cast<const double *>(base + header.data_offset)));
+    provider.set_edge_mode(header.edge_mode == (int32_t)CRateEdgeMode::CLAMP ? CRateEdgeMode::CLAMP : CRateEdgeMode::STRICT);
+}
+
+/**
+ * @brief Open a rate table file read-only. On POSIX systems the file is memory mapped and the provider
+ * uses the mapped values directly, otherwise the file is read into memory.
+ *
+ * @param path Path of the file written by `write_rate_table`
+ * @return shared_ptr<CStandardRateProvider> The provider (and all clones/slices) keep the mapping alive.
+ */
+shared_ptr<CStandardRateProvider> open_rate_table(const string &path)
+{
+    auto provider = make_shared<CStandardRateProvider>();
+
+#ifdef PYPROTOLINC_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open rate table file: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        throw runtime_error("Cannot read rate table file: " + path);
+    }
+    size_t file_size = (size_t)st.st_size;
+    void *addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+    if (addr == MAP_FAILED)
+    {
+        throw runtime_error("Cannot map rate table file: " + path);
+    }
+    shared_ptr<const char> storage(static_cast<const char *>(addr), [addr, file_size](const char *) { munmap(addr, file_size); });
+#else
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in)
+    {
+        throw runtime_error("Cannot open rate table file: " + path);
+    }
+    size_t file_size = (size_t)in.tellg();
+    in.seekg(0);
+
+    // allocate as doubles to get a suitable alignment for the values
+    shared_ptr<const char> storage(reinterpret_cast<const char *>(new double[file_size / sizeof(double) + 1]),
+                                   [](const char *p) { delete[] reinterpret_cast<const double *>(p); });
+    in.read(const_cast<char *>(storage.get()), file_size);
+    if (!in)
+    {
+        throw runtime_error("Cannot read rate table file: " + path);
+    }
+#endif
+
+    init_rate_table_provider(storage.get(), file_size, storage, *provider);
+    return provider;
+}
+
+#endif
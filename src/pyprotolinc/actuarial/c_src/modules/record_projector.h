@@ -22,7 +22,9 @@
 #include <iomanip>
 
 #include "utils.h"
+#include "simd.h"
 #include "assumption_sets.h"
+#include "rate_conversion.h"
 #include "providers.h"
 #include "portfolio.h"
 #include "run_config.h"
@@ -35,21 +37,29 @@ using namespace std;
 
 
 /**
- * @brief Methods to calculate the policy state probabilities, data storage is managed externally.
+ * @brief Methods to calculate the policy state probabilities. The probabilities of all time steps are kept (the
+ * reserves need them), the movements only for the current step.
  * 
+ * @tparam N Number of states if fixed at compile time (the loops over the states are unrolled), 0 otherwise.
  */
-class ProjectionStateMatrix
+template <int N>
+class ProjectionStateMatrixT
 {
 private:
-    double *_state_probs = nullptr;
-    double *_state_vols = nullptr;
-    double *_probs_mvms = nullptr;
-    double *_vol_mvms = nullptr;
+    unique_ptr<double[]> _state_probs;  // num_timesteps x num_states
+    unique_ptr<double[]> _probs_mvms;   // movements of the last step, num_states x num_states
 
     int _num_timesteps;
     int _num_states;
     int _size;
 
+    // sparsity pattern of the transitions as segments of consecutive target states per row (see simd.h),
+    // only used for large state models
+    bool _use_pattern = false;
+    vector<int> _pattern_row_offsets;
+    vector<int> _pattern_segments;
+    SimdLevel _simd_level = get_simd_level();
+
 public:
     /**
      * @brief Construct a new Projection State Matrix object
@@ -57,135 +67,157 @@ public:
      * @param num_timesteps Number of timesteps
      * @param num_states Number of possible states
      */
-    ProjectionStateMatrix(int num_timesteps, int num_states): _num_timesteps(num_timesteps), _num_states(num_states), _size(num_timesteps*num_states) {
+    ProjectionStateMatrixT(int num_timesteps, int num_states): _num_timesteps(num_timesteps), _num_states(num_states), _size(num_timesteps*num_states) {
+        if (N > 0 && num_states != N) {
+            throw domain_error("Number of states must be " + std::to_string(N));
+        }
+        _state_probs = unique_ptr<double[]>(new double[_size](), std::default_delete<double[]>());
+        _probs_mvms = unique_ptr<double[]>(new double[num_states * num_states](), std::default_delete<double[]>());
     }
 
     // no copying intended
-    ProjectionStateMatrix() = delete;
-    ProjectionStateMatrix(const ProjectionStateMatrix &) = delete;
-    ProjectionStateMatrix(ProjectionStateMatrix &&) = delete;
+    ProjectionStateMatrixT() = delete;
+    ProjectionStateMatrixT(const ProjectionStateMatrixT &) = delete;
+    ProjectionStateMatrixT(ProjectionStateMatrixT &&) = delete;
+
+    /// Number of states (a compile time constant if N > 0)
+    int num_states() const {
+        return N > 0 ? N : _num_states;
+    }
 
     
     /**
-     * @brief Set the data pointer in that method and reset the state matrix (fill with zero) and set the initial state in the first row
+     * @brief Set the initial state in the first row, the later rows are overwritten by the state updates.
+     * The volumes are not projected, they are the sum insured times the probabilities (see RunResult::add_record_states).
      * 
-     * @param state_probs Pointer to the data array
      * @param start_state Initial state the record is in
      */
-    void initialize_states(double *state_probs, double *state_vols, double *probs_mvms, double *vol_mvms, int start_state, double vol)
+    void initialize_states(int start_state)
     {
-        _state_probs = state_probs;
-        _state_vols = state_vols;
-        _probs_mvms = probs_mvms;
-        _vol_mvms = vol_mvms;
-
-        if (start_state < 0 || start_state >= _num_states) {
+        if (start_state < 0 || start_state >= num_states()) {
             throw domain_error("Invalid state index: " + std::to_string(start_state));
         }
-        // for(int j = 0; j<_size; j++) {
-        //     _state_probs[j] = 0;
-        // }
+        for (int s = 0; s < num_states(); s++) {
+            _state_probs[s] = 0.0;
+        }
         
-        _state_probs[0 * _num_states +  start_state] = 1;
-        _state_vols[0 * _num_states +  start_state] = vol;
+        _state_probs[0 * num_states() +  start_state] = 1;
     }
 
     double *get_state_probs(int time_index) {
-        return _state_probs + time_index * _num_states;
+        return _state_probs.get() + time_index * num_states();
     }
 
-    double *get_probs_mvms(int time_index) {
-        return _probs_mvms + time_index * _num_states * _num_states;
+    /// The probability movements of the last step (zero on the diagonal).
+    const double *get_step_movements() const {
+        return _probs_mvms.get();
     }
 
+    /**
+     * @brief Restrict the state update to the transitions of a sparsity pattern, the rates of all other
+     * transitions must be zero. The costs of a time step then scale with the number of transitions
+     * instead of the square of the number of states.
+     *
+     * @param pattern Element r * n + c is true if the transition r -> c can occur, see CAssumptionSet::get_transition_pattern.
+     */
+    void set_transition_pattern(const vector<bool> &pattern);
+
     /**
      * @brief Calculate the probabilities of the next state.
      * 
      * @param index_last Index (row) of the last valid assumption set
      * @param be_a_ts (Dependent) assumptions to be applied for the current timestep
      */
-    void update_state(int index_last, double* be_a_ts, double vol)
+    void update_state(int index_last, double* be_a_ts)
     {
         // SHOULD IT BE AS SIMPLE AS THAT?
         
         // use some pointer arithmetics
-        double *current_states = _state_probs + index_last * _num_states;
-        double *updated_states = _state_probs + (1 + index_last) * _num_states;
-        double *updated_vols = _state_vols + (1 + index_last) * _num_states;
+        double *current_states = _state_probs.get() + index_last * num_states();
+        double *updated_states = current_states + num_states();
+        for (int c = 0; c < num_states(); c++)
+        {
+            updated_states[c] = 0.0;
+        }
         
-        double *these_prob_movements = _probs_mvms + (1 + index_last) * _num_states * _num_states;
-        double *these_vol_movements = _vol_mvms + (1 + index_last) * _num_states * _num_states;
+        double *these_prob_movements = _probs_mvms.get();
+
+        if (_use_pattern)
+        {
+            sparse_update_state(_simd_level, num_states(), _pattern_row_offsets.data(), _pattern_segments.data(), be_a_ts,
+                                current_states, updated_states, these_prob_movements);
+            return;
+        }
 
 
-        for (int r = 0; r < _num_states; r++)
+        for (int r = 0; r < num_states(); r++)
         {
-            for (int  c = 0; c < _num_states; c++)
+            for (int  c = 0; c < num_states(); c++)
             {
-                //cout << "update movements: index_last=" << index_last << ", from=" << r << ", to=" << c << ", A=" << be_a_ts[r * _num_states + c];
+                //cout << "update movements: index_last=" << index_last << ", from=" << r << ", to=" << c << ", A=" << be_a_ts[r * num_states() + c];
                 
-                double mvm = be_a_ts[r * _num_states + c] * current_states[r];
+                double mvm = be_a_ts[r * num_states() + c] * current_states[r];
                 
                 if (r != c) {
-                    these_prob_movements[r * _num_states + c] = mvm;
-                    //these_prob_movements[r * _num_states + r] -=mvm;
-
-                    these_vol_movements[r * _num_states + c] = mvm * vol;
-                    // these_vol_movements[r * _num_states + r] -=mvm * vol;
+                    these_prob_movements[r * num_states() + c] = mvm;
+                    //these_prob_movements[r * num_states() + r] -=mvm;
                 } 
                 
                 // cout << ", prob(r)=" << current_states[r];
-                // cout << ", movemnt=" << these_movements[r * _num_states + c];
+                // cout << ", movemnt=" << these_movements[r * num_states() + c];
                 // cout << endl;
 
                 updated_states[c] += mvm;
-                updated_vols[c] += mvm * vol;
             }
         }        
     }
 
-    /**
-     * @brief Trivial completion of the projection without further movements
-     * 
-     * @param time_index First time index which is copied from the the one preceding it.
-     */
-    void trivial_runoff(int time_index);
-
-
     void print_state_probs(int time_index) const;
     
 };
 
- void ProjectionStateMatrix::trivial_runoff(int time_index)
+template <int N>
+void ProjectionStateMatrixT<N>::set_transition_pattern(const vector<bool> &pattern)
+{
+    int n = num_states();
+    if ((int)pattern.size() != n * n)
     {
-       // use some pointer arithmetics
-        double * current_states = _state_probs + (time_index - 1) * _num_states;
-        double * const current_vols = _state_vols + (time_index - 1) * _num_states;
-        
-        double *updated_states = current_states + _num_states;
-        double *updated_vols = current_vols + _num_states;
-
-        while (time_index++ < _num_timesteps) {
-
-            //cout << "TimeIndex=" << time_index;
-            for (int s= 0; s < _num_states; s++) {
-                updated_states[s] = current_states[s];
-                updated_vols[s] = current_vols[s];
+        throw domain_error("The transition pattern must have " + std::to_string(n * n) + " elements.");
+    }
 
-                //cout << ", current_states[" << s << "]=" << current_states[s];
-                //cout << ", updated_states[" << s << "]=" << updated_states[s];
+    _pattern_row_offsets.assign(1, 0);
+    _pattern_segments.clear();
+    for (int r = 0; r < n; r++)
+    {
+        for (int c = 0; c < n; c++)
+        {
+            if (!pattern[r * n + c] && c != r)
+            {
+                continue;
+            }
+            // extend the last segment of the row or start a new one
+            if (_pattern_segments.size() > 2 * (size_t)_pattern_row_offsets.back() && _pattern_segments.back() == c)
+            {
+                _pattern_segments.back() = c + 1;
+            }
+            else
+            {
+                _pattern_segments.push_back(c);
+                _pattern_segments.push_back(c + 1);
             }
-            updated_states += _num_states;
-            updated_vols += _num_states;
-            //cout << endl;
         }
+        _pattern_row_offsets.push_back((int)_pattern_segments.size() / 2);
     }
+    _use_pattern = true;
+}
 
- void ProjectionStateMatrix::print_state_probs(int time_index) const
+ template <int N>
+ void ProjectionStateMatrixT<N>::print_state_probs(int time_index) const
     {
-        double *states = _state_probs + time_index * _num_states;
+        const double *states = _state_probs.get() + time_index * num_states();
 
         // cout << "STATES (t=" << time_index << ") = [";
-        // for (int i = 0; i < _num_states; i++)
+        // for (int i = 0; i < num_states(); i++)
         // {
         //     if (i > 0) {
         //         cout << ", ";
@@ -196,12 +228,18 @@ public:
         // cout << "]" << endl;
     }
 
+/// Projection state matrix with the number of states determined at runtime
+typedef ProjectionStateMatrixT<0> ProjectionStateMatrix;
+
 
 /**
  * @brief Functionality to project cash flows for a single record at a time.
  * 
+ * @tparam N Number of states if fixed at compile time, then the loops over the states are unrolled and
+ * the small scratch buffers live within the object. 0 for a number of states determined at runtime.
  */
-class RecordProjector
+template <int N>
+class RecordProjectorT
 {
 
 private:
@@ -210,32 +248,101 @@ private:
 
     const unsigned int _dimension;
 
+    /// Number of states (a compile time constant if N > 0)
+    unsigned int dimension() const
+    {
+        return N > 0 ? (unsigned int)N : _dimension;
+    }
+
     // time loop relevant fixed vectors
     const vector<PeriodDate> &_start_dates = _ta.get_start_dates();
     const vector<PeriodDate> &_end_dates = _ta.get_end_dates();
     const vector<int> &_period_lengths = _ta.get_period_length_in_days();
 
+    // state models with at least this many states only process the transitions which have a provider
+    static const unsigned int SPARSE_UPDATE_MIN_STATES = 9;
+
     // valuation assumption sets
     CAssumptionSet _record_be_assumptions;
     vector<shared_ptr<CAssumptionSet>> _record_other_assumptions;
 
+    // dense version of the be assumptions shared by all projectors of a run (may be null)
+    shared_ptr<const CCompiledAssumptionSet> _compiled_be_assumptions;
+
+    // slices of the assumptions per gender and smoker status shared by all projectors of a run (may be null)
+    shared_ptr<const CAssumptionSliceCache> _slice_cache;
+
+    // converted rates by rate set and step length (shared between projectors) and the entries this projector has
+    // used, the latter are dropped once LOCAL_CONVERSIONS_CAPACITY is reached
+    shared_ptr<CRateConversionCache> _conversion_cache;
+    unordered_multimap<size_t, shared_ptr<const CRateConversionCache::Entry>> _local_conversions;
+    static const size_t LOCAL_CONVERSIONS_CAPACITY = 1024;
+
+    // the be assumptions used for the current record, either a cached slice or _record_be_assumptions
+    const CAssumptionSet *_current_be_assumptions = nullptr;
+
+    // the risk factors the assumptions depend on
+    vector<bool> _relevant_risk_factors = vector<bool>(NUMBER_OF_RISK_FACTORS, false);
+
+    // states which cannot be left, a record stops early once it has (almost) surely left all other states
+    vector<bool> _absorbing_states;
+    bool _early_termination = false;
+    vector<int> _in_force_states; // states in which the current record counts as in force
+
+    // last time index projected for the current record
+    int _horizon = 0;
+
+    // outputs requested from the run, without reserves neither their cash flows nor the history of the dependent
+    // assumptions is kept
+    bool _store_payments = true;
+    bool _calculate_reserves = true;
+
+    // payments of the current record in the current step by payment type
+    vector<double> _step_payments;
+
     ///////////////////////////////////////
     // run specific values
     ///////////////////////////////////////
 
-    unique_ptr<double[]> be_a_yearly; // current independent be assumptions on the yearly grid
+    CScratchBuffer<N * N> be_a_yearly; // current independent be assumptions on the yearly grid
+    const double *_current_yearly = nullptr; // the yearly assumptions in use, either be_a_yearly or within be_a_diagonals
+
+    // yearly be assumptions along the diagonals (age and calendar year increasing together) the record
+    // follows, the difference age - calendar year takes one of two values depending on the birthday
+    static const int NUMBER_OF_DIAGONALS = 2;
+    unique_ptr<double[]> be_a_diagonals;
+    int _diagonal_capacity = 0;        // number of yearly matrices per diagonal
+    int _diagonal_cohort_first = 0;    // age - calendar year of the first diagonal
+    int _diagonal_year_first[NUMBER_OF_DIAGONALS];
+    int _diagonal_year_last[NUMBER_OF_DIAGONALS];
+    bool _use_diagonals = false;
     // TODO: something similar for other assumptions needed
 
-    unique_ptr<double[]> be_a_time_step_dependent; // current dependent assumptions on the time-step-grid
-    unique_ptr<double[]> be_a_time_step_dependent_collect; // all assumptions for all timesteps
+    // state of the current record in the time loop
+    bool _use_compiled = false;          // the rates are copied from the compiled assumption set
+    bool _trajectory_validated = false;  // the sliced assumptions cover the trajectory of the record
+    int _age_month_completed = 0;
+    bool _first_iteration = true;
+
+    CScratchBuffer<N * N> be_a_time_step_dependent; // current dependent assumptions on the time-step-grid
+
+    // history of the dependent assumptions for the reserves: they change only with the relevant risk factors or the
+    // period length, so the distinct matrices are stored one after the other together with the index per time step
+    vector<double> _step_matrices;
+    vector<int> _step_matrix_index;
+    bool _step_matrix_changed = true; // the dependent assumptions changed since the last stored matrix
     // TODO: something similar for other assumptions needed
 
     // the risk factors
     vector<int> risk_factors_current = vector<int>(NUMBER_OF_RISK_FACTORS);
     vector<int> risk_factors_last_used = vector<int>(NUMBER_OF_RISK_FACTORS, -1);
 
+    // range of the risk factors the record can reach during the projection
+    vector<int> risk_factors_lower = vector<int>(NUMBER_OF_RISK_FACTORS);
+    vector<int> risk_factors_upper = vector<int>(NUMBER_OF_RISK_FACTORS);
+
     /// the best estimate states
-    unique_ptr<ProjectionStateMatrix> _be_states;
+    unique_ptr<ProjectionStateMatrixT<N>> _be_states;
 
     // reserves
     unique_ptr<double[]> reserves_bom;
@@ -252,13 +359,16 @@ private:
 
     void adjust_assumptions_simple(int days);
 
+    /// Convert the current yearly assumptions to a time step of `days` days with the configured method.
+    void convert_assumptions(int days);
+
     /// Mark the relevant risk factors as true
     void set_relevant_risk_factors(vector<bool> &relevant_risk_factors)
     {
         relevant_risk_factors.assign(NUMBER_OF_RISK_FACTORS, false);
         
-        _record_be_assumptions.get_relevant_risk_factor_indexes(relevant_risk_factors);
-        for (auto oas : _record_other_assumptions)
+        _run_config.get_be_assumptions().get_relevant_risk_factor_indexes(relevant_risk_factors);
+        for (auto oas : _run_config.get_other_assumptions())
         {
             oas->get_relevant_risk_factor_indexes(relevant_risk_factors);
         }
@@ -280,24 +390,42 @@ private:
     ///< Clear temporary values stored in the projector object.
     void clear()
     {
+        if (!_calculate_reserves)
+        {
+            return;
+        }
+
         // zeroise reserves
-        int len = _end_dates.size() * _dimension;
+        int len = _end_dates.size() * dimension();
         for(int j=0; j < len; j++) {
             reserves_bom[j] = 0.0;
             //reserves_last_month_conditional[j] = 0.0;
             cfs_bom_per_state_for_res[j] = 0.0;
         }
         
-        int len2 = _end_dates.size() * _dimension * _dimension;
-        for(int j=0; j < len; j++) {
+        int len2 = _end_dates.size() * dimension() * dimension();
+        for(int j=0; j < len2; j++) {
             cf_eom_per_state_change_for_res[j] = 0.0;
-            be_a_time_step_dependent_collect[j] = 0.0;
         }
+
+        _step_matrices.clear();
+        _step_matrix_changed = true;
     }
 
 
     void slice_assumptions(const CPolicy &policy)
     {
+        // use the shared slice if available
+        if (_slice_cache)
+        {
+            _current_be_assumptions = _slice_cache->get_be_slice(policy.get_gender(), policy.get_smoker_status());
+            if (_current_be_assumptions)
+            {
+                return;
+            }
+        }
+        _current_be_assumptions = &_record_be_assumptions;
+
         // cout << "RecordProjector::slice_assumptions(), gender=" << policy.get_gender() << ", smoker_status=" << policy.get_smoker_status() << endl;
         vector<int> slice_indexes(NUMBER_OF_RISK_FACTORS, -1);
 
@@ -312,18 +440,109 @@ private:
         }
     }
 
+    /// Determine the range of risk factor values the record passes through during the projection,
+    /// if the tables cover it the rates can be looked up unchecked.
+    void set_trajectory_range(const CPolicy &policy)
+    {
+        int last_index = (int)_start_dates.size() - 1;
+        int first_index = min(1, last_index);
+
+        // the projection stops once the maximum age is reached
+        int age_first = get_age_at_date(policy.get_dob(), _start_dates[first_index]) / 12;
+        int age_last = get_age_at_date(policy.get_dob(), _start_dates[last_index]) / 12;
+        age_last = max(age_first, min(age_last, _run_config.get_max_age()));
+
+        int year_first = _start_dates[first_index].get_year();
+        int year_last = min((int)_start_dates[last_index].get_year(), policy.get_dob().get_year() + _run_config.get_max_age() + 1);
+        year_last = max(year_first, year_last);
+
+        risk_factors_lower[0] = age_first;                    // 0 Age
+        risk_factors_upper[0] = age_last;
+        risk_factors_lower[1] = policy.get_gender();          // 1 Gender
+        risk_factors_upper[1] = policy.get_gender();
+        risk_factors_lower[2] = year_first;                   // 2 CalendarYear
+        risk_factors_upper[2] = year_last;
+        risk_factors_lower[3] = policy.get_smoker_status();   // 3 SmokerStatus
+        risk_factors_upper[3] = policy.get_smoker_status();
+        risk_factors_lower[4] = 0;                            // 4 YearsDisabledIfDisabledAtStart
+        risk_factors_upper[4] = 0;
+    }
+
+    /// Extract the yearly be assumptions along the diagonals of the record within the validated trajectory range
+    /// so that the time loop only needs to pick a matrix instead of looking up the rates.
+    void set_diagonals(const CPolicy &policy, bool use_compiled)
+    {
+        // the completed age equals calendar year - birth year before the birthday and one less afterwards
+        _diagonal_cohort_first = -(int)policy.get_dob().get_year() - 1;
+
+        vector<int> rf_start(risk_factors_lower);
+        vector<int> rf_step(NUMBER_OF_RISK_FACTORS, 0);
+        rf_step[(int)CRiskFactors::Age] = 1;
+        rf_step[(int)CRiskFactors::CalendarYear] = 1;
+
+        for (int k = 0; k < NUMBER_OF_DIAGONALS; k++)
+        {
+            int cohort = _diagonal_cohort_first + k;
+            int year_first = max(risk_factors_lower[2], risk_factors_lower[0] - cohort);
+            int year_last = min(risk_factors_upper[2], risk_factors_upper[0] - cohort);
+            year_last = min(year_last, year_first + _diagonal_capacity - 1);
+            _diagonal_year_first[k] = year_first;
+            _diagonal_year_last[k] = year_last;
+            if (year_last < year_first)
+            {
+                continue;
+            }
+
+            rf_start[0] = year_first + cohort; // 0 Age
+            rf_start[2] = year_first;          // 2 CalendarYear
+            double *target = be_a_diagonals.get() + (size_t)k * _diagonal_capacity * dimension() * dimension();
+            if (use_compiled)
+            {
+                _compiled_be_assumptions->get_rateset_diagonal_unchecked(rf_start, rf_step, year_last - year_first + 1, target);
+            }
+            else
+            {
+                _current_be_assumptions->get_rateset_diagonal_unchecked(rf_start, rf_step, year_last - year_first + 1, target);
+            }
+        }
+    }
+
+    /// Return the yearly assumptions for the current risk factors from the diagonals (null if not extracted).
+    const double *get_diagonal_rateset() const
+    {
+        int k = risk_factors_current[0] - risk_factors_current[2] - _diagonal_cohort_first;
+        if (k < 0 || k >= NUMBER_OF_DIAGONALS)
+        {
+            return nullptr;
+        }
+        int year = risk_factors_current[2];
+        if (year < _diagonal_year_first[k] || year > _diagonal_year_last[k])
+        {
+            return nullptr;
+        }
+        return be_a_diagonals.get() + ((size_t)k * _diagonal_capacity + (year - _diagonal_year_first[k])) * dimension() * dimension();
+    }
+
+    /// Check if the current risk factors lie within the range determined by `set_trajectory_range`.
+    bool in_trajectory_range() const
+    {
+        return risk_factors_current[0] <= risk_factors_upper[0] && risk_factors_current[2] <= risk_factors_upper[2];
+    }
+
     /// @brief Calculation of the reserves
     /// @param reserving_interest 
     /// @param time_index Is the latest time index that is needed to calculate the reserves
     void calculate_reserves(double reserving_interest, int time_index) {
-        double monthly_discount_factor = pow(1.0 + reserving_interest, -1.0 / 12.0);
+        // discount over the length of each period, it only changes between the segments of the time axis
+        double discount_factor = 1.0;
+        int discount_days = -1;
 
         //cout << "Reserving factor: " << monthly_discount_factor << endl; 
 
         // the vector of reserves conditional on being in the respective state
-        unique_ptr<double[]> reserves_last_month_conditional(new double[_dimension], std::default_delete<double[]>());
-        unique_ptr<double[]> reserves_last_month_conditional_save(new double[_dimension], std::default_delete<double[]>());
-        for (int r=0; r<_dimension;r++) {
+        CScratchBuffer<N> reserves_last_month_conditional(dimension());
+        CScratchBuffer<N> reserves_last_month_conditional_save(dimension());
+        for (int r=0; r<dimension();r++) {
             reserves_last_month_conditional[r] = 0.0;
             reserves_last_month_conditional_save[r] = 0.0;
         }
@@ -334,37 +553,45 @@ private:
             // Explanation of IDEA first: recursive calculation equation along the line of
             // reserves_bom[self.month_count, :] = CF@BOM|state=j + D * ( \sum_{states k}) p^{res, insured=i}_{j->k} (CF@EOM|state=j) + Res_bom(t+1)|state=k)
 
+            if (_period_lengths[time_index] != discount_days) {
+                discount_days = _period_lengths[time_index];
+                discount_factor = pow(1.0 + reserving_interest, -discount_days / 360.0);
+            }
+
             // copy the reserves from last month
-            for (int r=0; r<_dimension;r++) {
+            for (int r=0; r<dimension();r++) {
                 reserves_last_month_conditional_save[r] = reserves_last_month_conditional[r];
             }
 
+            // the dependent assumptions of this time step
+            const double *step_matrix = _step_matrices.data() + (size_t)_step_matrix_index[time_index] * dimension() * dimension();
+
             // calculate the conditional reserving amount needed conditional on a state transition
-            for(int from_state=0; from_state < _dimension; from_state++) {
+            for(int from_state=0; from_state < dimension(); from_state++) {
 
                 double cond_res_eom_from_state = 0.0;
-                for(int to_state=0; to_state < _dimension; to_state++) {
+                for(int to_state=0; to_state < dimension(); to_state++) {
                     //  first we determine the amounts needed based on the transitions which is the
                     // (conditional) target state reserve + the (conditional) payment for the state transition
-                    int ind_for_eom_cf = time_index * (_dimension * _dimension) + from_state * _dimension + to_state;
+                    int ind_for_eom_cf = time_index * (dimension() * dimension()) + from_state * dimension() + to_state;
                     double transition_amount = cf_eom_per_state_change_for_res[ind_for_eom_cf] + reserves_last_month_conditional_save[to_state];
 
                     // the transition amounts are multiplied with the transition probabilities
                     // the probabilities with time fixed have the strcuture(insured(r), from_state(f), to_state(t))
                     
-                    cond_res_eom_from_state += transition_amount * be_a_time_step_dependent_collect[ind_for_eom_cf];
+                    cond_res_eom_from_state += transition_amount * step_matrix[from_state * dimension() + to_state];
                 }
-                //cout << ", conditional bom payment added=" << cfs_bom_per_state_for_res[time_index * _dimension + from_state];
-                reserves_last_month_conditional[from_state] = cfs_bom_per_state_for_res[time_index * _dimension + from_state] +
-                                                              monthly_discount_factor * cond_res_eom_from_state;
+                //cout << ", conditional bom payment added=" << cfs_bom_per_state_for_res[time_index * dimension() + from_state];
+                reserves_last_month_conditional[from_state] = cfs_bom_per_state_for_res[time_index * dimension() + from_state] +
+                                                              discount_factor * cond_res_eom_from_state;
             }
 
             // store the "probability weighted" reserve
             double *state_probs = _be_states -> get_state_probs(time_index - 1); // check! the state probs are EOP
-            for (int from_state=0; from_state < _dimension; from_state++) {
+            for (int from_state=0; from_state < dimension(); from_state++) {
 
                 //cout << ", state_prob=" << state_probs[from_state];
-                reserves_bom[time_index * _dimension + from_state] = reserves_last_month_conditional[from_state] 
+                reserves_bom[time_index * dimension() + from_state] = reserves_last_month_conditional[from_state] 
                                                                     * state_probs[from_state];
             }
 
@@ -377,34 +604,84 @@ private:
         // Reserves are no in the reserves_bom field
         // cout << "Reserves: [";
         // for(int t=0; t < 10; t++) {
-        //     cout << ", " << std::setprecision(8) <<reserves_bom[t * _dimension + 0];
+        //     cout << ", " << std::setprecision(8) <<reserves_bom[t * dimension() + 0];
         // }
         // cout << endl;
     }   
 
 public:
-    RecordProjector(const CRunConfig &run_config, const TimeAxis &ta) : _run_config(run_config),
+    /**
+     * @brief Construct a new Record Projector object
+     *
+     * @param run_config Run configuration object.
+     * @param ta Time axis to be used for the simulation.
+     * @param compiled_be_assumptions Optional dense version of the be assumptions (shared read-only between projectors).
+     * @param slice_cache Optional cache of the assumptions sliced by gender and smoker status (shared read-only between projectors).
+     * @param conversion_cache Optional cache of the converted rates (shared between projectors), unused by the simple conversion.
+     */
+    RecordProjectorT(const CRunConfig &run_config, const TimeAxis &ta,
+                    shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions = nullptr,
+                    shared_ptr<const CAssumptionSliceCache> slice_cache = nullptr,
+                    shared_ptr<CRateConversionCache> conversion_cache = nullptr) : _run_config(run_config),
                                                                         _ta(ta),
                                                                         _dimension(run_config.get_dimension()),
                                                                         _start_dates(_ta.get_start_dates()),
                                                                         _end_dates(_ta.get_end_dates()),
                                                                         _period_lengths(_ta.get_period_length_in_days()),
-                                                                        _record_be_assumptions(_run_config.get_be_assumptions().get_dimension())
-                                                                        
+                                                                        _record_be_assumptions(_run_config.get_be_assumptions().get_dimension()),
+                                                                        _compiled_be_assumptions(compiled_be_assumptions),
+                                                                        _slice_cache(slice_cache),
+                                                                        _conversion_cache(conversion_cache),
+                                                                        be_a_yearly(_dimension * _dimension),
+                                                                        be_a_time_step_dependent(_dimension * _dimension)
     {
-        _be_states = unique_ptr<ProjectionStateMatrix>(new ProjectionStateMatrix((int)_ta.get_length(), (int)_run_config.get_dimension()));
+        if (N > 0 && _dimension != N)
+        {
+            throw domain_error("Projector for " + std::to_string(N) + " states used with a state model of dimension " + std::to_string(_dimension));
+        }
+        set_relevant_risk_factors(_relevant_risk_factors);
+        _store_payments = _run_config.get_result_spec().payments;
+        _calculate_reserves = _run_config.get_result_spec().reserves;
+
+        // the simple conversion is cheaper than a cache lookup
+        if (_run_config.get_rate_conversion() == RateConversion::SIMPLE)
+        {
+            _conversion_cache = nullptr;
+        }
+        else if (!_conversion_cache)
+        {
+            _conversion_cache = make_shared<CRateConversionCache>(_run_config.get_rate_conversion(), _dimension);
+        }
+        else if (_conversion_cache->get_method() != _run_config.get_rate_conversion() || _conversion_cache->get_dimension() != _dimension)
+        {
+            throw domain_error("The rate conversion cache does not match the run configuration.");
+        }
+
+        _be_states = unique_ptr<ProjectionStateMatrixT<N>>(new ProjectionStateMatrixT<N>((int)_ta.get_length(), (int)_run_config.get_dimension()));
+        if (_dimension >= SPARSE_UPDATE_MIN_STATES)
+        {
+            _be_states->set_transition_pattern(_run_config.get_be_assumptions().get_transition_pattern(!keeps_zero_rates(_run_config.get_rate_conversion())));
+        }
+
+        _absorbing_states = _run_config.get_be_assumptions().get_absorbing_states();
+        _early_termination = _run_config.get_early_termination() &&
+                             std::find(_absorbing_states.begin(), _absorbing_states.end(), true) != _absorbing_states.end();
         
         // array containers for the current assumptions
-        be_a_yearly = unique_ptr<double[]>(new double[_dimension * _dimension], std::default_delete<double[]>());
-        be_a_time_step_dependent = unique_ptr<double[]>(new double[_dimension * _dimension], std::default_delete<double[]>());
-        be_a_time_step_dependent_collect = unique_ptr<double[]>(new double[(int)_ta.get_length() * _dimension * _dimension], std::default_delete<double[]>());
+        _current_yearly = be_a_yearly.get();
+
+        // the diagonals span the calendar years of the time axis
+        _diagonal_capacity = max(1, (int)_start_dates.back().get_year() - (int)_start_dates.front().get_year() + 1);
+        be_a_diagonals = unique_ptr<double[]>(new double[(size_t)NUMBER_OF_DIAGONALS * _diagonal_capacity * dimension() * dimension()],
+                                              std::default_delete<double[]>());
+        _step_matrix_index.assign(_ta.get_length(), 0);
 
         // array containers for the reserve calculations
-        reserves_bom = unique_ptr<double[]>(new double[(int)_ta.get_length() * _dimension], std::default_delete<double[]>());
-        //reserves_last_month_conditional = unique_ptr<double[]>(new double[(int)_ta.get_length() * _dimension], std::default_delete<double[]>());
+        reserves_bom = unique_ptr<double[]>(new double[(int)_ta.get_length() * dimension()](), std::default_delete<double[]>());
+        //reserves_last_month_conditional = unique_ptr<double[]>(new double[(int)_ta.get_length() * dimension()], std::default_delete<double[]>());
 
-        cfs_bom_per_state_for_res = unique_ptr<double[]>(new double[(int)_ta.get_length() * _dimension], std::default_delete<double[]>());
-        cf_eom_per_state_change_for_res = unique_ptr<double[]>(new double[(int)_ta.get_length() *_dimension * _dimension], std::default_delete<double[]>());
+        cfs_bom_per_state_for_res = unique_ptr<double[]>(new double[(int)_ta.get_length() * dimension()], std::default_delete<double[]>());
+        cf_eom_per_state_change_for_res = unique_ptr<double[]>(new double[(int)_ta.get_length() *dimension() * dimension()], std::default_delete<double[]>());
 
         // deep copy of the portfolio assumption set into the record assumption set
         // which is later on sliced as needed
@@ -420,12 +697,94 @@ public:
 
 
     /**
-     * @brief Create the projection result for one policy.
+     * @brief Prepare the projection of a record: validate its trajectory against the tables, slice the
+     * assumptions and extract the diagonals as applicable.
+     *
+     * @param policy The record to project
+     * @param portfolio_date portfolio date
+     */
+    void start_record(const CPolicy &policy, const PeriodDate &portfolio_date);
+
+    /**
+     * @brief Determine the assumptions for the time step ending at `time_index`, the steps of a record
+     * must be passed in order starting with 1.
+     *
+     * @param policy The record started with `start_record`
+     * @param time_index Index of the time step
+     * @return The dependent assumptions for the length of the step (row major, dimension x dimension), valid until the next call.
+     */
+    const double *step_assumptions(const CPolicy &policy, int time_index);
+
+    /**
+     * @brief Determine the states in which the record counts as in force: the states which are not absorbing
+     * and the absorbing states with payments conditional on them.
+     *
+     * @param state_payments The state conditional payments of the record.
+     */
+    void set_in_force_states(const unordered_map<int, StateConditionalRecordPayout> &state_payments)
+    {
+        _in_force_states.clear();
+        for (int s = 0; s < (int)dimension(); s++)
+        {
+            if (!_absorbing_states[s] || state_payments.count(s) > 0)
+            {
+                _in_force_states.push_back(s);
+            }
+        }
+    }
+
+    /// True if early termination is enabled and the probability of the record to be in force does not exceed the
+    /// threshold, then nothing but negligible probabilities changes any more (state probabilities with the given stride).
+    bool in_force_negligible(const double *state_probs, size_t stride = 1) const
+    {
+        if (!_early_termination)
+        {
+            return false;
+        }
+        double in_force = 0.0;
+        for (int s : _in_force_states)
+        {
+            in_force += fabs(state_probs[s * stride]);
+        }
+        return in_force <= _run_config.get_early_termination_threshold();
+    }
+
+    /**
+     * @brief Determine the last time index to be projected for the record: the step containing the end of its
+     * cover and, if configured, the step of its last non-zero conditional payment. At least one step is projected.
+     *
+     * @param policy The record.
+     * @param state_payments The state conditional payments of the record.
+     * @param transition_payments The transition conditional payments of the record.
+     */
+    void set_projection_horizon(const CPolicy &policy,
+                                const unordered_map<int, StateConditionalRecordPayout> &state_payments,
+                                const unordered_map<pair<int, int>, TransitionConditionalRecordPayout> &transition_payments);
+
+    /// True if the current time step is the last one to be projected for the record.
+    bool projection_horizon_reached(int time_index) const { return time_index >= _horizon; }
+
+    /// Return the reserves at the beginning of the periods (per state, weighted with the state probabilities) of the last record,
+    /// zero unless the reserves are requested in the result spec of the run.
+    const double *get_reserves_bom() const { return reserves_bom.get(); }
+
+    /// Return the number of distinct dependent assumption matrices of the last record.
+    size_t get_num_step_matrices() const { return _step_matrices.size() / (dimension() * dimension()); }
+
+    /// True if the record has reached the maximum age, its projection stops after the current time step.
+    bool max_age_reached() const
+    {
+        return _age_month_completed >= _run_config.get_max_age() * 12;
+    }
+
+    /**
+     * @brief Project one policy and add its contributions to a result, only the time steps and outputs the record
+     * contributes to are touched.
      * 
      * @param runner_no Number of the runner instance.
      * @param record_count Number of record in batch for this runner.
      * @param policy The record to project
-     * @param result Container for the result
+     * @param result Container the result is added to
      * @param portfolio_date portfolio date
      * @param record_payments the state conditional payments
      */
@@ -435,7 +794,105 @@ public:
 };
 
 
-void RecordProjector::run(int runner_no,
+template <int N>
+void RecordProjectorT<N>::start_record(const CPolicy &policy, const PeriodDate &portfolio_date)
+{
+    // validate the trajectory against the table bounds once, the lookups in the loop are then unchecked
+    set_trajectory_range(policy);
+
+    // with a compiled assumption set covering the trajectory the rates are copied from the dense tensor,
+    // otherwise the assumption providers are specialized for the current record
+    _use_compiled = _compiled_be_assumptions && _compiled_be_assumptions->covers(risk_factors_lower, risk_factors_upper);
+    _trajectory_validated = false;
+    if (!_use_compiled)
+    {
+        this->slice_assumptions(policy);
+        _trajectory_validated = _current_be_assumptions->covers(risk_factors_lower, risk_factors_upper);
+    }
+
+    // if the rates depend on age and calendar year they change along diagonals of the tables which are extracted
+    // upfront, otherwise the few updates are looked up directly
+    _use_diagonals = (_use_compiled || _trajectory_validated) && _relevant_risk_factors[(int)CRiskFactors::Age]
+                     && _relevant_risk_factors[(int)CRiskFactors::CalendarYear];
+    if (_use_diagonals)
+    {
+        set_diagonals(policy, _use_compiled);
+    }
+
+    // special treatment of first time step as needed
+    // assert portfolio_date == _end_dates[0] == _start_dates[0]
+    _age_month_completed = get_age_at_date(policy.get_dob(), portfolio_date);
+    _first_iteration = true;
+}
+
+template <int N>
+const double *RecordProjectorT<N>::step_assumptions(const CPolicy &policy, int time_index)
+{
+    int days_previous_step = _period_lengths[time_index - 1];
+    int days_current_step = _period_lengths[time_index];
+
+    // update the risk factors
+    if (!_first_iteration && days_previous_step % 30 == 0)
+    {
+        _age_month_completed += days_previous_step / 30;
+    }
+    else
+    {
+        _age_month_completed = get_age_at_date(policy.get_dob(), _start_dates[time_index]);
+    }
+
+    risk_factors_current[0] = _age_month_completed / 12;           // 0 Age
+    risk_factors_current[1] = policy.get_gender();                 // 1 Gender
+    risk_factors_current[2] = _start_dates[time_index].get_year(); // 2 CalendarYear
+    risk_factors_current[3] = policy.get_smoker_status();          // 3 SmokerStatus
+    risk_factors_current[4] = 0;                                   // 4 YearsDisabledIfDisabledAtStart  -- TODO!
+
+    // check if we need to update the yearly assumptions
+    bool yearly_assumptions_updated = false;
+    if (relevant_factor_changed(_relevant_risk_factors) || _first_iteration)
+    {
+        const double *diagonal_rates = (_use_diagonals && in_trajectory_range()) ? get_diagonal_rateset() : nullptr;
+        _current_yearly = be_a_yearly.get();
+        if (diagonal_rates)
+        {
+            _current_yearly = diagonal_rates;
+        }
+        else if (_use_compiled && in_trajectory_range())
+        {
+            _compiled_be_assumptions->get_single_rateset_unchecked(risk_factors_current, be_a_yearly.get());
+        }
+        else if (_trajectory_validated && in_trajectory_range())
+        {
+            _current_be_assumptions->get_single_rateset_unchecked(risk_factors_current, be_a_yearly.get());
+        }
+        else if (_use_compiled)
+        {
+            // the record has not been sliced, query the portfolio assumptions directly
+            _run_config.get_be_assumptions().get_single_rateset(risk_factors_current, be_a_yearly.get());
+        }
+        else
+        {
+            _current_be_assumptions->get_single_rateset(risk_factors_current, be_a_yearly.get());
+        }
+        yearly_assumptions_updated = true;
+
+        // copy new relevant risk factors to last used
+        risk_factors_last_used.assign(risk_factors_current.begin(), risk_factors_current.end());
+    }
+
+    // convert the assumptions to the length of the timestep and make them dependent
+    if (yearly_assumptions_updated || (days_current_step != days_previous_step))
+    {
+        convert_assumptions(days_current_step);
+        _step_matrix_changed = true;
+    }
+
+    _first_iteration = false;
+    return be_a_time_step_dependent.get();
+}
+
+template <int N>
+void RecordProjectorT<N>::run(int runner_no,
                           int record_count,
                           const CPolicy &policy,
                           RunResult &result,
@@ -457,137 +914,59 @@ void RecordProjector::run(int runner_no,
     this->clear();
     if (debug_on) cout << "RecordProjector::run() - after clear" << endl;
 
-    // the current volume of this policy
-    double current_vol = policy.get_sum_insured();
-    int _num_states =  _run_config.get_be_assumptions().get_dimension();
-
-    /////////////////////////////////
-    // set relevant storage pointers
-    ////////////////////////////////
-    
-    // in this case also: initialize the state matrix
-    _be_states->initialize_states(result.get_be_state_probs_ptr(),
-                                  result.get_be_state_vols_ptr(),
-                                  result.get_be_prob_mvms_ptr(),
-                                  result.get_be_vol_mvms_ptr(),
-                                  policy.get_initial_state(),
-                                  current_vol);    
-    if (debug_on) cout << "RecordProjector::run() - after init state matrix." << endl;
-
-
-    // specialize the assumption providers for the current record
-    this->slice_assumptions(policy);
-    if (debug_on) cout << "RecordProjector::run() - after slice assumptions!" << endl;
-
-
-    // determine which risk factors are relevant
-    vector<bool> relevant_risk_factors(NUMBER_OF_RISK_FACTORS, false);
-    set_relevant_risk_factors(relevant_risk_factors);
+    const int _num_states = dimension();
 
-    if (debug_on) cout << "RecordProjector::run() - after setting relevant risk factors!" << endl;
-    // control output
-//    print_vec<bool>(relevant_risk_factors, "relevant_risk_factors");
+    // the contributions of the record are added to the result as they are projected: the probabilities (and their
+    // movements) times the number of records represented, the volumes are derived with the sum insured
+    const double weight = policy.get_weight();
+    const double volume = policy.get_sum_insured();
+    _step_payments.assign(_store_payments ? result.get_num_state_payment_cols() : 0, 0.0);
 
-    // initialize the risk factors - could have taken the start date from the time axis instead
+    // initialize the state matrix
+    _be_states->initialize_states(policy.get_initial_state());
+    result.add_record_states(0, _be_states->get_state_probs(0), weight, volume);
+    if (debug_on) cout << "RecordProjector::run() - after init state matrix." << endl;
 
 
-    // cout << "RecordProjector::run() - number of time steps is " << _end_dates.size() << endl;
-    // cout << "RecordProjector::run(): dimension=" << _record_be_assumptions.get_dimension() << endl;
-    // for (unsigned r = 0; r < _dimension; r++)
-    // {
-    //     for (unsigned c = 0; c < _dimension; c++)
-    //     {
-    //         cout << "RecordProjector::run(): (" << r << ", " << c << "): " << _record_be_assumptions.get_provider_info(r, c) << endl;
-    //     }
-    // }
+    start_record(policy, portfolio_date);
+    set_in_force_states(*payments);
+    set_projection_horizon(policy, *payments, *transition_payments);
 
     int max_time_step_index = (int)_end_dates.size() - 1;
 
     bool early_stop = false;
+    bool terminated = false;
     int time_index = 0;
 
-    // special treatment of first time step as needed
-    // assert portfolio_date == _end_dates[0] == _start_dates[0]
-//    cout << "Projection start at " << _end_dates[0] <<endl;
-    int age_month_completed = get_age_at_date(policy.get_dob(), portfolio_date);
-    if (debug_on) cout << "Age of policyholder: " << age_month_completed << "  (" << age_month_completed / 12.0 << ")" << endl;
-
-
     // main loop over time
-    bool first_iteration = true;
-    bool yearly_assumptions_updated = false;    
     while (++time_index <= max_time_step_index)
     {
-
-        int days_previous_step = _period_lengths[time_index - 1];
-        int days_current_step = _period_lengths[time_index];
-
-        if (debug_on) cout << "RecordProjector::run() - main loop, Simulation step until " << _end_dates[time_index] << ", duration_prev=" << days_previous_step << ", duration_curr=" << days_current_step << endl;
+        if (debug_on) cout << "RecordProjector::run() - main loop, Simulation step until " << _end_dates[time_index] << endl;
 
         ///////////////////////////////////////////////////////////////////////////////////////
         // Step 1: identify the assumptions to be used for this step
         ///////////////////////////////////////////////////////////////////////////////////////
+        step_assumptions(policy, time_index);
 
-        // update the risk factors
-        if (!first_iteration && days_previous_step % 30 == 0)
+        // save assumptions for this timestep (once per distinct matrix)
+        if (_calculate_reserves)
         {
-            age_month_completed += days_previous_step / 30;
-        }
-        else
-        {
-            age_month_completed = get_age_at_date(policy.get_dob(), _start_dates[time_index]);
-        } 
-
-        risk_factors_current[0] = age_month_completed / 12;            // 0 Age
-        risk_factors_current[1] = policy.get_gender();                 // 1 Gender
-        risk_factors_current[2] = _start_dates[time_index].get_year(); // 2 CalendarYear
-        risk_factors_current[3] = policy.get_smoker_status();          // 3 SmokerStatus
-        risk_factors_current[4] = 0;                                   // 4 YearsDisabledIfDisabledAtStart  -- TODO!
-
-        // check if we need to update the yearly assumptions
-        yearly_assumptions_updated = false;
-        if (relevant_factor_changed(relevant_risk_factors) || first_iteration)
-        {
-//            cout << "updating yearly assumptions" << endl;
-            _record_be_assumptions.get_single_rateset(risk_factors_current, be_a_yearly.get());
-            yearly_assumptions_updated = true;
-
-            // // print out the yearly assumptions
-            // cout << "  unscaled" << endl;
-            // for (unsigned r = 0; r < _dimension; r++)
-            // {
-            //     cout << "    ";
-            //     for (unsigned c = 0; c < _dimension; c++)
-            //     {
-            //         cout << be_a_yearly.get()[r * _dimension + c] << ", ";
-            //     }
-            //     cout << endl;
-            // }
-
-            // copy new relevant risk factors to last used
-            risk_factors_last_used.assign(risk_factors_current.begin(), risk_factors_current.end());
-        }
-
-        // convert the assumptions to the length of the timestep and make them dependent
-        if (yearly_assumptions_updated || (days_current_step != days_previous_step))
-        {
-//            cout << "updating period assumptions" << endl;
-            adjust_assumptions_simple(days_current_step);
-        }
-
-        // save assumptions for this timestep
-        for (int j=0; j < _dimension * _dimension; j++) {
-            be_a_time_step_dependent_collect[time_index * _dimension * _dimension + j] = be_a_time_step_dependent[j];
+            if (_step_matrix_changed)
+            {
+                _step_matrices.insert(_step_matrices.end(), be_a_time_step_dependent.get(), be_a_time_step_dependent.get() + dimension() * dimension());
+                _step_matrix_changed = false;
+            }
+            _step_matrix_index[time_index] = (int)(_step_matrices.size() / (dimension() * dimension())) - 1;
         }
 
         // // print out the adjusted assumptions
         // cout << "  scaled" << endl;
-        // for (unsigned r = 0; r < _dimension; r++)
+        // for (unsigned r = 0; r < dimension(); r++)
         // {
         //     cout << "    ";
-        //     for (unsigned c = 0; c < _dimension; c++)
+        //     for (unsigned c = 0; c < dimension(); c++)
         //     {
-        //         cout << be_a_time_step_dependent.get()[r * _dimension + c] << ", ";
+        //         cout << be_a_time_step_dependent.get()[r * dimension() + c] << ", ";
         //     }
         //     cout << endl;
         // }
@@ -599,7 +978,11 @@ void RecordProjector::run(int runner_no,
         // cout << "before payments, time_index=" << time_index << std::endl;
         // cout << payments->size() << std::endl;
         double *current_states_probs = _be_states -> get_state_probs(time_index - 1);
+        std::fill(_step_payments.begin(), _step_payments.end(), 0.0);
         for (auto &state_payments : *payments) {
+            if (!_store_payments && !_calculate_reserves) {
+                break;
+            }
             int state_ind = state_payments.first;
             StateConditionalRecordPayout &paym_state = state_payments.second;
 
@@ -609,11 +992,15 @@ void RecordProjector::run(int runner_no,
                 //double this_payment = payout.cond_payments[time_index - 1] * current_states_probs[state_ind];
 
                 // store (aggregated) conditional amounts per state for reserve calc with inverted sign
-                cfs_bom_per_state_for_res[time_index * _dimension + state_ind] -= payout.cond_payments[time_index];
+                if (_calculate_reserves) {
+                    cfs_bom_per_state_for_res[time_index * dimension() + state_ind] -= payout.cond_payments[time_index];
+                }
 
-                double this_payment = payout.cond_payments[time_index] * current_states_probs[state_ind];
-                //cout << "time_index=" << time_index << ", payment_index= " << payment_index << ", amount=" << this_payment << std::endl;
-                result.set_state_cond_payments(time_index, payment_index, this_payment);
+                if (_store_payments) {
+                    double this_payment = payout.cond_payments[time_index] * current_states_probs[state_ind];
+                    //cout << "time_index=" << time_index << ", payment_index= " << payment_index << ", amount=" << this_payment << std::endl;
+                    _step_payments[payment_index] = this_payment;
+                }
                 //result.get_state_cond_payments_ptr()
             }
         }
@@ -626,15 +1013,18 @@ void RecordProjector::run(int runner_no,
 
         
         //_be_states->print_state_probs(time_index - 1);
-        _be_states->update_state(time_index - 1, be_a_time_step_dependent.get(), current_vol);
+        _be_states->update_state(time_index - 1, be_a_time_step_dependent.get());
         // _be_states->print_state_probs(time_index);
 
 
         ///////////////////////////////////////////////////////////////////////////////////////
         // Step 4: Payments at end of period
         ///////////////////////////////////////////////////////////////////////////////////////
-        double *period_prob_movements = _be_states->get_probs_mvms(time_index);
+        const double *period_prob_movements = _be_states->get_step_movements();
         for (auto &trans_payments : *transition_payments) {
+            if (!_store_payments && !_calculate_reserves) {
+                break;
+            }
             pair<int, int> state_pair = trans_payments.first;
             int state_from = state_pair.first;
             int state_to = state_pair.second;
@@ -644,14 +1034,18 @@ void RecordProjector::run(int runner_no,
                 int payment_index = payout.payment_index;
 
                 // store (aggregated) conditional amounts per state for reserve calc with inverted sign
-                int ind_for_save = time_index * (_dimension * _dimension) + state_from * _dimension + state_to;
-                cf_eom_per_state_change_for_res[ind_for_save] -= payout.cond_payments[time_index];
+                if (_calculate_reserves) {
+                    int ind_for_save = time_index * (dimension() * dimension()) + state_from * dimension() + state_to;
+                    cf_eom_per_state_change_for_res[ind_for_save] -= payout.cond_payments[time_index];
+                }
                 
-                double this_payment = payout.cond_payments[time_index] * period_prob_movements[state_from * _num_states + state_to];
+                if (_store_payments) {
+                    double this_payment = payout.cond_payments[time_index] * period_prob_movements[state_from * _num_states + state_to];
 
-                // TODO: here it should be considered of a different result container should be used for transitional payments
-                // if not then rename
-                result.set_state_cond_payments(time_index, payment_index, this_payment);
+                    // TODO: here it should be considered of a different result container should be used for transitional payments
+                    // if not then rename
+                    _step_payments[payment_index] = this_payment;
+                }
             }
 
         }
@@ -662,48 +1056,141 @@ void RecordProjector::run(int runner_no,
         // TODO
 
 
-        // closing the loop
-        first_iteration = false;
-        if (age_month_completed >= _run_config.get_max_age() * 12)
+        // add the movements and payments of the step to the result
+        result.add_record_movements(time_index, period_prob_movements, weight, volume);
+        if (_store_payments)
+        {
+            result.add_record_payments(time_index, _step_payments.data());
+        }
+
+        // closing the loop, the states after the step which reaches the maximum age are discarded
+        if (max_age_reached())
         {
             early_stop = true;
             // cout << "Early stop detected at " << _end_dates[time_index] << endl;
             break;
         }
+        result.add_record_states(time_index, _be_states->get_state_probs(time_index), weight, volume);
+
+        // the cover has ended or the record has left all states that are in force, the remaining states are carried forward
+        if (projection_horizon_reached(time_index) || in_force_negligible(_be_states->get_state_probs(time_index)))
+        {
+            terminated = true;
+            break;
+        }
     }
 
     //////////////////////////////////////////////////
     // calculate reserves
-    calculate_reserves(policy.get_reserving_rate(), time_index);
+    // without early stop the loop ends one index behind the last time step
+    if (_calculate_reserves)
+    {
+        calculate_reserves(policy.get_reserving_rate(), min(time_index, max_time_step_index));
+    }
 
-    // clean-up after early stop as necessary
-    if (early_stop)
+    // the last states are carried forward after an early stop
+    int last_index = early_stop ? time_index - 1 : time_index;
+    if (early_stop || terminated)
     {
-        _be_states->trivial_runoff(time_index);
+        const double *last_states = _be_states->get_state_probs(last_index);
+        for (int t = last_index + 1; t <= max_time_step_index; t++)
+        {
+            result.add_record_states(t, last_states, weight, volume);
+        }
+    }
+    if (terminated)
+    {
+        result.add_skipped_time_steps(max_time_step_index - time_index);
     }
 }
 
-void RecordProjector::adjust_assumptions_simple(int days)
+template <int N>
+void RecordProjectorT<N>::set_projection_horizon(const CPolicy &policy,
+                                                 const unordered_map<int, StateConditionalRecordPayout> &state_payments,
+                                                 const unordered_map<pair<int, int>, TransitionConditionalRecordPayout> &transition_payments)
 {
-    double duration_factor = days / 360.0;
-    double sum_row_nondiag;
+    int max_time_step_index = (int)_end_dates.size() - 1;
+    _horizon = max_time_step_index;
 
-    // simple scaling method
-    for (unsigned r = 0; r < _dimension; r++)
+    // the step which contains the end of the cover
+    if (policy.has_coverage_end_date())
     {
-        sum_row_nondiag = 0;
-        for (unsigned c = 0; c < _dimension; c++)
-        {
-            if (c == r)
+        int cover_end_index = (int)(std::lower_bound(_end_dates.begin(), _end_dates.end(), policy.get_coverage_end_date()) - _end_dates.begin());
+        _horizon = min(_horizon, cover_end_index);
+    }
+
+    // the step of the last payment
+    if (_run_config.get_payment_horizon())
+    {
+        int last_payment_index = 0;
+        auto update_last_payment = [&](const vector<ConditionalPayout> &payouts) {
+            for (const ConditionalPayout &payout : payouts)
             {
-                continue;
+                for (int t = min(_horizon, (int)payout.cond_payments.size() - 1); t > last_payment_index; t--)
+                {
+                    if (payout.cond_payments[t] != 0)
+                    {
+                        last_payment_index = t;
+                        break;
+                    }
+                }
             }
-            double this_scaled_val = duration_factor * be_a_yearly.get()[r * _dimension + c];
-            sum_row_nondiag += this_scaled_val;
-            be_a_time_step_dependent.get()[r * _dimension + c] = this_scaled_val;
+        };
+        for (auto &sp : state_payments)
+        {
+            update_last_payment(sp.second.payments);
+        }
+        for (auto &tp : transition_payments)
+        {
+            update_last_payment(tp.second.payments);
+        }
+        _horizon = min(_horizon, last_payment_index);
+    }
+
+    _horizon = max(_horizon, 1);
+}
+
+template <int N>
+void RecordProjectorT<N>::adjust_assumptions_simple(int days)
+{
+    convert_rates_simple(dimension(), _current_yearly, days, be_a_time_step_dependent.get());
+}
+
+template <int N>
+void RecordProjectorT<N>::convert_assumptions(int days)
+{
+    if (!_conversion_cache)
+    {
+        adjust_assumptions_simple(days);
+        return;
+    }
+
+    // look up the entries used before without locking the shared cache
+    size_t hash = _conversion_cache->key_hash(_current_yearly, days);
+    const CRateConversionCache::Entry *entry = nullptr;
+    auto range = _local_conversions.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (_conversion_cache->matches(*it->second, _current_yearly, days))
+        {
+            entry = it->second.get();
+            break;
+        }
+    }
+    if (!entry)
+    {
+        if (_local_conversions.size() >= LOCAL_CONVERSIONS_CAPACITY)
+        {
+            _local_conversions.clear();
         }
-        be_a_time_step_dependent.get()[r * _dimension + r] = 1 - sum_row_nondiag;
+        shared_ptr<const CRateConversionCache::Entry> shared_entry = _conversion_cache->get(_current_yearly, days, hash);
+        entry = shared_entry.get();
+        _local_conversions.emplace(hash, std::move(shared_entry));
     }
+    std::copy(entry->converted.begin(), entry->converted.end(), be_a_time_step_dependent.get());
 }
 
+/// Record projector with the number of states determined at runtime
+typedef RecordProjectorT<0> RecordProjector;
+
 #endif
\ No newline at end of file
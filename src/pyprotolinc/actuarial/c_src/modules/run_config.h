@@ -19,9 +19,33 @@
 #include <memory>
 #include "time_axis.h"
 #include "assumption_sets.h"
+#include "rate_conversion.h"
 
 using namespace std;
 
+/// Flag to signal which projection engine the runners use
+enum class ProjectionEngine : int
+{
+    SCALAR, // 0  one record at a time
+    BLOCK   // 1  blocks of records advanced together in structure-of-arrays layout
+};
+
+/**
+ * @brief Outputs requested from a run. The columns of outputs which are not requested are zero and the calculations
+ * only needed for them are skipped: their arrays are neither allocated nor aggregated and no payments are stored.
+ * The state probabilities are always projected as everything else depends on them. The reserves are not part of the
+ * result columns, they are only available per record from the projector and hence not calculated by default.
+ */
+struct ResultSpec
+{
+    bool state_probs = true;       ///< PROB_STATE_* columns
+    bool prob_movements = true;    ///< PROB_MVM_* columns
+    bool state_volumes = true;     ///< VOL_STATE_* columns
+    bool volume_movements = true;  ///< VOL_MVM_* columns
+    bool payments = true;          ///< STATE_PAYMENT_TYPE_* columns
+    bool reserves = false;         ///< reserve recursion of the records (RecordProjector::get_reserves_bom)
+};
+
 /**
  * @brief Container with configuration parameters.
  * 
@@ -39,6 +63,9 @@ private:
     ///< Time scale on which to calculate
     int _years_to_simulate;
 
+    ///< sections at the beginning of the projection with another time step
+    vector<TimeStepSegment> _time_step_segments;
+
     ///< Number of cpus to use
     int _num_cpus;
 
@@ -48,6 +75,42 @@ private:
     ///< maximum age in projection in years
     int _max_age;
 
+    ///< project identical records once as weighted model point
+    bool _compress_model_points = true;
+
+    ///< width (in months) of the bands in which dates of birth are merged into one model point, 0 for exact compression
+    int _dob_band_months = 0;
+
+    ///< projection engine used by the runners
+    ProjectionEngine _projection_engine = ProjectionEngine::SCALAR;
+
+    ///< stop the projection of a record once its probability to be in a state it can still leave is negligible
+    bool _early_termination = true;
+
+    ///< probability up to which the in-force probability of a record is regarded as negligible
+    double _early_termination_threshold = 0.0;
+
+    ///< do not project a record beyond its last non-zero conditional payment
+    bool _payment_horizon = false;
+
+    ///< method to convert the yearly rates to the length of the time steps
+    RateConversion _rate_conversion = RateConversion::SIMPLE;
+
+    ///< outputs requested from the run
+    ResultSpec _result_spec;
+
+    ///< start the ranges of records with the highest estimated costs first
+    bool _schedule_by_cost = true;
+
+    ///< number of records per range distributed to the workers, 0 to determine it from the portfolio size
+    int _schedule_range_size = 0;
+
+    ///< sum the records in an order which does not depend on the number of workers
+    bool _reproducible_summation = false;
+
+    ///< pin the threads of the engine to cpus
+    bool _pin_threads = false;
+
     // valuation assumptions
     shared_ptr<CAssumptionSet> be_assumptions;
     shared_ptr<vector<shared_ptr<CAssumptionSet>>> other_assumptions = make_shared<vector<shared_ptr<CAssumptionSet>>>();
@@ -59,7 +122,7 @@ public:
      * @param _dim Dimension of the state model
      * @param time_step Time scale on which to calculate
      * @param years_to_simulate Number of years to project into the future
-     * @param num_cpus Number of cpus to use if `use_multicore=true`
+     * @param num_cpus Number of threads the engine uses if `use_multicore=true`, at least one
      * @param use_multicore Use multicore flag
      * @param _be_assumptions Best estimate assumptions
      */
@@ -76,18 +139,137 @@ public:
         {
             throw domain_error("Assumption set pointer must not be null!");
         }
+        if (num_cpus < 1)
+        {
+            throw domain_error("The number of cpus must be at least one.");
+        }
         if (_be_assumptions->get_dimension() != _dim)
         {
             throw domain_error("Dimension of assumptions set and the one passed in must match");
         }
     }
 
-    int get_cpu_count() const { return _num_cpus; }                     ///< Returns the number of cpus to use if `use_multicore=true`
+    int get_cpu_count() const { return _num_cpus; }                     ///< Returns the number of threads of the engine if `use_multicore=true`
     bool get_use_multicore() const { return _use_multicore; }           ///< Returns if multiple core should be used
     TimeStep get_time_step() const { return _time_step; }               ///< Returns the time scale on which to calculate
     int get_years_to_simulate() const { return _years_to_simulate;}     ///< Returns the umber of years to project into the future
+    const vector<TimeStepSegment> &get_time_step_segments() const { return _time_step_segments; } ///< Returns the sections with another time step
+
+    /**
+     * @brief Use another time step for the projection up to the end of the year `years` after the portfolio date,
+     * the segments are added in increasing order of years and the run's time step applies after the last one.
+     *
+     * @param time_step Time step in this segment, e.g. monthly in the near term.
+     * @param years End of the segment in years after the portfolio date.
+     */
+    void add_time_step_segment(TimeStep time_step, int years)
+    {
+        int years_before = _time_step_segments.empty() ? 0 : _time_step_segments.back().years;
+        if (years <= years_before || years > _years_to_simulate)
+        {
+            throw domain_error("Time step segments must end in increasing years up to the years to simulate, got " + std::to_string(years) + ".");
+        }
+        _time_step_segments.push_back({time_step, years});
+    }
     unsigned int get_dimension() const { return dimension; }            ///< Returns the dimension of the state model
     int get_max_age() const { return _max_age; }                        ///< Returns the maximum in years until the projection should be extended
+    bool get_compress_model_points() const { return _compress_model_points; } ///< Returns if identical records are projected as model points
+    int get_dob_band_months() const { return _dob_band_months; }        ///< Returns the band width (in months) for the dates of birth of model points
+    ProjectionEngine get_projection_engine() const { return _projection_engine; } ///< Returns the projection engine used by the runners
+
+    /// Select the projection engine, both engines produce identical results.
+    void set_projection_engine(ProjectionEngine engine) { _projection_engine = engine; }
+
+    bool get_early_termination() const { return _early_termination; }  ///< Returns if the projection of a record stops once it is no longer in force
+    double get_early_termination_threshold() const { return _early_termination_threshold; } ///< Returns the in-force probability regarded as negligible
+
+    /**
+     * @brief Configure the early termination of records which are no longer in force, i.e. whose probability to
+     * be in a non-absorbing state (or in an absorbing state with payments) does not exceed a threshold.
+     *
+     * @param enabled Stop the projection of such records and carry their states forward.
+     * @param threshold In-force probability regarded as negligible, the default 0 does not change the results
+     *        whereas positive values are an approximation within a materiality limit.
+     */
+    void set_early_termination(bool enabled, double threshold = 0.0)
+    {
+        if (threshold < 0)
+        {
+            throw domain_error("The early termination threshold must not be negative.");
+        }
+        _early_termination = enabled;
+        _early_termination_threshold = threshold;
+    }
+
+    bool get_payment_horizon() const { return _payment_horizon; }  ///< Returns if records are projected only up to their last payment
+
+    /**
+     * @brief Configure if the projection of a record ends with its last non-zero conditional payment. The payments
+     * and reserves are unchanged, the state probabilities and volumes are carried forward from there.
+     */
+    void set_payment_horizon(bool enabled) { _payment_horizon = enabled; }
+
+    RateConversion get_rate_conversion() const { return _rate_conversion; }  ///< Returns the method to convert yearly rates to the time steps
+
+    /// Select the method to convert the yearly rates to the length of the time steps.
+    void set_rate_conversion(RateConversion method) { _rate_conversion = method; }
+
+    const ResultSpec &get_result_spec() const { return _result_spec; }  ///< Returns the outputs requested from the run
+    bool get_schedule_by_cost() const { return _schedule_by_cost; }      ///< Returns if the most expensive ranges of records are started first
+    int get_schedule_range_size() const { return _schedule_range_size; } ///< Returns the number of records per range (0 for automatic)
+
+    /**
+     * @brief Configure the distribution of the records to the workers, which steal ranges of records from each other
+     * once they have finished their own.
+     *
+     * @param by_cost Start the ranges with the highest estimated costs (time steps to project times transitions) first.
+     * @param range_size Number of consecutive records per range, the default 0 chooses about 16 ranges per worker.
+     */
+    void set_scheduling(bool by_cost, int range_size = 0)
+    {
+        if (range_size < 0)
+        {
+            throw domain_error("The number of records per range must not be negative.");
+        }
+        _schedule_by_cost = by_cost;
+        _schedule_range_size = range_size;
+    }
+
+    bool get_reproducible_summation() const { return _reproducible_summation; }  ///< Returns if the results are independent of the number of workers
+
+    /**
+     * @brief With reproducible summation the portfolio is cut into at most 64 ranges that only depend on its size
+     * (the range size of set_scheduling is ignored), each range is summed in the order of the records into a result
+     * of its own and these are added in a fixed tree as soon as both halves of a subtree are complete. The results
+     * are then identical bit by bit for any number of workers, only the subtrees waiting for a sibling are kept.
+     */
+    void set_reproducible_summation(bool reproducible) { _reproducible_summation = reproducible; }
+
+    bool get_thread_pinning() const { return _pin_threads; }  ///< Returns if the threads of the engine are pinned to cpus
+
+    /// Pin each thread of the engine to a cpu of its own (Linux), the buffers of a worker are then allocated on
+    /// the NUMA node of its cpu.
+    void set_thread_pinning(bool pin_threads) { _pin_threads = pin_threads; }
+
+    /// Select the outputs of the run, the calculations only needed for other outputs are skipped.
+    void set_result_spec(const ResultSpec &spec) { _result_spec = spec; }
+
+    /**
+     * @brief Configure the compression of the portfolio into model points.
+     *
+     * @param compress Project records which agree in everything the projection depends on only once.
+     * @param dob_band_months If positive, dates of birth within bands of this many months are merged as well
+     *        (approximation within a materiality limit), the default 0 merges only records with identical projections.
+     */
+    void set_model_point_compression(bool compress, int dob_band_months = 0)
+    {
+        if (dob_band_months < 0)
+        {
+            throw domain_error("The band width for the dates of birth must not be negative.");
+        }
+        _compress_model_points = compress;
+        _dob_band_months = dob_band_months;
+    }
 
     /// Add an auxiliary assumption set.
     void add_assumption_set(shared_ptr<CAssumptionSet> as)
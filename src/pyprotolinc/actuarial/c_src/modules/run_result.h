@@ -14,7 +14,12 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include "time_axis.h"
+#include "run_config.h"
+#include "thread_pool.h"
 
 using namespace std;
 
@@ -28,7 +33,7 @@ const vector<string> time_axis_names = {
  * @brief Copy the results from one 2D array (internal) to another 2D (external) array. Both must have the same number of rows but the target matrix may have more columns.
  *
  * @param target_array Pointer to target 2D memory block (where to copy to).
- * @param source_array Pointer to source 2D memory block (where to copy from).
+ * @param source_array Pointer to source 2D memory block (where to copy from), if null the columns are filled with zeros.
  * @param source_col_num Number of states, this is the number of columns in the source data.
  * @param row_num Number of rows to be copied. Should conincide with the row-dimensions of source and target
  * @param target_col_num Number of columns **of the target Matrix**.
@@ -40,7 +45,7 @@ void insert_2dmatrix_as_submatrix(double *target_array, double *source_array, in
     {
         for (int state_index = 0; state_index < source_col_num; state_index++)
         {
-            target_array[t * target_col_num + target_start_col + state_index] = source_array[t * source_col_num + state_index];
+            target_array[t * target_col_num + target_start_col + state_index] = source_array ? source_array[t * source_col_num + state_index] : 0.0;
         }
     }
 }
@@ -84,7 +89,10 @@ private:
 
     shared_ptr<TimeAxis> _ta = nullptr;
 
-    /// projected state probabilities and probability movements
+    /// the outputs stored in this result
+    ResultSpec _spec;
+
+    /// projected state probabilities and probability movements (only allocated if requested, as all outputs)
     unique_ptr<double[]> _be_state_probs = nullptr;
     unique_ptr<double[]> _be_prob_movements = nullptr;
 
@@ -101,31 +109,54 @@ private:
 
     int _num_state_payment_cols;
 
+    /// number of record time steps skipped by early termination
+    long long _skipped_time_steps = 0;
+
+    /// time each worker of the run spent projecting records
+    vector<double> _worker_busy_seconds;
+
 public:
     /**
      * @brief Construct a new Run Result object
      *
      * @param num_states Number of states in states model
      * @param p_time_axis Pointer to the time axis object
+     * @param num_state_payment_cols Number of payment types
+     * @param spec The outputs to be stored, the columns of the others are zero
      */
-    RunResult(int num_states, shared_ptr<TimeAxis> p_time_axis, int num_state_payment_cols) : _num_states(num_states), _num_timesteps(p_time_axis->get_length()), _ta(p_time_axis),
-                                                                                              _num_state_payment_cols(num_state_payment_cols)
+    RunResult(int num_states, shared_ptr<TimeAxis> p_time_axis, int num_state_payment_cols, const ResultSpec &spec = ResultSpec()) :
+        _num_states(num_states), _num_timesteps(p_time_axis->get_length()), _ta(p_time_axis), _spec(spec), _num_state_payment_cols(num_state_payment_cols)
     {
 
-        // allocate memory for the be probability states
-        _be_state_probs = unique_ptr<double[]>(new double[_num_timesteps * _num_states], std::default_delete<double[]>());
-        _be_prob_movements = unique_ptr<double[]>(new double[_num_timesteps * _num_states * _num_states], std::default_delete<double[]>());
+        // allocate memory for the be probability states, initialized with zeros
+        if (_spec.state_probs)
+        {
+            _be_state_probs = unique_ptr<double[]>(new double[_num_timesteps * _num_states](), std::default_delete<double[]>());
+        }
+        if (_spec.prob_movements)
+        {
+            _be_prob_movements = unique_ptr<double[]>(new double[_num_timesteps * _num_states * _num_states](), std::default_delete<double[]>());
+        }
 
-        _be_state_vols = unique_ptr<double[]>(new double[_num_timesteps * _num_states], std::default_delete<double[]>());
-        _be_vol_movements = unique_ptr<double[]>(new double[_num_timesteps * _num_states * _num_states], std::default_delete<double[]>());
+        if (_spec.state_volumes)
+        {
+            _be_state_vols = unique_ptr<double[]>(new double[_num_timesteps * _num_states](), std::default_delete<double[]>());
+        }
+        if (_spec.volume_movements)
+        {
+            _be_vol_movements = unique_ptr<double[]>(new double[_num_timesteps * _num_states * _num_states](), std::default_delete<double[]>());
+        }
 
-        if (_num_state_payment_cols > 0)
+        if (_num_state_payment_cols > 0 && _spec.payments)
         {
-            _state_cond_payments = unique_ptr<double[]>(new double[_num_timesteps * _num_state_payment_cols], std::default_delete<double[]>());
+            _state_cond_payments = unique_ptr<double[]>(new double[_num_timesteps * _num_state_payment_cols](), std::default_delete<double[]>());
         }
+    }
 
-        // initialize with zeros
-        this->reset();
+    /// Return the outputs stored in this result
+    const ResultSpec &get_result_spec() const
+    {
+        return _spec;
     }
 
     /// Return a list of strings containing the headers of the external results table
@@ -172,51 +203,84 @@ public:
         return hdrs;
     }
 
-    /// Return a pointer to the space where to store the projected state probabilities
+    /// Return a pointer to the space where to store the projected state probabilities, null if not requested
     double *get_be_state_probs_ptr()
     {
         return _be_state_probs.get();
     }
 
-    /// Return a pointer to the space where to store the projected volume results
+    /// Return a pointer to the space where to store the projected volume results, null if not requested
     double *get_be_state_vols_ptr()
     {
         return _be_state_vols.get();
     }
 
-    /// Return a pointer to the space where to store the projected state probability movements
+    /// Return a pointer to the space where to store the projected state probability movements, null if not requested
     double *get_be_prob_mvms_ptr()
     {
         return _be_prob_movements.get();
     }
 
-    /// Return a pointer to the space where to store the projected state volume movements
+    /// Return a pointer to the space where to store the projected state volume movements, null if not requested
     double *get_be_vol_mvms_ptr()
     {
         return _be_vol_movements.get();
     }
 
-    /// Return a pointer to the space where to store the cash flows
+    /// Return a pointer to the space where to store the cash flows, null if not requested
     double *get_state_cond_payments_ptr()
     {
         return _state_cond_payments.get();
     }
 
-    /// @brief Set the value for the state conditional payment
-    /// @param time_index
-    /// @param cf_type_index
-    /// @param val
-    void set_state_cond_payments(size_t time_index, size_t cf_type_index, double val)
+    /// Return the number of payment types
+    int get_num_state_payment_cols() const
     {
-        _state_cond_payments[time_index * _num_state_payment_cols + cf_type_index] = val;
+        return _num_state_payment_cols;
     }
 
-    /// Reset the result, zeroises the allocated arrays
-    void reset();
+    /// Add the state probabilities of a record at `time_index` multiplied by `weight` (the number of records it
+    /// represents), its volumes are derived with the sum insured `volume`
+    void add_record_states(int time_index, const double *probs, double weight, double volume);
+
+    /// Add the probability movements of a record in the step ending at `time_index` multiplied by `weight`, its
+    /// volume movements are derived with the sum insured `volume`
+    void add_record_movements(int time_index, const double *prob_mvms, double weight, double volume);
+
+    /// Add the payments of a record (one per payment type) in the step ending at `time_index`
+    void add_record_payments(int time_index, const double *payments);
+
+    /// Count time steps whose projection was skipped since the record stopped early
+    void add_skipped_time_steps(long long steps)
+    {
+        _skipped_time_steps += steps;
+    }
+
+    /// Return the number of record time steps skipped by early termination
+    long long get_skipped_time_steps() const
+    {
+        return _skipped_time_steps;
+    }
+
+    /// Store the time each worker of the run spent projecting records
+    void set_worker_busy_seconds(const vector<double> &busy_seconds)
+    {
+        _worker_busy_seconds = busy_seconds;
+    }
+
+    /// Return the time each worker of the run spent projecting records (empty if not set)
+    const vector<double> &get_worker_busy_seconds() const
+    {
+        return _worker_busy_seconds;
+    }
 
     /// Add another result to this one
     void add_result(const RunResult &other_res);
 
+    /// Add the results pairwise in a binary tree, the pairs of each level in parallel if a thread pool is given.
+    /// The sum ends up in `results[0]`, the order of the additions only depends on the number of results.
+    static void tree_reduce(vector<RunResult> &results, CThreadPool *pool = nullptr);
+
     /// Copy results to an external array
     void copy_results(double *ext_result, int row_num, int col_num) const;
 
@@ -227,50 +291,219 @@ public:
     }
 };
 
-void RunResult::reset()
+/**
+ * @brief Adds the results of a fixed number of leaves in the binary tree of RunResult::tree_reduce while they are
+ * completed in any order: a result is added to its sibling as soon as both are complete. Only the subtrees waiting
+ * for a sibling are kept in memory, the sum is identical bit by bit to the one of RunResult::tree_reduce.
+ *
+ */
+class RunResultTree
+{
+private:
+    size_t _num_leaves;
+
+    // the complete subtree starting at leaf i and its level (-1 if none is waiting)
+    vector<unique_ptr<RunResult>> _nodes;
+    vector<int> _levels;
+    std::mutex _mutex;
+
+public:
+    RunResultTree(size_t num_leaves) : _num_leaves(num_leaves), _nodes(num_leaves), _levels(num_leaves, -1) {}
+
+    /// Add the result of leaf `index`, may be called concurrently for different leaves.
+    void add(size_t index, unique_ptr<RunResult> result);
+
+    /// Return the sum once all leaves have been added (null without leaves).
+    unique_ptr<RunResult> release_sum();
+};
+
+void RunResultTree::add(size_t index, unique_ptr<RunResult> result)
 {
-    // resetting _be_state_probs
-    for (auto i = 0; i < _num_states * _num_timesteps; i++)
+    if (index >= _num_leaves || !result)
     {
-        _be_state_probs[i] = 0;
-        _be_state_vols[i] = 0;
+        throw domain_error("Invalid leaf " + std::to_string(index) + " of the result tree.");
     }
 
-    for (auto i = 0; i < _num_states * _num_states * _num_timesteps; i++)
+    int level = 0;
+    for (size_t stride = 1; stride < _num_leaves; stride *= 2, level++)
     {
-        _be_prob_movements[i] = 0;
-        _be_vol_movements[i] = 0;
+        bool left = index % (2 * stride) == 0;
+        size_t sibling = left ? index + stride : index - stride;
+        if (sibling >= _num_leaves)
+        {
+            // the last subtree of the level has no sibling
+            continue;
+        }
+
+        unique_ptr<RunResult> other;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_levels[sibling] != level)
+            {
+                // the sibling adds this subtree when it is complete
+                _nodes[index] = std::move(result);
+                _levels[index] = level;
+                return;
+            }
+            other = std::move(_nodes[sibling]);
+            _levels[sibling] = -1;
+        }
+
+        // the left subtree adds the right one as in tree_reduce
+        if (left)
+        {
+            result->add_result(*other);
+        }
+        else
+        {
+            other->add_result(*result);
+            result = std::move(other);
+            index = sibling;
+        }
     }
 
-    for (auto i = 0; i < _num_state_payment_cols * _num_timesteps; i++)
+    std::lock_guard<std::mutex> lock(_mutex);
+    _nodes[0] = std::move(result);
+    _levels[0] = level;
+}
+
+unique_ptr<RunResult> RunResultTree::release_sum()
+{
+    int root_level = 0;
+    for (size_t stride = 1; stride < _num_leaves; stride *= 2)
     {
-        _state_cond_payments[i] = 0.0;
+        root_level++;
     }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_num_leaves > 0 && (!_nodes[0] || _levels[0] != root_level))
+    {
+        throw domain_error("Not all results have been added to the tree.");
+    }
+    return _num_leaves > 0 ? std::move(_nodes[0]) : nullptr;
 }
+
 void RunResult::add_result(const RunResult &other_res)
 {
 
     // add state probabilities and volumes
-    for (auto i = 0; i < _num_states * _num_timesteps; i++)
+    if (_be_state_probs && other_res._be_state_probs)
     {
-        _be_state_probs[i] += other_res._be_state_probs[i];
-        _be_state_vols[i] += other_res._be_state_vols[i];
+        for (auto i = 0; i < _num_states * _num_timesteps; i++)
+        {
+            _be_state_probs[i] += other_res._be_state_probs[i];
+        }
+    }
+    if (_be_state_vols && other_res._be_state_vols)
+    {
+        for (auto i = 0; i < _num_states * _num_timesteps; i++)
+        {
+            _be_state_vols[i] += other_res._be_state_vols[i];
+        }
     }
 
     // add probability and volume movements
-    for (auto i = 0; i < _num_states * _num_states * _num_timesteps; i++)
+    if (_be_prob_movements && other_res._be_prob_movements)
+    {
+        for (auto i = 0; i < _num_states * _num_states * _num_timesteps; i++)
+        {
+            _be_prob_movements[i] += other_res._be_prob_movements[i];
+        }
+    }
+    if (_be_vol_movements && other_res._be_vol_movements)
+    {
+        for (auto i = 0; i < _num_states * _num_states * _num_timesteps; i++)
+        {
+            _be_vol_movements[i] += other_res._be_vol_movements[i];
+        }
+    }
+
+    if (_state_cond_payments && other_res._state_cond_payments)
+    {
+        for (auto i = 0; i < _num_state_payment_cols * _num_timesteps; i++)
+        {
+            _state_cond_payments[i] += other_res._state_cond_payments[i];
+        }
+    }
+    _skipped_time_steps += other_res._skipped_time_steps;
+}
+
+void RunResult::tree_reduce(vector<RunResult> &results, CThreadPool *pool)
+{
+    const int num_results = (int)results.size();
+    for (int stride = 1; stride < num_results; stride *= 2)
+    {
+        // pair p adds result (2p + 1) * stride to 2p * stride
+        const int num_pairs = (num_results - stride + 2 * stride - 1) / (2 * stride);
+        const int num_tasks = pool ? min(pool->get_num_threads(), num_pairs) : 1;
+        auto add_pairs = [&](int task) {
+            for (int p = task; p < num_pairs; p += num_tasks)
+            {
+                results[2 * p * stride].add_result(results[(2 * p + 1) * stride]);
+            }
+        };
+        if (num_tasks > 1)
+        {
+            pool->run(num_tasks, add_pairs);
+        }
+        else
+        {
+            add_pairs(0);
+        }
+    }
+}
+
+void RunResult::add_record_states(int time_index, const double *probs, double weight, double volume)
+{
+    if (_be_state_probs)
+    {
+        double *target_probs = _be_state_probs.get() + time_index * _num_states;
+        for (int s = 0; s < _num_states; s++)
+        {
+            target_probs[s] += weight * probs[s];
+        }
+    }
+    if (_be_state_vols)
+    {
+        double *target_vols = _be_state_vols.get() + time_index * _num_states;
+        for (int s = 0; s < _num_states; s++)
+        {
+            target_vols[s] += volume * probs[s];
+        }
+    }
+}
+
+void RunResult::add_record_movements(int time_index, const double *prob_mvms, double weight, double volume)
+{
+    const int len = _num_states * _num_states;
+    if (_be_prob_movements)
+    {
+        double *target_mvms = _be_prob_movements.get() + time_index * len;
+        for (int k = 0; k < len; k++)
+        {
+            target_mvms[k] += weight * prob_mvms[k];
+        }
+    }
+    if (_be_vol_movements)
     {
-        _be_prob_movements[i] += other_res._be_prob_movements[i];
-        _be_vol_movements[i] += other_res._be_vol_movements[i];
+        double *target_vol_mvms = _be_vol_movements.get() + time_index * len;
+        for (int k = 0; k < len; k++)
+        {
+            target_vol_mvms[k] += volume * prob_mvms[k];
+        }
     }
+}
 
-    // cout << "adding! " << other_res._state_cond_payments[0] << ", "
-    //                    << other_res._state_cond_payments[1] << ", "
-    //                    << other_res._state_cond_payments[_num_timesteps] << ", "
-    //                    << other_res._state_cond_payments[_num_timesteps + 1] << ", ";
-    for (auto i = 0; i < _num_state_payment_cols * _num_timesteps; i++)
+void RunResult::add_record_payments(int time_index, const double *payments)
+{
+    if (!_state_cond_payments)
+    {
+        return;
+    }
+    double *target = _state_cond_payments.get() + time_index * _num_state_payment_cols;
+    for (int k = 0; k < _num_state_payment_cols; k++)
     {
-        _state_cond_payments[i] += other_res._state_cond_payments[i];
+        target[k] += payments[k];
     }
 }
 
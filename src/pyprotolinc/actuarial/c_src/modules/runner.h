@@ -17,22 +17,30 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <iomanip>
 #include "assumption_sets.h"
 #include "providers.h"
 #include "portfolio.h"
 #include "run_config.h"
 #include "record_projector.h"
+#include "block_projector.h"
 #include "time_axis.h"
 #include "run_result.h"
 #include "payments.h"
+#include "model_points.h"
+#include "scheduler.h"
+#include "thread_pool.h"
 
 using namespace std;
 
 /**
  * @brief Provides an interface to the calculation functionality for a portfolio that will be made in one sequential batch.
  * 
+ * @tparam N Number of states the projector is specialized for, 0 for any number of states.
  */
-class Runner
+template <int N>
+class RunnerT
 {
 private:
     ///< Number of this runner.
@@ -48,10 +56,10 @@ private:
     const shared_ptr<TimeAxis> _ta;
 
     ///< projection engine for single policy
-    RecordProjector _record_projector;
+    RecordProjectorT<N> _record_projector;
 
-    ///< the result of the single record
-    RunResult _record_result;
+    ///< projection engine for blocks of policies (only with the block engine selected)
+    unique_ptr<BlockProjector> _block_projector;
 
     const int _num_state_payment_cols;
 
@@ -63,46 +71,76 @@ public:
      * @param ptr_portfolio The (sub-)portfolio of type CPolicyPortfolio that shall be valued.
      * @param run_config  CRunConfig configuration object.
      * @param ta Time axis to be used for the simulation.
+     * @param num_state_payment_cols Number of payment types.
+     * @param compiled_be_assumptions Optional dense version of the be assumptions, shared between the runners.
+     * @param slice_cache Optional cache of the sliced assumptions, shared between the runners.
+     * @param conversion_cache Optional cache of the converted rates, shared between the runners.
      */
-    Runner(int runner_no, const shared_ptr<CPolicyPortfolio> ptr_portfolio,
-           const CRunConfig &run_config, const shared_ptr<TimeAxis> ta, int num_state_payment_cols) : _runner_no(runner_no),
+    RunnerT(int runner_no, const shared_ptr<CPolicyPortfolio> ptr_portfolio,
+           const CRunConfig &run_config, const shared_ptr<TimeAxis> ta, int num_state_payment_cols,
+           shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions = nullptr,
+           shared_ptr<const CAssumptionSliceCache> slice_cache = nullptr,
+           shared_ptr<CRateConversionCache> conversion_cache = nullptr) : _runner_no(runner_no),
                                                                           _ptr_portfolio(ptr_portfolio),
                                                                           _run_config(run_config),
                                                                           _ta(ta),
-                                                                          _record_projector(RecordProjector(run_config, *_ta)),
-                                                                          _record_result(run_config.get_dimension(), _ta, num_state_payment_cols),
+                                                                          _record_projector(RecordProjectorT<N>(run_config, *_ta, compiled_be_assumptions, slice_cache, conversion_cache)),
                                                                           _num_state_payment_cols(num_state_payment_cols)
     {
+        if (run_config.get_projection_engine() == ProjectionEngine::BLOCK)
+        {
+            _block_projector = unique_ptr<BlockProjector>(new BlockProjector(run_config, *_ta, num_state_payment_cols, compiled_be_assumptions, slice_cache, conversion_cache));
+        }
     }
 
     /// Starts the main loop over the policies in the portfolio and combines the results.
     void run(RunResult &run_result, const AggregatePayments &payments);
+
+    /// Project the policies with index in [begin, end) of the portfolio and add them to the result.
+    void run(RunResult &run_result, const AggregatePayments &payments, size_t begin, size_t end);
 };
 
-void Runner::run(RunResult &run_result, const AggregatePayments &payments)
+template <int N>
+void RunnerT<N>::run(RunResult &run_result, const AggregatePayments &payments)
+{
+    run(run_result, payments, 0, _ptr_portfolio->size());
+}
+
+template <int N>
+void RunnerT<N>::run(RunResult &run_result, const AggregatePayments &payments, size_t begin, size_t end)
 {
     // cout << "Runner::run(): RUNNER " << _runner_no << " run() - "
     //      << "Portfolio size is " << _ptr_portfolio->size() << ". " << endl;
 
     PeriodDate portfolio_date(_ptr_portfolio->get_portfolio_date());
 
-    int record_count = 0;
-    for (auto record_ptr : _ptr_portfolio->get_policies())
+    if (_block_projector)
     {
-        shared_ptr<unordered_map<int, StateConditionalRecordPayout>> record_payments = payments.get_single_record_payments(record_count);
-        shared_ptr<unordered_map<pair<int, int>,  TransitionConditionalRecordPayout>> record_transiton_payments = payments.get_single_record_transition_payments(record_count);
-        // shared_ptr<unordered_map<int, StateConditionalRecordPayout>> &record_payments = payments.get_single_record_payments(record_count);
-
-        record_count++;
-        _record_result.reset();
-        _record_projector.run(_runner_no, record_count, *record_ptr, _record_result, portfolio_date, record_payments, record_transiton_payments);
-        run_result.add_result(_record_result);
+        const vector<shared_ptr<CPolicy>> &policies = _ptr_portfolio->get_policies();
+        for (size_t first = begin; first < end; first += BlockProjector::LANES)
+        {
+            _block_projector->run(policies, first, end, payments, run_result, portfolio_date);
+        }
+        return;
+    }
+
+    const vector<shared_ptr<CPolicy>> &policies = _ptr_portfolio->get_policies();
+    for (size_t record_index = begin; record_index < end && record_index < policies.size(); record_index++)
+    {
+        // by reference into the payments of the portfolio
+        const shared_ptr<unordered_map<int, StateConditionalRecordPayout>> &record_payments = payments.get_single_record_payments(record_index);
+        const shared_ptr<unordered_map<pair<int, int>,  TransitionConditionalRecordPayout>> &record_transiton_payments = payments.get_single_record_transition_payments(record_index);
+
+        _record_projector.run(_runner_no, (int)record_index + 1, *policies[record_index], run_result, portfolio_date, record_payments, record_transiton_payments);
     }
 }
 
+/// Runner with the number of states determined at runtime
+typedef RunnerT<0> Runner;
+
 /**
- * @brief The MetaRunner object. Splits the portfolio and triggers a (possibly) parallelized run
- * by instantiating several runner objects, starting them and combining their results.
+ * @brief The MetaRunner object. Triggers a (possibly) parallelized run by instantiating one runner object per worker,
+ * the records are distributed to the workers by a work-stealing scheduler and the results of the workers are combined.
  * 
  */
 class MetaRunner
@@ -116,6 +154,21 @@ protected:
 
     const int _num_state_payment_cols;
 
+    /// Number of workers for a portfolio of the given size.
+    int get_num_workers(size_t ptf_size) const;
+
+    /// Estimated costs of each record: the number of time steps it is projected times the number of transitions.
+    vector<double> estimate_costs(const CPolicyPortfolio &portfolio) const;
+
+    /// Value the portfolio (in parallel) with one runner per worker specialized for N states (0 for any number of
+    /// states) and add their results to `run_result`.
+    template <int N>
+    void run_workers(RunResult &run_result, const shared_ptr<CPolicyPortfolio> &portfolio,
+                     const AggregatePayments &payments,
+                     shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions,
+                     shared_ptr<const CAssumptionSliceCache> slice_cache,
+                     shared_ptr<CRateConversionCache> conversion_cache) const;
+
 public:
     /**
      * @brief Construct a new Meta Runner object
@@ -138,34 +191,85 @@ public:
         }
     }
 
-    ///> Calculates into how many sub-portfolios the portfolio will be split into
+    ///> Calculates how many workers will value the portfolio
     ///> depending on the cpu_count/use_multicore settings in the config and the portfolio size.
-    int get_num_groups() const;
+    int get_num_workers() const;
 
     ///> Calculate the result and store it in the reference passed in.
     ///>
     void run(RunResult &run_result, const AggregatePayments &agg_payments) const;  // check if const?
 };
 
-int MetaRunner::get_num_groups() const
+int MetaRunner::get_num_workers() const
+{
+    return get_num_workers(_ptr_portfolio->size());
+}
+
+int MetaRunner::get_num_workers(size_t num_records) const
 {
     if (!_run_config.get_use_multicore())
     {
         return 1;
     }
     int cpu_count = _run_config.get_cpu_count();
-    int ptf_size = (int) _ptr_portfolio->size();
+    int ptf_size = (int) num_records;
 
-    // make sure we have at least four policies in each group
+    // make sure we have at least four policies for each worker
     int tmp = cpu_count < ptf_size / 4 ? cpu_count : ptf_size / 4;
     return tmp == 0 ? 1 : tmp;
 }
 
+vector<double> MetaRunner::estimate_costs(const CPolicyPortfolio &portfolio) const
+{
+    const vector<PeriodDate> &end_dates = _ta->get_end_dates();
+    const int max_age_months = _run_config.get_max_age() * 12;
+    const int max_steps = max((int)end_dates.size() - 1, 1);
+
+    // the work of a time step grows with the number of transitions that can occur
+    int num_transitions = 0;
+    for (bool possible : _run_config.get_be_assumptions().get_transition_pattern(!keeps_zero_rates(_run_config.get_rate_conversion())))
+    {
+        num_transitions += possible ? 1 : 0;
+    }
+
+    const vector<shared_ptr<CPolicy>> &policies = portfolio.get_policies();
+    vector<double> costs(policies.size());
+    for (size_t i = 0; i < policies.size(); i++)
+    {
+        const CPolicy &policy = *policies[i];
+
+        // the steps before the maximum age and the end of the cover are reached
+        int steps = (int)(std::partition_point(end_dates.begin(), end_dates.end(), [&](const PeriodDate &d) {
+                              return get_age_at_date(policy.get_dob(), d) < max_age_months;
+                          }) - end_dates.begin());
+        if (policy.has_coverage_end_date())
+        {
+            steps = min(steps, (int)(std::lower_bound(end_dates.begin(), end_dates.end(), policy.get_coverage_end_date()) - end_dates.begin()));
+        }
+        costs[i] = (double)max(min(steps, max_steps), 1) * num_transitions;
+    }
+    return costs;
+}
+
 
 void MetaRunner::run(RunResult &run_result, const AggregatePayments &agg_payments) const
 {
     cout << "C++: STARTING RUN, portfolio.size()=" << _ptr_portfolio->size() << endl;
     const CAssumptionSet &be_ass = _run_config.get_be_assumptions();
+
+    // project identical records only once
+    shared_ptr<CPolicyPortfolio> portfolio = _ptr_portfolio;
+    shared_ptr<AggregatePayments> mp_payments;
+    if (_run_config.get_compress_model_points())
+    {
+        CModelPointCompressor compressor(*_ta, _run_config.get_dob_band_months());
+        portfolio = compressor.compress(_ptr_portfolio, agg_payments, mp_payments);
+        if (portfolio != _ptr_portfolio)
+        {
+            cout << "C++: compressed into " << portfolio->size() << " model points" << endl;
+        }
+    }
+    const AggregatePayments &payments = mp_payments ? *mp_payments : agg_payments;
     unsigned dimension = be_ass.get_dimension();
 
     //cout << "MetaRunner::run(): dimension=" << be_ass.get_dimension() << endl;
@@ -179,63 +283,167 @@ void MetaRunner::run(RunResult &run_result, const AggregatePayments &agg_payment
     //     }
     // }
 
-    // create N runners, run_results and sub-portfolios
-    const int NUM_GROUPS = get_num_groups();
-    // cout << "MetaRunner::run(): NUM_GROUPS=" << NUM_GROUPS << endl;
-    vector<shared_ptr<CPolicyPortfolio>> subportfolios(NUM_GROUPS);
-    vector<Runner> runners = vector<Runner>();
-    vector<RunResult> results = vector<RunResult>();
-    vector<AggregatePayments> sub_ptf_payments = vector<AggregatePayments>();
-
-    // when splitting the portfolios the size may vary by one depedning on the size and
-    // the number of groups
-    int base_size = _ptr_portfolio->size() / NUM_GROUPS;
-    int num_of_groups_with_one_record_more = _ptr_portfolio->size() - NUM_GROUPS * base_size;
-    for (int j = 0; j < NUM_GROUPS; j++)
+    // compile the be assumptions once into a dense tensor which is shared by all runners
+    shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions = be_ass.compile();
+
+    // slice the assumptions once for each combination of gender and smoker status in the portfolio
+    shared_ptr<CAssumptionSliceCache> slice_cache = make_shared<CAssumptionSliceCache>(be_ass, _run_config.get_other_assumptions());
+    for (const shared_ptr<CPolicy> &record : portfolio->get_policies())
     {
-        //subportfolios[j] = make_shared<CPolicyPortfolio>(_ptr_portfolio->_ptf_year, _ptr_portfolio->_ptf_month, _ptr_portfolio->_ptf_day);
-        subportfolios[j] = make_shared<CPolicyPortfolio>(_ptr_portfolio->get_portfolio_date());
-        runners.emplace_back(Runner(j + 1, subportfolios[j], _run_config, _ta, _num_state_payment_cols));
-        results.emplace_back(RunResult(_run_config.get_dimension(), _ta, _num_state_payment_cols));
-        
-        sub_ptf_payments.emplace_back(AggregatePayments(base_size +  (j < num_of_groups_with_one_record_more ? 1 : 0), agg_payments.get_payment_types_used()));
+        slice_cache->add(record->get_gender(), record->get_smoker_status());
     }
 
-    // split portfolio into N groups
-    int subportfolio_index = 0;
-    size_t overall_index = 0;
-    const vector<shared_ptr<CPolicy>> &policies = _ptr_portfolio->get_policies();
-    size_t index_in_group = 0;
-    for (shared_ptr<CPolicy> record : policies)
+    // the rates are converted to the time steps once per run for all runners
+    shared_ptr<CRateConversionCache> conversion_cache;
+    if (_run_config.get_rate_conversion() != RateConversion::SIMPLE)
     {
-        subportfolios[subportfolio_index]->add(record);
-        AggregatePayments &this_sub_ptf_payments = sub_ptf_payments[subportfolio_index];
-        this_sub_ptf_payments.add_single_record_payments(agg_payments.get_single_record_payments(overall_index), index_in_group);
-        this_sub_ptf_payments.add_single_record_transition_payments(agg_payments.get_single_record_transition_payments(overall_index), index_in_group);
-        if (++subportfolio_index >= NUM_GROUPS)
-        {
-            subportfolio_index = 0;
-            index_in_group++;
-        }
-        overall_index++;
+        conversion_cache = make_shared<CRateConversionCache>(_run_config.get_rate_conversion(), dimension);
     }
 
-    // value subportfolios
-#pragma omp parallel for
-    for (int j = 0; j < NUM_GROUPS; j++)
+    // value the portfolio with the projector specialized for small state models
+    switch (dimension)
     {
-        runners[j].run(results[j], sub_ptf_payments[j]);
+    case 2:
+        run_workers<2>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 3:
+        run_workers<3>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 4:
+        run_workers<4>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 5:
+        run_workers<5>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 6:
+        run_workers<6>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 7:
+        run_workers<7>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    case 8:
+        run_workers<8>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
+        break;
+    default:
+        run_workers<0>(run_result, portfolio, payments, compiled_be_assumptions, slice_cache, conversion_cache);
     }
 
-    // combine the results of the subportfolios to combined result
-    for (int j = 0; j < NUM_GROUPS; j++)
+    if (run_result.get_skipped_time_steps() > 0)
     {
-        run_result.add_result(results[j]);
+        cout << "C++: projection horizons and early termination skipped " << run_result.get_skipped_time_steps() << " record time steps" << endl;
     }
 
     //cout << "MetaRunner::run(): DONE" << endl;
 }
 
+template <int N>
+void MetaRunner::run_workers(RunResult &run_result, const shared_ptr<CPolicyPortfolio> &portfolio,
+                             const AggregatePayments &payments,
+                             shared_ptr<const CCompiledAssumptionSet> compiled_be_assumptions,
+                             shared_ptr<const CAssumptionSliceCache> slice_cache,
+                             shared_ptr<CRateConversionCache> conversion_cache) const
+{
+    const int NUM_WORKERS = get_num_workers(portfolio->size());
+    const bool reproducible = _run_config.get_reproducible_summation();
+
+    // the persistent threads of the engine, worker w runs on thread w
+    shared_ptr<CThreadPool> pool;
+    if (NUM_WORKERS > 1)
+    {
+        pool = CThreadPool::get_shared(_run_config.get_cpu_count(), _run_config.get_thread_pinning());
+    }
+    auto for_each_worker = [&](const function<void(int)> &task) {
+        if (pool)
+        {
+            pool->run(NUM_WORKERS, task);
+        }
+        else
+        {
+            task(0);
+        }
+    };
+
+    // one runner per worker, each runner may value any record of the portfolio; the buffers are allocated
+    // by the thread of the worker (first touch places them on its NUMA node)
+    vector<unique_ptr<RunnerT<N>>> runners(NUM_WORKERS);
+    for_each_worker([&](int w) {
+        runners[w] = unique_ptr<RunnerT<N>>(new RunnerT<N>(w + 1, portfolio, _run_config, _ta, _num_state_payment_cols, compiled_be_assumptions, slice_cache, conversion_cache));
+    });
+
+    // ranges of consecutive records, a multiple of the lanes for the block engine; for a reproducible summation
+    // they must not depend on the number of workers (nor on the engine), at most 64 ranges whatever range size is set
+    size_t range_size;
+    if (reproducible)
+    {
+        range_size = CWorkStealingScheduler::fixed_range_size(portfolio->size(), 64, BlockProjector::LANES);
+    }
+    else if (_run_config.get_schedule_range_size() > 0)
+    {
+        range_size = (size_t)_run_config.get_schedule_range_size();
+    }
+    else
+    {
+        size_t multiple = _run_config.get_projection_engine() == ProjectionEngine::BLOCK ? BlockProjector::LANES : 1;
+        range_size = CWorkStealingScheduler::default_range_size(portfolio->size(), NUM_WORKERS, multiple);
+    }
+    // a single worker keeps the order of the portfolio, its result does not depend on the scheduling
+    bool order_by_cost = _run_config.get_schedule_by_cost() && NUM_WORKERS > 1;
+    vector<double> costs = order_by_cost ? estimate_costs(*portfolio) : vector<double>(portfolio->size(), 1.0);
+    vector<WorkRange> ranges = CWorkStealingScheduler::make_ranges(costs, range_size, order_by_cost);
+    CWorkStealingScheduler scheduler(NUM_WORKERS, ranges);
+
+    if (reproducible)
+    {
+        // each range is summed into a result of its own (allocated by the worker) which is added to the tree of
+        // the ranges as soon as its sibling is complete
+        RunResultTree tree(ranges.size());
+        scheduler.run([&](int w, const WorkRange &range) {
+            unique_ptr<RunResult> result(new RunResult(_run_config.get_dimension(), _ta, _num_state_payment_cols, _run_config.get_result_spec()));
+            runners[w]->run(*result, payments, range.begin, range.end);
+            tree.add(range.begin / range_size, std::move(result));
+        }, pool.get());
+
+        unique_ptr<RunResult> sum = tree.release_sum();
+        if (sum)
+        {
+            run_result.add_result(*sum);
+        }
+    }
+    else
+    {
+        // one result per worker, allocated by the thread of the worker
+        vector<unique_ptr<RunResult>> allocated(NUM_WORKERS);
+        for_each_worker([&](int w) {
+            allocated[w] = unique_ptr<RunResult>(new RunResult(_run_config.get_dimension(), _ta, _num_state_payment_cols, _run_config.get_result_spec()));
+        });
+        vector<RunResult> results = vector<RunResult>();
+        for (int w = 0; w < NUM_WORKERS; w++)
+        {
+            results.push_back(std::move(*allocated[w]));
+        }
+
+        // value the ranges
+        scheduler.run([&](int w, const WorkRange &range) {
+            runners[w]->run(results[w], payments, range.begin, range.end);
+        }, pool.get());
+
+        // combine the results pairwise to the combined result
+        RunResult::tree_reduce(results, pool.get());
+        run_result.add_result(results[0]);
+    }
+    run_result.set_worker_busy_seconds(scheduler.get_busy_seconds());
+
+    if (NUM_WORKERS > 1)
+    {
+        cout << "C++: worker busy times [s]:";
+        for (double busy : scheduler.get_busy_seconds())
+        {
+            cout << " " << std::fixed << std::setprecision(3) << busy;
+        }
+        cout << std::defaultfloat << endl;
+    }
+}
+
 
 /**
  * @brief RunnerInterface is the external run interface
@@ -257,7 +465,8 @@ public:
                                             run_config.get_years_to_simulate(),
                                             ptr_portfolio->get_portfolio_date().get_year(),
                                             ptr_portfolio->get_portfolio_date().get_month(),
-                                            ptr_portfolio->get_portfolio_date().get_day())),
+                                            ptr_portfolio->get_portfolio_date().get_day(),
+                                            run_config.get_time_step_segments())),
         agg_payments(ptr_portfolio->size())         
         {}
             
@@ -282,7 +491,7 @@ public:
         // cout << "num_state_payment_cols=" << num_state_payment_cols << std::endl;
 
         MetaRunner _runner(_run_config, _ptr_portfolio, _p_time_axis, num_state_payment_cols);
-        unique_ptr<RunResult> run_res_ptr = unique_ptr<RunResult>(new RunResult(_run_config.get_dimension(), _p_time_axis, num_state_payment_cols));
+        unique_ptr<RunResult> run_res_ptr = unique_ptr<RunResult>(new RunResult(_run_config.get_dimension(), _p_time_axis, num_state_payment_cols, _run_config.get_result_spec()));
         _runner.run(*run_res_ptr, agg_payments);
         return run_res_ptr;        
     }
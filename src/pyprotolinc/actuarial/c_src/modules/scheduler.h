@@ -0,0 +1,247 @@
+/**
+ * @file scheduler.h
+ * @author M. Seehafer
+ * @brief Work-stealing scheduler distributing the records of a run to the workers.
+ * @version 0.2.0
+ * @date 2023-06-03
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The portfolio is cut into small ranges of consecutive records which are dealt to one queue per worker. A worker
+ * takes the ranges from the front of its own queue and, once that is empty, steals from the back of the queues of
+ * the others. The costs of the records vary a lot (age, early termination), with stealing the workers still finish
+ * at about the same time. If the ranges are ordered by their estimated costs, the expensive ones are started first.
+ */
+#ifndef C_SCHEDULER_H
+#define C_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "thread_pool.h"
+
+using namespace std;
+
+/// Range [begin, end) of records together with its estimated costs
+struct WorkRange
+{
+    size_t begin;
+    size_t end;
+    double cost;
+};
+
+/**
+ * @brief Distributes ranges of records to a fixed number of workers with work stealing and measures the time
+ * each worker is busy.
+ *
+ */
+class CWorkStealingScheduler
+{
+private:
+    /// Ranges not yet started by the worker owning the queue
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        deque<WorkRange> ranges;
+    };
+
+    vector<unique_ptr<WorkerQueue>> _queues;
+
+    // statistics per worker
+    vector<double> _busy_seconds;
+    vector<size_t> _stolen_ranges;
+
+public:
+    /**
+     * @brief Construct a new scheduler, the ranges are dealt to the workers in the given order.
+     *
+     * @param num_workers Number of workers, at least one.
+     * @param ranges The ranges of records to process.
+     */
+    CWorkStealingScheduler(int num_workers, const vector<WorkRange> &ranges)
+    {
+        if (num_workers < 1)
+        {
+            throw domain_error("The scheduler needs at least one worker.");
+        }
+        for (int w = 0; w < num_workers; w++)
+        {
+            _queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (size_t k = 0; k < ranges.size(); k++)
+        {
+            _queues[k % num_workers]->ranges.push_back(ranges[k]);
+        }
+        _busy_seconds.assign(num_workers, 0.0);
+        _stolen_ranges.assign(num_workers, 0);
+    }
+
+    // no copying intended
+    CWorkStealingScheduler(const CWorkStealingScheduler &) = delete;
+
+    int get_num_workers() const { return (int)_queues.size(); }                 ///< Returns the number of workers
+    const vector<double> &get_busy_seconds() const { return _busy_seconds; }    ///< Returns the time each worker spent processing ranges
+    const vector<size_t> &get_stolen_ranges() const { return _stolen_ranges; }  ///< Returns the number of ranges each worker stole from others
+
+    /**
+     * @brief Take the next range for a worker: the front of its own queue or the back of the queue of another worker.
+     *
+     * @param worker Index of the worker.
+     * @param range Set to the range to be processed.
+     * @return False if no range is left.
+     */
+    bool next(int worker, WorkRange &range);
+
+    /**
+     * @brief Process all ranges, the workers call `process(worker, range)` until no range is left. An exception
+     * thrown by `process` stops all workers and is rethrown once they have finished.
+     *
+     * @param process Function processing a range.
+     * @param pool Thread pool with at least one thread per worker, worker `w` runs on thread `w`. Without pool
+     * the workers run one after the other on the calling thread.
+     */
+    template <typename F>
+    void run(F process, CThreadPool *pool = nullptr);
+
+    /**
+     * @brief Cut the records into ranges of `range_size` consecutive records.
+     *
+     * @param costs Estimated costs of each record.
+     * @param range_size Number of records per range (the last one may be shorter).
+     * @param order_by_cost Order the ranges by decreasing costs, otherwise they are in the order of the records.
+     */
+    static vector<WorkRange> make_ranges(const vector<double> &costs, size_t range_size, bool order_by_cost);
+
+    /**
+     * @brief Number of records per range such that each worker gets several ranges, a multiple of `multiple`
+     * (e.g. the number of lanes of the block engine) between `multiple` and 256.
+     */
+    static size_t default_range_size(size_t num_records, int num_workers, size_t multiple = 1);
+
+    /// Number of records per range to obtain at most `num_ranges` ranges, a multiple of `multiple`.
+    static size_t fixed_range_size(size_t num_records, size_t num_ranges, size_t multiple = 1);
+};
+
+bool CWorkStealingScheduler::next(int worker, WorkRange &range)
+{
+    {
+        WorkerQueue &own = *_queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.ranges.empty())
+        {
+            range = own.ranges.front();
+            own.ranges.pop_front();
+            return true;
+        }
+    }
+
+    // steal from the other workers starting with the next one
+    int num_workers = get_num_workers();
+    for (int k = 1; k < num_workers; k++)
+    {
+        WorkerQueue &victim = *_queues[(worker + k) % num_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.ranges.empty())
+        {
+            range = victim.ranges.back();
+            victim.ranges.pop_back();
+            _stolen_ranges[worker]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename F>
+void CWorkStealingScheduler::run(F process, CThreadPool *pool)
+{
+    const int num_workers = get_num_workers();
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto work = [&](int w) {
+        WorkRange range;
+        while (!failed && next(w, range))
+        {
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                process(w, range);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+            _busy_seconds[w] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    if (pool)
+    {
+        pool->run(num_workers, work);
+    }
+    else
+    {
+        for (int w = 0; w < num_workers; w++)
+        {
+            work(w);
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+vector<WorkRange> CWorkStealingScheduler::make_ranges(const vector<double> &costs, size_t range_size, bool order_by_cost)
+{
+    range_size = max(range_size, (size_t)1);
+    vector<WorkRange> ranges;
+    for (size_t begin = 0; begin < costs.size(); begin += range_size)
+    {
+        size_t end = min(begin + range_size, costs.size());
+        double cost = 0.0;
+        for (size_t j = begin; j < end; j++)
+        {
+            cost += costs[j];
+        }
+        ranges.push_back({begin, end, cost});
+    }
+    if (order_by_cost)
+    {
+        std::stable_sort(ranges.begin(), ranges.end(), [](const WorkRange &a, const WorkRange &b) { return a.cost > b.cost; });
+    }
+    return ranges;
+}
+
+size_t CWorkStealingScheduler::default_range_size(size_t num_records, int num_workers, size_t multiple)
+{
+    // about 16 ranges per worker
+    size_t size = num_records / (16 * (size_t)max(num_workers, 1));
+    size = min(max(size, (size_t)1), (size_t)256);
+    multiple = max(multiple, (size_t)1);
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+size_t CWorkStealingScheduler::fixed_range_size(size_t num_records, size_t num_ranges, size_t multiple)
+{
+    num_ranges = max(num_ranges, (size_t)1);
+    multiple = max(multiple, (size_t)1);
+    size_t size = max((num_records + num_ranges - 1) / num_ranges, (size_t)1);
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ * @file simd.h
+ * @author M. Seehafer
+ * @brief Vectorized kernels with runtime selection of the instruction set (scalar, AVX2, AVX-512).
+ * @version 0.2.0
+ * @date 2023-04-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The vectorized variants are compiled with function level target attributes so that
+ * no special compiler flags are needed. On other compilers/platforms only the scalar
+ * variants are available.
+ */
+#ifndef C_SIMD_H
+#define C_SIMD_H
+
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PYPROTOLINC_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/// Instruction set used by the vectorized kernels
+enum class SimdLevel : int
+{
+    SCALAR, // 0
+    AVX2,   // 1
+    AVX512  // 2
+};
+
+/// Determine the best instruction set supported by the CPU we are running on.
+inline SimdLevel detect_simd_level()
+{
+#ifdef PYPROTOLINC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::AVX2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+/// Return the (cached) instruction set to be used by the kernels.
+inline SimdLevel get_simd_level()
+{
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Gather kernels for rate tables
+//
+// All kernels calculate for each j < length the flat index
+//     base_index + sum_k strides[k] * indices[k][j]
+// and store values[index] in out[j]. If `clamp` is set each index is first restricted
+// to the range [lower[k], upper[k]]. No range checks are applied.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Scalar reference implementation of the gather kernel.
+inline void gather_rates_scalar(double *out, size_t length, const double *values, unsigned rank,
+                                const int *strides, int base_index, const int *const *indices,
+                                bool clamp, const int *lower, const int *upper)
+{
+    for (size_t j = 0; j < length; j++)
+    {
+        int index = base_index;
+        for (unsigned k = 0; k < rank; k++)
+        {
+            int ind = indices[k][j];
+            if (clamp)
+            {
+                ind = ind < lower[k] ? lower[k] : (ind > upper[k] ? upper[k] : ind);
+            }
+            index += strides[k] * ind;
+        }
+        out[j] = values[index];
+    }
+}
+
+#ifdef PYPROTOLINC_X86_SIMD
+
+/// AVX2 variant of the gather kernel, processes four values at a time.
+__attribute__((target("avx2"))) inline void gather_rates_avx2(double *out, size_t length, const double *values, unsigned rank,
+                                                              const int *strides, int base_index, const int *const *indices,
+                                                              bool clamp, const int *lower, const int *upper)
+{
+    size_t j = 0;
+    for (; j + 4 <= length; j += 4)
+    {
+        __m128i vidx = _mm_set1_epi32(base_index);
+        for (unsigned k = 0; k < rank; k++)
+        {
+            __m128i vind = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices[k] + j));
+            if (clamp)
+            {
+                vind = _mm_min_epi32(_mm_max_epi32(vind, _mm_set1_epi32(lower[k])), _mm_set1_epi32(upper[k]));
+            }
+            vidx = _mm_add_epi32(vidx, _mm_mullo_epi32(vind, _mm_set1_epi32(strides[k])));
+        }
+        _mm256_storeu_pd(out + j, _mm256_i32gather_pd(values, vidx, 8));
+    }
+
+    // remainder
+    const int *tail_indices[8];
+    for (unsigned k = 0; k < rank && k < 8; k++)
+    {
+        tail_indices[k] = indices[k] + j;
+    }
+    gather_rates_scalar(out + j, length - j, values, rank, strides, base_index, tail_indices, clamp, lower, upper);
+}
+
+/// AVX-512 variant of the gather kernel, processes eight values at a time.
+__attribute__((target("avx512f,avx2"))) inline void gather_rates_avx512(double *out, size_t length, const double *values, unsigned rank,
+                                                                        const int *strides, int base_index, const int *const *indices,
+                                                                        bool clamp, const int *lower, const int *upper)
+{
+    size_t j = 0;
+    for (; j + 8 <= length; j += 8)
+    {
+        __m256i vidx = _mm256_set1_epi32(base_index);
+        for (unsigned k = 0; k < rank; k++)
+        {
+            __m256i vind = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices[k] + j));
+            if (clamp)
+            {
+                vind = _mm256_min_epi32(_mm256_max_epi32(vind, _mm256_set1_epi32(lower[k])), _mm256_set1_epi32(upper[k]));
+            }
+            vidx = _mm256_add_epi32(vidx, _mm256_mullo_epi32(vind, _mm256_set1_epi32(strides[k])));
+        }
+        _mm512_storeu_pd(out + j, _mm512_i32gather_pd(vidx, values, 8));
+    }
+
+    // remainder
+    const int *tail_indices[8];
+    for (unsigned k = 0; k < rank && k < 8; k++)
+    {
+        tail_indices[k] = indices[k] + j;
+    }
+    gather_rates_avx2(out + j, length - j, values, rank, strides, base_index, tail_indices, clamp, lower, upper);
+}
+
+#endif
+
+/// Run the gather kernel with the given instruction set (falls back to scalar if not available).
+inline void gather_rates(SimdLevel level, double *out, size_t length, const double *values, unsigned rank,
+                         const int *strides, int base_index, const int *const *indices,
+                         bool clamp, const int *lower, const int *upper)
+{
+#ifdef PYPROTOLINC_X86_SIMD
+    if (level == SimdLevel::AVX512)
+    {
+        gather_rates_avx512(out, length, values, rank, strides, base_index, indices, clamp, lower, upper);
+        return;
+    }
+    if (level == SimdLevel::AVX2)
+    {
+        gather_rates_avx2(out, length, values, rank, strides, base_index, indices, clamp, lower, upper);
+        return;
+    }
+#endif
+    gather_rates_scalar(out, length, values, rank, strides, base_index, indices, clamp, lower, upper);
+}
+
+/// Run the gather kernel with the best instruction set of the CPU.
+inline void gather_rates(double *out, size_t length, const double *values, unsigned rank,
+                         const int *strides, int base_index, const int *const *indices,
+                         bool clamp, const int *lower, const int *upper)
+{
+    gather_rates(get_simd_level(), out, length, values, rank, strides, base_index, indices, clamp, lower, upper);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// State update kernels for blocks of records in structure-of-arrays layout
+//
+// The records of a block are the lanes, all arrays store the lane index innermost:
+//     a[(r * n + c) * lanes + l]   dependent transition probabilities r -> c of lane l
+//     probs[r * lanes + l]         state probabilities at the start of the step
+// The kernels calculate the movements a * probs (diagonal movements are set to zero) and the
+// state probabilities at the end of the step, the volumes are derived from them when the results
+// are aggregated. Products and sums are formed in the same order as in
+// ProjectionStateMatrix::update_state so that the results of each lane are identical to the
+// projection of the record on its own.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Scalar reference implementation of the block state update.
+inline void block_update_state_scalar(size_t lanes, unsigned n, const double *a, const double *probs,
+                                      double *probs_next, double *prob_mvms)
+{
+    for (size_t j = 0; j < n * lanes; j++)
+    {
+        probs_next[j] = 0.0;
+    }
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            size_t rc = (r * n + c) * lanes;
+            for (size_t l = 0; l < lanes; l++)
+            {
+                double mvm = a[rc + l] * probs[r * lanes + l];
+                prob_mvms[rc + l] = r != c ? mvm : 0.0;
+                probs_next[c * lanes + l] += mvm;
+            }
+        }
+    }
+}
+
+#ifdef PYPROTOLINC_X86_SIMD
+
+/// AVX2 variant of the block state update, `lanes` must be a multiple of four.
+__attribute__((target("avx2"))) inline void block_update_state_avx2(size_t lanes, unsigned n, const double *a, const double *probs,
+                                                                    double *probs_next, double *prob_mvms)
+{
+    for (size_t j = 0; j < n * lanes; j += 4)
+    {
+        _mm256_storeu_pd(probs_next + j, _mm256_setzero_pd());
+    }
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            size_t rc = (r * n + c) * lanes;
+            for (size_t l = 0; l < lanes; l += 4)
+            {
+                // separate multiplication and addition (no fused multiply-add) as in the scalar code
+                __m256d mvm = _mm256_mul_pd(_mm256_loadu_pd(a + rc + l), _mm256_loadu_pd(probs + r * lanes + l));
+                _mm256_storeu_pd(prob_mvms + rc + l, r != c ? mvm : _mm256_setzero_pd());
+                _mm256_storeu_pd(probs_next + c * lanes + l, _mm256_add_pd(_mm256_loadu_pd(probs_next + c * lanes + l), mvm));
+            }
+        }
+    }
+}
+
+/// AVX-512 variant of the block state update, `lanes` must be a multiple of eight.
+__attribute__((target("avx512f,avx2"))) inline void block_update_state_avx512(size_t lanes, unsigned n, const double *a, const double *probs,
+                                                                              double *probs_next, double *prob_mvms)
+{
+    for (size_t j = 0; j < n * lanes; j += 8)
+    {
+        _mm512_storeu_pd(probs_next + j, _mm512_setzero_pd());
+    }
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            size_t rc = (r * n + c) * lanes;
+            for (size_t l = 0; l < lanes; l += 8)
+            {
+                __m512d mvm = _mm512_mul_pd(_mm512_loadu_pd(a + rc + l), _mm512_loadu_pd(probs + r * lanes + l));
+                _mm512_storeu_pd(prob_mvms + rc + l, r != c ? mvm : _mm512_setzero_pd());
+                _mm512_storeu_pd(probs_next + c * lanes + l, _mm512_add_pd(_mm512_loadu_pd(probs_next + c * lanes + l), mvm));
+            }
+        }
+    }
+}
+
+#endif
+
+/// Run the block state update with the given instruction set (falls back to scalar if not available or
+/// the number of lanes is not a multiple of the vector width).
+inline void block_update_state(SimdLevel level, size_t lanes, unsigned n, const double *a, const double *probs,
+                               double *probs_next, double *prob_mvms)
+{
+#ifdef PYPROTOLINC_X86_SIMD
+    if (level == SimdLevel::AVX512 && lanes % 8 == 0)
+    {
+        block_update_state_avx512(lanes, n, a, probs, probs_next, prob_mvms);
+        return;
+    }
+    if (level != SimdLevel::SCALAR && lanes % 4 == 0)
+    {
+        block_update_state_avx2(lanes, n, a, probs, probs_next, prob_mvms);
+        return;
+    }
+#endif
+    block_update_state_scalar(lanes, n, a, probs, probs_next, prob_mvms);
+}
+
+/// Run the block state update with the best instruction set of the CPU.
+inline void block_update_state(size_t lanes, unsigned n, const double *a, const double *probs,
+                               double *probs_next, double *prob_mvms)
+{
+    block_update_state(get_simd_level(), lanes, n, a, probs, probs_next, prob_mvms);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// State update kernels for a single record of a large, sparse state model
+//
+// Only the transitions of the sparsity pattern are processed. The target states of row r are given
+// as segments [begin, end) of consecutive states stored as pairs in
+//     segments[2 * k], segments[2 * k + 1]   for row_offsets[r] <= k < row_offsets[r + 1]
+// and must include the diagonal. The movements a[r * n + c] * probs[r] are added to probs_next[c]
+// row by row as in ProjectionStateMatrix::update_state, so the results are identical as long as the
+// rates outside of the pattern are zero. The movements of the pattern are stored (zero on the
+// diagonal), all other movements are left untouched.
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+/// Scalar reference implementation of the sparse state update.
+inline void sparse_update_state_scalar(unsigned n, const int *row_offsets, const int *segments, const double *a, const double *probs,
+                                       double *probs_next, double *prob_mvms)
+{
+    for (unsigned r = 0; r < n; r++)
+    {
+        double p = probs[r];
+        for (int k = row_offsets[r]; k < row_offsets[r + 1]; k++)
+        {
+            for (int c = segments[2 * k]; c < segments[2 * k + 1]; c++)
+            {
+                double mvm = a[r * n + c] * p;
+                prob_mvms[r * n + c] = mvm;
+                probs_next[c] += mvm;
+            }
+        }
+        prob_mvms[r * n + r] = 0.0;
+    }
+}
+
+#ifdef PYPROTOLINC_X86_SIMD
+
+/// AVX2 variant of the sparse state update, processes four target states of a segment at a time.
+__attribute__((target("avx2"))) inline void sparse_update_state_avx2(unsigned n, const int *row_offsets, const int *segments, const double *a, const double *probs,
+                                                                     double *probs_next, double *prob_mvms)
+{
+    for (unsigned r = 0; r < n; r++)
+    {
+        double p = probs[r];
+        __m256d vp = _mm256_set1_pd(p);
+        const double *a_row = a + r * n;
+        for (int k = row_offsets[r]; k < row_offsets[r + 1]; k++)
+        {
+            int c = segments[2 * k];
+            int end = segments[2 * k + 1];
+            for (; c + 4 <= end; c += 4)
+            {
+                // separate multiplication and addition (no fused multiply-add) as in the scalar code
+                __m256d mvm = _mm256_mul_pd(_mm256_loadu_pd(a_row + c), vp);
+                _mm256_storeu_pd(prob_mvms + r * n + c, mvm);
+                _mm256_storeu_pd(probs_next + c, _mm256_add_pd(_mm256_loadu_pd(probs_next + c), mvm));
+            }
+            for (; c < end; c++)
+            {
+                double mvm = a_row[c] * p;
+                prob_mvms[r * n + c] = mvm;
+                probs_next[c] += mvm;
+            }
+        }
+        prob_mvms[r * n + r] = 0.0;
+    }
+}
+
+/// AVX-512 variant of the sparse state update, processes eight target states of a segment at a time.
+__attribute__((target("avx512f,avx2"))) inline void sparse_update_state_avx512(unsigned n, const int *row_offsets, const int *segments, const double *a, const double *probs,
+                                                                               double *probs_next, double *prob_mvms)
+{
+    for (unsigned r = 0; r < n; r++)
+    {
+        double p = probs[r];
+        __m512d vp = _mm512_set1_pd(p);
+        const double *a_row = a + r * n;
+        for (int k = row_offsets[r]; k < row_offsets[r + 1]; k++)
+        {
+            int c = segments[2 * k];
+            int end = segments[2 * k + 1];
+            for (; c + 8 <= end; c += 8)
+            {
+                __m512d mvm = _mm512_mul_pd(_mm512_loadu_pd(a_row + c), vp);
+                _mm512_storeu_pd(prob_mvms + r * n + c, mvm);
+                _mm512_storeu_pd(probs_next + c, _mm512_add_pd(_mm512_loadu_pd(probs_next + c), mvm));
+            }
+            for (; c < end; c++)
+            {
+                double mvm = a_row[c] * p;
+                prob_mvms[r * n + c] = mvm;
+                probs_next[c] += mvm;
+            }
+        }
+        prob_mvms[r * n + r] = 0.0;
+    }
+}
+
+#endif
+
+/// Run the sparse state update with the given instruction set (falls back to scalar if not available).
+inline void sparse_update_state(SimdLevel level, unsigned n, const int *row_offsets, const int *segments, const double *a, const double *probs,
+                                double *probs_next, double *prob_mvms)
+{
+#ifdef PYPROTOLINC_X86_SIMD
+    if (level == SimdLevel::AVX512)
+    {
+        sparse_update_state_avx512(n, row_offsets, segments, a, probs, probs_next, prob_mvms);
+        return;
+    }
+    if (level == SimdLevel::AVX2)
+    {
+        sparse_update_state_avx2(n, row_offsets, segments, a, probs, probs_next, prob_mvms);
+        return;
+    }
+#endif
+    sparse_update_state_scalar(n, row_offsets, segments, a, probs, probs_next, prob_mvms);
+}
+
+#endif
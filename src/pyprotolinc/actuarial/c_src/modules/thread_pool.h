@@ -0,0 +1,248 @@
+/**
+ * @file thread_pool.h
+ * @author M. Seehafer
+ * @brief Persistent pool of worker threads used for the parallel parts of a run.
+ * @version 0.2.0
+ * @date 2023-06-10
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * The threads are started once and reused by all runs with the same settings, a run does not pay for starting
+ * threads. Thread `w` always executes task `w`, optionally pinned to the `w`-th cpu the process may run on (Linux).
+ * Memory which is first written by a pinned thread is placed on the NUMA node of its cpu by the operating system,
+ * hence the buffers of a worker should be allocated and initialized by its own task.
+ */
+#ifndef C_THREAD_POOL_H
+#define C_THREAD_POOL_H
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+/**
+ * @brief Fixed number of threads which execute the tasks of one parallel section at a time.
+ *
+ */
+class CThreadPool
+{
+private:
+    vector<std::thread> _threads;
+    bool _pin_threads;
+    bool _pinned;
+
+    // cpus the threads are pinned to (empty if not pinned)
+    vector<int> _cpus;
+
+    // only one parallel section at a time
+    std::mutex _run_mutex;
+
+    // state of the current parallel section, guarded by _mutex
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _done;
+    const function<void(int)> *_task = nullptr;
+    int _num_tasks = 0;
+    int _pending = 0;
+    unsigned long _generation = 0;
+    bool _stop = false;
+    std::exception_ptr _error;
+
+    /// Main loop of thread `index`.
+    void work(int index);
+
+    /// Pin the calling thread to the cpu of thread `index`.
+    void pin(int index) const;
+
+public:
+    /**
+     * @brief Start the threads.
+     *
+     * @param num_threads Number of threads, at least one.
+     * @param pin_threads Pin each thread to a cpu of its own (only on Linux, ignored elsewhere).
+     */
+    CThreadPool(int num_threads, bool pin_threads = false);
+
+    // no copying intended
+    CThreadPool(const CThreadPool &) = delete;
+
+    /// Stops and joins the threads.
+    ~CThreadPool();
+
+    int get_num_threads() const { return (int)_threads.size(); }  ///< Returns the number of threads
+    bool get_pinned() const { return _pinned; }                   ///< Returns if the threads are pinned to cpus
+
+    /**
+     * @brief Execute `task(w)` for w = 0, ..., num_tasks - 1, task `w` on thread `w`, and wait until all have
+     * finished. The first exception thrown by a task is rethrown.
+     */
+    void run(int num_tasks, const function<void(int)> &task);
+
+    /**
+     * @brief Return the pool shared by the runs of the process, it is created on first use and recreated if the
+     * number of threads or the pinning differs from the last call.
+     */
+    static shared_ptr<CThreadPool> get_shared(int num_threads, bool pin_threads);
+};
+
+CThreadPool::CThreadPool(int num_threads, bool pin_threads) : _pin_threads(pin_threads), _pinned(false)
+{
+    if (num_threads < 1)
+    {
+        throw domain_error("The thread pool needs at least one thread.");
+    }
+
+#ifdef __linux__
+    // the cpus the process may run on, thread w is pinned to the w-th of them
+    cpu_set_t allowed;
+    if (pin_threads && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                _cpus.push_back(cpu);
+            }
+        }
+        _pinned = !_cpus.empty();
+    }
+#endif
+
+    for (int w = 0; w < num_threads; w++)
+    {
+        _threads.push_back(std::thread(&CThreadPool::work, this, w));
+    }
+}
+
+CThreadPool::~CThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (std::thread &thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+void CThreadPool::pin(int index) const
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(_cpus[index % _cpus.size()], &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+}
+
+void CThreadPool::work(int index)
+{
+    if (_pinned)
+    {
+        pin(index);
+    }
+
+    unsigned long generation = 0;
+    while (true)
+    {
+        const function<void(int)> *task = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [&]() { return _stop || _generation != generation; });
+            if (_stop)
+            {
+                return;
+            }
+            generation = _generation;
+            if (index >= _num_tasks)
+            {
+                continue;
+            }
+            task = _task;
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            (*task)(index);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (error && !_error)
+        {
+            _error = error;
+        }
+        if (--_pending == 0)
+        {
+            _done.notify_all();
+        }
+    }
+}
+
+void CThreadPool::run(int num_tasks, const function<void(int)> &task)
+{
+    if (num_tasks > get_num_threads())
+    {
+        throw domain_error("The thread pool has " + std::to_string(get_num_threads()) + " threads, " + std::to_string(num_tasks) + " tasks requested.");
+    }
+    if (num_tasks < 1)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(_run_mutex);
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task = &task;
+        _num_tasks = num_tasks;
+        _pending = num_tasks;
+        _error = nullptr;
+        _generation++;
+        _start.notify_all();
+        _done.wait(lock, [&]() { return _pending == 0; });
+        _task = nullptr;
+        error = _error;
+        _error = nullptr;
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+shared_ptr<CThreadPool> CThreadPool::get_shared(int num_threads, bool pin_threads)
+{
+    static std::mutex mutex;
+    static shared_ptr<CThreadPool> pool;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pool || pool->get_num_threads() != num_threads || pool->_pin_threads != pin_threads)
+    {
+        // a run still using the old pool keeps it alive
+        pool = nullptr;
+        pool = make_shared<CThreadPool>(num_threads, pin_threads);
+    }
+    return pool;
+}
+
+#endif
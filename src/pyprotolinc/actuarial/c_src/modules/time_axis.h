@@ -28,6 +28,13 @@ enum class TimeStep : int
     YEARLY     // 2
 };
 
+/// A section of a time axis with its own time step, it reaches up to the end of the year `years` after the portfolio date
+struct TimeStepSegment
+{
+    TimeStep time_step;
+    int years;
+};
+
 /// number of day in each month
 const int _days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 
@@ -345,9 +352,13 @@ public:
      * @param ptf_year Year of the portfolio. inforce date.
      * @param ptf_month Month of the portfolio inforce date.
      * @param ptf_day Day of the portfolio inforce date.
+     * @param segments Optional sections at the beginning of the time axis which use another time step (in increasing
+     *        order of their years), `time_step` applies after the last one, e.g. monthly for 5 years and quarterly
+     *        up to 20 years followed by yearly steps.
      */
     TimeAxis(TimeStep time_step, int years_to_simulate,
-             short ptf_year, short ptf_month, short ptf_day);
+             short ptf_year, short ptf_month, short ptf_day,
+             const vector<TimeStepSegment> &segments = vector<TimeStepSegment>());
 
     int get_portfolio_year() const { return _ptf_year; }
     int get_portfolio_month() const { return _ptf_month; }
@@ -409,7 +420,8 @@ public:
 };
 
 TimeAxis::TimeAxis(TimeStep time_step, int years_to_simulate,
-                   short ptf_year, short ptf_month, short ptf_day) : _time_step(time_step),
+                   short ptf_year, short ptf_month, short ptf_day,
+                   const vector<TimeStepSegment> &segments) : _time_step(time_step),
                                                                      _years_to_simulate(years_to_simulate),
                                                                      _ptf_year(ptf_year), _ptf_month(ptf_month), _ptf_day(ptf_day)
 {
@@ -429,15 +441,22 @@ TimeAxis::TimeAxis(TimeStep time_step, int years_to_simulate,
     d_start = d;
     d_start.set_next_day();
 
+    size_t segment = 0;
     while (d < end_date)
     {
+        // the segments end with a year so that the coarser steps remain aligned
+        while (segment < segments.size() && !(d < PeriodDate(_ptf_year + segments[segment].years, 12, 31)))
+        {
+            segment++;
+        }
+        TimeStep current_step = segment < segments.size() ? segments[segment].time_step : time_step;
 
         int duration;
-        if (time_step == TimeStep::YEARLY)
+        if (current_step == TimeStep::YEARLY)
         {
             duration = d.set_next_end_of_year();
         }
-        else if (time_step == TimeStep::QUARTERLY)
+        else if (current_step == TimeStep::QUARTERLY)
         {
             duration = d.set_next_end_of_quarter();
         }
@@ -11,6 +11,8 @@
 #ifndef C_UTILS_H
 #define C_UTILS_H
 
+#include <cstddef>
+#include <memory>
 #include <utility>
 #include <unordered_map>
 
@@ -42,6 +44,39 @@ namespace std
 }
 //////////////////////////////////////////////////////////////
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+// scratch buffers of doubles, stored within the owning object if the size is known at compile
+// time (SIZE > 0) and allocated on the heap otherwise
+
+template <int SIZE>
+class CScratchBuffer
+{
+  double _data[SIZE];
+
+public:
+  explicit CScratchBuffer(std::size_t) {}
+
+  double *get() { return _data; }
+  const double *get() const { return _data; }
+  double &operator[](std::size_t j) { return _data[j]; }
+  const double &operator[](std::size_t j) const { return _data[j]; }
+};
+
+template <>
+class CScratchBuffer<0>
+{
+  unique_ptr<double[]> _data;
+
+public:
+  explicit CScratchBuffer(std::size_t size) : _data(new double[size]) {}
+
+  double *get() { return _data.get(); }
+  const double *get() const { return _data.get(); }
+  double &operator[](std::size_t j) { return _data[j]; }
+  const double &operator[](std::size_t j) const { return _data[j]; }
+};
+//////////////////////////////////////////////////////////////
+
 
 
 #endif
\ No newline at end of file
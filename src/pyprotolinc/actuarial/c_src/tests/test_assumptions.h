@@ -4,11 +4,14 @@
 /* Testing of the time_axis class. */
 
 #include <gtest/gtest.h>
+#include <cmath>
+#include <thread>
 
 // #include "../modules/portfolio.h"
 //#include "../modules/time_axis.h"
 //#include "../modules/run_config.h"
 #include "../modules/assumption_sets.h"
+#include "../modules/rate_table_file.h"
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -133,6 +136,740 @@ TEST(assumptions, standard_provider_slicing)
 }
 
 
+TEST(assumptions, standard_provider_shared_storage)
+{
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::Age);
+    srp->add_risk_factor(CRiskFactors::Gender);
+    srp->add_risk_factor(CRiskFactors::SmokerStatus);
+    vector<int> shape_vec = {4, 2, 3};
+    vector<int> offsets = {30, 0, 0};
+    vector<double> ext_vals(24);
+    for (int j = 0; j < 24; j++) {
+        ext_vals[j] = 0.01 * j;
+    }
+    srp->set_values(shape_vec, offsets, ext_vals.data());
+
+    // clones and slices share the data
+    auto srp_cloned = dynamic_pointer_cast<CStandardRateProvider>(srp->clone());
+    EXPECT_TRUE(srp_cloned->shares_values_with(*srp));
+
+    vector<int> slice_indexes = {-1, 1, -1};  // strided view
+    shared_ptr<CStandardRateProvider> srp_sliced = srp->slice(slice_indexes);
+    EXPECT_TRUE(srp_sliced->shares_values_with(*srp));
+    EXPECT_FALSE(srp_sliced->is_contiguous());
+    EXPECT_EQ(srp_sliced->size(), 12);
+    EXPECT_EQ(srp_sliced->get_capacity(), 24);
+
+    vector<double> sliced_vals(12);
+    srp_sliced->get_values(sliced_vals.data());
+    vector<int> query_indexes = {0, 0};
+    for (int a = 0; a < 4; a++) {
+        for (int s = 0; s < 3; s++) {
+            double expected = ext_vals[a * 6 + 3 + s];
+            query_indexes[0] = 30 + a;
+            query_indexes[1] = s;
+            EXPECT_EQ(srp_sliced->get_rate(query_indexes), expected);
+            EXPECT_EQ(sliced_vals[a * 3 + s], expected);
+        }
+    }
+
+    // slicing a slice down to a single value
+    vector<int> slice_indexes2 = {32, 2};
+    shared_ptr<CStandardRateProvider> srp_sliced2 = srp_sliced->slice(slice_indexes2);
+    EXPECT_EQ(srp_sliced2->get_dimension(), 0);
+    vector<int> no_indexes;
+    EXPECT_EQ(srp_sliced2->get_rate(no_indexes), ext_vals[2 * 6 + 3 + 2]);
+
+    // the storage outlives the original provider
+    srp.reset();
+    query_indexes[0] = 33;
+    query_indexes[1] = 1;
+    EXPECT_EQ(srp_sliced->get_rate(query_indexes), ext_vals[3 * 6 + 3 + 1]);
+}
+
+
+static int borrowed_buffer_releases = 0;
+
+static void release_borrowed_buffer(void *owner)
+{
+    borrowed_buffer_releases++;
+    EXPECT_TRUE(owner != nullptr);
+}
+
+TEST(assumptions, standard_provider_borrowed_values)
+{
+    vector<int> shape_vec = {2, 3};
+    vector<int> offsets = {0, 0};
+    double ext_vals[] = {0.1, 0.2, 0.3,
+                         0.4, 0.5, 0.6};
+
+    borrowed_buffer_releases = 0;
+    {
+        shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+        srp->add_risk_factor(CRiskFactors::Age);
+        srp->add_risk_factor(CRiskFactors::Gender);
+        srp->set_values_borrowed(shape_vec, offsets, ext_vals, ext_vals, release_borrowed_buffer);
+
+        // the external buffer is used directly
+        ext_vals[4] = 0.55;
+        vector<int> query_indexes = {1, 1};
+        EXPECT_EQ(srp->get_rate(query_indexes), 0.55);
+
+        // slices keep the buffer alive
+        vector<int> slice_indexes = {1, -1};
+        shared_ptr<CStandardRateProvider> srp_sliced = srp->slice(slice_indexes);
+        srp.reset();
+        EXPECT_EQ(borrowed_buffer_releases, 0);
+        vector<int> query_indexes1d = {2};
+        EXPECT_EQ(srp_sliced->get_rate(query_indexes1d), 0.6);
+    }
+    EXPECT_EQ(borrowed_buffer_releases, 1);
+
+    // the buffer is released if setting the values fails
+    CStandardRateProvider srp_wrong;
+    srp_wrong.add_risk_factor(CRiskFactors::Age);
+    ASSERT_THROW(srp_wrong.set_values_borrowed(shape_vec, offsets, ext_vals, ext_vals, release_borrowed_buffer), domain_error);
+    EXPECT_EQ(borrowed_buffer_releases, 2);
+}
+
+
+TEST(assumptions, standard_provider_table_file)
+{
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::CalendarYear);
+    srp->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {3, 5};
+    vector<int> offsets = {2020, 18};
+    vector<double> ext_vals(15);
+    for (int j = 0; j < 15; j++) {
+        ext_vals[j] = 0.001 * j;
+    }
+    srp->set_values(shape_vec, offsets, ext_vals.data());
+    srp->set_edge_mode(CRateEdgeMode::CLAMP);
+
+    string path = "test_rate_table.bin";
+    write_rate_table(path, *srp);
+    shared_ptr<CStandardRateProvider> srp_file = open_rate_table(path);
+
+    EXPECT_EQ(srp_file->to_string(), srp->to_string());
+    EXPECT_EQ(srp_file->get_shape(), shape_vec);
+    EXPECT_EQ(srp_file->get_offsets(), offsets);
+    EXPECT_EQ(srp_file->get_edge_mode(), CRateEdgeMode::CLAMP);
+
+    vector<int> query_indexes = {0, 0};
+    for (int y = 2019; y < 2024; y++) {
+        for (int a = 17; a < 24; a++) {
+            query_indexes[0] = y;
+            query_indexes[1] = a;
+            EXPECT_EQ(srp_file->get_rate(query_indexes), srp->get_rate(query_indexes));
+        }
+    }
+
+    // a strided slice is written in row-major order
+    vector<int> slice_indexes = {-1, 20};
+    write_rate_table(path, *srp->slice(slice_indexes));
+    shared_ptr<CStandardRateProvider> srp_file_sliced = open_rate_table(path);
+    EXPECT_EQ(srp_file_sliced->to_string(), "<CStandardRateProvider with RF (CalendarYear)>");
+    vector<int> query_indexes1d = {2021};
+    EXPECT_EQ(srp_file_sliced->get_rate(query_indexes1d), ext_vals[1 * 5 + 2]);
+
+    // the first mapping is still valid
+    EXPECT_EQ(srp_file->get_rate(query_indexes), srp->get_rate(query_indexes));
+    std::remove(path.c_str());
+
+    // not a rate table file
+    {
+        ofstream out(path, ios::binary);
+        out << "no rate table, just some text which is long enough for the header";
+    }
+    ASSERT_THROW(open_rate_table(path), domain_error);
+    std::remove(path.c_str());
+
+    ASSERT_THROW(open_rate_table("does_not_exist.bin"), runtime_error);
+}
+
+
+TEST(assumptions, standard_provider_unchecked_and_clamped)
+{
+    // provider with three risk factors and an offset in the first one
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::Age);
+    srp->add_risk_factor(CRiskFactors::Gender);
+    srp->add_risk_factor(CRiskFactors::CalendarYear);
+    vector<int> shape_vec = {3, 2, 2};
+    vector<int> offsets = {10, 0, 2020};
+    double ext_vals[12];
+    for (int j = 0; j < 12; j++) {
+        ext_vals[j] = 0.01 * (j + 1);
+    }
+    srp->set_values(shape_vec, offsets, ext_vals);
+
+    // the unchecked kernel agrees with the checked lookup
+    int query[3];
+    vector<int> query_vec(3);
+    for (int a = 10; a < 13; a++) {
+        for (int g = 0; g < 2; g++) {
+            for (int y = 2020; y < 2022; y++) {
+                query[0] = query_vec[0] = a;
+                query[1] = query_vec[1] = g;
+                query[2] = query_vec[2] = y;
+                EXPECT_EQ(srp->get_rate_unchecked(query), srp->get_rate(query_vec));
+            }
+        }
+    }
+
+    // range validation
+    int lower[3] = {10, 0, 2020};
+    int upper[3] = {12, 1, 2021};
+    EXPECT_TRUE(srp->covers(lower, upper));
+    upper[0] = 13;
+    EXPECT_FALSE(srp->covers(lower, upper));
+
+    // by default out of range ages throw, in clamp mode they resolve to the edge
+    vector<int> too_old = {15, 1, 2021};
+    vector<int> oldest = {12, 1, 2021};
+    ASSERT_THROW(srp->get_rate(too_old), out_of_range);
+    srp->set_edge_mode(CRateEdgeMode::CLAMP);
+    EXPECT_TRUE(srp->covers(lower, upper));
+    EXPECT_EQ(srp->get_rate(too_old), srp->get_rate(oldest));
+    EXPECT_EQ(srp->get_rate(too_old), ext_vals[11]);
+
+    // the edge mode is inherited by the clone
+    EXPECT_EQ(srp->clone()->get_rate(too_old), ext_vals[11]);
+}
+
+
+TEST(assumptions, standard_provider_batched_gather)
+{
+    // 3D table with offsets
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::Age);
+    srp->add_risk_factor(CRiskFactors::Gender);
+    srp->add_risk_factor(CRiskFactors::CalendarYear);
+    vector<int> shape_vec = {50, 2, 30};
+    vector<int> offsets = {20, 0, 2000};
+    vector<double> ext_vals(50 * 2 * 30);
+    for (size_t j = 0; j < ext_vals.size(); j++) {
+        ext_vals[j] = 0.001 * j;
+    }
+    srp->set_values(shape_vec, offsets, ext_vals.data());
+
+    // odd length to exercise the remainder loops
+    const size_t len = 37;
+    vector<int> ages(len), genders(len), years(len);
+    for (size_t j = 0; j < len; j++) {
+        ages[j] = 20 + (int)(7 * j) % 50;
+        genders[j] = (int)j % 2;
+        years[j] = 2000 + (int)(3 * j) % 30;
+    }
+    vector<int *> indices = {ages.data(), genders.data(), years.data()};
+
+    vector<double> expected(len);
+    for (size_t j = 0; j < len; j++) {
+        expected[j] = srp->get_rate({ages[j], genders[j], years[j]});
+    }
+
+    // result of the dispatched kernel
+    vector<double> result(len);
+    srp->get_rates(result.data(), len, indices);
+    for (size_t j = 0; j < len; j++) {
+        EXPECT_EQ(result[j], expected[j]) << "Results differ at index " << j;
+    }
+
+    // all instruction sets available on this machine give the same result
+    int strides[3] = {60, 30, 1};
+    int base_index = -(60 * 20 + 30 * 0 + 1 * 2000);
+    for (int level = 0; level <= (int)get_simd_level(); level++) {
+        std::fill(result.begin(), result.end(), -1.0);
+        gather_rates((SimdLevel)level, result.data(), len, ext_vals.data(), 3, strides, base_index, indices.data(), false, nullptr, nullptr);
+        for (size_t j = 0; j < len; j++) {
+            EXPECT_EQ(result[j], expected[j]) << "Level " << level << ", results differ at index " << j;
+        }
+    }
+
+    // out of range detection and clamping
+    ages[len - 1] = 100;
+    ASSERT_THROW(srp->get_rates(result.data(), len, indices), out_of_range);
+    srp->set_edge_mode(CRateEdgeMode::CLAMP);
+    srp->get_rates(result.data(), len, indices);
+    EXPECT_EQ(result[len - 1], srp->get_rate({69, genders[len - 1], years[len - 1]}));
+}
+
+
+TEST(assumptions, trend_provider)
+{
+    // Gender x Age base rates with trend, calendar years 2000..2049
+    shared_ptr<CTrendRateProvider> trp = make_shared<CTrendRateProvider>();
+    trp->add_risk_factor(CRiskFactors::Gender);
+    trp->add_risk_factor(CRiskFactors::CalendarYear);
+    trp->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {2, 50, 10};
+    vector<int> offsets = {0, 2000, 60};
+    vector<double> base_rates(20);
+    vector<double> trend(20);
+    vector<double> initial_trend(20);
+    for (int j = 0; j < 20; j++) {
+        base_rates[j] = 0.01 + 0.001 * j;
+        trend[j] = 0.01 + 0.0005 * j;
+        initial_trend[j] = 0.02;
+    }
+    vector<double> weights(50);
+    for (int j = 0; j < 50; j++) {
+        weights[j] = j < 10 ? 1.0 : 10.0 / j;
+    }
+    trp->set_values(shape_vec, offsets, 1999, base_rates.data(), trend.data(), initial_trend.data(), weights.data());
+    EXPECT_EQ(trp->to_string(), "<CTrendRateProvider with RF (Gender, CalendarYear, Age)>");
+
+    auto expected_rate = [&](int g, int t, int x) {
+        int b = g * 10 + x - 60;
+        double f = trend[b] + weights[t - 2000] * (initial_trend[b] - trend[b]);
+        return base_rates[b] * exp(-f * (t - 1999));
+    };
+
+    // a cohort is calculated once for all ages
+    EXPECT_EQ(trp->get_cached_cohorts(), (size_t)0);
+    vector<int> query_indexes = {1, 2010, 65};
+    trp->get_rate(query_indexes);
+    query_indexes = {1, 2011, 66};
+    EXPECT_DOUBLE_EQ(trp->get_rate(query_indexes), expected_rate(1, 2011, 66));
+    EXPECT_EQ(trp->get_cached_cohorts(), (size_t)1);
+
+    for (int g = 0; g < 2; g++) {
+        for (int t = 2000; t < 2050; t += 7) {
+            for (int x = 60; x < 70; x++) {
+                query_indexes[0] = g;
+                query_indexes[1] = t;
+                query_indexes[2] = x;
+                EXPECT_DOUBLE_EQ(trp->get_rate(query_indexes), expected_rate(g, t, x));
+            }
+        }
+    }
+
+    query_indexes = {1, 2050, 66};
+    ASSERT_THROW(trp->get_rate(query_indexes), out_of_range);
+
+    // slicing by gender shares the data
+    vector<int> slice_indexes = {1, -1, -1};
+    shared_ptr<CTrendRateProvider> trp_sliced = trp->slice(slice_indexes);
+    EXPECT_EQ(trp_sliced->get_dimension(), 2);
+    vector<int> query_indexes2d = {2030, 61};
+    EXPECT_DOUBLE_EQ(trp_sliced->get_rate(query_indexes2d), expected_rate(1, 2030, 61));
+    vector<int> slice_indexes_age = {1, -1, 65};
+    ASSERT_THROW(trp->slice(slice_indexes_age), domain_error);
+
+    // clamping uses the edges of the table
+    trp_sliced->set_edge_mode(CRateEdgeMode::CLAMP);
+    query_indexes2d = {2070, 58};
+    EXPECT_DOUBLE_EQ(trp_sliced->get_rate(query_indexes2d), expected_rate(1, 2049, 60));
+
+    // batched lookup
+    int genders[] = {0, 1, 1};
+    int years[] = {2000, 2020, 2049};
+    int ages[] = {60, 65, 69};
+    double rates[3];
+    vector<int *> indices = {genders, years, ages};
+    trp->get_rates(rates, 3, indices);
+    for (int j = 0; j < 3; j++) {
+        EXPECT_DOUBLE_EQ(rates[j], expected_rate(genders[j], years[j], ages[j]));
+    }
+
+    // concurrent lookups on a fresh provider with a shared cache
+    auto trp_cloned = dynamic_pointer_cast<CTrendRateProvider>(trp_sliced->clone());
+    vector<thread> threads;
+    vector<int> errors(4, 0);
+    for (int th = 0; th < 4; th++) {
+        threads.push_back(thread([&, th]() {
+            vector<int> qi = {0, 0};
+            for (int t = 2000; t < 2050; t++) {
+                for (int x = 60; x < 70; x++) {
+                    qi[0] = t;
+                    qi[1] = x;
+                    errors[th] += trp_cloned->get_rate(qi) != expected_rate(1, t, x);
+                }
+            }
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    for (int th = 0; th < 4; th++) {
+        EXPECT_EQ(errors[th], 0);
+    }
+
+    // an assumption set with the provider is not densified over the calendar years, also not within a composite
+    CAssumptionSet assumption_set(2);
+    assumption_set.set_provider(0, 1, trp);
+    EXPECT_TRUE(trp->is_lazy());
+    EXPECT_TRUE(assumption_set.compile() == nullptr);
+    vector<int> rf(NUMBER_OF_RISK_FACTORS, 0);
+    rf[(int)CRiskFactors::Gender] = 1;
+    rf[(int)CRiskFactors::CalendarYear] = 2033;
+    rf[(int)CRiskFactors::Age] = 67;
+    double result[4];
+    assumption_set.get_single_rateset(rf, result);
+    EXPECT_DOUBLE_EQ(result[1], expected_rate(1, 2033, 67));
+
+    vector<shared_ptr<CBaseRateProvider>> children = {trp, make_shared<CConstantRateProvider>(0.9)};
+    assumption_set.set_provider(0, 1, make_shared<CCompositeRateProvider>(CCompositeOperation::PRODUCT, children));
+    EXPECT_TRUE(assumption_set.compile() == nullptr);
+    assumption_set.set_provider(0, 1, make_shared<CConstantRateProvider>(0.01));
+    EXPECT_TRUE(assumption_set.compile() != nullptr);
+}
+
+
+TEST(assumptions, composite_provider)
+{
+    // base table Age x Gender
+    shared_ptr<CStandardRateProvider> base = make_shared<CStandardRateProvider>();
+    base->add_risk_factor(CRiskFactors::Age);
+    base->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_vec = {5, 2};
+    vector<int> offsets = {40, 0};
+    double base_vals[10];
+    for (int j = 0; j < 10; j++) {
+        base_vals[j] = 0.01 * (j + 1);
+    }
+    base->set_values(shape_vec, offsets, base_vals);
+
+    // smoker loading by SmokerStatus x Gender
+    shared_ptr<CStandardRateProvider> loading = make_shared<CStandardRateProvider>();
+    loading->add_risk_factor(CRiskFactors::SmokerStatus);
+    loading->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_vec2 = {2, 2};
+    vector<int> offsets2 = {0, 0};
+    double loading_vals[] = {1.0, 1.1, 1.5, 1.6};
+    loading->set_values(shape_vec2, offsets2, loading_vals);
+
+    // base x 0.9 x loading, the scalars are folded
+    vector<shared_ptr<CBaseRateProvider>> children = {base, make_shared<CConstantRateProvider>(0.9), loading,
+                                                      make_shared<CConstantRateProvider>(2.0)};
+    shared_ptr<CCompositeRateProvider> comp = make_shared<CCompositeRateProvider>(CCompositeOperation::PRODUCT, children);
+    EXPECT_EQ(comp->get_number_of_children(), (size_t)2);
+    vector<CRiskFactors> expected_rfs = {CRiskFactors::Age, CRiskFactors::Gender, CRiskFactors::SmokerStatus};
+    EXPECT_EQ(comp->get_risk_factors(), expected_rfs);
+
+    auto expected_rate = [&](int a, int g, int s) {
+        return base_vals[(a - 40) * 2 + g] * 1.8 * loading_vals[s * 2 + g];
+    };
+
+    vector<int> query_vec(3);
+    int query[3];
+    for (int a = 40; a < 45; a++) {
+        for (int g = 0; g < 2; g++) {
+            for (int s = 0; s < 2; s++) {
+                query[0] = query_vec[0] = a;
+                query[1] = query_vec[1] = g;
+                query[2] = query_vec[2] = s;
+                EXPECT_DOUBLE_EQ(comp->get_rate(query_vec), expected_rate(a, g, s));
+                EXPECT_EQ(comp->get_rate_unchecked(query), comp->get_rate(query_vec));
+            }
+        }
+    }
+    query_vec = {45, 0, 0};
+    ASSERT_THROW(comp->get_rate(query_vec), out_of_range);
+
+    // batched lookup over more than one block
+    const int n = 600;
+    vector<int> ages(n), genders(n), smokers(n);
+    for (int j = 0; j < n; j++) {
+        ages[j] = 40 + j % 5;
+        genders[j] = j % 2;
+        smokers[j] = (j / 3) % 2;
+    }
+    vector<double> rates(n);
+    vector<int *> indices = {ages.data(), genders.data(), smokers.data()};
+    comp->get_rates(rates.data(), n, indices);
+    for (int j = 0; j < n; j++) {
+        EXPECT_DOUBLE_EQ(rates[j], expected_rate(ages[j], genders[j], smokers[j]));
+    }
+
+    // min, max and sum
+    vector<shared_ptr<CBaseRateProvider>> children2 = {base, make_shared<CConstantRateProvider>(0.045)};
+    CCompositeRateProvider comp_min(CCompositeOperation::MIN, children2);
+    CCompositeRateProvider comp_max(CCompositeOperation::MAX, children2);
+    CCompositeRateProvider comp_sum(CCompositeOperation::SUM, children2);
+    vector<int> query2 = {42, 1};
+    EXPECT_DOUBLE_EQ(comp_min.get_rate(query2), 0.045);
+    EXPECT_DOUBLE_EQ(comp_max.get_rate(query2), 0.06);
+    EXPECT_DOUBLE_EQ(comp_sum.get_rate(query2), 0.105);
+
+    // nested trees
+    vector<shared_ptr<CBaseRateProvider>> children3 = {comp, make_shared<CCompositeRateProvider>(comp_min)};
+    CCompositeRateProvider comp_nested(CCompositeOperation::SUM, children3);
+    query_vec = {42, 1, 1};
+    EXPECT_DOUBLE_EQ(comp_nested.get_rate(query_vec), expected_rate(42, 1, 1) + 0.045);
+
+    // the index range is the intersection of the children
+    int lower[3], upper[3];
+    ASSERT_TRUE(comp->get_index_range(lower, upper));
+    EXPECT_EQ(lower[0], 40);
+    EXPECT_EQ(upper[0], 44);
+    EXPECT_EQ(upper[2], 1);
+    EXPECT_TRUE(comp->covers(lower, upper));
+    upper[2] = 2;
+    EXPECT_FALSE(comp->covers(lower, upper));
+
+    // slicing is pushed down to the children
+    vector<int> slice_indexes = {-1, 1, 0};
+    shared_ptr<CCompositeRateProvider> comp_sliced = comp->slice(slice_indexes);
+    EXPECT_EQ(comp_sliced->get_risk_factors().size(), (size_t)1);
+    vector<int> query1d = {43};
+    EXPECT_DOUBLE_EQ(comp_sliced->get_rate(query1d), expected_rate(43, 1, 0));
+    slice_indexes = {-1, 0, 1};
+    comp->slice_into(slice_indexes, comp_sliced.get());
+    EXPECT_DOUBLE_EQ(comp_sliced->get_rate(query1d), expected_rate(43, 0, 1));
+    ASSERT_THROW(comp->slice_into(slice_indexes, base.get()), domain_error);
+
+    // compiled assumption set agrees with the composite
+    CAssumptionSet assumption_set(2);
+    assumption_set.set_provider(0, 1, comp);
+    shared_ptr<CCompiledAssumptionSet> compiled = assumption_set.compile();
+    ASSERT_TRUE(compiled != nullptr);
+    vector<int> rf(NUMBER_OF_RISK_FACTORS, 0);
+    rf[(int)CRiskFactors::Age] = 44;
+    rf[(int)CRiskFactors::Gender] = 1;
+    rf[(int)CRiskFactors::SmokerStatus] = 1;
+    double result[4];
+    compiled->get_single_rateset(rf, result);
+    EXPECT_DOUBLE_EQ(result[1], expected_rate(44, 1, 1));
+}
+
+
+TEST(assumptions, set_rateset_block)
+{
+    unsigned state_dimension = 2;
+    CAssumptionSet assumption_set(state_dimension);
+
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {5};
+    vector<int> offsets = {60};
+    double ext_vals[] = {0.1, 0.2, 0.3, 0.4, 0.5};
+    srp->set_values(shape_vec, offsets, ext_vals);
+
+    assumption_set.set_provider(0, 1, srp);
+    assumption_set.set_provider(1, 0, make_shared<CConstantRateProvider>(0.05));
+
+    const size_t num_records = 3;
+    vector<int> ages = {60, 62, 64};
+    vector<int *> rf_vectors(NUMBER_OF_RISK_FACTORS, nullptr);
+    rf_vectors[(int)CRiskFactors::Age] = ages.data();
+
+    vector<double> rates(state_dimension * state_dimension * num_records);
+    assumption_set.get_rateset_block(num_records, rf_vectors, rates.data());
+
+    vector<int> rf_single(NUMBER_OF_RISK_FACTORS, 0);
+    double single_rates[4];
+    for (size_t j = 0; j < num_records; j++) {
+        rf_single[(int)CRiskFactors::Age] = ages[j];
+        assumption_set.get_single_rateset(rf_single, single_rates);
+        for (unsigned cell = 0; cell < state_dimension * state_dimension; cell++) {
+            EXPECT_EQ(rates[cell * num_records + j], single_rates[cell]);
+        }
+    }
+}
+
+
+TEST(assumptions, set_compile)
+{
+    unsigned state_dimension = 3;
+    CAssumptionSet assumption_set(state_dimension);
+
+    // Age x Gender table and a CalendarYear table with different age ranges
+    shared_ptr<CStandardRateProvider> srp1 = make_shared<CStandardRateProvider>();
+    srp1->add_risk_factor(CRiskFactors::Age);
+    srp1->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_vec1 = {10, 2};
+    vector<int> offsets1 = {60, 0};
+    vector<double> vals1(20);
+    for (int j = 0; j < 20; j++) {
+        vals1[j] = 0.01 * j;
+    }
+    srp1->set_values(shape_vec1, offsets1, vals1.data());
+
+    shared_ptr<CStandardRateProvider> srp2 = make_shared<CStandardRateProvider>();
+    srp2->add_risk_factor(CRiskFactors::CalendarYear);
+    srp2->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec2 = {3, 20};
+    vector<int> offsets2 = {2021, 55};
+    vector<double> vals2(60);
+    for (int j = 0; j < 60; j++) {
+        vals2[j] = 0.001 * j;
+    }
+    srp2->set_values(shape_vec2, offsets2, vals2.data());
+
+    assumption_set.set_provider(0, 1, srp1);
+    assumption_set.set_provider(0, 2, srp2);
+    assumption_set.set_provider(1, 2, make_shared<CConstantRateProvider>(0.3));
+
+    shared_ptr<CCompiledAssumptionSet> compiled = assumption_set.compile();
+    ASSERT_TRUE(compiled != nullptr);
+
+    // common age range is 60..69
+    EXPECT_EQ(compiled->size(), (size_t)(10 * 2 * 3 * 9));
+
+    vector<int> rf(NUMBER_OF_RISK_FACTORS, 0);
+    double expected[9];
+    double result[9];
+    for (int age = 60; age < 70; age++) {
+        for (int gender = 0; gender < 2; gender++) {
+            for (int year = 2021; year < 2024; year++) {
+                rf[(int)CRiskFactors::Age] = age;
+                rf[(int)CRiskFactors::Gender] = gender;
+                rf[(int)CRiskFactors::CalendarYear] = year;
+                assumption_set.get_single_rateset(rf, expected);
+                compiled->get_single_rateset(rf, result);
+                for (int cell = 0; cell < 9; cell++) {
+                    EXPECT_EQ(result[cell], expected[cell]);
+                }
+            }
+        }
+    }
+
+    // outside of the common range
+    rf[(int)CRiskFactors::Age] = 58;
+    ASSERT_THROW(compiled->get_single_rateset(rf, result), out_of_range);
+
+    // too big
+    EXPECT_TRUE(assumption_set.compile(100) == nullptr);
+}
+
+
+TEST(assumptions, set_rateset_diagonal)
+{
+    unsigned state_dimension = 3;
+    CAssumptionSet assumption_set(state_dimension);
+
+    // CalendarYear x Age table, a composite of an Age x Gender table and a constant
+    shared_ptr<CStandardRateProvider> srp1 = make_shared<CStandardRateProvider>();
+    srp1->add_risk_factor(CRiskFactors::CalendarYear);
+    srp1->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec1 = {10, 30};
+    vector<int> offsets1 = {2020, 50};
+    vector<double> vals1(300);
+    for (int j = 0; j < 300; j++) {
+        vals1[j] = 0.0001 * j;
+    }
+    srp1->set_values(shape_vec1, offsets1, vals1.data());
+
+    shared_ptr<CStandardRateProvider> srp2 = make_shared<CStandardRateProvider>();
+    srp2->add_risk_factor(CRiskFactors::Age);
+    srp2->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_vec2 = {30, 2};
+    vector<int> offsets2 = {50, 0};
+    vector<double> vals2(60);
+    for (int j = 0; j < 60; j++) {
+        vals2[j] = 0.01 + 0.001 * j;
+    }
+    srp2->set_values(shape_vec2, offsets2, vals2.data());
+    vector<shared_ptr<CBaseRateProvider>> children = {srp2, make_shared<CConstantRateProvider>(1.2)};
+
+    assumption_set.set_provider(0, 1, srp1);
+    assumption_set.set_provider(0, 2, make_shared<CCompositeRateProvider>(CCompositeOperation::PRODUCT, children));
+    assumption_set.set_provider(1, 2, make_shared<CConstantRateProvider>(0.3));
+
+    // the diagonal agrees with the single lookups
+    vector<int> rf_start(NUMBER_OF_RISK_FACTORS, 0);
+    rf_start[(int)CRiskFactors::Age] = 55;
+    rf_start[(int)CRiskFactors::Gender] = 1;
+    rf_start[(int)CRiskFactors::CalendarYear] = 2021;
+    vector<int> rf_step(NUMBER_OF_RISK_FACTORS, 0);
+    rf_step[(int)CRiskFactors::Age] = 1;
+    rf_step[(int)CRiskFactors::CalendarYear] = 1;
+
+    const size_t length = 9;
+    vector<double> diagonal(length * 9);
+    assumption_set.get_rateset_diagonal(rf_start, rf_step, length, diagonal.data());
+
+    vector<int> rf(rf_start);
+    double expected[9];
+    for (size_t j = 0; j < length; j++) {
+        assumption_set.get_single_rateset(rf, expected);
+        for (int cell = 0; cell < 9; cell++) {
+            EXPECT_EQ(diagonal[j * 9 + cell], expected[cell]);
+        }
+        rf[(int)CRiskFactors::Age]++;
+        rf[(int)CRiskFactors::CalendarYear]++;
+    }
+
+    // the same from the compiled set
+    shared_ptr<CCompiledAssumptionSet> compiled = assumption_set.compile();
+    ASSERT_TRUE(compiled != nullptr);
+    vector<double> diagonal_compiled(length * 9);
+    compiled->get_rateset_diagonal_unchecked(rf_start, rf_step, length, diagonal_compiled.data());
+    EXPECT_EQ(diagonal_compiled, diagonal);
+
+    // beyond the last calendar year the tables reject the lookups, unless they are clamped
+    vector<double> diagonal_clamped((length + 1) * 9);
+    ASSERT_THROW(assumption_set.get_rateset_diagonal(rf_start, rf_step, length + 1, diagonal_clamped.data()), out_of_range);
+    assumption_set.set_edge_mode(CRateEdgeMode::CLAMP);
+    assumption_set.get_rateset_diagonal(rf_start, rf_step, length + 1, diagonal_clamped.data());
+    rf[(int)CRiskFactors::Age] = 64;
+    rf[(int)CRiskFactors::CalendarYear] = 2029;
+    assumption_set.get_single_rateset(rf, expected);
+    for (int cell = 0; cell < 9; cell++) {
+        EXPECT_EQ(diagonal_clamped[length * 9 + cell], expected[cell]);
+    }
+    EXPECT_DOUBLE_EQ(diagonal_clamped[length * 9 + 1], vals1[9 * 30 + 14]);
+}
+
+
+TEST(assumptions, set_slice_cache)
+{
+    unsigned state_dimension = 2;
+    CAssumptionSet assumption_set(state_dimension);
+
+    shared_ptr<CStandardRateProvider> srp = make_shared<CStandardRateProvider>();
+    srp->add_risk_factor(CRiskFactors::Age);
+    srp->add_risk_factor(CRiskFactors::Gender);
+    srp->add_risk_factor(CRiskFactors::SmokerStatus);
+    vector<int> shape_vec = {5, 2, 3};
+    vector<int> offsets = {40, 0, 0};
+    vector<double> vals(30);
+    for (int j = 0; j < 30; j++) {
+        vals[j] = 0.01 * j;
+    }
+    srp->set_values(shape_vec, offsets, vals.data());
+    assumption_set.set_provider(0, 1, srp);
+    assumption_set.set_provider(1, 0, make_shared<CConstantRateProvider>(0.2));
+
+    vector<shared_ptr<CAssumptionSet>> other_assumptions;
+    other_assumptions.push_back(make_shared<CAssumptionSet>(state_dimension));
+    other_assumptions[0]->set_provider(0, 1, srp);
+
+    CAssumptionSliceCache cache(assumption_set, other_assumptions);
+    cache.add(1, 2);
+    cache.add(0, 1);
+    cache.add(1, 2);
+    EXPECT_EQ(cache.size(), (size_t)2);
+    EXPECT_TRUE(cache.get_be_slice(0, 0) == nullptr);
+    EXPECT_TRUE(cache.get_other_slices(0, 0) == nullptr);
+
+    const CAssumptionSet *slice = cache.get_be_slice(1, 2);
+    ASSERT_TRUE(slice != nullptr);
+    EXPECT_EQ(slice->get_provider(0, 1)->get_risk_factors().size(), (size_t)1);
+    ASSERT_EQ(cache.get_other_slices(1, 2)->size(), (size_t)1);
+
+    vector<int> rf(NUMBER_OF_RISK_FACTORS, 0);
+    double expected[4];
+    double result[4];
+    rf[(int)CRiskFactors::Gender] = 1;
+    rf[(int)CRiskFactors::SmokerStatus] = 2;
+    for (int age = 40; age < 45; age++) {
+        rf[(int)CRiskFactors::Age] = age;
+        assumption_set.get_single_rateset(rf, expected);
+        slice->get_single_rateset(rf, result);
+        for (int cell = 0; cell < 4; cell++) {
+            EXPECT_EQ(result[cell], expected[cell]);
+        }
+    }
+
+    // the portfolio assumptions are not modified
+    EXPECT_EQ(assumption_set.get_provider(0, 1)->get_risk_factors().size(), (size_t)3);
+}
+
+
 TEST(assumptions, set_create)
 {
 
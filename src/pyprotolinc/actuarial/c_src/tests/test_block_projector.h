@@ -0,0 +1,131 @@
+#ifndef TEST_BLOCK_PROJECTOR_H
+#define TEST_BLOCK_PROJECTOR_H
+
+#include <gtest/gtest.h>
+
+#include "../modules/simd.h"
+#include "../modules/block_projector.h"
+#include "../modules/runner.h"
+
+
+TEST(block_projector, update_state_kernels)
+{
+    const size_t lanes = 8;
+    const unsigned n = 3;
+    vector<double> a(n * n * lanes), probs(n * lanes);
+    for (size_t j = 0; j < a.size(); j++) {
+        a[j] = 0.001 * (j % 7) + 0.1 * (j % 3);
+    }
+    for (size_t j = 0; j < probs.size(); j++) {
+        probs[j] = 1.0 / (1 + j);
+    }
+
+    // all instruction sets agree with the scalar kernel bit by bit
+    vector<vector<double>> results;
+    for (SimdLevel level : {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        if ((int)level > (int)get_simd_level()) {
+            continue;
+        }
+        vector<double> probs_next(n * lanes, -1.0), prob_mvms(n * n * lanes, -1.0);
+        block_update_state(level, lanes, n, a.data(), probs.data(), probs_next.data(), prob_mvms.data());
+        results.push_back(probs_next);
+        results.back().insert(results.back().end(), prob_mvms.begin(), prob_mvms.end());
+    }
+    for (size_t k = 1; k < results.size(); k++) {
+        EXPECT_EQ(results[k], results[0]);
+    }
+
+    // lane 1: movement 0 -> 2 and new probability of state 2
+    const vector<double> &res = results[0];
+    EXPECT_EQ(res[n * lanes + (0 * n + 2) * lanes + 1], a[(0 * n + 2) * lanes + 1] * probs[0 * lanes + 1]);
+    EXPECT_EQ(res[n * lanes + (1 * n + 1) * lanes + 1], 0.0);
+    double expected = 0.0;
+    for (unsigned r = 0; r < n; r++) {
+        expected += a[(r * n + 2) * lanes + 1] * probs[r * lanes + 1];
+    }
+    EXPECT_EQ(res[2 * lanes + 1], expected);
+}
+
+TEST(block_projector, identical_to_scalar)
+{
+    // active (0), disabled (1), dead (2)
+    unsigned state_dimension = 3;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+
+    auto incidence = make_shared<CStandardRateProvider>();
+    incidence->add_risk_factor(CRiskFactors::Age);
+    incidence->add_risk_factor(CRiskFactors::CalendarYear);
+    vector<int> shape_inc = {121, 40};
+    vector<int> offsets_inc = {0, 2000};
+    vector<double> vals_inc(121 * 40);
+    for (int age = 0; age < 121; age++) {
+        for (int y = 0; y < 40; y++) {
+            vals_inc[age * 40 + y] = min(0.5, 0.001 * exp(0.04 * age) * (1.0 - 0.005 * y));
+        }
+    }
+    incidence->set_values(shape_inc, offsets_inc, vals_inc.data());
+
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    mortality->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_mort = {121, 2};
+    vector<int> offsets_mort = {0, 0};
+    vector<double> vals_mort(242);
+    for (int j = 0; j < 242; j++) {
+        vals_mort[j] = min(1.0, 0.0004 * exp(0.045 * (j / 2)) * (j % 2 == 0 ? 1.0 : 0.8));
+    }
+    mortality->set_values(shape_mort, offsets_mort, vals_mort.data());
+
+    assumptions->set_provider(0, 1, incidence);
+    assumptions->set_provider(0, 2, mortality);
+    assumptions->set_provider(1, 0, make_shared<CConstantRateProvider>(0.15));
+    assumptions->set_provider(1, 2, mortality);
+
+    // eleven records fill one block and part of a second one, two reach the maximum age during the projection
+    auto make_portfolio = []() {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(1, 19650704, 20100101, -1, 1, 0, 2000.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(2, 19080101, 20000101, -1, 0, 0, 1500.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(3, 19801130, 20150101, 20200101, 1, 0, 800.0, 0.01, "DI", 1));
+        ptf->add(make_shared<CPolicy>(4, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "DI", 0)); // same as #0
+        ptf->add(make_shared<CPolicy>(5, 19550520, 20000101, -1, 1, 0, 3000.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(6, 19911001, 20190101, -1, 0, 0, 500.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(7, 19601231, 20100101, -1, 0, 0, 1200.0, 0.01, "DI", 1));
+        ptf->add(make_shared<CPolicy>(8, 19040606, 19900101, -1, 1, 0, 700.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(9, 19750301, 20100101, -1, 1, 0, 900.0, 0.01, "DI", 0));
+        ptf->add(make_shared<CPolicy>(10, 19850815, 20100101, -1, 0, 0, 1100.0, 0.01, "DI", 0));
+        return ptf;
+    };
+
+    vector<vector<double>> results;
+    for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+        shared_ptr<CPolicyPortfolio> ptf = make_portfolio();
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 10, 1, false, assumptions, 120);
+        run_config.set_projection_engine(engine);
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        vector<double> annuity(ptf->size() * T), death_benefit(ptf->size() * T);
+        for (size_t k = 0; k < ptf->size(); k++) {
+            for (int t = 0; t < T; t++) {
+                annuity[k * T + t] = 0.01 * ptf->at(k).get_sum_insured();
+                death_benefit[k * T + t] = ptf->at(k).get_sum_insured() * (t < 60 ? 1.0 : 0.5);
+            }
+        }
+        ri.add_cond_state_payment(1, 0, annuity.data());
+        ri.add_transition_payment(0, 2, 1, death_benefit.data());
+        ri.add_transition_payment(1, 2, 2, death_benefit.data());
+        unique_ptr<RunResult> result = ri.run();
+
+        int cols = result->get_result_header_names().size();
+        results.push_back(vector<double>(T * cols));
+        result->copy_results(results.back().data(), T, cols);
+    }
+
+    ASSERT_EQ(results[1].size(), results[0].size());
+    for (size_t j = 0; j < results[0].size(); j++) {
+        EXPECT_EQ(results[1][j], results[0][j]) << "at position " << j;
+    }
+}
+
+#endif
@@ -14,4 +14,10 @@
 #include "test_time_axis.h"
 #include "test_assumptions.h"
 #include "test_config.h"
+#include "test_model_points.h"
+#include "test_block_projector.h"
+#include "test_record_projector.h"
+#include "test_rate_conversion.h"
+#include "test_scheduler.h"
+#include "test_thread_pool.h"
 
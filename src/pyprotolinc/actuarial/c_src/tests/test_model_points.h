@@ -0,0 +1,201 @@
+#ifndef TEST_MODEL_POINTS_H
+#define TEST_MODEL_POINTS_H
+
+#include <gtest/gtest.h>
+
+#include "../modules/model_points.h"
+#include "../modules/runner.h"
+
+
+// portfolio at 2021/12/20, the start dates of the monthly time axis are on the 1st, 20th and 21st
+static shared_ptr<CPolicyPortfolio> make_model_point_test_portfolio()
+{
+    auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 20);
+    ptf->add(make_shared<CPolicy>(0, 19600503, 20100101, -1, 0, 0, 1000.0, 0.01, "TERM", 0));
+    ptf->add(make_shared<CPolicy>(1, 19600515, 20100101, -1, 0, 0, 2000.0, 0.01, "TERM", 0)); // same as #0
+    ptf->add(make_shared<CPolicy>(2, 19600525, 20100101, -1, 0, 0, 1000.0, 0.01, "TERM", 0)); // birthday after the 21st
+    ptf->add(make_shared<CPolicy>(3, 19600503, 20100101, -1, 1, 0, 1000.0, 0.01, "TERM", 0)); // other gender
+    ptf->add(make_shared<CPolicy>(4, 19600510, 20100101, -1, 0, 0, 1000.0, 0.02, "TERM", 0)); // other reserving rate
+    ptf->add(make_shared<CPolicy>(5, 19600512, 20100101, -1, 0, 0, 500.0, 0.01, "TERM", 0));  // same as #0
+    return ptf;
+}
+
+TEST(model_points, compress)
+{
+    shared_ptr<CPolicyPortfolio> ptf = make_model_point_test_portfolio();
+    TimeAxis ta(TimeStep::MONTHLY, 2, 2021, 12, 20);
+    int T = (int)ta.get_length();
+
+    // payments proportional to the insured amount
+    AggregatePayments payments(ptf->size());
+    vector<double> annuity(ptf->size() * T);
+    for (size_t k = 0; k < ptf->size(); k++) {
+        for (int t = 0; t < T; t++) {
+            annuity[k * T + t] = 0.1 * ptf->at(k).get_sum_insured();
+        }
+    }
+    payments.add_cond_state_payment(0, 0, annuity.data(), ptf->size(), T);
+
+    CModelPointCompressor compressor(ta);
+    shared_ptr<AggregatePayments> mp_payments;
+    shared_ptr<CPolicyPortfolio> mp_ptf = compressor.compress(ptf, payments, mp_payments);
+    ASSERT_EQ(mp_ptf->size(), (size_t)4);
+    ASSERT_TRUE(mp_payments != nullptr);
+
+    const CPolicy &mp = mp_ptf->at(0);
+    EXPECT_EQ(mp.get_weight(), 3.0);
+    EXPECT_EQ(mp.get_sum_insured(), 3500.0);
+    EXPECT_EQ(mp.get_dob().get_day(), 3);
+    EXPECT_EQ(mp_payments->get_single_record_payments(0)->at(0).payments[0].cond_payments[5], 350.0);
+    EXPECT_EQ(mp_ptf->at(1).get_weight(), 1.0);
+    EXPECT_EQ(mp_payments->get_single_record_payments(1), payments.get_single_record_payments(2));
+
+    // banding the dates of birth by year also merges #2
+    CModelPointCompressor banding_compressor(ta, 12);
+    mp_ptf = banding_compressor.compress(ptf, payments, mp_payments);
+    EXPECT_EQ(mp_ptf->size(), (size_t)3);
+    EXPECT_EQ(mp_ptf->at(0).get_weight(), 4.0);
+
+    // nothing to compress
+    auto ptf_single = make_shared<CPolicyPortfolio>(2021, 12, 20);
+    ptf_single->add(ptf->get_policies()[0]);
+    AggregatePayments payments_single(1);
+    EXPECT_EQ(compressor.compress(ptf_single, payments_single, mp_payments), ptf_single);
+    EXPECT_TRUE(mp_payments == nullptr);
+}
+
+TEST(model_points, payment_structure)
+{
+    // #0, #1 and #5 agree in everything but the payments: #1 has another payment type in state 0, #5 the same
+    // payment type in state 1
+    shared_ptr<CPolicyPortfolio> ptf = make_model_point_test_portfolio();
+    TimeAxis ta(TimeStep::MONTHLY, 2, 2021, 12, 20);
+    int T = (int)ta.get_length();
+    AggregatePayments payments(ptf->size());
+    vector<pair<int, int>> state_and_type = {{0, 0}, {0, 1}, {0, 0}, {0, 0}, {0, 0}, {1, 0}};
+    for (size_t k = 0; k < ptf->size(); k++) {
+        ConditionalPayout payout;
+        payout.payment_index = state_and_type[k].second;
+        payout.cond_payments.assign(T, 10.0);
+        StateConditionalRecordPayout state_payout(state_and_type[k].first);
+        state_payout.payments.push_back(payout);
+        auto record_payments = make_shared<unordered_map<int, StateConditionalRecordPayout>>();
+        record_payments->insert(pair<int, StateConditionalRecordPayout>(state_and_type[k].first, std::move(state_payout)));
+        payments.add_single_record_payments(record_payments, k);
+    }
+
+    // no records merged
+    CModelPointCompressor compressor(ta);
+    shared_ptr<AggregatePayments> mp_payments;
+    EXPECT_EQ(compressor.compress(ptf, payments, mp_payments), ptf);
+    EXPECT_TRUE(mp_payments == nullptr);
+}
+
+TEST(model_points, run)
+{
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    mortality->add_risk_factor(CRiskFactors::Gender);
+    vector<int> shape_vec = {121, 2};
+    vector<int> offsets = {0, 0};
+    vector<double> vals(242);
+    for (int j = 0; j < 242; j++) {
+        vals[j] = min(1.0, 0.0005 * exp(0.045 * j));
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, mortality);
+
+    // the results with and without compression agree
+    vector<vector<double>> results;
+    for (int compress = 0; compress < 2; compress++) {
+        shared_ptr<CPolicyPortfolio> ptf = make_model_point_test_portfolio();
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 10, 1, false, assumptions, 120);
+        run_config.set_model_point_compression(compress == 1);
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        vector<double> annuity(ptf->size() * T), death_benefit(ptf->size() * T);
+        for (size_t k = 0; k < ptf->size(); k++) {
+            for (int t = 0; t < T; t++) {
+                annuity[k * T + t] = 0.1 * ptf->at(k).get_sum_insured();
+                death_benefit[k * T + t] = ptf->at(k).get_sum_insured() * (t < 60 ? 1.0 : 0.5);
+            }
+        }
+        ri.add_cond_state_payment(0, 0, annuity.data());
+        ri.add_transition_payment(0, 1, 1, death_benefit.data());
+        unique_ptr<RunResult> result = ri.run();
+
+        int cols = result->get_result_header_names().size();
+        results.push_back(vector<double>(T * cols));
+        result->copy_results(results.back().data(), T, cols);
+    }
+
+    for (size_t j = 0; j < results[0].size(); j++) {
+        EXPECT_NEAR(results[1][j], results[0][j], 1e-12 * max(1.0, fabs(results[0][j])));
+    }
+
+    CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 10, 1, false, assumptions, 120);
+    ASSERT_THROW(run_config.set_model_point_compression(true, -1), domain_error);
+}
+
+TEST(model_points, engines)
+{
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int j = 0; j < 121; j++) {
+        vals[j] = min(1.0, 0.0005 * exp(0.07 * j));
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, mortality);
+
+    // the model points and their payments (built by the compressor) are read by index by both engines and
+    // several workers; the results agree with the uncompressed scalar run
+    vector<vector<double>> results;
+    for (bool compress : {false, true}) {
+        for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+            for (bool multicore : {false, true}) {
+                shared_ptr<CPolicyPortfolio> ptf = make_model_point_test_portfolio();
+                for (size_t k = 0; k < 15; k++) {
+                    ptf->add(make_shared<CPolicy>(*ptf->get_policies()[k % 6]));
+                }
+                CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 10, 2, multicore, assumptions, 120);
+                run_config.set_model_point_compression(compress);
+                run_config.set_projection_engine(engine);
+                RunnerInterface ri(run_config, ptf);
+                int T = ri.get_time_axis()->get_length();
+                vector<double> annuity(ptf->size() * T), death_benefit(ptf->size() * T);
+                for (size_t k = 0; k < ptf->size(); k++) {
+                    for (int t = 0; t < T; t++) {
+                        annuity[k * T + t] = 0.1 * ptf->at(k).get_sum_insured();
+                        death_benefit[k * T + t] = ptf->at(k).get_sum_insured();
+                    }
+                }
+                ri.add_cond_state_payment(0, 0, annuity.data());
+                ri.add_transition_payment(0, 1, 1, death_benefit.data());
+                unique_ptr<RunResult> result = ri.run();
+
+                int cols = result->get_result_header_names().size();
+                results.push_back(vector<double>(T * cols));
+                result->copy_results(results.back().data(), T, cols);
+            }
+        }
+    }
+
+    for (size_t k = 1; k < results.size(); k++) {
+        ASSERT_EQ(results[k].size(), results[0].size());
+        for (size_t j = 0; j < results[0].size(); j++) {
+            EXPECT_NEAR(results[k][j], results[0][j], 1e-12 * max(1.0, fabs(results[0][j]))) << "run " << k << " at position " << j;
+        }
+    }
+
+    // single core, the engines agree bit by bit on the model points
+    EXPECT_EQ(results[6], results[4]);
+}
+
+#endif
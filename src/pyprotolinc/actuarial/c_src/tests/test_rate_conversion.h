@@ -0,0 +1,174 @@
+#ifndef TEST_RATE_CONVERSION_H
+#define TEST_RATE_CONVERSION_H
+
+#include <gtest/gtest.h>
+
+#include "../modules/rate_conversion.h"
+#include "../modules/runner.h"
+
+
+TEST(rate_conversion, methods)
+{
+    // active (0), disabled (1), dead (2)
+    const unsigned n = 3;
+    const double yearly[n * n] = {0.0, 0.02, 0.01,
+                                  0.3, 0.0, 0.05,
+                                  0.0, 0.0, 0.0};
+    double simple[n * n], constant_force[n * n], matrix_exp[n * n];
+    convert_rates(RateConversion::SIMPLE, n, yearly, 30, simple);
+    convert_rates(RateConversion::CONSTANT_FORCE, n, yearly, 30, constant_force);
+    convert_rates(RateConversion::MATRIX_EXPONENTIAL, n, yearly, 30, matrix_exp);
+
+    EXPECT_EQ(simple[0 * n + 1], 30 / 360.0 * 0.02);
+    EXPECT_EQ(simple[0 * n + 0], 1 - (30 / 360.0 * 0.02 + 30 / 360.0 * 0.01));
+
+    // rows are distributions and agree to first order
+    for (unsigned r = 0; r < n; r++)
+    {
+        double sum_cf = 0, sum_exp = 0;
+        for (unsigned c = 0; c < n; c++)
+        {
+            sum_cf += constant_force[r * n + c];
+            sum_exp += matrix_exp[r * n + c];
+            EXPECT_NEAR(constant_force[r * n + c], simple[r * n + c], 1e-2);
+            EXPECT_NEAR(matrix_exp[r * n + c], simple[r * n + c], 1e-2);
+        }
+        EXPECT_NEAR(sum_cf, 1.0, 1e-15);
+        EXPECT_NEAR(sum_exp, 1.0, 1e-14);
+    }
+    EXPECT_EQ(constant_force[2 * n + 2], 1.0);
+    EXPECT_EQ(matrix_exp[2 * n + 2], 1.0);
+
+    // twelve monthly steps with constant force reproduce the yearly decrement
+    EXPECT_NEAR(pow(constant_force[0], 12), 1 - 0.03, 1e-14);
+    EXPECT_NEAR(constant_force[0 * n + 1] / constant_force[0 * n + 2], 2.0, 1e-14);
+
+    // the exponential of the generator is a semigroup: one quarter equals three months
+    double quarter[n * n];
+    convert_rates(RateConversion::MATRIX_EXPONENTIAL, n, yearly, 90, quarter);
+    double two_months[n * n], three_months[n * n];
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            two_months[r * n + c] = 0;
+            for (unsigned j = 0; j < n; j++)
+            {
+                two_months[r * n + c] += matrix_exp[r * n + j] * matrix_exp[j * n + c];
+            }
+        }
+    }
+    for (unsigned r = 0; r < n; r++)
+    {
+        for (unsigned c = 0; c < n; c++)
+        {
+            three_months[r * n + c] = 0;
+            for (unsigned j = 0; j < n; j++)
+            {
+                three_months[r * n + c] += two_months[r * n + j] * matrix_exp[j * n + c];
+            }
+            EXPECT_NEAR(three_months[r * n + c], quarter[r * n + c], 1e-15);
+        }
+    }
+
+    // the survival of a single decrement is exp(-mu t) and a decrement of one or more empties the state
+    const double mortality[4] = {0.0, 0.7, 0.0, 0.0};
+    double p[4];
+    convert_rates(RateConversion::MATRIX_EXPONENTIAL, 2, mortality, 360, p);
+    EXPECT_NEAR(p[0], exp(-0.7), 1e-15);
+    const double certain_death[4] = {0.0, 1.2, 0.0, 0.0};
+    convert_rates(RateConversion::CONSTANT_FORCE, 2, certain_death, 30, p);
+    EXPECT_EQ(p[0], 0.0);
+    EXPECT_EQ(p[1], 1.0);
+}
+
+TEST(rate_conversion, cache)
+{
+    const unsigned n = 2;
+    CRateConversionCache cache(RateConversion::CONSTANT_FORCE, n);
+    const double yearly_1[n * n] = {0.0, 0.01, 0.0, 0.0};
+    const double yearly_2[n * n] = {0.0, 0.02, 0.0, 0.0};
+
+    shared_ptr<const CRateConversionCache::Entry> e1 = cache.get(yearly_1, 30, cache.key_hash(yearly_1, 30));
+    EXPECT_EQ(cache.get(yearly_1, 30, cache.key_hash(yearly_1, 30)), e1);
+    EXPECT_NE(cache.get(yearly_1, 10, cache.key_hash(yearly_1, 10)), e1);
+    EXPECT_NE(cache.get(yearly_2, 30, cache.key_hash(yearly_2, 30)), e1);
+    EXPECT_EQ(cache.size(), 3u);
+
+    double expected[n * n];
+    convert_rates_constant_force(n, yearly_1, 30, expected);
+    for (unsigned k = 0; k < n * n; k++)
+    {
+        EXPECT_EQ(e1->converted[k], expected[k]);
+    }
+
+    // a colliding hash does not mix up the entries
+    shared_ptr<const CRateConversionCache::Entry> e2 = cache.get(yearly_2, 30, 0);
+    EXPECT_EQ(cache.get(yearly_1, 30, 0), cache.get(yearly_1, 30, 0));
+    EXPECT_NE(cache.get(yearly_1, 30, 0), e2);
+
+    // a full shard is emptied, the entries handed out stay valid
+    CRateConversionCache small_cache(RateConversion::CONSTANT_FORCE, n, CRateConversionCache::NUM_SHARDS);
+    shared_ptr<const CRateConversionCache::Entry> first = small_cache.get(yearly_1, 30, 0);
+    EXPECT_NE(small_cache.get(yearly_2, 30, 0), first);
+    EXPECT_EQ(small_cache.size(), 1u);
+    EXPECT_EQ(first->converted[1], expected[1]);
+
+    // concurrent conversions of the same rates return one entry
+    CRateConversionCache shared_cache(RateConversion::MATRIX_EXPONENTIAL, n);
+    CThreadPool pool(4);
+    vector<shared_ptr<const CRateConversionCache::Entry>> entries(4);
+    pool.run(4, [&](int w) { entries[w] = shared_cache.get(yearly_1, 30, shared_cache.key_hash(yearly_1, 30)); });
+    for (int w = 1; w < 4; w++)
+    {
+        EXPECT_EQ(entries[w], entries[0]);
+    }
+    EXPECT_EQ(shared_cache.size(), 1u);
+}
+
+TEST(rate_conversion, projection)
+{
+    // alive (0) and dead (1) with a yearly mortality of 6%
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.06));
+
+    auto run = [&](RateConversion method, ProjectionEngine engine) {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        for (int k = 0; k < 10; k++)
+        {
+            ptf->add(make_shared<CPolicy>(k, 19700215 + 10000 * k, 20100101, -1, k % 2, 0, 1000.0 + k, 0.01, "TERM", 0));
+        }
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 10, 1, false, assumptions, 120);
+        run_config.set_rate_conversion(method);
+        run_config.set_projection_engine(engine);
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        unique_ptr<RunResult> result = ri.run();
+        vector<string> names = result->get_result_header_names();
+        int cols = names.size();
+        vector<double> values(T * cols);
+        result->copy_results(values.data(), T, cols);
+        int prob_col = (int)(std::find(names.begin(), names.end(), "PROB_STATE_0") - names.begin());
+        vector<double> probs(T);
+        for (int t = 0; t < T; t++)
+        {
+            probs[t] = values[t * cols + prob_col];
+        }
+        return probs;
+    };
+
+    // with constant force the survival after a year is exactly the yearly rate, the simple method overstates it
+    vector<double> simple = run(RateConversion::SIMPLE, ProjectionEngine::SCALAR);
+    vector<double> constant_force = run(RateConversion::CONSTANT_FORCE, ProjectionEngine::SCALAR);
+    EXPECT_NEAR(constant_force[12], 10 * 0.94, 1e-12);
+    EXPECT_GT(simple[12], constant_force[12]);
+
+    vector<double> matrix_exp = run(RateConversion::MATRIX_EXPONENTIAL, ProjectionEngine::SCALAR);
+    EXPECT_NEAR(matrix_exp[12], 10 * exp(-0.06), 1e-12);
+
+    // the block engine uses the same converted rates
+    EXPECT_EQ(run(RateConversion::CONSTANT_FORCE, ProjectionEngine::BLOCK), constant_force);
+}
+
+#endif
@@ -0,0 +1,545 @@
+#ifndef TEST_RECORD_PROJECTOR_H
+#define TEST_RECORD_PROJECTOR_H
+
+#include <gtest/gtest.h>
+
+#include "../modules/record_projector.h"
+#include "../modules/runner.h"
+
+
+TEST(record_projector, fixed_dimension)
+{
+    unsigned state_dimension = 3;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int j = 0; j < 121; j++) {
+        vals[j] = min(1.0, 0.0005 * exp(0.05 * j));
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.02));
+    assumptions->set_provider(0, 2, mortality);
+    assumptions->set_provider(1, 0, make_shared<CConstantRateProvider>(0.1));
+    assumptions->set_provider(1, 2, mortality);
+
+    auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+    ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "DI", 0));
+    ptf->add(make_shared<CPolicy>(1, 19060704, 20100101, -1, 1, 0, 2000.0, 0.02, "DI", 0));
+    ptf->add(make_shared<CPolicy>(2, 19801130, 20150101, 20200101, 1, 0, 800.0, 0.01, "DI", 1));
+
+    CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 20, 1, false, assumptions, 120);
+    auto ta = make_shared<TimeAxis>(TimeStep::MONTHLY, 20, 2021, 12, 31);
+    int T = ta->get_length();
+    AggregatePayments payments(ptf->size());
+    vector<double> annuity(ptf->size() * T, 12.0), death_benefit(ptf->size() * T, 1000.0);
+    payments.add_cond_state_payment(1, 0, annuity.data(), ptf->size(), T);
+    payments.add_transition_payment(0, 2, 1, death_benefit.data(), ptf->size(), T);
+
+    // the specialized projector produces the same results as the generic one
+    RunResult result_generic(state_dimension, ta, 2), result_fixed(state_dimension, ta, 2);
+    Runner(1, ptf, run_config, ta, 2).run(result_generic, payments);
+    RunnerT<3>(1, ptf, run_config, ta, 2).run(result_fixed, payments);
+
+    int cols = result_generic.get_result_header_names().size();
+    vector<double> values_generic(T * cols), values_fixed(T * cols);
+    result_generic.copy_results(values_generic.data(), T, cols);
+    result_fixed.copy_results(values_fixed.data(), T, cols);
+    EXPECT_EQ(values_fixed, values_generic);
+    EXPECT_GT(values_generic[(T - 1) * cols + 7 + 2], 0.0);
+
+    // the number of states must match
+    ASSERT_THROW(RecordProjectorT<2>(run_config, *ta), domain_error);
+    ASSERT_THROW((ProjectionStateMatrixT<4>(T, 3)), domain_error);
+}
+
+TEST(record_projector, sparse_update)
+{
+    // care levels 0..10 (deteriorate by one level or recover to level 0) and death (11)
+    const int n = 12;
+    CAssumptionSet assumptions(n);
+    for (int r = 0; r < n - 1; r++) {
+        if (r + 1 < n - 1) {
+            assumptions.set_provider(r, r + 1, make_shared<CConstantRateProvider>(0.05 + 0.01 * r));
+        }
+        if (r > 0) {
+            assumptions.set_provider(r, 0, make_shared<CConstantRateProvider>(0.02));
+        }
+        assumptions.set_provider(r, n - 1, make_shared<CConstantRateProvider>(0.01 * (r + 1)));
+    }
+    vector<bool> pattern = assumptions.get_transition_pattern();
+    EXPECT_TRUE(pattern[3 * n + 4]);
+    EXPECT_TRUE(pattern[3 * n + 3]);
+    EXPECT_TRUE(pattern[(n - 1) * n + n - 1]);
+    EXPECT_FALSE(pattern[3 * n + 5]);
+    EXPECT_FALSE(pattern[(n - 1) * n]);
+
+    // dependent monthly probabilities
+    vector<int> rf(NUMBER_OF_RISK_FACTORS, 0);
+    vector<double> a(n * n);
+    assumptions.get_single_rateset(rf, a.data());
+    for (int r = 0; r < n; r++) {
+        double sum = 0.0;
+        for (int c = 0; c < n; c++) {
+            if (c != r) {
+                a[r * n + c] /= 12.0;
+                sum += a[r * n + c];
+            }
+        }
+        a[r * n + r] = 1.0 - sum;
+    }
+
+    // the state update restricted to the pattern agrees with the dense one
+    const int T = 25;
+    vector<vector<double>> results;
+    for (int use_pattern = 0; use_pattern < 2; use_pattern++) {
+        ProjectionStateMatrix states(T, n);
+        if (use_pattern) {
+            states.set_transition_pattern(pattern);
+        }
+        states.initialize_states(0);
+        results.push_back(vector<double>());
+        for (int t = 0; t < T - 1; t++) {
+            states.update_state(t, a.data());
+            results.back().insert(results.back().end(), states.get_step_movements(), states.get_step_movements() + n * n);
+        }
+        results.back().insert(results.back().end(), states.get_state_probs(0), states.get_state_probs(0) + T * n);
+    }
+    EXPECT_EQ(results[1], results[0]);
+    EXPECT_GT(results[0].back(), 0.0);
+
+    // all instruction sets agree with the scalar kernel (one segment with all states per row)
+    vector<int> row_offsets(n + 1), segments(2 * n);
+    vector<double> probs(n);
+    for (int r = 0; r < n; r++) {
+        row_offsets[r + 1] = r + 1;
+        segments[2 * r] = 0;
+        segments[2 * r + 1] = n;
+        probs[r] = 1.0 / (r + 2);
+    }
+    vector<double> kernel_results;
+    for (int level = 0; level <= (int)get_simd_level(); level++) {
+        vector<double> out(n + n * n, 0.0);
+        sparse_update_state((SimdLevel)level, n, row_offsets.data(), segments.data(), a.data(), probs.data(),
+                            out.data(), out.data() + n);
+        if (level == 0) {
+            kernel_results = out;
+            EXPECT_EQ(out[n + 3 * n + 4], a[3 * n + 4] * probs[3]);
+            EXPECT_EQ(out[n + 3 * n + 3], 0.0);
+        }
+        EXPECT_EQ(out, kernel_results);
+    }
+    EXPECT_THROW(ProjectionStateMatrix(T, n).set_transition_pattern(vector<bool>(n)), domain_error);
+
+    // the matrix exponential also moves along chains of transitions, e.g. two levels within one step
+    vector<bool> transitive_pattern = assumptions.get_transition_pattern(true);
+    EXPECT_TRUE(transitive_pattern[3 * n + 5]);
+    EXPECT_TRUE(transitive_pattern[3 * n + 1]);
+    EXPECT_FALSE(transitive_pattern[(n - 1) * n]);
+
+    // the probabilities of the states still add up to one and both engines agree
+    auto shared_assumptions = make_shared<CAssumptionSet>(assumptions);
+    vector<vector<double>> engine_results;
+    for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        for (int k = 0; k < 10; k++) {
+            ptf->add(make_shared<CPolicy>(k, 19600215 + 10000 * k, 20100101, -1, k % 2, 0, 1000.0 + k, 0.01, "TERM", k % 3));
+        }
+        CRunConfig run_config(n, TimeStep::MONTHLY, 10, 1, false, shared_assumptions, 120);
+        run_config.set_rate_conversion(RateConversion::MATRIX_EXPONENTIAL);
+        run_config.set_projection_engine(engine);
+        RunnerInterface ri(run_config, ptf);
+        int steps = ri.get_time_axis()->get_length();
+        unique_ptr<RunResult> result = ri.run();
+        vector<string> names = result->get_result_header_names();
+        int cols = names.size();
+        engine_results.push_back(vector<double>(steps * cols));
+        result->copy_results(engine_results.back().data(), steps, cols);
+
+        int prob_col = (int)(std::find(names.begin(), names.end(), "PROB_STATE_0") - names.begin());
+        ASSERT_LT(prob_col + n, cols);
+        for (int t = 0; t < steps; t++) {
+            double total = 0.0;
+            for (int c = 0; c < n; c++) {
+                total += engine_results.back()[t * cols + prob_col + c];
+            }
+            EXPECT_NEAR(total, (double)ptf->size(), 1e-12) << "at time step " << t;
+        }
+        EXPECT_GT(engine_results.back()[(steps - 1) * cols + prob_col + 5], 0.0);
+    }
+    ASSERT_EQ(engine_results[1].size(), engine_results[0].size());
+    for (size_t j = 0; j < engine_results[0].size(); j++) {
+        EXPECT_NEAR(engine_results[1][j], engine_results[0][j], 1e-12 * max(1.0, fabs(engine_results[0][j]))) << "at position " << j;
+    }
+}
+
+TEST(record_projector, early_termination)
+{
+    // alive (0) and dead (1, absorbing), everyone dies within the first month after age 90
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int j = 0; j < 121; j++) {
+        vals[j] = j < 90 ? 0.0005 * exp(0.06 * j) : 12.0;
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, mortality);
+    vector<bool> absorbing = assumptions->get_absorbing_states();
+    EXPECT_FALSE(absorbing[0]);
+    EXPECT_TRUE(absorbing[1]);
+
+    struct Run
+    {
+        vector<double> values;
+        long long skipped;
+    };
+    auto run = [&](bool early_termination, double threshold, ProjectionEngine engine) {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        ptf->add(make_shared<CPolicy>(0, 19361015, 20000101, -1, 0, 0, 1000.0, 0.01, "TERM", 0));
+        ptf->add(make_shared<CPolicy>(1, 19500101, 20000101, -1, 1, 0, 2000.0, 0.01, "TERM", 0));
+        ptf->add(make_shared<CPolicy>(2, 19700601, 20000101, -1, 0, 0, 500.0, 0.01, "TERM", 0));
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 40, 1, false, assumptions, 120);
+        run_config.set_early_termination(early_termination, threshold);
+        run_config.set_projection_engine(engine);
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        vector<double> death_benefit(ptf->size() * T, 1000.0);
+        ri.add_transition_payment(0, 1, 0, death_benefit.data());
+        unique_ptr<RunResult> result = ri.run();
+        int cols = result->get_result_header_names().size();
+        Run r = {vector<double>(T * cols), result->get_skipped_time_steps()};
+        result->copy_results(r.values.data(), T, cols);
+        return r;
+    };
+
+    // stopping once nobody is alive any more changes the results at most by rounding
+    Run full = run(false, 0.0, ProjectionEngine::SCALAR);
+    Run stopped = run(true, 0.0, ProjectionEngine::SCALAR);
+    EXPECT_EQ(full.skipped, 0);
+    EXPECT_GT(stopped.skipped, 12 * 20);
+    ASSERT_EQ(stopped.values.size(), full.values.size());
+    for (size_t j = 0; j < full.values.size(); j++) {
+        EXPECT_NEAR(stopped.values[j], full.values[j], 1e-12 * max(1.0, fabs(full.values[j])));
+    }
+
+    // the block engine stops the same way
+    Run stopped_block = run(true, 0.0, ProjectionEngine::BLOCK);
+    EXPECT_EQ(stopped_block.values, stopped.values);
+    EXPECT_EQ(stopped_block.skipped, stopped.skipped);
+
+    // a materiality threshold stops earlier
+    Run approx = run(true, 0.5, ProjectionEngine::SCALAR);
+    EXPECT_GT(approx.skipped, stopped.skipped);
+    EXPECT_EQ(run(true, 0.5, ProjectionEngine::BLOCK).values, approx.values);
+
+    CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 40, 1, false, assumptions, 120);
+    ASSERT_THROW(run_config.set_early_termination(true, -0.1), domain_error);
+}
+
+TEST(record_projector, projection_horizon)
+{
+    // alive (0) and dead (1)
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int j = 0; j < 121; j++) {
+        vals[j] = min(1.0, 0.0005 * exp(0.07 * j));
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, mortality);
+
+    // the cover of the first record ends in June 2031 (time index 114), the second one pays for five years only
+    const int cover_end_index = 114, last_payment_index = 60;
+    struct Run
+    {
+        vector<double> payments;
+        vector<double> probs;
+        long long skipped;
+    };
+    auto run = [&](bool horizons, ProjectionEngine engine) {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "TERM", 0));
+        ptf->add(make_shared<CPolicy>(1, 19650704, 20100101, -1, 1, 0, 2000.0, 0.01, "TERM", 0));
+        ptf->add(make_shared<CPolicy>(2, 19801130, 20150101, -1, 0, 0, 500.0, 0.01, "TERM", 0));
+        if (horizons) {
+            ptf->get_policies()[0]->set_coverage_end_date(20310615);
+        }
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 40, 1, false, assumptions, 120);
+        run_config.set_model_point_compression(false);
+        run_config.set_payment_horizon(horizons);
+        run_config.set_projection_engine(engine);
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        vector<double> death_benefit(ptf->size() * T, 1000.0);
+        for (int t = cover_end_index + 1; t < T; t++) {
+            death_benefit[t] = 0.0;
+        }
+        for (int t = last_payment_index + 1; t < T; t++) {
+            death_benefit[T + t] = 0.0;
+        }
+        ri.add_transition_payment(0, 1, 0, death_benefit.data());
+        unique_ptr<RunResult> result = ri.run();
+        vector<string> names = result->get_result_header_names();
+        int cols = names.size();
+        vector<double> values(T * cols);
+        result->copy_results(values.data(), T, cols);
+        int payment_col = (int)(std::find(names.begin(), names.end(), "STATE_PAYMENT_TYPE_0") - names.begin());
+        int prob_col = (int)(std::find(names.begin(), names.end(), "PROB_STATE_0") - names.begin());
+        Run r = {vector<double>(T), vector<double>(T), result->get_skipped_time_steps()};
+        for (int t = 0; t < T; t++) {
+            r.payments[t] = values[t * cols + payment_col];
+            r.probs[t] = values[t * cols + prob_col];
+        }
+        return r;
+    };
+
+    // the payments are not affected by the horizons, the state probabilities are carried forward
+    Run full = run(false, ProjectionEngine::SCALAR);
+    Run truncated = run(true, ProjectionEngine::SCALAR);
+    int T = full.payments.size();
+    EXPECT_EQ(full.skipped, 0);
+    EXPECT_EQ(truncated.skipped, (T - 1 - cover_end_index) + (T - 1 - last_payment_index));
+    EXPECT_EQ(truncated.payments, full.payments);
+    for (int t = 0; t <= last_payment_index; t++) {
+        EXPECT_EQ(truncated.probs[t], full.probs[t]);
+    }
+    EXPECT_GT(truncated.probs[T - 1], full.probs[T - 1]);
+
+    // the block engine stops the lanes at the same time steps
+    Run truncated_block = run(true, ProjectionEngine::BLOCK);
+    EXPECT_EQ(truncated_block.payments, truncated.payments);
+    EXPECT_EQ(truncated_block.probs, truncated.probs);
+    EXPECT_EQ(truncated_block.skipped, truncated.skipped);
+
+    // records without an end of cover are not affected
+    CPolicy policy(3, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "TERM", 0);
+    EXPECT_FALSE(policy.has_coverage_end_date());
+    policy.set_coverage_end_date(20310615);
+    EXPECT_TRUE(policy.has_coverage_end_date());
+    EXPECT_EQ(policy.get_coverage_end_date().get_month(), 6);
+    policy.set_coverage_end_date(-1);
+    EXPECT_FALSE(policy.has_coverage_end_date());
+}
+
+TEST(record_projector, time_step_segments)
+{
+    // alive (0) and dead (1) with a constant mortality
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.01));
+
+    auto run = [&](bool segmented) {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "TERM", 0));
+        CRunConfig run_config(state_dimension, segmented ? TimeStep::YEARLY : TimeStep::MONTHLY, 20, 1, false, assumptions, 120);
+        if (segmented) {
+            run_config.add_time_step_segment(TimeStep::MONTHLY, 5);
+            run_config.add_time_step_segment(TimeStep::QUARTERLY, 10);
+        }
+        RunnerInterface ri(run_config, ptf);
+        int T = ri.get_time_axis()->get_length();
+        unique_ptr<RunResult> result = ri.run();
+        vector<string> names = result->get_result_header_names();
+        int cols = names.size();
+        vector<double> values(T * cols);
+        result->copy_results(values.data(), T, cols);
+        int prob_col = (int)(std::find(names.begin(), names.end(), "PROB_STATE_0") - names.begin());
+        vector<double> probs(T);
+        for (int t = 0; t < T; t++) {
+            probs[t] = values[t * cols + prob_col];
+        }
+        return probs;
+    };
+
+    vector<double> monthly = run(false);
+    vector<double> segmented = run(true);
+    ASSERT_EQ(monthly.size(), (size_t)(1 + 12 * 20));
+    ASSERT_EQ(segmented.size(), (size_t)(1 + 12 * 5 + 4 * 5 + 10));
+
+    // the monthly segment is identical, afterwards the coarser steps approximate the monthly projection
+    for (int t = 0; t <= 60; t++) {
+        EXPECT_EQ(segmented[t], monthly[t]);
+    }
+    EXPECT_NEAR(segmented[80], monthly[120], 1e-4);
+    EXPECT_NEAR(segmented[90], monthly[240], 1e-3);
+
+    CRunConfig run_config(state_dimension, TimeStep::YEARLY, 20, 1, false, assumptions, 120);
+    run_config.add_time_step_segment(TimeStep::MONTHLY, 5);
+    ASSERT_THROW(run_config.add_time_step_segment(TimeStep::QUARTERLY, 5), domain_error);
+    ASSERT_THROW(run_config.add_time_step_segment(TimeStep::QUARTERLY, 21), domain_error);
+}
+
+TEST(record_projector, reserves)
+{
+    // active (0), disabled (1), dead (2) with age dependent mortality
+    unsigned state_dimension = 3;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape_vec = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int j = 0; j < 121; j++) {
+        vals[j] = min(1.0, 0.0005 * exp(0.05 * j));
+    }
+    mortality->set_values(shape_vec, offsets, vals.data());
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.02));
+    assumptions->set_provider(0, 2, mortality);
+    assumptions->set_provider(1, 0, make_shared<CConstantRateProvider>(0.1));
+    assumptions->set_provider(1, 2, mortality);
+
+    auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+    ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "DI", 0));
+    const CPolicy &policy = ptf->at(0);
+
+    // the reserve recursion only runs on request
+    CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 20, 1, false, assumptions, 120);
+    EXPECT_FALSE(run_config.get_result_spec().reserves);
+    ResultSpec with_reserves;
+    with_reserves.reserves = true;
+    run_config.set_result_spec(with_reserves);
+    auto ta = make_shared<TimeAxis>(TimeStep::MONTHLY, 20, 2021, 12, 31);
+    const int T = ta->get_length();
+    const int n = state_dimension;
+    AggregatePayments payments(ptf->size());
+    vector<double> annuity(T, 12.0), death_benefit(T, 1000.0);
+    payments.add_cond_state_payment(1, 0, annuity.data(), ptf->size(), T);
+    payments.add_transition_payment(0, 2, 1, death_benefit.data(), ptf->size(), T);
+
+    RecordProjector projector(run_config, *ta);
+    RunResult result(state_dimension, ta, 2);
+    projector.run(1, 0, policy, result, ptf->get_portfolio_date(), payments.get_single_record_payments(0),
+                  payments.get_single_record_transition_payments(0));
+
+    // the matrices change with the age only
+    EXPECT_GE(projector.get_num_step_matrices(), 20u);
+    EXPECT_LE(projector.get_num_step_matrices(), 22u);
+
+    // reference: the recursion with the matrices of all time steps
+    RecordProjector reference(run_config, *ta);
+    reference.start_record(policy, ptf->get_portfolio_date());
+    vector<double> matrices(T * n * n);
+    for (int t = 1; t < T; t++) {
+        const double *a = reference.step_assumptions(policy, t);
+        std::copy(a, a + n * n, matrices.begin() + t * n * n);
+    }
+    const double *probs = result.get_be_state_probs_ptr();
+    vector<double> v(n, 0.0), v_next(n, 0.0);
+    for (int t = T - 1; t > 0; t--) {
+        double discount_factor = pow(1.01, -ta->duration_at(t) / 360.0);
+        for (int from = 0; from < n; from++) {
+            double eom = 0.0;
+            for (int to = 0; to < n; to++) {
+                eom += ((from == 0 && to == 2 ? -1000.0 : 0.0) + v[to]) * matrices[(t * n + from) * n + to];
+            }
+            v_next[from] = (from == 1 ? -12.0 : 0.0) + discount_factor * eom;
+            EXPECT_NEAR(projector.get_reserves_bom()[t * n + from], v_next[from] * probs[(t - 1) * n + from], 1e-12 * 1000.0);
+        }
+        v = v_next;
+    }
+    EXPECT_LT(projector.get_reserves_bom()[1 * n + 0], 0.0);
+}
+
+TEST(record_projector, result_spec)
+{
+    // active (0), disabled (1), dead (2)
+    unsigned state_dimension = 3;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.02));
+    assumptions->set_provider(0, 2, make_shared<CConstantRateProvider>(0.01));
+    assumptions->set_provider(1, 0, make_shared<CConstantRateProvider>(0.1));
+    assumptions->set_provider(1, 2, make_shared<CConstantRateProvider>(0.03));
+
+    auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+    ptf->add(make_shared<CPolicy>(0, 19700215, 20100101, -1, 0, 0, 1000.0, 0.01, "DI", 0));
+    ptf->add(make_shared<CPolicy>(1, 19801130, 20150101, 20200101, 1, 0, 800.0, 0.01, "DI", 1));
+
+    auto ta = make_shared<TimeAxis>(TimeStep::MONTHLY, 20, 2021, 12, 31);
+    const int T = ta->get_length();
+    const int n = state_dimension;
+    AggregatePayments payments(ptf->size());
+    vector<double> annuity(ptf->size() * T, 12.0), death_benefit(ptf->size() * T, 1000.0);
+    payments.add_cond_state_payment(1, 0, annuity.data(), ptf->size(), T);
+    payments.add_transition_payment(0, 2, 1, death_benefit.data(), ptf->size(), T);
+
+    auto run = [&](const ResultSpec &spec, ProjectionEngine engine) {
+        CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 20, 1, false, assumptions, 120);
+        run_config.set_result_spec(spec);
+        run_config.set_projection_engine(engine);
+        RunResult result(state_dimension, ta, 2, spec);
+        Runner(1, ptf, run_config, ta, 2).run(result, payments);
+        int cols = result.get_result_header_names().size();
+        vector<double> values(T * cols);
+        result.copy_results(values.data(), T, cols);
+        return values;
+    };
+    const int cols = 7 + 2 * (n + n * n) + 2;
+    const int vol_col = 7 + n + n * n, vol_mvm_col = vol_col + n, payment_col = vol_mvm_col + n * n;
+
+    // the volumes are the sum insured times the probabilities
+    vector<double> full = run(ResultSpec(), ProjectionEngine::SCALAR);
+    for (int t = 0; t < T; t++) {
+        double total_volume = 0.0;
+        for (int s = 0; s < n; s++) {
+            total_volume += full[t * cols + vol_col + s];
+        }
+        EXPECT_NEAR(total_volume, 1800.0, 1e-9);
+    }
+    EXPECT_NEAR(full[0 * cols + vol_col + 0], 1000.0, 1e-12);
+    EXPECT_NEAR(full[0 * cols + vol_col + 1], 800.0, 1e-12);
+
+    // cash flows only: the payments are unchanged and the other columns are zero, with both engines
+    ResultSpec cash_flows;
+    cash_flows.state_probs = false;
+    cash_flows.prob_movements = false;
+    cash_flows.state_volumes = false;
+    cash_flows.volume_movements = false;
+    cash_flows.reserves = false;
+    for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+        vector<double> values = run(cash_flows, engine);
+        for (int t = 0; t < T; t++) {
+            for (int c = 7; c < payment_col; c++) {
+                EXPECT_EQ(values[t * cols + c], 0.0);
+            }
+            for (int c = payment_col; c < cols; c++) {
+                EXPECT_EQ(values[t * cols + c], full[t * cols + c]);
+            }
+        }
+    }
+
+    // volume movements without probability movements are still derived from the movements
+    ResultSpec volumes_only = cash_flows;
+    volumes_only.volume_movements = true;
+    vector<double> values = run(volumes_only, ProjectionEngine::SCALAR);
+    for (int t = 0; t < T; t++) {
+        for (int c = vol_mvm_col; c < vol_mvm_col + n * n; c++) {
+            EXPECT_EQ(values[t * cols + c], full[t * cols + c]);
+        }
+        EXPECT_EQ(values[t * cols + 7 + n + 2], 0.0);
+    }
+    EXPECT_GT(values[(T - 1) * cols + vol_mvm_col + 2], 0.0);
+
+    // the reserves are only calculated if requested
+    CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 20, 1, false, assumptions, 120);
+    run_config.set_result_spec(cash_flows);
+    RecordProjector projector(run_config, *ta);
+    RunResult result(state_dimension, ta, 2, cash_flows);
+    projector.run(1, 0, ptf->at(0), result, ptf->get_portfolio_date(), payments.get_single_record_payments(0),
+                  payments.get_single_record_transition_payments(0));
+    EXPECT_EQ(projector.get_num_step_matrices(), 0u);
+    EXPECT_EQ(projector.get_reserves_bom()[1 * n + 0], 0.0);
+    EXPECT_EQ(result.get_be_state_vols_ptr(), nullptr);
+    EXPECT_EQ(result.get_be_state_probs_ptr(), nullptr);
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef TEST_SCHEDULER_H
+#define TEST_SCHEDULER_H
+
+#include <gtest/gtest.h>
+
+#include "../modules/scheduler.h"
+#include "../modules/runner.h"
+
+
+TEST(scheduler, ranges)
+{
+    vector<double> costs = {1, 1, 5, 5, 2, 2, 9};
+
+    // in the order of the records, the last range is shorter
+    vector<WorkRange> ranges = CWorkStealingScheduler::make_ranges(costs, 2, false);
+    ASSERT_EQ(ranges.size(), 4);
+    EXPECT_EQ(ranges[0].begin, 0);
+    EXPECT_EQ(ranges[0].end, 2);
+    EXPECT_EQ(ranges[3].begin, 6);
+    EXPECT_EQ(ranges[3].end, 7);
+    EXPECT_EQ(ranges[1].cost, 10);
+
+    // by decreasing costs
+    ranges = CWorkStealingScheduler::make_ranges(costs, 2, true);
+    ASSERT_EQ(ranges.size(), 4);
+    EXPECT_EQ(ranges[0].begin, 2);
+    EXPECT_EQ(ranges[1].begin, 6);
+    EXPECT_EQ(ranges[2].begin, 4);
+    EXPECT_EQ(ranges[3].begin, 0);
+
+    EXPECT_EQ(CWorkStealingScheduler::default_range_size(10, 4), 1);
+    EXPECT_EQ(CWorkStealingScheduler::default_range_size(10, 4, 8), 8);
+    EXPECT_EQ(CWorkStealingScheduler::default_range_size(6400, 4), 100);
+    EXPECT_EQ(CWorkStealingScheduler::default_range_size(6400, 4, 8), 104);
+    EXPECT_EQ(CWorkStealingScheduler::default_range_size(1000000, 2), 256);
+
+    EXPECT_THROW(CWorkStealingScheduler(0, ranges), domain_error);
+}
+
+TEST(scheduler, all_ranges_processed_once)
+{
+    const size_t num_records = 103;
+    vector<WorkRange> ranges = CWorkStealingScheduler::make_ranges(vector<double>(num_records, 1.0), 4, false);
+
+    // on the calling thread and on the threads of a pool
+    CThreadPool pool(3);
+    for (CThreadPool *p : {(CThreadPool *)nullptr, &pool}) {
+        for (int num_workers : {1, 3}) {
+            CWorkStealingScheduler scheduler(num_workers, ranges);
+            vector<int> processed(num_records, 0);
+            scheduler.run([&](int w, const WorkRange &range) {
+                ASSERT_GE(w, 0);
+                ASSERT_LT(w, num_workers);
+                for (size_t i = range.begin; i < range.end; i++) {
+                    processed[i]++;  // the ranges are disjoint
+                }
+            }, p);
+            EXPECT_EQ(processed, vector<int>(num_records, 1));
+            EXPECT_EQ(scheduler.get_busy_seconds().size(), (size_t)num_workers);
+            EXPECT_EQ(scheduler.get_stolen_ranges().size(), (size_t)num_workers);
+
+            WorkRange range;
+            EXPECT_FALSE(scheduler.next(0, range));
+        }
+    }
+}
+
+TEST(scheduler, stealing)
+{
+    vector<WorkRange> ranges = CWorkStealingScheduler::make_ranges(vector<double>(6, 1.0), 1, false);
+    CWorkStealingScheduler scheduler(2, ranges);
+
+    // worker 0 first takes its own ranges 0, 2, 4 from the front, then steals 5, 3, 1 from the back of worker 1
+    vector<size_t> order;
+    WorkRange range;
+    while (scheduler.next(0, range)) {
+        order.push_back(range.begin);
+    }
+    EXPECT_EQ(order, vector<size_t>({0, 2, 4, 5, 3, 1}));
+    EXPECT_EQ(scheduler.get_stolen_ranges()[0], 3);
+    EXPECT_EQ(scheduler.get_stolen_ranges()[1], 0);
+}
+
+TEST(scheduler, exception)
+{
+    vector<WorkRange> ranges = CWorkStealingScheduler::make_ranges(vector<double>(10, 1.0), 1, false);
+    CWorkStealingScheduler scheduler(2, ranges);
+    CThreadPool pool(2);
+    EXPECT_THROW(scheduler.run([](int, const WorkRange &range) {
+        if (range.begin == 3) {
+            throw domain_error("failed");
+        }
+    }, &pool), domain_error);
+}
+
+TEST(scheduler, runner)
+{
+    // healthy (0), dead (1)
+    unsigned state_dimension = 2;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int age = 0; age < 121; age++) {
+        vals[age] = min(1.0, 0.0005 * exp(0.06 * age));
+    }
+    mortality->set_values(shape, offsets, vals.data());
+    assumptions->set_provider(0, 1, mortality);
+
+    // records of very different ages, some of them reach the maximum age or the end of the cover
+    auto make_portfolio = []() {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        for (int k = 0; k < 37; k++) {
+            long dob = (1920 + 2 * k) * 10000L + (1 + k % 12) * 100 + 1 + k % 28;
+            long cover_end = k % 5 == 0 ? 20300101 : -1;
+            ptf->add(make_shared<CPolicy>(k, dob, 20100101, cover_end, k % 2, 0, 1000.0 + 10 * k, 0.01, "TERM", 0));
+        }
+        return ptf;
+    };
+
+    vector<vector<double>> results;
+    for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+        for (bool multicore : {false, true}) {
+            shared_ptr<CPolicyPortfolio> ptf = make_portfolio();
+            CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 20, 3, multicore, assumptions, 110);
+            run_config.set_projection_engine(engine);
+            run_config.set_scheduling(true, multicore ? 2 : 0);
+            RunnerInterface ri(run_config, ptf);
+            int T = ri.get_time_axis()->get_length();
+            vector<double> death_benefit(ptf->size() * T);
+            for (size_t k = 0; k < ptf->size(); k++) {
+                for (int t = 0; t < T; t++) {
+                    death_benefit[k * T + t] = ptf->at(k).get_sum_insured();
+                }
+            }
+            ri.add_transition_payment(0, 1, 0, death_benefit.data());
+            unique_ptr<RunResult> result = ri.run();
+            EXPECT_EQ(result->get_worker_busy_seconds().size(), multicore ? 3 : 1);
+
+            int cols = result->get_result_header_names().size();
+            results.push_back(vector<double>(T * cols));
+            result->copy_results(results.back().data(), T, cols);
+        }
+    }
+
+    // the workers only change the order of the summation
+    for (size_t k = 1; k < results.size(); k++) {
+        ASSERT_EQ(results[k].size(), results[0].size());
+        for (size_t j = 0; j < results[0].size(); j++) {
+            EXPECT_NEAR(results[k][j], results[0][j], 1e-12 * max(1.0, fabs(results[0][j]))) << "at position " << j;
+        }
+    }
+    EXPECT_THROW(CRunConfig(state_dimension, TimeStep::MONTHLY, 20, 3, true, assumptions, 110).set_scheduling(true, -1), domain_error);
+}
+
+TEST(scheduler, tree_reduce)
+{
+    auto ta = make_shared<TimeAxis>(TimeStep::MONTHLY, 1, 2021, 12, 31);
+    vector<double> values = {0.1, 0.7, 1e16, -1e16, 0.3};
+    vector<RunResult> results;
+    for (double v : values) {
+        results.emplace_back(RunResult(2, ta, 1));
+        results.back().add_record_payments(1, &v);
+    }
+    RunResult::tree_reduce(results);
+
+    // pairs first, then the pairs of pairs
+    double expected = ((values[0] + values[1]) + (values[2] + values[3])) + values[4];
+    EXPECT_EQ(results[0].get_state_cond_payments_ptr()[1], expected);
+
+    // the same tree while the leaves are completed in any order
+    for (vector<size_t> order : {vector<size_t>({0, 1, 2, 3, 4}), vector<size_t>({4, 3, 2, 1, 0}), vector<size_t>({2, 4, 0, 3, 1})}) {
+        RunResultTree tree(values.size());
+        for (size_t k = 0; k < order.size(); k++) {
+            unique_ptr<RunResult> leaf(new RunResult(2, ta, 1));
+            leaf->add_record_payments(1, &values[order[k]]);
+            tree.add(order[k], std::move(leaf));
+            if (k + 1 < order.size()) {
+                EXPECT_THROW(tree.release_sum(), domain_error);
+            }
+        }
+        EXPECT_EQ(tree.release_sum()->get_state_cond_payments_ptr()[1], expected);
+    }
+    EXPECT_EQ(RunResultTree(0).release_sum(), nullptr);
+    EXPECT_THROW(RunResultTree(2).add(2, unique_ptr<RunResult>(new RunResult(2, ta, 1))), domain_error);
+}
+
+TEST(scheduler, reproducible_summation)
+{
+    // healthy (0), disabled (1), dead (2)
+    unsigned state_dimension = 3;
+    auto assumptions = make_shared<CAssumptionSet>(state_dimension);
+    auto mortality = make_shared<CStandardRateProvider>();
+    mortality->add_risk_factor(CRiskFactors::Age);
+    vector<int> shape = {121};
+    vector<int> offsets = {0};
+    vector<double> vals(121);
+    for (int age = 0; age < 121; age++) {
+        vals[age] = min(1.0, 0.0005 * exp(0.06 * age));
+    }
+    mortality->set_values(shape, offsets, vals.data());
+    assumptions->set_provider(0, 1, make_shared<CConstantRateProvider>(0.013));
+    assumptions->set_provider(0, 2, mortality);
+    assumptions->set_provider(1, 0, make_shared<CConstantRateProvider>(0.2));
+    assumptions->set_provider(1, 2, mortality);
+
+    auto make_portfolio = []() {
+        auto ptf = make_shared<CPolicyPortfolio>(2021, 12, 31);
+        for (int k = 0; k < 61; k++) {
+            long dob = (1925 + k) * 10000L + (1 + k % 12) * 100 + 1 + k % 28;
+            ptf->add(make_shared<CPolicy>(k, dob, 20100101, -1, k % 2, 0, 1000.0 + 13.7 * k, 0.01, "DI", k % 3 == 0 ? 1 : 0));
+        }
+        return ptf;
+    };
+
+    // the same bits for any number of workers and both engines
+    vector<vector<double>> results;
+    for (ProjectionEngine engine : {ProjectionEngine::SCALAR, ProjectionEngine::BLOCK}) {
+        for (int cpus : {1, 2, 3, 5}) {
+            shared_ptr<CPolicyPortfolio> ptf = make_portfolio();
+            CRunConfig run_config(state_dimension, TimeStep::MONTHLY, 15, cpus, cpus > 1, assumptions, 110);
+            run_config.set_projection_engine(engine);
+            run_config.set_reproducible_summation(true);
+            if (cpus == 5) {
+                // the ranges do not depend on the range size of the scheduling either
+                run_config.set_scheduling(true, 1);
+            }
+            RunnerInterface ri(run_config, ptf);
+            int T = ri.get_time_axis()->get_length();
+            vector<double> annuity(ptf->size() * T);
+            for (size_t k = 0; k < ptf->size(); k++) {
+                for (int t = 0; t < T; t++) {
+                    annuity[k * T + t] = 0.01 * ptf->at(k).get_sum_insured();
+                }
+            }
+            ri.add_cond_state_payment(1, 0, annuity.data());
+            unique_ptr<RunResult> result = ri.run();
+            EXPECT_EQ(result->get_worker_busy_seconds().size(), (size_t)cpus);
+
+            int cols = result->get_result_header_names().size();
+            results.push_back(vector<double>(T * cols));
+            result->copy_results(results.back().data(), T, cols);
+        }
+    }
+    for (size_t k = 1; k < results.size(); k++) {
+        EXPECT_EQ(results[k], results[0]) << "run " << k;
+    }
+
+    EXPECT_EQ(CWorkStealingScheduler::fixed_range_size(61, 64, 8), 8);
+    EXPECT_EQ(CWorkStealingScheduler::fixed_range_size(10000, 64, 8), 160);
+    EXPECT_EQ(CWorkStealingScheduler::fixed_range_size(0, 64), 1);
+}
+
+#endif
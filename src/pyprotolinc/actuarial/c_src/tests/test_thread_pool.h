@@ -0,0 +1,66 @@
+#ifndef TEST_THREAD_POOL_H
+#define TEST_THREAD_POOL_H
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <set>
+
+#include "../modules/thread_pool.h"
+
+
+TEST(thread_pool, run)
+{
+    CThreadPool pool(4);
+    EXPECT_EQ(pool.get_num_threads(), 4);
+    EXPECT_FALSE(pool.get_pinned());
+
+    // the threads are reused for the next parallel section, task w always runs on thread w
+    vector<std::thread::id> first(4), second(4);
+    pool.run(4, [&](int w) { first[w] = std::this_thread::get_id(); });
+    pool.run(4, [&](int w) { second[w] = std::this_thread::get_id(); });
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(set<std::thread::id>(first.begin(), first.end()).size(), 4);
+    EXPECT_EQ(set<std::thread::id>(first.begin(), first.end()).count(std::this_thread::get_id()), 0);
+
+    // fewer tasks than threads
+    std::atomic<int> calls(0);
+    pool.run(2, [&](int w) { ASSERT_LT(w, 2); calls++; });
+    EXPECT_EQ(calls, 2);
+
+    EXPECT_THROW(pool.run(5, [](int) {}), domain_error);
+    EXPECT_THROW(CThreadPool(0), domain_error);
+}
+
+TEST(thread_pool, exception)
+{
+    CThreadPool pool(3);
+    std::atomic<int> finished(0);
+    EXPECT_THROW(pool.run(3, [&](int w) {
+        if (w == 1) {
+            throw domain_error("failed");
+        }
+        finished++;
+    }), domain_error);
+    EXPECT_EQ(finished, 2);
+
+    // the pool is usable afterwards
+    pool.run(3, [&](int) { finished++; });
+    EXPECT_EQ(finished, 5);
+}
+
+TEST(thread_pool, shared)
+{
+    shared_ptr<CThreadPool> pool = CThreadPool::get_shared(2, false);
+    EXPECT_EQ(CThreadPool::get_shared(2, false), pool);
+
+    // other settings replace the shared pool, the old one stays valid while in use
+    shared_ptr<CThreadPool> pinned = CThreadPool::get_shared(2, true);
+    EXPECT_NE(pinned, pool);
+    std::atomic<int> calls(0);
+    pool->run(2, [&](int) { calls++; });
+    pinned->run(2, [&](int) { calls++; });
+    EXPECT_EQ(calls, 4);
+}
+
+#endif
@@ -198,4 +198,39 @@ TEST(time_axis, yearly)
 
 
 
+TEST(time_axis, segments)
+{
+    // monthly for two years, quarterly up to five years and yearly afterwards
+    vector<TimeStepSegment> segments = {{TimeStep::MONTHLY, 2}, {TimeStep::QUARTERLY, 5}};
+    TimeAxis ta(TimeStep::YEARLY, 10, 2021, 12, 20, segments);
+
+    const vector<PeriodDate> &end_dates = ta.get_end_dates();
+    const vector<int> &period_lengths = ta.get_period_length_in_days();
+
+    // the portfolio date, a stub to the end of the month, 24 months, 12 quarters and 5 years
+    ASSERT_EQ(ta.get_length(), 1 + 1 + 24 + 12 + 5);
+    EXPECT_EQ(period_lengths[1], 10);
+    for (int t = 2; t <= 25; t++) {
+        EXPECT_EQ(period_lengths[t], 30);
+    }
+    for (int t = 26; t <= 37; t++) {
+        EXPECT_EQ(period_lengths[t], 90);
+    }
+    for (int t = 38; t <= 42; t++) {
+        EXPECT_EQ(period_lengths[t], 360);
+    }
+
+    // the segments end with a year
+    EXPECT_EQ(end_dates[25].year, 2023);
+    EXPECT_EQ(end_dates[25].month, 12);
+    EXPECT_EQ(end_dates[26].month, 3);
+    EXPECT_EQ(end_dates[37].year, 2026);
+    EXPECT_EQ(end_dates[37].month, 12);
+    EXPECT_EQ(end_dates[42].year, 2031);
+
+    // without segments the time step applies throughout
+    TimeAxis ta_yearly(TimeStep::YEARLY, 10, 2021, 12, 20, vector<TimeStepSegment>());
+    EXPECT_EQ(ta_yearly.get_length(), 1 + 1 + 10);
+}
+
 #endif
\ No newline at end of file
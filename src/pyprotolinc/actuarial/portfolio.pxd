@@ -24,6 +24,7 @@ cdef extern from "portfolio.h":
         CPortfolioBuilder &set_date_of_birth(int64_t *ptr_dob)
         CPortfolioBuilder &set_issue_date(int64_t *ptr_issue_date)
         CPortfolioBuilder &set_date_disablement(int64_t *ptr_disablement_date)
+        CPortfolioBuilder &set_coverage_end_date(int64_t *ptr_coverage_end_date)
         CPortfolioBuilder &set_gender(int32_t *)
         CPortfolioBuilder &set_smoker_status(int32_t *)
         CPortfolioBuilder &set_sum_insured(double *)
@@ -91,6 +92,10 @@ def build_c_portfolio(py_portfolio):
     cdef int64_t[::1] dod_mv = dod
     dereference(cp_builder_ptr).set_date_disablement(&dod_mv[0])
 
+    # end of cover (-1 if the cover does not end)
+    cdef int64_t[::1] doe_mv = py_portfolio.coverage_end_dates
+    dereference(cp_builder_ptr).set_coverage_end_date(&doe_mv[0])
+
     # gender
     cdef int32_t[::1] gender_mv = py_portfolio.gender
     dereference(cp_builder_ptr).set_gender(&gender_mv[0])
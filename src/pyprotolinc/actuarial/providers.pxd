@@ -2,6 +2,8 @@
 from copy import deepcopy
 from multiprocessing import cpu_count
 from libcpp.memory cimport shared_ptr, unique_ptr, make_shared, static_pointer_cast
+from libc.stdlib cimport malloc, free
+from cpython.buffer cimport PyObject_GetBuffer, PyBuffer_Release, PyBUF_C_CONTIGUOUS, PyBUF_FORMAT
 
 
 from libcpp cimport bool
@@ -15,10 +17,23 @@ include "portfolio.pxd"
 # should go into .pxd file?
 cdef extern from "providers.h":
 
+    cpdef enum class CRateEdgeMode(int):
+        STRICT,
+        CLAMP,
+
+    cpdef enum class CCompositeOperation(int):
+        PRODUCT,
+        SUM,
+        MIN,
+        MAX,
+
+    ctypedef void (*CBufferRelease)(void *owner)
+
 
     cdef cppclass CBaseRateProvider:
         void add_risk_factor(CRiskFactors rf) except +
         vector[CRiskFactors] &get_risk_factors() const
+        void set_edge_mode(CRateEdgeMode mode)
         
         double get_rate(vector[int] &indices)  except +
         void get_rates(double *out_array, int length, vector[int *] &indices) except +
@@ -37,11 +52,38 @@ cdef extern from "providers.h":
         int get_dimension()
         int size()
         void get_values(double *ext_vals)        
+        CRateEdgeMode get_edge_mode() const
+        vector[int] &get_shape() const
+        vector[int] &get_offsets() const
 
         void set_values(vector[int] &shape_vec_in, vector[int] &offsets_in, double *ext_vals) except +
+        void set_values_borrowed(vector[int] &shape_vec_in, vector[int] &offsets_in, const double *ext_vals,
+                                 void *owner, CBufferRelease release) except +
         
         shared_ptr[CStandardRateProvider] slice(vector[int] &indices) except +
 
+    cdef cppclass CTrendRateProvider(CBaseRateProvider):
+
+        CTrendRateProvider()
+        int get_dimension()
+        int get_base_year() const
+        size_t get_cached_cohorts() const
+        CRateEdgeMode get_edge_mode() const
+
+        void set_values(vector[int] &shape_vec_in, vector[int] &offsets_in, int base_year_in,
+                        const double *base_rates_in, const double *trend_in,
+                        const double *initial_trend_in, const double *trend_weights_in) except +
+
+        shared_ptr[CTrendRateProvider] slice(vector[int] &indices) except +
+
+    cdef cppclass CCompositeRateProvider(CBaseRateProvider):
+
+        CCompositeRateProvider(CCompositeOperation op, const vector[shared_ptr[CBaseRateProvider]] &children) except +
+        CCompositeOperation get_operation() const
+        size_t get_number_of_children() const
+
+        shared_ptr[CCompositeRateProvider] slice(vector[int] &indices) except +
+
 
 cdef class ConstantRateProvider:
     cdef shared_ptr[CConstantRateProvider] c_provider
@@ -93,6 +135,19 @@ def rebuild_ConstantRateProvider(rate):
     return ConstantRateProvider(rate)
 
 
+cdef extern from "rate_table_file.h":
+
+    void write_rate_table(string path, const CStandardRateProvider &provider) except +
+    shared_ptr[CStandardRateProvider] open_rate_table(string path) except +
+
+
+cdef void _release_borrowed_buffer(void *owner) noexcept with gil:
+    """ Release the buffer view of a NumPy array borrowed by a CStandardRateProvider. """
+    cdef Py_buffer *view = <Py_buffer *> owner
+    PyBuffer_Release(view)
+    free(view)
+
+
 cdef class StandardRateProvider:
 
     cdef shared_ptr[CStandardRateProvider] c_provider
@@ -106,10 +161,15 @@ cdef class StandardRateProvider:
         return self.c_provider
 
     # def __cinit__(self, rfs, values, np.ndarray[int, ndim=1, mode="c"] offsets):
-    def __init__(self, rfs, values, np.ndarray[int, ndim=1, mode="c"] offsets):
+    def __init__(self, rfs, values, np.ndarray[int, ndim=1, mode="c"] offsets, bint copy=True):
+        """ Create the provider from the array `values`. With `copy=False` the provider borrows the
+            buffer of the array (which must not be modified afterwards) instead of copying it,
+            only non-contiguous input is copied in this case. """
         # cdef vector[int] shapevec
         cdef int k
         cdef int d
+        cdef double[::1] values_memview
+        cdef Py_buffer *view
 
         # keep the input data so that we can restore this object by pickling
         for k in offsets:
@@ -138,8 +198,30 @@ cdef class StandardRateProvider:
             d = values.shape[k]
             self.shapevec.push_back(d)        
 
-        cdef double[::1] values_memview = values.flatten()
-        self.c_provider.get()[0].set_values(self.shapevec, offsets, &values_memview[0])
+        # only copies if the input is not C-contiguous
+        values = np.ascontiguousarray(values, dtype=np.float64)
+        if copy:
+            values_memview = values.ravel()
+            self.c_provider.get()[0].set_values(self.shapevec, offsets, &values_memview[0])
+        else:
+            # the buffer view keeps the array alive until the last provider using it is destroyed
+            view = <Py_buffer *> malloc(sizeof(Py_buffer))
+            if view == NULL:
+                raise MemoryError()
+            try:
+                PyObject_GetBuffer(values, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)
+            except:
+                free(view)
+                raise
+            self.c_provider.get()[0].set_values_borrowed(self.shapevec, offsets, <const double *> view.buf,
+                                                         view, _release_borrowed_buffer)
+
+    def set_edge_mode(self, mode):
+        """ Set the treatment of out-of-range indices, `CRateEdgeMode.CLAMP` uses the value at the nearest table edge. """
+        self.c_provider.get()[0].set_edge_mode(CRateEdgeMode(mode))
+
+    def get_edge_mode(self):
+        return CRateEdgeMode(self.c_provider.get()[0].get_edge_mode())
 
     def get_offsets(self):
         offsets = np.zeros(self.dim, dtype=np.int32)
@@ -154,7 +236,7 @@ cdef class StandardRateProvider:
     def __reduce__(self):
         """ Reduce method to make this object pickalable, cf. https://stackoverflow.com/questions/12646436/pickle-cython-class"""
         return (rebuild_StandardRateProvider, (self.get_risk_factors(),
-                self.get_values().reshape(self.get_shape()), self.get_offsets()))
+                self.get_values().reshape(self.get_shape()), self.get_offsets(), self.get_edge_mode()))
 
     def get_risk_factors(self):
         cdef vector[CRiskFactors] rfs = self.c_provider.get()[0].get_risk_factors()
@@ -235,6 +317,27 @@ cdef class StandardRateProvider:
         sliced_srp.dim = slicedCSRP.get()[0].get_dimension()
         return sliced_srp
     
+    def write_table(self, path):
+        """ Write the table to a binary file which can be opened (memory mapped) with `from_table_file`. """
+        write_rate_table(str(path).encode(), self.c_provider.get()[0])
+
+    @staticmethod
+    def from_table_file(path):
+        """ Open a table written by `write_table`, the values are memory mapped read-only and shared
+            by all processes opening the same file. """
+        cdef shared_ptr[CStandardRateProvider] fileCSRP = open_rate_table(str(path).encode())
+        cdef CRiskFactors rf
+
+        srp = StandardRateProvider([], np.zeros(1), np.array([0], dtype=np.int32))
+        srp.c_provider = fileCSRP
+        srp.dim = fileCSRP.get()[0].get_dimension()
+        srp.shapevec = fileCSRP.get()[0].get_shape()
+        srp.offsets = fileCSRP.get()[0].get_offsets()
+        srp.rfs.clear()
+        for rf in fileCSRP.get()[0].get_risk_factors():
+            srp.rfs.push_back(<int> rf)
+        return srp
+
     def get_values(self):
         # print(self.c_provider.get()[0].size())
         cdef np.ndarray[double, ndim=1, mode="c"] values_placeholder = np.zeros(self.c_provider.get()[0].size())
@@ -245,8 +348,256 @@ cdef class StandardRateProvider:
 
 
 # standalone rebuild function
-def rebuild_StandardRateProvider(rfs, values, offsets):
-    return StandardRateProvider(rfs, values, offsets)
+def rebuild_StandardRateProvider(rfs, values, offsets, edge_mode=CRateEdgeMode.STRICT):
+    srp = StandardRateProvider(rfs, values, offsets)
+    srp.set_edge_mode(edge_mode)
+    return srp
+
+
+cdef class TrendRateProvider:
+    """ Provider for generational tables with trend, the rates
+            q(x, t) = q_base(x) * exp(-F(x, t) * (t - base_year)),  F(x, t) = F(x) + w(t) * (F_initial(x) - F(x))
+        are calculated on demand (per cohort) rather than stored for all calendar years. """
+
+    cdef shared_ptr[CTrendRateProvider] c_provider
+    cdef object init_args
+
+    cdef shared_ptr[CTrendRateProvider] get_provider(self):
+        return self.c_provider
+
+    def __init__(self, rfs, base_rates, trend, np.ndarray[int, ndim=1, mode="c"] offsets, int year_max, int base_year,
+                 initial_trend=None, trend_weights=None):
+        """ `base_rates`, `trend` and (optionally) `initial_trend` are arrays over the risk factors `rfs` without
+            CalendarYear (in the same order). `offsets` has one entry per risk factor, for CalendarYear it is the
+            first year of the table and `year_max` the last one. `trend_weights` are the weights of the initial
+            trend, one per calendar year. """
+        cdef vector[int] shapevec
+        cdef vector[int] offsetvec
+        cdef double[::1] base_memview
+        cdef double[::1] trend_memview
+        cdef double[::1] initial_memview
+        cdef double[::1] weights_memview
+        cdef const double *initial_ptr = NULL
+        cdef const double *weights_ptr = NULL
+        cdef int k = 0
+        cdef int j
+        cdef int num_years = 0
+
+        base_rates = np.ascontiguousarray(base_rates, dtype=np.float64)
+        trend = np.ascontiguousarray(trend, dtype=np.float64)
+        assert base_rates.shape == trend.shape, "Base rates and trend must have the same shape."
+        assert offsets.shape[0] == len(rfs), "Number of `offsets` must match the number of risk factors."
+        assert base_rates.ndim == len(rfs) - 1, "Base rates must have one dimension less than the number of risk factors."
+
+        self.c_provider = make_shared[CTrendRateProvider]()
+        for j, rf in enumerate(rfs):
+            self.c_provider.get()[0].add_risk_factor(CRiskFactors(rf))
+            offsetvec.push_back(offsets[j])
+            if CRiskFactors(rf) == CRiskFactors.CalendarYear:
+                num_years = year_max - offsets[j] + 1
+                shapevec.push_back(num_years)
+            else:
+                shapevec.push_back(base_rates.shape[k])
+                k += 1
+
+        base_memview = base_rates.ravel()
+        trend_memview = trend.ravel()
+        if initial_trend is not None:
+            initial_trend = np.ascontiguousarray(initial_trend, dtype=np.float64)
+            assert initial_trend.shape == base_rates.shape, "Initial trend must have the shape of the base rates."
+            assert trend_weights is not None, "An initial trend requires trend weights."
+            trend_weights = np.ascontiguousarray(trend_weights, dtype=np.float64)
+            assert len(trend_weights) == num_years, "One trend weight per calendar year required."
+            initial_memview = initial_trend.ravel()
+            weights_memview = trend_weights
+            initial_ptr = &initial_memview[0]
+            weights_ptr = &weights_memview[0]
+
+        self.c_provider.get()[0].set_values(shapevec, offsetvec, base_year, &base_memview[0], &trend_memview[0],
+                                            initial_ptr, weights_ptr)
+        self.init_args = (list(rfs), base_rates, trend, offsets, year_max, base_year, initial_trend, trend_weights)
+
+    def set_edge_mode(self, mode):
+        """ Set the treatment of out-of-range indices, `CRateEdgeMode.CLAMP` uses the value at the nearest table edge. """
+        self.c_provider.get()[0].set_edge_mode(CRateEdgeMode(mode))
+
+    def get_edge_mode(self):
+        return CRateEdgeMode(self.c_provider.get()[0].get_edge_mode())
+
+    def get_cached_cohorts(self):
+        """ Number of cohorts for which the rates have been calculated. """
+        return self.c_provider.get()[0].get_cached_cohorts()
+
+    def __reduce__(self):
+        if self.init_args is None:
+            raise TypeError("Sliced trend providers cannot be pickled.")
+        return (rebuild_TrendRateProvider, self.init_args + (self.get_edge_mode(),))
+
+    def get_risk_factors(self):
+        cdef vector[CRiskFactors] rfs = self.c_provider.get()[0].get_risk_factors()
+        return [CRiskFactors(rf) for rf in rfs]
+
+    def __repr__(self):
+        return self.c_provider.get()[0].to_string().decode(encoding='ASCII')
+
+    def get_rates(self, int _len, **kwargs):
+        assert _len >= 1, "Required lengh must be >= 1"
+
+        cdef np.ndarray[double, ndim=1, mode="c"] output = np.zeros(_len)
+        cdef double[::1] output_memview = output
+
+        cdef vector[int*] indices
+        cdef int[:] an_index_vector
+        cdef CRiskFactors rf
+
+        cdef vector[CRiskFactors] applicable_rfs = self.c_provider.get()[0].get_risk_factors()
+
+        kwargs_lv = {k.lower(): v for k, v in kwargs.items()}
+        for rf in applicable_rfs:
+            pyrf = CRiskFactors(rf)
+            an_index_vector = kwargs_lv[pyrf.name.lower()]
+            assert len(an_index_vector) == _len, "Lookup indices for {} has unexpected length!".format(pyrf.name)
+            indices.push_back(&an_index_vector[0])
+
+        self.c_provider.get()[0].get_rates(&output_memview[0], _len, indices)
+        return output
+
+    def get_rate(self, indices):
+        cdef vector[int] indexes
+        cdef int k
+        for k in indices:
+            indexes.push_back(k)
+        return self.c_provider.get()[0].get_rate(indexes)
+
+    def initialize(self, **kwargs):
+        pass
+
+    def slice(self, **kwargs):
+        """ Fix segment risk factors (e.g. `gender=0`), Age and CalendarYear cannot be fixed. """
+        cdef vector[int] indices
+        cdef vector[CRiskFactors] applicable_rfs = self.c_provider.get()[0].get_risk_factors()
+        cdef TrendRateProvider sliced_trp
+
+        kwargs_lv = {k.lower(): v for k, v in kwargs.items()}
+        for rf in applicable_rfs:
+            an_index = kwargs_lv.get(CRiskFactors(rf).name.lower())
+            indices.push_back(int(an_index) if an_index is not None else -1)
+
+        sliced_trp = TrendRateProvider.__new__(TrendRateProvider)
+        sliced_trp.c_provider = self.c_provider.get()[0].slice(indices)
+        sliced_trp.init_args = None
+        return sliced_trp
+
+
+# standalone rebuild function
+def rebuild_TrendRateProvider(rfs, base_rates, trend, offsets, year_max, base_year, initial_trend=None, trend_weights=None,
+                              edge_mode=CRateEdgeMode.STRICT):
+    trp = TrendRateProvider(rfs, base_rates, trend, offsets, year_max, base_year, initial_trend, trend_weights)
+    trp.set_edge_mode(edge_mode)
+    return trp
+
+
+cdef shared_ptr[CBaseRateProvider] _get_base_provider(provider) except *:
+    """ The C++ provider wrapped by one of the provider classes. """
+    if isinstance(provider, StandardRateProvider):
+        return static_pointer_cast[CBaseRateProvider, CStandardRateProvider]((<StandardRateProvider> provider).get_provider())
+    elif isinstance(provider, TrendRateProvider):
+        return static_pointer_cast[CBaseRateProvider, CTrendRateProvider]((<TrendRateProvider> provider).get_provider())
+    elif isinstance(provider, ConstantRateProvider):
+        return static_pointer_cast[CBaseRateProvider, CConstantRateProvider]((<ConstantRateProvider> provider).get_provider())
+    elif isinstance(provider, CompositeRateProvider):
+        return static_pointer_cast[CBaseRateProvider, CCompositeRateProvider]((<CompositeRateProvider> provider).get_provider())
+    raise TypeError("Unsupported provider type: {}".format(type(provider)))
+
+
+cdef class CompositeRateProvider:
+    """ Combination of the rates of other providers by a product, sum, minimum or maximum, e.g.
+        base table x experience factor x smoker loading, evaluated without materializing a table.
+        Numbers may be passed as children and are treated as constant providers. """
+
+    cdef shared_ptr[CCompositeRateProvider] c_provider
+    cdef object init_args
+
+    cdef shared_ptr[CCompositeRateProvider] get_provider(self):
+        return self.c_provider
+
+    def __init__(self, operation, providers):
+        cdef vector[shared_ptr[CBaseRateProvider]] children
+
+        assert len(providers) >= 1, "A composite provider requires at least one child."
+        providers = [ConstantRateProvider(p) if isinstance(p, (int, float)) else p for p in providers]
+        for p in providers:
+            children.push_back(_get_base_provider(p))
+
+        self.c_provider = make_shared[CCompositeRateProvider](CCompositeOperation(operation), children)
+        self.init_args = (CCompositeOperation(operation), providers)
+
+    def get_operation(self):
+        return CCompositeOperation(self.c_provider.get()[0].get_operation())
+
+    def set_edge_mode(self, mode):
+        """ Set the treatment of out-of-range indices for all children. """
+        self.c_provider.get()[0].set_edge_mode(CRateEdgeMode(mode))
+
+    def __reduce__(self):
+        if self.init_args is None:
+            raise TypeError("Sliced composite providers cannot be pickled.")
+        return (CompositeRateProvider, self.init_args)
+
+    def get_risk_factors(self):
+        cdef vector[CRiskFactors] rfs = self.c_provider.get()[0].get_risk_factors()
+        return [CRiskFactors(rf) for rf in rfs]
+
+    def __repr__(self):
+        return self.c_provider.get()[0].to_string().decode(encoding='ASCII')
+
+    def get_rates(self, int _len, **kwargs):
+        assert _len >= 1, "Required lengh must be >= 1"
+
+        cdef np.ndarray[double, ndim=1, mode="c"] output = np.zeros(_len)
+        cdef double[::1] output_memview = output
+
+        cdef vector[int*] indices
+        cdef int[:] an_index_vector
+        cdef CRiskFactors rf
+
+        cdef vector[CRiskFactors] applicable_rfs = self.c_provider.get()[0].get_risk_factors()
+
+        kwargs_lv = {k.lower(): v for k, v in kwargs.items()}
+        for rf in applicable_rfs:
+            pyrf = CRiskFactors(rf)
+            an_index_vector = kwargs_lv[pyrf.name.lower()]
+            assert len(an_index_vector) == _len, "Lookup indices for {} has unexpected length!".format(pyrf.name)
+            indices.push_back(&an_index_vector[0])
+
+        self.c_provider.get()[0].get_rates(&output_memview[0], _len, indices)
+        return output
+
+    def get_rate(self, indices):
+        cdef vector[int] indexes
+        cdef int k
+        for k in indices:
+            indexes.push_back(k)
+        return self.c_provider.get()[0].get_rate(indexes)
+
+    def initialize(self, **kwargs):
+        pass
+
+    def slice(self, **kwargs):
+        """ Fix risk factors (e.g. `gender=0`), the slicing is applied to the children. """
+        cdef vector[int] indices
+        cdef vector[CRiskFactors] applicable_rfs = self.c_provider.get()[0].get_risk_factors()
+        cdef CompositeRateProvider sliced_crp
+
+        kwargs_lv = {k.lower(): v for k, v in kwargs.items()}
+        for rf in applicable_rfs:
+            an_index = kwargs_lv.get(CRiskFactors(rf).name.lower())
+            indices.push_back(int(an_index) if an_index is not None else -1)
+
+        sliced_crp = CompositeRateProvider.__new__(CompositeRateProvider)
+        sliced_crp.c_provider = self.c_provider.get()[0].slice(indices)
+        sliced_crp.init_args = None
+        return sliced_crp
 
 
 cdef extern from "assumption_sets.h":
@@ -255,6 +606,9 @@ cdef extern from "assumption_sets.h":
         CAssumptionSet(unsigned dim)
         void set_provider(int row, int col, const shared_ptr[CBaseRateProvider] &prvdr)
         void get_single_rateset(const vector[int] &rf_indexes, double *rates_ext) except +
+        void set_edge_mode(CRateEdgeMode mode)
+        void get_rateset_block(size_t num_records, const vector[int *] &rf_index_vectors, double *rates_ext) except +
+        void get_rateset_diagonal(const vector[int] &rf_start, const vector[int] &rf_step, size_t length, double *rates_ext) except +
 
 
 cdef class AssumptionSet:
@@ -276,6 +630,18 @@ cdef class AssumptionSet:
         # brp = static_cast[CBaseRateProvider, CStandardRateProvider] (srp)
         self.c_assumption_set.get()[0].set_provider(r, c, brp)
 
+    def add_provider_trend(self, int r, int c, TrendRateProvider rp):
+        cdef shared_ptr[CTrendRateProvider] trp = rp.get_provider()
+        cdef shared_ptr[CBaseRateProvider] brp
+        brp = static_pointer_cast[CBaseRateProvider, CTrendRateProvider] (trp)
+        self.c_assumption_set.get()[0].set_provider(r, c, brp)
+
+    def add_provider_composite(self, int r, int c, CompositeRateProvider rp):
+        cdef shared_ptr[CCompositeRateProvider] crp = rp.get_provider()
+        cdef shared_ptr[CBaseRateProvider] brp
+        brp = static_pointer_cast[CBaseRateProvider, CCompositeRateProvider] (crp)
+        self.c_assumption_set.get()[0].set_provider(r, c, brp)
+
     def add_provider_const(self, int r, int c, ConstantRateProvider rp):
         cdef shared_ptr[CConstantRateProvider] srp = rp.get_provider()
         cdef shared_ptr[CBaseRateProvider] brp
@@ -283,6 +649,10 @@ cdef class AssumptionSet:
         self.c_assumption_set.get()[0].set_provider(r, c, brp)
     
 
+    def set_edge_mode(self, mode):
+        """ Set the treatment of out-of-range indices for all providers in the set. """
+        self.c_assumption_set.get()[0].set_edge_mode(CRateEdgeMode(mode))
+
     def get_single_rateset(self, risk_factor_values):
 
         assert len(risk_factor_values) == NUMBER_OF_RISK_FACTORS
@@ -296,6 +666,43 @@ cdef class AssumptionSet:
         self.c_assumption_set.get()[0].get_single_rateset(rf_indexes, &output_memview[0])
         return output
 
+    def get_rateset_block(self, int num_records, **kwargs):
+        """ Return the rate matrices for a block of records as array of shape (dim, dim, num_records),
+            the risk factor values are passed in as named int32 arrays (e.g. `age=...`). """
+        assert num_records >= 1, "Required lengh must be >= 1"
+
+        cdef vector[int *] rf_index_vectors = vector[int *](NUMBER_OF_RISK_FACTORS, NULL)
+        cdef int[::1] an_index_vector
+
+        kwargs_lv = {k.lower(): v for k, v in kwargs.items()}
+        keep_alive = []
+        for rf in CRiskFactors:
+            rf_values = kwargs_lv.get(rf.name.lower())
+            if rf_values is not None:
+                rf_values = np.ascontiguousarray(rf_values, dtype=np.int32)
+                assert len(rf_values) == num_records, "Lookup indices for {} has unexpected length!".format(rf.name)
+                keep_alive.append(rf_values)
+                an_index_vector = rf_values
+                rf_index_vectors[<int> rf] = &an_index_vector[0]
+
+        cdef np.ndarray[double, ndim=1, mode="c"] output = np.zeros(self.dim * self.dim * num_records)
+        cdef double[::1] output_memview = output
+        self.c_assumption_set.get()[0].get_rateset_block(num_records, rf_index_vectors, &output_memview[0])
+        return output.reshape((self.dim, self.dim, num_records))
+
+    def get_rateset_diagonal(self, rf_start, rf_step, int length):
+        """ Return the rate matrices along the diagonal `rf_start + j * rf_step` (j < length), e.g. with age and
+            calendar year increasing together, as array of shape (length, dim, dim). """
+        assert len(rf_start) == NUMBER_OF_RISK_FACTORS and len(rf_step) == NUMBER_OF_RISK_FACTORS
+        assert length >= 1, "Required lengh must be >= 1"
+        cdef vector[int] start_vec = [int(v) for v in rf_start]
+        cdef vector[int] step_vec = [int(v) for v in rf_step]
+
+        cdef np.ndarray[double, ndim=1, mode="c"] output = np.zeros(self.dim * self.dim * length)
+        cdef double[::1] output_memview = output
+        self.c_assumption_set.get()[0].get_rateset_diagonal(start_vec, step_vec, length, &output_memview[0])
+        return output.reshape((length, self.dim, self.dim))
+
 
 
 
@@ -317,11 +724,41 @@ cdef extern from "time_axis.h":
 
 
 
+cdef extern from "rate_conversion.h":
+
+    cpdef enum class RateConversion(int):
+        SIMPLE,
+        CONSTANT_FORCE,
+        MATRIX_EXPONENTIAL,
+
+
 cdef extern from "run_config.h":
 
+    cpdef enum class ProjectionEngine(int):
+        SCALAR,
+        BLOCK,
+
+    cdef cppclass ResultSpec:
+        bool state_probs
+        bool prob_movements
+        bool state_volumes
+        bool volume_movements
+        bool payments
+        bool reserves
+
     cdef cppclass CRunConfig:
          CRunConfig(unsigned dim, TimeStep time_step, int years_to_simulate, int num_cpus, bool use_multicore, shared_ptr[CAssumptionSet] _be_assumptions, int max_age) except +
          void add_assumption_set(shared_ptr[CAssumptionSet])
+         void set_model_point_compression(bool compress, int dob_band_months) except +
+         void set_projection_engine(ProjectionEngine engine)
+         void set_early_termination(bool enabled, double threshold) except +
+         void set_payment_horizon(bool enabled)
+         void add_time_step_segment(TimeStep time_step, int years) except +
+         void set_rate_conversion(RateConversion method)
+         void set_result_spec(const ResultSpec &spec)
+         void set_scheduling(bool by_cost, int range_size) except +
+         void set_reproducible_summation(bool reproducible)
+         void set_thread_pinning(bool pin_threads)
          # int get_total_timesteps()
     
     # shared_ptr[TimeAxis] make_time_axis(const CRunConfig &run_config, short _ptf_year, short _ptf_month, short _ptf_day)
@@ -396,12 +833,53 @@ cdef class RunnerInterfaceWrapper:
                   TimeStep time_step,
                   int max_age,
                   bool use_multicore,
-                  int years_to_simulate):
+                  int years_to_simulate,
+                  bool model_point_compression=True,
+                  int dob_band_months=0,
+                  ProjectionEngine projection_engine=ProjectionEngine.SCALAR,
+                  bool early_termination=True,
+                  double early_termination_threshold=0.0,
+                  bool payment_horizon=False,
+                  time_step_segments=(),
+                  RateConversion rate_conversion=RateConversion.SIMPLE,
+                  result_outputs=None,
+                  bool schedule_by_cost=True,
+                  int schedule_range_size=0,
+                  bool reproducible_summation=False,
+                  int num_threads=0,
+                  bool pin_threads=False):
         cdef unsigned dim = be_ass.dim
-        cdef int num_cpus = cpu_count()
+        # the threads of the engine, all cpus by default
+        cdef int num_cpus = num_threads if num_threads != 0 else cpu_count()
         cdef shared_ptr[CAssumptionSet] c_assumption_set = be_ass.c_assumption_set
         
         self.crun_config = make_shared[CRunConfig](dim, time_step, years_to_simulate, num_cpus, use_multicore, c_assumption_set, max_age)
+        self.crun_config.get()[0].set_model_point_compression(model_point_compression, dob_band_months)
+        self.crun_config.get()[0].set_projection_engine(projection_engine)
+        self.crun_config.get()[0].set_early_termination(early_termination, early_termination_threshold)
+        self.crun_config.get()[0].set_payment_horizon(payment_horizon)
+        for segment_time_step, segment_years in time_step_segments:
+            self.crun_config.get()[0].add_time_step_segment(segment_time_step, segment_years)
+        self.crun_config.get()[0].set_rate_conversion(rate_conversion)
+
+        # outputs named by the prefix of their columns, all if not given; the reserves are no columns, 'RESERVES'
+        # only runs the reserve recursion of the records (off by default)
+        cdef ResultSpec result_spec
+        if result_outputs is not None:
+            outputs = {str(o).upper() for o in result_outputs}
+            unknown = outputs - {"PROB_STATE", "PROB_MVM", "VOL_STATE", "VOL_MVM", "PAYMENTS", "RESERVES"}
+            if unknown:
+                raise ValueError("Unknown result outputs: {}".format(sorted(unknown)))
+            result_spec.state_probs = "PROB_STATE" in outputs
+            result_spec.prob_movements = "PROB_MVM" in outputs
+            result_spec.state_volumes = "VOL_STATE" in outputs
+            result_spec.volume_movements = "VOL_MVM" in outputs
+            result_spec.payments = "PAYMENTS" in outputs
+            result_spec.reserves = "RESERVES" in outputs
+        self.crun_config.get()[0].set_result_spec(result_spec)
+        self.crun_config.get()[0].set_scheduling(schedule_by_cost, schedule_range_size)
+        self.crun_config.get()[0].set_reproducible_summation(reproducible_summation)
+        self.crun_config.get()[0].set_thread_pinning(pin_threads)
         
         self.pri = unique_ptr[RunnerInterface](new RunnerInterface(self.crun_config.get()[0], cportfolio_wapper.ptf))
     
@@ -83,13 +83,16 @@ class DAV2004R:
         })
         self.df_trend_rates = df_tmp   # .copy()
 
-    def rates_provider(self, table_type: str = 'AGGREGATE', estimate_type: str = "BE", t_begin: int = 1999, t_end: int = 2150) -> Union[StandardRateProvider, act.StandardRateProvider]:
+    def rates_provider(self, table_type: str = 'AGGREGATE', estimate_type: str = "BE", t_begin: int = 1999, t_end: int = 2150,
+                       lazy_trend: bool = False) -> Union[StandardRateProvider, act.StandardRateProvider, act.TrendRateProvider]:
         """ A rate provider object is returned.
 
         Arguments:
 
         :table_table           Can be either 'AGGREGATE' or 'SELECT' depending on the intended purpose (SELECT is not yet implemented)
         :estimate_type         Can be either 'BE' (best estimate, "2. Ordnung") or 'LOADED' (with loading, "1. Ordnung")
+        :lazy_trend            If True the trend is applied on demand by a TrendRateProvider instead of materializing
+                               the table for all calendar years
 
         """
 
@@ -107,6 +110,9 @@ class DAV2004R:
                        .unstack("LONG/SHORT")\
                        .droplevel(0, axis=0)
 
+        if table_type == 'AGGREGATE' and lazy_trend:
+            return self._trend_rates_provider(estimate_type, t_begin, t_end, df_base, df_trend)
+
         table = None
 
         if estimate_type == "BE":
@@ -133,6 +139,33 @@ class DAV2004R:
 
         return provider
 
+    def _trend_rates_provider(self, estimate_type, t_begin, t_end, df_base, df_trend) -> act.TrendRateProvider:
+        """ Return a TrendRateProvider with the risk factors Gender, Age and CalendarYear. """
+        genders = (risk_factors.Gender.M, risk_factors.Gender.F)
+        base_rates = np.array([df_base.values[:, g] for g in genders], dtype=np.float64)
+        initial_trend, trend_weights = None, None
+
+        if estimate_type == "BE":
+            # the initial trend F1 is blended into the long term trend F2
+            trend = np.array([df_trend[(g, "F2")].values for g in genders], dtype=np.float64)
+            initial_trend = np.array([df_trend[(g, "F1")].values for g in genders], dtype=np.float64)
+            trend_weights = np.array([_G(t, self.trend_t1, self.trend_t2) for t in range(t_begin, 1 + t_end)], dtype=np.float64)
+        elif estimate_type == "LOADED":
+            trend = np.array([df_trend[(g, "F")].values for g in genders], dtype=np.float64)
+        else:
+            raise Exception("Unknow estimate type: {}".format(estimate_type))
+
+        return act.TrendRateProvider(rfs=[risk_factors.Gender.get_CRiskFactor(),
+                                          risk_factors.Age.get_CRiskFactor(),
+                                          risk_factors.CalendarYear.get_CRiskFactor()],
+                                     base_rates=base_rates,
+                                     trend=trend,
+                                     offsets=np.array([0, 0, t_begin], dtype=np.int32),
+                                     year_max=t_end,
+                                     base_year=self.base_year_trend,
+                                     initial_trend=initial_trend,
+                                     trend_weights=trend_weights)
+
 
 def _G(t, T1, T2):
     """ Trend interpolation formula, cf.
@@ -279,4 +279,8 @@ class AssumptionSetWrapper:
                         acs.add_provider_const(from_state, to_state, provider)
                     elif isinstance(provider, actuarial.StandardRateProvider):
                         acs.add_provider_std(from_state, to_state, provider)
+                    elif isinstance(provider, actuarial.TrendRateProvider):
+                        acs.add_provider_trend(from_state, to_state, provider)
+                    elif isinstance(provider, actuarial.CompositeRateProvider):
+                        acs.add_provider_composite(from_state, to_state, provider)
         return acs
@@ -123,7 +123,8 @@ def project_cashflows(run_config: RunConfig,
     results_arrays = []
 
     # projections
-    if run_config.use_multicore and len(subportfolios) > 1:  # and run_config.kernel_engine in ["P", "PY", "PYTHON"]:
+    # the C++ engine uses its own threads, the sub-portfolios are then projected one after another
+    if run_config.use_multicore and len(subportfolios) > 1 and run_config.kernel_engine in ["P", "PY", "PYTHON"]:
 
         num_processes = min(cpu_count(), len(subportfolios))
 
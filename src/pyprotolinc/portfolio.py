@@ -81,6 +81,14 @@ class Portfolio:
         self.policy_inception_month = df_portfolio["DATE_START_OF_COVER"].dt.month.values.astype(np.int16)
         self.policy_inception_day = df_portfolio["DATE_START_OF_COVER"].dt.day.values.astype(np.int16)
 
+        # the optional end of the cover in the format YYYYMMDD, -1 if the cover does not end
+        self.coverage_end_dates = np.full(len(df_portfolio), -1, dtype=np.int64)
+        if "DATE_END_OF_COVER" in df_portfolio.columns:
+            dates_end_of_cover = pd.to_datetime(df_portfolio["DATE_END_OF_COVER"])
+            has_end_of_cover = dates_end_of_cover.notna().values
+            self.coverage_end_dates[has_end_of_cover] = (dates_end_of_cover.dt.year * 10000 + dates_end_of_cover.dt.month * 100
+                                                         + dates_end_of_cover.dt.day).values[has_end_of_cover].astype(np.int64)
+
         # extract and map the MultiStateDisabilityStates
         _unknown_status = set(df_portfolio["CURRENT_STATUS"]) - {s.name for s in states_model}
         assert len(_unknown_status) == 0, "Unknow status " + str(_unknown_status)
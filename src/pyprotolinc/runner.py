@@ -36,7 +36,8 @@ class CProjector:
                  num_chunks: int = 1) -> None:
 
         self.c_portfolio = actuarial.build_c_portfolio(portfolio)
-        self.time_step = actuarial.TimeStep.MONTHLY  # actuarial.TimeStep.MONTHLY  # QUARTERLY   # TODO: test if we get back a result set with this timestep
+        self.time_step = actuarial.TimeStep[run_config.time_step]
+        self.time_step_segments = [(actuarial.TimeStep[ts], years) for ts, years in run_config.time_step_segments]
         self.max_age = run_config.max_age
 
         self.model = model
@@ -54,7 +55,16 @@ class CProjector:
         # construct assumption set
         acs_be: actuarial.AssumptionSet = model.assumption_set_be  # self.build_assumption_set()
 
-        self.runner = actuarial.RunnerInterfaceWrapper(acs_be, self.c_portfolio, self.time_step, self.max_age, run_config.use_multicore, run_config.years_to_simulate)
+        self.runner = actuarial.RunnerInterfaceWrapper(acs_be, self.c_portfolio, self.time_step, self.max_age, run_config.use_multicore, run_config.years_to_simulate,
+                                                       run_config.model_point_compression, run_config.dob_band_months,
+                                                       actuarial.ProjectionEngine[run_config.projection_engine],
+                                                       run_config.early_termination, run_config.early_termination_threshold,
+                                                       run_config.payment_horizon, self.time_step_segments,
+                                                       actuarial.RateConversion[run_config.rate_conversion],
+                                                       run_config.result_outputs,
+                                                       run_config.schedule_by_cost, run_config.schedule_range_size,
+                                                       run_config.reproducible_summation,
+                                                       run_config.num_threads, run_config.pin_threads)
         self.time_axis = TimeAxis2(*self.runner.get_time_axis())
 
         # product information, here we obtain the whole conditional payment stream upfront
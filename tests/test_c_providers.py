@@ -52,6 +52,105 @@ def test_std_2d():
         providerS.get_rates(len(gender2), age=age2, gender=gender2)
 
 
+def test_std_borrowed_values():
+    vals2D = np.array([
+        [1, 2, 3],
+        [4, 5, 6]], dtype=np.float64)
+    offsets = np.zeros(2, dtype=np.int32)
+
+    providerS = actuarial.StandardRateProvider([actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age],
+                                               vals2D, offsets, copy=False)
+    assert providerS.get_rate([1, 2]) == 6
+
+    # the provider uses the buffer of the array and keeps it alive
+    vals2D[1, 2] = 7
+    assert providerS.get_rate([1, 2]) == 7
+    del vals2D
+    assert providerS.get_rate([1, 1]) == 5
+
+    # non-contiguous input is copied
+    vals_t = np.array([[1, 4], [2, 5], [3, 6]], dtype=np.float64).T
+    providerT = actuarial.StandardRateProvider([actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age],
+                                               vals_t, offsets, copy=False)
+    assert providerT.get_rate([0, 1]) == 2
+    assert providerT.get_rate([1, 2]) == 6
+
+
+def test_std_table_file(tmp_path):
+    vals2D = np.array([
+        [1, 2, 3],
+        [4, 5, 6]], dtype=np.float64)
+    offsets = np.array([0, 20], dtype=np.int32)
+    providerS = actuarial.StandardRateProvider([actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age], vals2D, offsets)
+
+    path = tmp_path / "table.bin"
+    providerS.write_table(path)
+    providerF = actuarial.StandardRateProvider.from_table_file(path)
+
+    assert providerF.__repr__() == "<CStandardRateProvider with RF (Gender, Age)>"
+    assert providerF.get_shape() == (2, 3)
+    assert np.array_equal(providerF.get_offsets(), offsets)
+    assert providerF.get_rate([1, 21]) == 5
+
+    # pickling works from the mapped values
+    providerP = pickle.loads(pickle.dumps(providerF))
+    assert providerP.get_rate([0, 22]) == 3
+
+
+def test_trend_provider():
+    base_rates = np.array([[0.01, 0.02, 0.03],
+                           [0.015, 0.025, 0.035]], dtype=np.float64)
+    trend = np.array([[0.02, 0.01, 0.0],
+                      [0.03, 0.02, 0.01]], dtype=np.float64)
+    offsets = np.array([0, 60, 2000], dtype=np.int32)
+    provider = actuarial.TrendRateProvider([actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age, actuarial.CRiskFactors.CalendarYear],
+                                           base_rates, trend, offsets, year_max=2030, base_year=1999)
+
+    assert provider.__repr__() == "<CTrendRateProvider with RF (Gender, Age, CalendarYear)>"
+    assert provider.get_rate([1, 61, 2010]) == pytest.approx(0.025 * np.exp(-0.02 * 11))
+
+    gender = np.array([0, 1], dtype=np.int32)
+    age = np.array([60, 62], dtype=np.int32)
+    year = np.array([2000, 2030], dtype=np.int32)
+    expected = np.array([0.01 * np.exp(-0.02), 0.035 * np.exp(-0.01 * 31)])
+    assert np.allclose(provider.get_rates(2, gender=gender, age=age, calendaryear=year), expected)
+
+    sliced = provider.slice(gender=1)
+    assert sliced.get_rate([61, 2010]) == pytest.approx(0.025 * np.exp(-0.02 * 11))
+
+    provider2 = pickle.loads(pickle.dumps(provider))
+    assert provider2.get_rate([0, 62, 2020]) == provider.get_rate([0, 62, 2020])
+
+
+def test_composite_provider():
+    vals = np.array([[0.01, 0.02, 0.03],
+                     [0.015, 0.025, 0.035]], dtype=np.float64)
+    offsets = np.array([0, 60], dtype=np.int32)
+    base = actuarial.StandardRateProvider([actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age], vals, offsets)
+    loading = actuarial.StandardRateProvider([actuarial.CRiskFactors.SmokerStatus],
+                                             np.array([1.0, 1.5]), np.zeros(1, dtype=np.int32))
+
+    provider = actuarial.CompositeRateProvider(actuarial.CCompositeOperation.PRODUCT, [base, 0.9, loading])
+    assert provider.get_risk_factors() == [actuarial.CRiskFactors.Gender, actuarial.CRiskFactors.Age,
+                                           actuarial.CRiskFactors.SmokerStatus]
+    assert provider.get_rate([1, 61, 1]) == pytest.approx(0.025 * 0.9 * 1.5)
+
+    gender = np.array([0, 1], dtype=np.int32)
+    age = np.array([60, 62], dtype=np.int32)
+    smoker = np.array([1, 0], dtype=np.int32)
+    expected = np.array([0.01 * 0.9 * 1.5, 0.035 * 0.9])
+    assert np.allclose(provider.get_rates(2, gender=gender, age=age, smokerstatus=smoker), expected)
+
+    capped = actuarial.CompositeRateProvider(actuarial.CCompositeOperation.MIN, [provider, 0.03])
+    assert capped.get_rate([1, 62, 1]) == pytest.approx(0.03)
+
+    sliced = provider.slice(gender=1, smokerstatus=0)
+    assert sliced.get_rate([61]) == pytest.approx(0.025 * 0.9)
+
+    provider2 = pickle.loads(pickle.dumps(provider))
+    assert provider2.get_rate([0, 62, 1]) == provider.get_rate([0, 62, 1])
+
+
 def test_pickle_constant_rate_provider():
     rate = 0.02
     const_prov = actuarial.ConstantRateProvider(rate)